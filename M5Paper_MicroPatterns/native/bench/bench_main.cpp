@@ -0,0 +1,313 @@
+// Host benchmark of the render pipeline (env:native): renders each script through
+// RenderController as RenderTask would, and reports per render the render mode, wall time,
+// display-list items/s, pixels/s, heap peak and a checksum of the 4bpp framebuffer.
+//
+//   pio run -e native
+//   .pio/build/native/program [options] native/bench/corpus/*.mp
+//
+// Options:
+//   --iterations N    Renders per script (default 3). Render i uses $COUNTER=i, $HOUR=10,
+//                     $MINUTE=20, $SECOND=30, so later renders exercise the program, frame and
+//                     segment caches and partial re-rendering.
+//   --streaming       Streaming render mode (RenderController::setStreamingRender)
+//   --budget BYTES    Display-list memory budget (default: none)
+//   --json            Also print the RenderProfile JSON line of every render
+//   --check FILE      Compare framebuffer checksums with FILE; mismatches fail the run
+//   --write FILE      Write the checksums to FILE (a new baseline for --check)
+//   --reference DIR   Compare the first render of each script with DIR/<script>.pgm from
+//                     native/bench/emulator_reference.mjs; exact black/white pixel parity is
+//                     reported, and fails the run below --parity percent
+//   --parity PERCENT  Required parity with the emulator (default 0: report only)
+//   --dump DIR        Write the first render of each script as DIR/<script>.pgm
+//   --verbose         Pipeline logs up to info level on stderr
+//
+// Exits with 1 if a render or a check fails.
+
+#include "render_controller.h"
+#include "host_heap.h"
+#include "esp32-hal-log.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+static const int BENCH_HOUR = 10; // Inputs of every render but $COUNTER; emulator_reference.mjs defaults to the same
+static const int BENCH_MINUTE = 20;
+static const int BENCH_SECOND = 30;
+
+struct BenchOptions {
+    int iterations = 3;
+    bool streaming = false;
+    size_t budget = 0;
+    bool json = false;
+    const char* checkFile = nullptr;
+    const char* writeFile = nullptr;
+    const char* referenceDir = nullptr;
+    double parityPercent = 0;
+    const char* dumpDir = nullptr;
+    std::vector<std::string> scripts;
+};
+
+struct BenchTotals {
+    uint64_t items = 0;
+    uint64_t pixels = 0;
+    uint64_t renderMicros = 0;    // Generation, binning and rasterisation
+    uint64_t rasteriseMicros = 0;
+    double wallMillis = 0;
+    size_t peakBytes = 0;
+    int renders = 0;
+    int failures = 0;
+};
+
+static void usage() {
+    fprintf(stderr, "usage: program [--iterations N] [--streaming] [--budget BYTES] [--json] [--check FILE] [--write FILE]\n"
+                    "               [--reference DIR] [--parity PERCENT] [--dump DIR] [--verbose] script.mp...\n");
+    exit(2);
+}
+
+static bool parseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--iterations" && hasValue) options.iterations = std::max(1, atoi(argv[++i]));
+        else if (arg == "--streaming") options.streaming = true;
+        else if (arg == "--budget" && hasValue) options.budget = (size_t)strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--json") options.json = true;
+        else if (arg == "--check" && hasValue) options.checkFile = argv[++i];
+        else if (arg == "--write" && hasValue) options.writeFile = argv[++i];
+        else if (arg == "--reference" && hasValue) options.referenceDir = argv[++i];
+        else if (arg == "--parity" && hasValue) options.parityPercent = atof(argv[++i]);
+        else if (arg == "--dump" && hasValue) options.dumpDir = argv[++i];
+        else if (arg == "--verbose") nativeLogLevel = 3;
+        else if (arg.compare(0, 2, "--") == 0) return false;
+        else options.scripts.push_back(arg);
+    }
+    return !options.scripts.empty();
+}
+
+static bool readFile(const std::string& path, std::string& out) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    out = buffer.str();
+    return true;
+}
+
+// Script file name without directory and extension, e.g. "city" for corpus/city.mp
+static std::string scriptName(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static uint32_t checksum(const uint8_t* data, size_t bytes) {
+    uint32_t hash = 2166136261u; // FNV-1a, as ProgramCache::hashContent
+    for (size_t i = 0; i < bytes; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint8_t pixelAt(const uint8_t* frame, int width, int x, int y) {
+    uint8_t b = frame[((size_t)y * width + x) >> 1];
+    return (x & 1) ? (b & 0x0F) : (b >> 4);
+}
+
+// Binary PGM, 0 black to 255 white: the device's 4bpp colour 15 is black
+static bool writePgm(const std::string& path, const uint8_t* frame, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "P5\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(width);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) row[x] = (uint8_t)(255 - pixelAt(frame, width, x, y) * 17);
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+static bool readPgm(const std::string& path, int& width, int& height, std::vector<uint8_t>& pixels) {
+    std::string data;
+    if (!readFile(path, data)) return false;
+    int maxValue = 0, headerBytes = 0;
+    if (sscanf(data.c_str(), "P5 %d %d %d%n", &width, &height, &maxValue, &headerBytes) != 3 || maxValue != 255) return false;
+    headerBytes++; // Single whitespace after the maximum value
+    if (data.size() < (size_t)headerBytes + (size_t)width * height) return false;
+    pixels.assign(data.begin() + headerBytes, data.begin() + headerBytes + (size_t)width * height);
+    return true;
+}
+
+// Percentage of pixels on which the framebuffer and the reference agree, both thresholded to black and white
+static bool parityWith(const std::string& referencePath, const uint8_t* frame, int width, int height, double& percent) {
+    int refWidth = 0, refHeight = 0;
+    std::vector<uint8_t> reference;
+    if (!readPgm(referencePath, refWidth, refHeight, reference) || refWidth != width || refHeight != height) return false;
+    size_t matching = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            bool black = pixelAt(frame, width, x, y) >= 8;
+            bool referenceBlack = reference[(size_t)y * width + x] < 128;
+            if (black == referenceBlack) matching++;
+        }
+    }
+    percent = 100.0 * matching / ((size_t)width * height);
+    return true;
+}
+
+static std::map<std::string, std::string> readChecksums(const char* path) {
+    std::map<std::string, std::string> checksums;
+    std::ifstream file(path);
+    std::string key, value;
+    while (file >> key >> value) checksums[key] = value;
+    return checksums;
+}
+
+static uint32_t pixelsWritten(const RenderProfile& profile) {
+    uint32_t pixels = 0;
+    for (int i = 0; i < RENDER_PROFILE_KINDS; ++i) pixels += profile.kinds[i].pixels;
+    return pixels;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseOptions(argc, argv, options)) usage();
+    if (options.dumpDir) mkdir(options.dumpDir, 0755); // May exist already
+
+    DisplayManager displayMgr;
+    displayMgr.initializeEPD();
+    RenderController renderCtrl(displayMgr);
+    renderCtrl.setStreamingRender(options.streaming);
+    if (options.budget) renderCtrl.setDisplayListBudget(options.budget);
+
+    std::map<std::string, std::string> expected;
+    if (options.checkFile) expected = readChecksums(options.checkFile);
+    std::vector<std::string> written;
+    BenchTotals totals;
+    int checked = 0, mismatched = 0;
+
+    printf("%-18s %2s %-15s %9s %8s %9s %9s %10s %9s %8s %s\n", "script", "#", "mode", "wall ms", "items", "items/s",
+           "pixels", "pixels/s", "heap KB", "checksum", "parity");
+    for (const std::string& path : options.scripts) {
+        std::string name = scriptName(path);
+        std::string content;
+        if (!readFile(path, content)) {
+            fprintf(stderr, "%s: cannot be read\n", path.c_str());
+            totals.failures++;
+            continue;
+        }
+        String fileId(path.c_str());
+        String scriptContent(content);
+
+        for (int iteration = 0; iteration < options.iterations; ++iteration) {
+            ScriptExecState state;
+            state.counter = iteration;
+            state.hour = BENCH_HOUR;
+            state.minute = BENCH_MINUTE;
+            state.second = BENCH_SECOND;
+            state.state_loaded = true;
+
+            size_t heapBefore = nativeHeapStats().liveBytes;
+            nativeHeapResetPeak();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            // Like RenderTask: no content when a cached frame or program makes it unnecessary
+            bool needsContent = !renderCtrl.hasCachedFrame(fileId, state, 0) && !renderCtrl.hasCachedProgram(fileId, 0);
+            RenderResultData result = renderCtrl.renderScript(String(name.c_str()), fileId, needsContent ? scriptContent : String(),
+                                                              state, 0);
+            double wallMillis = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            size_t heapPeak = nativeHeapStats().peakBytes - std::min(heapBefore, nativeHeapStats().peakBytes);
+
+            M5EPD_Canvas* canvas = displayMgr.getRenderCanvas();
+            const uint8_t* frame = (const uint8_t*)canvas->frameBuffer();
+            int width = canvas->width(), height = canvas->height();
+            char hash[9];
+            snprintf(hash, sizeof(hash), "%08x", checksum(frame, (size_t)width * height / 2));
+
+            const RenderProfile& profile = result.profile;
+            uint64_t renderMicros = profile.phaseMicros(RENDER_PHASE_GENERATE) + profile.phaseMicros(RENDER_PHASE_BIN) +
+                                    profile.phaseMicros(RENDER_PHASE_RASTERISE);
+            uint64_t rasteriseMicros = profile.phaseMicros(RENDER_PHASE_RASTERISE);
+            uint32_t pixels = pixelsWritten(profile);
+
+            std::string parity = "-";
+            if (iteration == 0 && options.referenceDir) {
+                double percent = 0;
+                std::string referencePath = std::string(options.referenceDir) + "/" + name + ".pgm";
+                if (!parityWith(referencePath, frame, width, height, percent)) {
+                    parity = "no reference";
+                } else {
+                    char text[32];
+                    snprintf(text, sizeof(text), "%.2f%%", percent);
+                    parity = text;
+                    if (percent < options.parityPercent) {
+                        parity += " FAIL";
+                        totals.failures++;
+                    }
+                }
+            }
+            if (iteration == 0 && options.dumpDir) {
+                std::string dumpPath = std::string(options.dumpDir) + "/" + name + ".pgm";
+                if (!writePgm(dumpPath, frame, width, height)) fprintf(stderr, "%s: cannot be written\n", dumpPath.c_str());
+            }
+
+            char key[256];
+            snprintf(key, sizeof(key), "%s#%d", name.c_str(), iteration);
+            written.push_back(std::string(key) + " " + hash);
+            std::string checkMark;
+            if (options.checkFile) {
+                std::map<std::string, std::string>::const_iterator it = expected.find(key);
+                if (it != expected.end()) {
+                    checked++;
+                    if (it->second != hash) {
+                        checkMark = " (expected " + it->second + ")";
+                        mismatched++;
+                    }
+                }
+            }
+
+            if (!result.success) {
+                fprintf(stderr, "%s #%d: %s\n", path.c_str(), iteration, result.error_message.c_str());
+                totals.failures++;
+            }
+            printf("%-18s %2d %-15s %9.2f %8u %9.0f %9u %10.0f %9.1f %s%s %s\n", name.c_str(), iteration,
+                   result.success ? renderModeName(result.render_mode) : "FAILED", wallMillis, (unsigned)profile.displayListItems,
+                   renderMicros ? profile.displayListItems * 1e6 / renderMicros : 0.0, (unsigned)pixels,
+                   rasteriseMicros ? pixels * 1e6 / rasteriseMicros : 0.0, heapPeak / 1024.0, hash, checkMark.c_str(),
+                   parity.c_str());
+            if (options.json) printf("%s\n", profile.toJson(name.c_str(), renderModeName(result.render_mode)).c_str());
+
+            totals.items += profile.displayListItems;
+            totals.pixels += pixels;
+            totals.renderMicros += renderMicros;
+            totals.rasteriseMicros += rasteriseMicros;
+            totals.wallMillis += wallMillis;
+            totals.peakBytes = std::max(totals.peakBytes, heapPeak);
+            totals.renders++;
+        }
+    }
+
+    printf("\n%d renders in %.1f ms: %.0f items/s, %.0f pixels/s, heap peak %.1f KB%s\n", totals.renders, totals.wallMillis,
+           totals.renderMicros ? totals.items * 1e6 / totals.renderMicros : 0.0,
+           totals.rasteriseMicros ? totals.pixels * 1e6 / totals.rasteriseMicros : 0.0, totals.peakBytes / 1024.0,
+           nativeHeapTracked() ? "" : " (heap not tracked on this host)");
+    if (options.checkFile) printf("Checksums: %d checked, %d mismatched\n", checked, mismatched);
+
+    if (options.writeFile) {
+        FILE* file = fopen(options.writeFile, "w");
+        if (!file) {
+            fprintf(stderr, "%s: cannot be written\n", options.writeFile);
+            return 1;
+        }
+        for (const std::string& line : written) fprintf(file, "%s\n", line.c_str());
+        fclose(file);
+    }
+    return (totals.failures || mismatched) ? 1 : 0;
+}
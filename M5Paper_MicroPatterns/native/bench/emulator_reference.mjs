@@ -0,0 +1,191 @@
+// Renders MicroPatterns scripts with the emulator's display-list path (parser.js,
+// display_list_generator.js, display_list_renderer.js) into binary PGM files, the pixel
+// reference for `program --reference DIR`. Each PGM is named after the script, e.g.
+// city.mp -> city.pgm: 0 for black, 255 for white.
+//
+//   node native/bench/emulator_reference.mjs OUT_DIR script.mp... [--counter N] [--hour H] [--minute M] [--second S]
+//
+// The inputs default to those of the benchmark's first render of each script. The browser
+// canvas is replaced by a 1-bit stand-in: fills cover the pixels whose centres they contain
+// (no anti-aliasing), and putImageData() replaces pixels like the real one, so transparent
+// pixels of an ImageData read back as white.
+
+import { readFileSync, writeFileSync, mkdirSync } from 'node:fs';
+import { basename, extname, join } from 'node:path';
+
+const WIDTH = 540;
+const HEIGHT = 960;
+
+// --- DOMMatrix: the 2D subset the emulator uses ---
+class ReferenceMatrix {
+    constructor(init) {
+        const m = init instanceof ReferenceMatrix ? [init.a, init.b, init.c, init.d, init.e, init.f]
+                                                 : (Array.isArray(init) ? init : [1, 0, 0, 1, 0, 0]);
+        [this.a, this.b, this.c, this.d, this.e, this.f] = m;
+    }
+    get m11() { return this.a; }
+    get m12() { return this.b; }
+    get m21() { return this.c; }
+    get m22() { return this.d; }
+    get m41() { return this.e; }
+    get m42() { return this.f; }
+    get isIdentity() {
+        return this.a === 1 && this.b === 0 && this.c === 0 && this.d === 1 && this.e === 0 && this.f === 0;
+    }
+    // this = this * other
+    _multiplySelf(a, b, c, d, e, f) {
+        const m = [
+            this.a * a + this.c * b, this.b * a + this.d * b,
+            this.a * c + this.c * d, this.b * c + this.d * d,
+            this.a * e + this.c * f + this.e, this.b * e + this.d * f + this.f,
+        ];
+        [this.a, this.b, this.c, this.d, this.e, this.f] = m;
+        return this;
+    }
+    translateSelf(tx = 0, ty = 0) { return this._multiplySelf(1, 0, 0, 1, tx, ty); }
+    scaleSelf(sx = 1, sy = sx) { return this._multiplySelf(sx, 0, 0, sy, 0, 0); }
+    rotateSelf(degrees = 0) { // One argument: rotation about the Z axis, as DOMMatrix
+        const r = degrees * Math.PI / 180;
+        return this._multiplySelf(Math.cos(r), Math.sin(r), -Math.sin(r), Math.cos(r), 0, 0);
+    }
+    multiply(other) { return new ReferenceMatrix(this)._multiplySelf(other.a, other.b, other.c, other.d, other.e, other.f); }
+    inverse() {
+        const det = this.a * this.d - this.b * this.c;
+        if (det === 0) return new ReferenceMatrix([NaN, NaN, NaN, NaN, NaN, NaN]);
+        return new ReferenceMatrix([
+            this.d / det, -this.b / det, -this.c / det, this.a / det,
+            (this.c * this.f - this.d * this.e) / det, (this.b * this.e - this.a * this.f) / det,
+        ]);
+    }
+    transformPoint(p) {
+        return { x: this.a * p.x + this.c * p.y + this.e, y: this.b * p.x + this.d * p.y + this.f, z: 0, w: 1 };
+    }
+}
+
+// --- CanvasRenderingContext2D: fills and ImageData on an RGBA buffer ---
+class ReferenceContext {
+    constructor(width, height) {
+        this.canvas = { width, height };
+        this.data = new Uint8ClampedArray(width * height * 4);
+        this.fillStyle = 'black';
+        this._path = [];
+    }
+    _color() {
+        const style = String(this.fillStyle).toLowerCase();
+        return (style === 'white' || style === '#ffffff' || style === '#fff') ? 255 : 0;
+    }
+    fillRect(x, y, w, h) {
+        if (w < 0) { x += w; w = -w; }
+        if (h < 0) { y += h; h = -h; }
+        const x0 = Math.max(0, Math.ceil(x - 0.5)), x1 = Math.min(this.canvas.width, Math.ceil(x + w - 0.5));
+        const y0 = Math.max(0, Math.ceil(y - 0.5)), y1 = Math.min(this.canvas.height, Math.ceil(y + h - 0.5));
+        const v = this._color();
+        for (let py = y0; py < y1; py++) {
+            for (let px = x0; px < x1; px++) {
+                const i = (py * this.canvas.width + px) * 4;
+                this.data[i] = this.data[i + 1] = this.data[i + 2] = v;
+                this.data[i + 3] = 255;
+            }
+        }
+    }
+    beginPath() { this._path = []; }
+    rect(x, y, w, h) { this._path.push([x, y, w, h]); }
+    fill() { for (const r of this._path) this.fillRect(...r); }
+    createImageData(w, h) { return { width: w, height: h, data: new Uint8ClampedArray(w * h * 4) }; }
+    getImageData(x, y, w, h) {
+        const image = this.createImageData(w, h);
+        for (let py = 0; py < h; py++) {
+            for (let px = 0; px < w; px++) {
+                const sx = x + px, sy = y + py;
+                if (sx < 0 || sy < 0 || sx >= this.canvas.width || sy >= this.canvas.height) continue;
+                const si = (sy * this.canvas.width + sx) * 4, di = (py * w + px) * 4;
+                for (let k = 0; k < 4; k++) image.data[di + k] = this.data[si + k];
+            }
+        }
+        return image;
+    }
+    putImageData(image, x, y) {
+        for (let py = 0; py < image.height; py++) {
+            for (let px = 0; px < image.width; px++) {
+                const dx = x + px, dy = y + py;
+                if (dx < 0 || dy < 0 || dx >= this.canvas.width || dy >= this.canvas.height) continue;
+                const si = (py * image.width + px) * 4, di = (dy * this.canvas.width + dx) * 4;
+                for (let k = 0; k < 4; k++) this.data[di + k] = image.data[si + k];
+            }
+        }
+    }
+    // Alpha-composited onto white, as the emulator page shows the canvas
+    toGray() {
+        const gray = new Uint8Array(this.canvas.width * this.canvas.height);
+        for (let i = 0; i < gray.length; i++) {
+            gray[i] = this.data[i * 4 + 3] < 128 ? 255 : this.data[i * 4];
+        }
+        return gray;
+    }
+}
+
+globalThis.DOMMatrix = ReferenceMatrix;
+
+const { MicroPatternsParser } = await import('../../../micropatterns_emulator/parser.js');
+const { DisplayListGenerator } = await import('../../../micropatterns_emulator/display_list_generator.js');
+const { DisplayListRenderer } = await import('../../../micropatterns_emulator/display_list_renderer.js');
+
+function usage() {
+    console.error('usage: node emulator_reference.mjs OUT_DIR script.mp... [--counter N] [--hour H] [--minute M] [--second S]');
+    process.exit(2);
+}
+
+const args = process.argv.slice(2);
+const inputs = { counter: 0, hour: 10, minute: 20, second: 30 }; // As the benchmark's first render
+const scripts = [];
+let outDir = null;
+for (let i = 0; i < args.length; i++) {
+    const flag = args[i].startsWith('--') ? args[i].slice(2) : null;
+    if (flag !== null) {
+        if (!(flag in inputs) || i + 1 >= args.length) usage();
+        inputs[flag] = parseInt(args[++i], 10) || 0;
+    } else if (outDir === null) {
+        outDir = args[i];
+    } else {
+        scripts.push(args[i]);
+    }
+}
+if (outDir === null || scripts.length === 0) usage();
+mkdirSync(outDir, { recursive: true });
+
+const console_warn = console.warn;
+console.warn = () => {}; // Per-item emulator warnings; errors are reported below
+
+let failed = 0;
+for (const script of scripts) {
+    const parseResult = new MicroPatternsParser().parse(readFileSync(script, 'utf8'));
+    if (parseResult.errors.length > 0) {
+        console.error(`${script}: parse failed: ${parseResult.errors[0].message}`);
+        failed++;
+        continue;
+    }
+    const environment = {
+        HOUR: inputs.hour, MINUTE: inputs.minute, SECOND: inputs.second, COUNTER: inputs.counter,
+        WIDTH: WIDTH, HEIGHT: HEIGHT,
+    };
+    const initialVariables = {};
+    parseResult.variables.forEach(name => { initialVariables[`$${name}`] = 0; });
+    const generated = new DisplayListGenerator(parseResult.assets.assets, environment).generate(parseResult.commands, initialVariables);
+    if (generated.errors.length > 0) {
+        console.error(`${script}: generation failed: ${generated.errors[0]}`);
+        failed++;
+        continue;
+    }
+
+    const ctx = new ReferenceContext(WIDTH, HEIGHT);
+    new DisplayListRenderer(ctx, parseResult.assets.assets, {
+        enableOcclusionCulling: true, occlusionBlockSize: 16, enablePixelBatching: true,
+        enablePatternTileCaching: true, enableTransformCaching: true, // As the emulator's display-list path
+    }).render(generated.displayList);
+
+    const out = join(outDir, basename(script, extname(script)) + '.pgm');
+    writeFileSync(out, Buffer.concat([Buffer.from(`P5\n${WIDTH} ${HEIGHT}\n255\n`), Buffer.from(ctx.toGray())]));
+    console.log(`${script}: ${generated.displayList.length} items -> ${out}`);
+}
+console.warn = console_warn;
+process.exit(failed ? 1 : 0);
@@ -0,0 +1,31 @@
+// Timing and logging for the native build (env:native only)
+#include "Arduino.h"
+#include "esp32-hal-log.h"
+#include <chrono>
+#include <thread>
+
+int nativeLogLevel = 2;
+EspClass ESP;
+
+static const std::chrono::steady_clock::time_point START_TIME = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - START_TIME).count();
+}
+
+unsigned long micros() {
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - START_TIME).count();
+}
+
+void yield() {
+    std::this_thread::yield();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+uint32_t EspClass::getCycleCount() {
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - START_TIME).count();
+    return (uint32_t)(ns * getCpuFrequencyMhz() / 1000); // Wraps like CCOUNT
+}
@@ -0,0 +1,110 @@
+// DisplayManager without a panel (env:native only): a displayed canvas and a back buffer of
+// the M5Paper's size in portrait orientation, as on the device with PSRAM. Presenting copies
+// the back buffer; messages and indicators only bump the canvas revision.
+#include "display_manager.h"
+#include "esp32-hal-log.h"
+#include <string.h>
+
+static const int NATIVE_EPD_WIDTH = 540;
+static const int NATIVE_EPD_HEIGHT = 960;
+
+DisplayManager::DisplayManager() : _canvas(nullptr), _indicatorCanvas(nullptr), _backCanvas(nullptr),
+      _hasBackBuffer(false), _isInitialized(false), _canvasRevision(0),
+      _ghostingBudget(DISPLAY_DEFAULT_GHOSTING_BUDGET), _ghostTilesX(0), _ghostTilesY(0) {
+    _epdMutex = xSemaphoreCreateMutex();
+}
+
+DisplayManager::~DisplayManager() {
+    _backCanvas.deleteCanvas();
+    _canvas.deleteCanvas();
+}
+
+bool DisplayManager::initializeEPD() {
+    if (_isInitialized) return true;
+    _canvas.createCanvas(NATIVE_EPD_WIDTH, NATIVE_EPD_HEIGHT);
+    _hasBackBuffer = _backCanvas.createCanvas(NATIVE_EPD_WIDTH, NATIVE_EPD_HEIGHT);
+    _isInitialized = true;
+    return true;
+}
+
+void DisplayManager::showMessage(const String& text, int, uint16_t, bool, bool) {
+    log_i("DisplayManager: %s", text.c_str());
+    _canvasRevision++;
+}
+
+void DisplayManager::pushCanvasUpdate(int32_t, int32_t, m5epd_update_mode_t) {}
+
+void DisplayManager::clearScreen(uint16_t color) {
+    _canvas.fillCanvas(color);
+    _canvasRevision++;
+}
+
+bool DisplayManager::pushCanvasRegion(int32_t, int32_t, int32_t, int32_t, m5epd_update_mode_t) { return true; }
+
+m5epd_update_mode_t DisplayManager::scheduleUpdate(int32_t, int32_t, int32_t, int32_t) {
+    return UPDATE_MODE_GC16;
+}
+
+m5epd_update_mode_t DisplayManager::pushCanvasScheduled(int32_t, int32_t, int32_t, int32_t) {
+    return UPDATE_MODE_GC16;
+}
+
+M5EPD_Canvas* DisplayManager::getCanvas() {
+    return &_canvas;
+}
+
+M5EPD_Canvas* DisplayManager::getRenderCanvas() {
+    return _hasBackBuffer ? &_backCanvas : &_canvas;
+}
+
+m5epd_update_mode_t DisplayManager::presentRegion(int32_t x, int32_t y, int32_t w, int32_t h) {
+    if (_hasBackBuffer) {
+        // Whole bytes: x and w are multiples of 4 for partial updates
+        const uint8_t* src = (const uint8_t*)_backCanvas.frameBuffer();
+        uint8_t* dst = (uint8_t*)_canvas.frameBuffer();
+        size_t rowBytes = NATIVE_EPD_WIDTH / 2;
+        for (int32_t row = std::max(0, y); row < std::min(NATIVE_EPD_HEIGHT, y + h); ++row) {
+            memcpy(dst + row * rowBytes + x / 2, src + row * rowBytes + x / 2, (size_t)w / 2);
+        }
+    }
+    return UPDATE_MODE_GC16;
+}
+
+M5EPD_Canvas* DisplayManager::createSpareCanvas() {
+    M5EPD_Canvas* canvas = new M5EPD_Canvas(nullptr);
+    if (!canvas->createCanvas(NATIVE_EPD_WIDTH, NATIVE_EPD_HEIGHT)) {
+        delete canvas;
+        return nullptr;
+    }
+    return canvas;
+}
+
+void DisplayManager::releaseSpareCanvas(M5EPD_Canvas* canvas) {
+    if (!canvas) return;
+    canvas->deleteCanvas();
+    delete canvas;
+}
+
+int DisplayManager::getWidth() {
+    return NATIVE_EPD_WIDTH;
+}
+
+int DisplayManager::getHeight() {
+    return NATIVE_EPD_HEIGHT;
+}
+
+bool DisplayManager::lockEPD(TickType_t timeout) {
+    return xSemaphoreTake(_epdMutex, timeout) == pdTRUE;
+}
+
+void DisplayManager::unlockEPD() {
+    xSemaphoreGive(_epdMutex);
+}
+
+void DisplayManager::drawStartupIndicator() {
+    _canvasRevision++;
+}
+
+void DisplayManager::drawActivityIndicator(ActivityIndicatorType) {
+    _canvasRevision++;
+}
@@ -0,0 +1,103 @@
+// Tracks every malloc/free of the process, operator new included, by wrapping the glibc
+// allocator: PSRAM "free" sizes and block counts then follow the live heap (env:native only)
+#include "host_heap.h"
+#include <esp_heap_caps.h>
+#include <atomic>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+static std::atomic<size_t> s_liveBytes(0);
+static std::atomic<size_t> s_liveBlocks(0);
+static std::atomic<size_t> s_peakBytes(0);
+
+static void trackAllocated(void* ptr) {
+    if (!ptr) return;
+    size_t live = s_liveBytes.fetch_add(malloc_usable_size(ptr)) + malloc_usable_size(ptr);
+    s_liveBlocks.fetch_add(1);
+    size_t peak = s_peakBytes.load();
+    while (live > peak && !s_peakBytes.compare_exchange_weak(peak, live)) {}
+}
+
+static void trackFreed(void* ptr) {
+    if (!ptr) return;
+    s_liveBytes.fetch_sub(malloc_usable_size(ptr));
+    s_liveBlocks.fetch_sub(1);
+}
+
+extern "C" void* malloc(size_t size) {
+    void* ptr = __libc_malloc(size);
+    trackAllocated(ptr);
+    return ptr;
+}
+
+extern "C" void* calloc(size_t count, size_t size) {
+    void* ptr = __libc_calloc(count, size);
+    trackAllocated(ptr);
+    return ptr;
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    trackFreed(ptr);
+    void* moved = __libc_realloc(ptr, size);
+    trackAllocated(moved ? moved : (size ? ptr : nullptr)); // A failed realloc keeps the block
+    return moved;
+}
+
+extern "C" void free(void* ptr) {
+    trackFreed(ptr);
+    __libc_free(ptr);
+}
+
+bool nativeHeapTracked() { return true; }
+
+NativeHeapStats nativeHeapStats() {
+    NativeHeapStats stats;
+    stats.liveBytes = s_liveBytes.load();
+    stats.liveBlocks = s_liveBlocks.load();
+    stats.peakBytes = s_peakBytes.load();
+    return stats;
+}
+
+void nativeHeapResetPeak() {
+    s_peakBytes.store(s_liveBytes.load());
+}
+
+#else
+
+bool nativeHeapTracked() { return false; }
+
+NativeHeapStats nativeHeapStats() {
+    NativeHeapStats stats = { 0, 0, 0 };
+    return stats;
+}
+
+void nativeHeapResetPeak() {}
+
+#endif
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    if (!(caps & MALLOC_CAP_SPIRAM) && (caps & MALLOC_CAP_INTERNAL)) return NATIVE_INTERNAL_BYTES;
+    size_t live = nativeHeapStats().liveBytes;
+    return live < NATIVE_PSRAM_BYTES ? NATIVE_PSRAM_BYTES - live : 0;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
+
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps) {
+    NativeHeapStats stats = nativeHeapStats();
+    info->total_free_bytes = heap_caps_get_free_size(caps);
+    info->total_allocated_bytes = stats.liveBytes;
+    info->largest_free_block = info->total_free_bytes;
+    info->minimum_free_bytes = NATIVE_PSRAM_BYTES - stats.peakBytes;
+    info->allocated_blocks = stats.liveBlocks;
+    info->free_blocks = 0;
+    info->total_blocks = stats.liveBlocks;
+}
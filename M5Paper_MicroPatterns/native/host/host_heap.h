@@ -0,0 +1,18 @@
+// Live heap accounting of the native build, for the benchmark's memory figures (env:native only)
+#ifndef NATIVE_HOST_HEAP_H
+#define NATIVE_HOST_HEAP_H
+
+#include <stddef.h>
+
+struct NativeHeapStats {
+    size_t liveBytes;  // Usable size of all live blocks
+    size_t liveBlocks;
+    size_t peakBytes;  // Largest liveBytes since the last nativeHeapResetPeak()
+};
+
+// False where malloc cannot be tracked (non-glibc hosts): the figures then stay at zero
+bool nativeHeapTracked();
+NativeHeapStats nativeHeapStats();
+void nativeHeapResetPeak();
+
+#endif // NATIVE_HOST_HEAP_H
@@ -0,0 +1,87 @@
+// Host stand-in for the parts of the Arduino core the render pipeline uses (env:native only):
+// a std::string backed String, timing and the cycle counter.
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <strings.h> // For strcasecmp
+#include <string>
+#include <algorithm>
+
+class String {
+public:
+    String() {}
+    String(const char* s) : _s(s ? s : "") {}
+    String(const char* s, unsigned int n) : _s(s, n) {}
+    String(const std::string& s) : _s(s) {}
+    String(char c) : _s(1, c) {}
+    String(int v) : _s(std::to_string(v)) {}
+    String(unsigned int v) : _s(std::to_string(v)) {}
+    String(long v) : _s(std::to_string(v)) {}
+    String(unsigned long v) : _s(std::to_string(v)) {}
+    String(float v, unsigned int d = 2) { char b[64]; snprintf(b, sizeof b, "%.*f", d, v); _s = b; }
+    String(double v, unsigned int d = 2) { char b[64]; snprintf(b, sizeof b, "%.*f", d, v); _s = b; }
+    unsigned int length() const { return _s.size(); }
+    const char* c_str() const { return _s.c_str(); }
+    bool isEmpty() const { return _s.empty(); }
+    char operator[](unsigned int i) const { return i < _s.size() ? _s[i] : 0; }
+    char& operator[](unsigned int i) { return _s[i]; }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+    int indexOf(char c, unsigned int from = 0) const { size_t p = _s.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+    int indexOf(const String& s, unsigned int from = 0) const { size_t p = _s.find(s._s, from); return p == std::string::npos ? -1 : (int)p; }
+    int lastIndexOf(char c) const { size_t p = _s.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+    int lastIndexOf(const String& s) const { size_t p = _s.rfind(s._s); return p == std::string::npos ? -1 : (int)p; }
+    String substring(unsigned int a) const { return a >= _s.size() ? String() : String(_s.substr(a)); }
+    String substring(unsigned int a, unsigned int b) const { if (a > b) std::swap(a, b); if (a >= _s.size()) return String(); return String(_s.substr(a, b - a)); }
+    void trim() { size_t a = 0; while (a < _s.size() && isspace((unsigned char)_s[a])) a++; size_t b = _s.size(); while (b > a && isspace((unsigned char)_s[b-1])) b--; _s = _s.substr(a, b - a); }
+    void toUpperCase() { for (auto& c : _s) c = toupper((unsigned char)c); }
+    void toLowerCase() { for (auto& c : _s) c = tolower((unsigned char)c); }
+    bool startsWith(const String& p) const { return _s.compare(0, p._s.size(), p._s) == 0; }
+    bool endsWith(const String& p) const { return _s.size() >= p._s.size() && _s.compare(_s.size() - p._s.size(), p._s.size(), p._s) == 0; }
+    bool equals(const String& o) const { return _s == o._s; }
+    bool equalsIgnoreCase(const String& o) const { return strcasecmp(_s.c_str(), o._s.c_str()) == 0; }
+    long toInt() const { return atol(_s.c_str()); }
+    bool reserve(unsigned int n) { _s.reserve(n); return true; }
+    void remove(unsigned int i, unsigned int n = 1) { if (i < _s.size()) _s.erase(i, n); }
+    void replace(const String& a, const String& b) { size_t p = 0; if (a._s.empty()) return; while ((p = _s.find(a._s, p)) != std::string::npos) { _s.replace(p, a._s.size(), b._s); p += b._s.size(); } }
+    String& operator+=(const String& o) { _s += o._s; return *this; }
+    String& operator+=(const char* o) { _s += o; return *this; }
+    String& operator+=(char c) { _s += c; return *this; }
+    String& operator+=(int v) { _s += std::to_string(v); return *this; }
+    bool concat(const char* s, unsigned int n) { _s.append(s, n); return true; }
+    bool concat(char c) { _s += c; return true; }
+    bool operator==(const String& o) const { return _s == o._s; }
+    bool operator==(const char* o) const { return _s == o; }
+    bool operator!=(const String& o) const { return _s != o._s; }
+    bool operator!=(const char* o) const { return _s != o; }
+    bool operator<(const String& o) const { return _s < o._s; }
+    const char* begin() const { return _s.data(); }
+    const char* end() const { return _s.data() + _s.size(); }
+    friend String operator+(const String& a, const String& b) { return String(a._s + b._s); }
+    friend String operator+(const String& a, const char* b) { return String(a._s + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b._s); }
+    friend String operator+(const String& a, char b) { return String(a._s + b); }
+    friend String operator+(const String& a, int b) { return String(a._s + std::to_string(b)); }
+private:
+    std::string _s;
+};
+
+unsigned long millis();
+unsigned long micros();
+void yield();
+void delay(unsigned long);
+
+// ESP.getCycleCount() at a nominal 240 MHz, so cycle counts convert to real microseconds
+struct EspClass {
+    uint32_t getCycleCount();
+};
+extern EspClass ESP;
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+
+#endif // NATIVE_ARDUINO_H
@@ -0,0 +1,5 @@
+// Empty on the host: the render pipeline only sees ArduinoJson through event_defs.h, which
+// does not use it (env:native only)
+#ifndef NATIVE_ARDUINOJSON_H
+#define NATIVE_ARDUINOJSON_H
+#endif // NATIVE_ARDUINOJSON_H
@@ -0,0 +1,61 @@
+// M5EPD_Canvas as a plain 4bpp framebuffer, two pixels per byte with the left one in the high
+// nibble like the real canvas; nothing is pushed to a panel (env:native only)
+#ifndef NATIVE_M5EPD_H
+#define NATIVE_M5EPD_H
+
+#include "Arduino.h"
+#include <vector>
+
+typedef enum {
+    UPDATE_MODE_INIT = 0,
+    UPDATE_MODE_DU = 1,
+    UPDATE_MODE_GC16 = 2,
+    UPDATE_MODE_GL16 = 3,
+    UPDATE_MODE_GLR16 = 4,
+    UPDATE_MODE_GLD16 = 5,
+    UPDATE_MODE_DU4 = 6,
+    UPDATE_MODE_A2 = 7,
+    UPDATE_MODE_NONE = 8
+} m5epd_update_mode_t;
+
+class M5EPD_Driver {};
+
+class M5EPD_Canvas {
+public:
+    M5EPD_Canvas(M5EPD_Driver* = nullptr) : _w(0), _h(0) {}
+    bool createCanvas(int w, int h) {
+        _w = w;
+        _h = h;
+        _buf.assign((size_t)w * h / 2, 0);
+        return true;
+    }
+    void deleteCanvas() {
+        _buf.clear();
+        _w = _h = 0;
+    }
+    int width() const { return _w; }
+    int height() const { return _h; }
+    void* frameBuffer(int8_t = 1) { return _buf.empty() ? nullptr : _buf.data(); }
+    void drawPixel(int32_t x, int32_t y, uint32_t color) {
+        if (x < 0 || y < 0 || x >= _w || y >= _h) return;
+        uint8_t& b = _buf[((size_t)y * _w + x) >> 1];
+        b = (x & 1) ? ((b & 0xF0) | (color & 0x0F)) : ((b & 0x0F) | ((color & 0x0F) << 4));
+    }
+    uint16_t readPixel(int32_t x, int32_t y) {
+        if (x < 0 || y < 0 || x >= _w || y >= _h) return 0;
+        uint8_t b = _buf[((size_t)y * _w + x) >> 1];
+        return (x & 1) ? (b & 0x0F) : (b >> 4);
+    }
+    void fillCanvas(uint32_t color) { memset(_buf.data(), (color & 0x0F) | ((color & 0x0F) << 4), _buf.size()); }
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+        for (int32_t j = y; j < y + h; ++j)
+            for (int32_t i = x; i < x + w; ++i) drawPixel(i, j, color);
+    }
+    void pushCanvas(int32_t, int32_t, m5epd_update_mode_t) {}
+
+private:
+    int _w, _h;
+    std::vector<uint8_t> _buf;
+};
+
+#endif // NATIVE_M5EPD_H
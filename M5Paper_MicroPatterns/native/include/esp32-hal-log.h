@@ -0,0 +1,18 @@
+// log_* to stderr, filtered by nativeLogLevel (env:native only)
+#ifndef NATIVE_ESP32_HAL_LOG_H
+#define NATIVE_ESP32_HAL_LOG_H
+
+#include <cstdio>
+
+// 0: silent, 1: errors, 2: + warnings (default), 3: + info, 4: + debug, 5: + verbose
+extern int nativeLogLevel;
+
+#define NATIVE_LOG(level, tag, fmt, ...) \
+    do { if (nativeLogLevel >= (level)) fprintf(stderr, "[" tag "] " fmt "\n", ##__VA_ARGS__); } while (0)
+#define log_e(fmt, ...) NATIVE_LOG(1, "E", fmt, ##__VA_ARGS__)
+#define log_w(fmt, ...) NATIVE_LOG(2, "W", fmt, ##__VA_ARGS__)
+#define log_i(fmt, ...) NATIVE_LOG(3, "I", fmt, ##__VA_ARGS__)
+#define log_d(fmt, ...) NATIVE_LOG(4, "D", fmt, ##__VA_ARGS__)
+#define log_v(fmt, ...) NATIVE_LOG(5, "V", fmt, ##__VA_ARGS__)
+
+#endif // NATIVE_ESP32_HAL_LOG_H
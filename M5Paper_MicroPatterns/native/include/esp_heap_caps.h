@@ -0,0 +1,35 @@
+// Capability allocators on the process heap (env:native only). Where the heap is tracked
+// (glibc, see native/host/host_heap.cpp), every allocation counts as PSRAM: free sizes and
+// block counts follow the live heap, so RenderProfile memory figures are meaningful.
+#ifndef NATIVE_ESP_HEAP_CAPS_H
+#define NATIVE_ESP_HEAP_CAPS_H
+
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+const size_t NATIVE_PSRAM_BYTES = 4 * 1024 * 1024;    // As the M5Paper's usable PSRAM
+const size_t NATIVE_INTERNAL_BYTES = 160 * 1024;      // Reported constant: nothing is internal here
+
+struct multi_heap_info_t {
+    size_t total_free_bytes;
+    size_t total_allocated_bytes;
+    size_t largest_free_block;
+    size_t minimum_free_bytes;
+    size_t allocated_blocks;
+    size_t free_blocks;
+    size_t total_blocks;
+};
+
+inline void* heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline void* heap_caps_calloc(size_t count, size_t size, uint32_t) { return calloc(count, size); }
+inline void heap_caps_free(void* ptr) { free(ptr); }
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+void heap_caps_get_info(multi_heap_info_t* info, uint32_t caps);
+
+#endif // NATIVE_ESP_HEAP_CAPS_H
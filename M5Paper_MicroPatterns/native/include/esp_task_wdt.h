@@ -0,0 +1,13 @@
+// No task watchdog on the host (env:native only)
+#ifndef NATIVE_ESP_TASK_WDT_H
+#define NATIVE_ESP_TASK_WDT_H
+
+#include <cstdint>
+
+typedef int esp_err_t;
+inline esp_err_t esp_task_wdt_init(uint32_t, bool) { return 0; }
+inline esp_err_t esp_task_wdt_reset() { return 0; }
+inline esp_err_t esp_task_wdt_add(void*) { return 0; }
+inline esp_err_t esp_task_wdt_delete(void*) { return 0; }
+
+#endif // NATIVE_ESP_TASK_WDT_H
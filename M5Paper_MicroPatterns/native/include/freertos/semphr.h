@@ -0,0 +1,44 @@
+// Counting semaphores on std::mutex and std::condition_variable (env:native only)
+#ifndef NATIVE_FREERTOS_SEMPHR_H
+#define NATIVE_FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+struct NativeSemaphore {
+    std::mutex mutex;
+    std::condition_variable cv;
+    int count;
+    explicit NativeSemaphore(int initial) : count(initial) {}
+};
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { return new NativeSemaphore(1); }
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new NativeSemaphore(0); }
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+    NativeSemaphore* s = static_cast<NativeSemaphore*>(handle);
+    std::unique_lock<std::mutex> lock(s->mutex);
+    if (ticks == portMAX_DELAY) {
+        s->cv.wait(lock, [s] { return s->count > 0; });
+    } else if (!s->cv.wait_for(lock, std::chrono::milliseconds(ticks), [s] { return s->count > 0; })) {
+        return pdFALSE;
+    }
+    s->count--;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    NativeSemaphore* s = static_cast<NativeSemaphore*>(handle);
+    {
+        std::lock_guard<std::mutex> lock(s->mutex);
+        if (s->count < 1) s->count++;
+    }
+    s->cv.notify_one();
+    return pdTRUE;
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t) {} // Leaked: a worker thread may still wait on it
+
+#endif // NATIVE_FREERTOS_SEMPHR_H
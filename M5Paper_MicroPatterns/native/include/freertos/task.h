@@ -0,0 +1,22 @@
+// Tasks as detached std::threads (env:native only). Priorities and core affinity are ignored.
+#ifndef NATIVE_FREERTOS_TASK_H
+#define NATIVE_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+#include <thread>
+
+typedef void (*TaskFunction_t)(void*);
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char*, uint32_t, void* param, UBaseType_t,
+                                          TaskHandle_t* handle, BaseType_t) {
+    std::thread thread(function, param);
+    thread.detach();
+    if (handle) *handle = reinterpret_cast<TaskHandle_t>(1);
+    return pdPASS;
+}
+inline UBaseType_t uxTaskPriorityGet(TaskHandle_t) { return 1; }
+inline void vTaskDelete(TaskHandle_t) {}
+inline void vTaskDelay(TickType_t) { std::this_thread::yield(); }
+
+#endif // NATIVE_FREERTOS_TASK_H
@@ -0,0 +1,68 @@
+#include "boot_snapshot.h"
+#include "esp32-hal-log.h"
+#include <esp_attr.h> // For RTC_DATA_ATTR
+#include <string.h>   // For memcpy
+#include <algorithm>  // For std::min
+
+static const uint32_t BOOT_SNAPSHOT_MAGIC = 0x4D505331; // "MPS1"; change with the layout
+
+struct SealedBootSnapshot {
+    uint32_t magic;
+    uint32_t checksum; // Of 'snapshot', so a wake never trusts a half-written or stale layout
+    BootSnapshot snapshot;
+};
+
+// Zero at power-on: no snapshot
+RTC_DATA_ATTR static SealedBootSnapshot s_rtcSnapshot;
+
+static uint32_t fnv1a(const uint8_t* data, size_t bytes, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < bytes; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+const BootSnapshot* bootSnapshotLoad() {
+    if (s_rtcSnapshot.magic != BOOT_SNAPSHOT_MAGIC) return nullptr;
+    const BootSnapshot& snapshot = s_rtcSnapshot.snapshot;
+    if (fnv1a((const uint8_t*)&snapshot, sizeof(snapshot)) != s_rtcSnapshot.checksum ||
+        snapshot.contentLength > BOOT_SNAPSHOT_MAX_CONTENT) {
+        log_w("BootSnapshot: Checksum mismatch, ignoring the snapshot.");
+        return nullptr;
+    }
+    return &snapshot;
+}
+
+void bootSnapshotStore(const BootSnapshot& snapshot) {
+    if (&snapshot != &s_rtcSnapshot.snapshot) memcpy(&s_rtcSnapshot.snapshot, &snapshot, sizeof(snapshot));
+    s_rtcSnapshot.snapshot.humanId[MAX_SCRIPT_ID_LEN - 1] = '\0';
+    s_rtcSnapshot.snapshot.fileId[MAX_SCRIPT_ID_LEN - 1] = '\0';
+    s_rtcSnapshot.checksum = fnv1a((const uint8_t*)&s_rtcSnapshot.snapshot, sizeof(s_rtcSnapshot.snapshot));
+    s_rtcSnapshot.magic = BOOT_SNAPSHOT_MAGIC;
+}
+
+void bootSnapshotInvalidate() {
+    s_rtcSnapshot.magic = 0;
+}
+
+bool bootSnapshotHashTiles(const uint8_t* frameBuffer, int width, int height, uint32_t* tileHashes) {
+    int tilesX = (width + BOOT_SNAPSHOT_TILE_SIZE - 1) / BOOT_SNAPSHOT_TILE_SIZE;
+    int tilesY = (height + BOOT_SNAPSHOT_TILE_SIZE - 1) / BOOT_SNAPSHOT_TILE_SIZE;
+    if (!frameBuffer || tilesX * tilesY != BOOT_SNAPSHOT_TILES) return false;
+    const int stride = width / 2;
+    for (int ty = 0; ty < tilesY; ++ty) {
+        int y1 = std::min<int>(height, (ty + 1) * BOOT_SNAPSHOT_TILE_SIZE);
+        for (int tx = 0; tx < tilesX; ++tx) {
+            // Tile edges are multiples of 4 pixels, so rows split on whole bytes
+            int b0 = tx * BOOT_SNAPSHOT_TILE_SIZE / 2;
+            int b1 = std::min<int>(width, (tx + 1) * BOOT_SNAPSHOT_TILE_SIZE) / 2;
+            uint32_t hash = 2166136261u;
+            for (int y = ty * BOOT_SNAPSHOT_TILE_SIZE; y < y1; ++y) {
+                hash = fnv1a(frameBuffer + (size_t)y * stride + b0, b1 - b0, hash);
+            }
+            tileHashes[ty * tilesX + tx] = hash;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef BOOT_SNAPSHOT_H
+#define BOOT_SNAPSHOT_H
+
+#include <Arduino.h>
+#include "event_defs.h"      // For ScriptExecState, MAX_SCRIPT_ID_LEN
+#include "display_manager.h" // For DISPLAY_GHOST_TILE_SIZE
+
+const int32_t BOOT_SNAPSHOT_TILE_SIZE = DISPLAY_GHOST_TILE_SIZE; // One tile per update scheduler tile
+const int BOOT_SNAPSHOT_TILES = 9 * 16;                         // Of the 540x960 canvas
+const size_t BOOT_SNAPSHOT_MAX_CONTENT = 3072;                  // Larger scripts are read from SPIFFS
+const uint16_t BOOT_SNAPSHOT_MAX_FAST_WAKES = 30; // Then a full boot, which also writes the state to SPIFFS
+
+// What a timer wake from deep sleep needs to bring the panel up to date without the normal
+// boot: the script on the panel and the state it was rendered with, the inputs its program
+// reads, a hash per tile of the panel image and, for small scripts, the script itself. Kept in
+// RTC slow memory, which survives deep sleep but not a reset or a power loss: the state table
+// on SPIFFS is brought up to date by the next full boot (see bootSnapshotLoad()).
+struct BootSnapshot {
+    char humanId[MAX_SCRIPT_ID_LEN];
+    char fileId[MAX_SCRIPT_ID_LEN];
+    ScriptExecState state;               // Inputs of the frame on the panel
+    uint32_t contentHash;                // ProgramCache::hashContent of its script
+    uint32_t inputMask;                  // Inputs its program reads (bits 1 << SLOT_HOUR .. SLOT_COUNTER)
+    uint16_t fastWakes;                  // Wakes handled without a full boot since the last one
+    uint16_t contentLength;              // Bytes in 'content', 0 if the script did not fit
+    uint32_t tileHashes[BOOT_SNAPSHOT_TILES];  // See bootSnapshotHashTiles()
+    uint8_t tileGhosting[BOOT_SNAPSHOT_TILES]; // DisplayManager update scheduler state
+    uint8_t tileGray[BOOT_SNAPSHOT_TILES];
+    char content[BOOT_SNAPSHOT_MAX_CONTENT];
+};
+
+// Snapshot sealed before the last deep sleep, else nullptr (power-on, reset, or none written)
+const BootSnapshot* bootSnapshotLoad();
+// Seals a copy of 'snapshot' into RTC memory for the next wake
+void bootSnapshotStore(const BootSnapshot& snapshot);
+void bootSnapshotInvalidate();
+
+// FNV-1a of each BOOT_SNAPSHOT_TILE_SIZE tile of a 4bpp framebuffer, row-major. False if the
+// framebuffer does not have BOOT_SNAPSHOT_TILES tiles.
+bool bootSnapshotHashTiles(const uint8_t* frameBuffer, int width, int height, uint32_t* tileHashes);
+
+#endif // BOOT_SNAPSHOT_H
@@ -1,106 +1,102 @@
 #include "display_list_renderer.h"
 #include "esp32-hal-log.h"
 #include <algorithm> // For std::min, std::max
-#include <cmath>     // For sqrtf, floor, ceil, round
+#include <cmath>     // For floor, ceil, hypot
+#include <string.h>  // For memset
+
+RenderBand::RenderBand(M5EPD_Canvas* canvas, int canvasWidth, int bandY0, int bandY1)
+    : y0(bandY0), y1(bandY1), drawing(canvas), occlusion(canvasWidth, bandY1 - bandY0, bandY0),
+      area(0), nextItem(0), areaStarted(false), done(true), rendered(0), culledByOcclusion(0) {
+    memset(kinds, 0, sizeof(kinds));
+    drawing.setRowRange(y0, y1);
+    drawing.setCoverageSink(&occlusion); // Every rasterised span feeds the band's occlusion buffer
+}
 
 DisplayListRenderer::DisplayListRenderer(DisplayManager& displayMgr,
-                                       const std::map<String, MicroPatternsAsset>& assets,
                                        int canvasWidth, int canvasHeight)
     : _displayMgr(displayMgr),
-      _drawing(displayMgr.getCanvas()), // Initialize _drawing with the canvas
-      _assets(assets),
-      _occlusionBuffer(canvasWidth, canvasHeight, 16), // Default block size 16
+      _renderCanvas(displayMgr.getRenderCanvas()), _targetCanvas(_renderCanvas),
       _canvasWidth(canvasWidth),
       _canvasHeight(canvasHeight),
       _totalItems(0), _renderedItems(0), _culledOffScreen(0), _culledByOcclusion(0),
-      _interrupt_check_cb(nullptr) {
-    _drawing.setCanvas(displayMgr.getCanvas()); // Ensure drawing module has the correct canvas
+      _binCycles(0), _rasteriseCycles(0),
+      _dependentOverflow(true), _previousDependentOverflow(true), _partialRender(false),
+      _interruptFlag(nullptr), _renderPending(false), _sliceDeadline(0),
+      _workerTask(nullptr), _workerStart(nullptr), _workerDone(nullptr), _bandMutex(nullptr),
+      _nextBand(0), _workerFailed(false), _streamRing(nullptr) {
+    // Band heights are whole occlusion blocks so no block straddles two bands
+    int bandHeight = (canvasHeight + RENDER_BAND_COUNT - 1) / RENDER_BAND_COUNT;
+    bandHeight = (bandHeight + OCCLUSION_BLOCK_SIZE - 1) / OCCLUSION_BLOCK_SIZE * OCCLUSION_BLOCK_SIZE;
+    for (int y = 0; y < canvasHeight; y += bandHeight) {
+        _bands.push_back(new RenderBand(_renderCanvas, canvasWidth, y, std::min(canvasHeight, y + bandHeight)));
+    }
 }
 
-void DisplayListRenderer::setInterruptCheckCallback(std::function<bool()> cb) {
-    _interrupt_check_cb = cb;
-    _drawing.setInterruptCheckCallback(cb); // Pass to drawing module
+DisplayListRenderer::~DisplayListRenderer() {
+    if (_workerTask) vTaskDelete(_workerTask); // Idle: render() always waits for the worker
+    if (_workerStart) vSemaphoreDelete(_workerStart);
+    if (_workerDone) vSemaphoreDelete(_workerDone);
+    if (_bandMutex) vSemaphoreDelete(_bandMutex);
+    for (RenderBand* band : _bands) delete band;
 }
 
-bool DisplayListRenderer::isAssetDataFullyOpaque(const MicroPatternsAsset* asset) const {
-    if (!asset || asset->data.empty()) {
-        return false;
-    }
-    for (uint8_t pixelValue : asset->data) {
-        if (pixelValue == 0) { // 0 means transparent for DRAW
-            return false;
-        }
+void DisplayListRenderer::setTargetCanvas(M5EPD_Canvas* canvas) {
+    if (!canvas) canvas = _renderCanvas;
+    if (canvas == _targetCanvas) return;
+    abandonRender();
+    _targetCanvas = canvas;
+    for (RenderBand* band : _bands) {
+        band->drawing.setCanvas(canvas);
+        band->drawing.setRowRange(band->y0, band->y1);
     }
-    return true;
 }
 
-bool DisplayListRenderer::determineItemOpacity(const DisplayListItem& item) const {
-    // FILL_* commands are always opaque over their shape.
-    if (item.type == CMD_FILL_RECT || item.type == CMD_FILL_CIRCLE || item.type == CMD_FILL_PIXEL) {
-        return true;
-    }
-    // PIXEL command draws a single scaled block of the current color. This is opaque.
-    if (item.type == CMD_PIXEL) {
-        return true;
-    }
-    // For DRAW commands, opacity depends on the asset being drawn.
-    if (item.type == CMD_DRAW) {
-        if (item.stringParams.count("NAME")) {
-            String assetName = item.stringParams.at("NAME"); // Already uppercase
-            if (_assets.count(assetName)) {
-                return isAssetDataFullyOpaque(&_assets.at(assetName));
-            }
-        }
-        return false; // No asset name or asset not found.
-    }
-    // LINE, RECT (outline), CIRCLE (outline) are not considered opaque for area culling.
-    return false;
+void DisplayListRenderer::setInterruptFlag(const volatile bool* flag) {
+    _interruptFlag = flag;
+    for (RenderBand* band : _bands) band->drawing.setInterruptFlag(flag); // Pass to drawing modules
 }
 
+void DisplayListRenderer::invalidatePatternTiles() {
+    abandonRender(); // Its items may point at the assets
+    for (RenderBand* band : _bands) band->drawing.clearPatternTiles();
+}
 
-ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& item) {
+ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& item) const {
     ScreenBounds bounds;
     bounds.isOffScreen = true; // Default to off-screen
 
     float unclippedVisualMinX = 0, unclippedVisualMinY = 0, unclippedVisualMaxX = 0, unclippedVisualMaxY = 0;
     bool validShape = false;
 
-    // Helper for transforming points using item's state
+    // Helper for transforming points using item's state (as MicroPatternsDrawing::transformPoint)
     auto transformItemPoint = [&](float lx, float ly, float& sx, float& sy) {
-        _drawing.transformPoint(lx, ly, item, sx, sy);
+        matrix_apply_to_point(item.matrix, lx * item.scaleFactor, ly * item.scaleFactor, sx, sy);
     };
     
-    float s_center_x_for_circle = 0, s_center_y_for_circle = 0;
-    float effective_radius_for_circle = 0;
 
 
     if (item.type == CMD_DRAW) {
-        if (item.stringParams.count("NAME")) {
-            String assetName = item.stringParams.at("NAME");
-            if (_assets.count(assetName)) {
-                const MicroPatternsAsset& asset = _assets.at(assetName);
-                if (asset.width > 0 && asset.height > 0) {
-                    int lx = item.intParams.at("X");
-                    int ly = item.intParams.at("Y");
-                    float s_pts_x[4], s_pts_y[4];
-                    transformItemPoint(lx, ly, s_pts_x[0], s_pts_y[0]);
-                    transformItemPoint(lx + asset.width, ly, s_pts_x[1], s_pts_y[1]);
-                    transformItemPoint(lx + asset.width, ly + asset.height, s_pts_x[2], s_pts_y[2]);
-                    transformItemPoint(lx, ly + asset.height, s_pts_x[3], s_pts_y[3]);
-
-                    unclippedVisualMinX = std::min({s_pts_x[0], s_pts_x[1], s_pts_x[2], s_pts_x[3]});
-                    unclippedVisualMinY = std::min({s_pts_y[0], s_pts_y[1], s_pts_y[2], s_pts_y[3]});
-                    unclippedVisualMaxX = std::max({s_pts_x[0], s_pts_x[1], s_pts_x[2], s_pts_x[3]});
-                    unclippedVisualMaxY = std::max({s_pts_y[0], s_pts_y[1], s_pts_y[2], s_pts_y[3]});
-                    validShape = true;
-                }
-            }
+        const MicroPatternsAsset* asset = item.draw.asset;
+        if (asset && asset->width > 0 && asset->height > 0) {
+            int lx = item.draw.x;
+            int ly = item.draw.y;
+            float s_pts_x[4], s_pts_y[4];
+            transformItemPoint(lx, ly, s_pts_x[0], s_pts_y[0]);
+            transformItemPoint(lx + asset->width, ly, s_pts_x[1], s_pts_y[1]);
+            transformItemPoint(lx + asset->width, ly + asset->height, s_pts_x[2], s_pts_y[2]);
+            transformItemPoint(lx, ly + asset->height, s_pts_x[3], s_pts_y[3]);
+
+            unclippedVisualMinX = std::min({s_pts_x[0], s_pts_x[1], s_pts_x[2], s_pts_x[3]});
+            unclippedVisualMinY = std::min({s_pts_y[0], s_pts_y[1], s_pts_y[2], s_pts_y[3]});
+            unclippedVisualMaxX = std::max({s_pts_x[0], s_pts_x[1], s_pts_x[2], s_pts_x[3]});
+            unclippedVisualMaxY = std::max({s_pts_y[0], s_pts_y[1], s_pts_y[2], s_pts_y[3]});
+            validShape = true;
         }
     } else if (item.type == CMD_RECT || item.type == CMD_FILL_RECT) {
-        int lx = item.intParams.at("X");
-        int ly = item.intParams.at("Y");
-        int lw = item.intParams.at("WIDTH");
-        int lh = item.intParams.at("HEIGHT");
+        int lx = item.rect.x;
+        int ly = item.rect.y;
+        int lw = item.rect.width;
+        int lh = item.rect.height;
         if (lw > 0 && lh > 0) {
             float s_pts_x[4], s_pts_y[4];
             transformItemPoint(lx, ly, s_pts_x[0], s_pts_y[0]);
@@ -115,32 +111,33 @@ ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& i
         }
     } else if (item.type == CMD_LINE) {
         float s_p1_x, s_p1_y, s_p2_x, s_p2_y;
-        transformItemPoint(item.intParams.at("X1"), item.intParams.at("Y1"), s_p1_x, s_p1_y);
-        transformItemPoint(item.intParams.at("X2"), item.intParams.at("Y2"), s_p2_x, s_p2_y);
+        transformItemPoint(item.line.x1, item.line.y1, s_p1_x, s_p1_y);
+        transformItemPoint(item.line.x2, item.line.y2, s_p2_x, s_p2_y);
         unclippedVisualMinX = std::min(s_p1_x, s_p2_x);
         unclippedVisualMinY = std::min(s_p1_y, s_p2_y);
         unclippedVisualMaxX = std::max(s_p1_x, s_p2_x);
         unclippedVisualMaxY = std::max(s_p1_y, s_p2_y);
         validShape = true;
     } else if (item.type == CMD_PIXEL || item.type == CMD_FILL_PIXEL) {
-        float s_p_x, s_p_y;
-        transformItemPoint(item.intParams.at("X"), item.intParams.at("Y"), s_p_x, s_p_y);
         // A pixel covers a 1x1 logical unit. Transform all 4 corners.
+        int lx = item.pixel.x;
+        int ly = item.pixel.y;
         float s_p1_x, s_p1_y, s_p2_x, s_p2_y, s_p3_x, s_p3_y, s_p4_x, s_p4_y;
-        transformItemPoint(item.intParams.at("X"), item.intParams.at("Y"), s_p1_x, s_p1_y);
-        transformItemPoint(item.intParams.at("X") + 1, item.intParams.at("Y"), s_p2_x, s_p2_y);
-        transformItemPoint(item.intParams.at("X") + 1, item.intParams.at("Y") + 1, s_p3_x, s_p3_y);
-        transformItemPoint(item.intParams.at("X"), item.intParams.at("Y") + 1, s_p4_x, s_p4_y);
+        transformItemPoint(lx, ly, s_p1_x, s_p1_y);
+        transformItemPoint(lx + 1, ly, s_p2_x, s_p2_y);
+        transformItemPoint(lx + 1, ly + 1, s_p3_x, s_p3_y);
+        transformItemPoint(lx, ly + 1, s_p4_x, s_p4_y);
         unclippedVisualMinX = std::min({s_p1_x, s_p2_x, s_p3_x, s_p4_x});
         unclippedVisualMinY = std::min({s_p1_y, s_p2_y, s_p3_y, s_p4_y});
         unclippedVisualMaxX = std::max({s_p1_x, s_p2_x, s_p3_x, s_p4_x});
         unclippedVisualMaxY = std::max({s_p1_y, s_p2_y, s_p3_y, s_p4_y});
         validShape = true;
     } else if (item.type == CMD_CIRCLE || item.type == CMD_FILL_CIRCLE) {
-        int lcx = item.intParams.at("X");
-        int lcy = item.intParams.at("Y");
-        int lr = item.intParams.at("RADIUS");
+        int lcx = item.circle.x;
+        int lcy = item.circle.y;
+        int lr = item.circle.radius;
         if (lr > 0) {
+            float s_center_x_for_circle, s_center_y_for_circle;
             transformItemPoint(lcx, lcy, s_center_x_for_circle, s_center_y_for_circle);
             float s_edge_on_x_axis_x, s_edge_on_x_axis_y;
             transformItemPoint(lcx + lr, lcy, s_edge_on_x_axis_x, s_edge_on_x_axis_y);
@@ -149,7 +146,7 @@ ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& i
             
             float radius_proj_x = std::hypot(s_edge_on_x_axis_x - s_center_x_for_circle, s_edge_on_x_axis_y - s_center_y_for_circle);
             float radius_proj_y = std::hypot(s_edge_on_y_axis_x - s_center_x_for_circle, s_edge_on_y_axis_y - s_center_y_for_circle);
-            effective_radius_for_circle = std::max({radius_proj_x, radius_proj_y, 1.0f});
+            float effective_radius_for_circle = std::max({radius_proj_x, radius_proj_y, 1.0f});
 
             unclippedVisualMinX = s_center_x_for_circle - effective_radius_for_circle;
             unclippedVisualMaxX = s_center_x_for_circle + effective_radius_for_circle;
@@ -161,7 +158,6 @@ ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& i
 
     if (!validShape) {
         bounds.minX = bounds.minY = bounds.maxX = bounds.maxY = 0;
-        bounds.markingBounds = {0,0,0,0};
         return bounds;
     }
 
@@ -177,80 +173,25 @@ ScreenBounds DisplayListRenderer::calculateScreenBounds(const DisplayListItem& i
         bounds.isOffScreen = true;
     }
 
-    // Default marking bounds to visual bounds
-    bounds.markingBounds.minX = bounds.minX;
-    bounds.markingBounds.minY = bounds.minY;
-    bounds.markingBounds.maxX = bounds.maxX;
-    bounds.markingBounds.maxY = bounds.maxY;
-
-    // Adjust marking bounds for specific opaque shapes (similar to JS logic)
-    if (item.isOpaque) {
-        if (item.type == CMD_FILL_CIRCLE && validShape && effective_radius_for_circle > 0) {
-            const float markingRadiusScaleFactor = sqrtf(M_PI / 4.0f); // approx 0.886
-            const float markingRadius = effective_radius_for_circle * markingRadiusScaleFactor;
-            bounds.markingBounds.minX = static_cast<int>(floor(std::max(0.0f, s_center_x_for_circle - markingRadius)));
-            bounds.markingBounds.minY = static_cast<int>(floor(std::max(0.0f, s_center_y_for_circle - markingRadius)));
-            bounds.markingBounds.maxX = static_cast<int>(ceil(std::min(static_cast<float>(_canvasWidth), s_center_x_for_circle + markingRadius)));
-            bounds.markingBounds.maxY = static_cast<int>(ceil(std::min(static_cast<float>(_canvasHeight), s_center_y_for_circle + markingRadius)));
-        } else if (item.type == CMD_FILL_RECT && validShape) {
-            int lw = item.intParams.at("WIDTH");
-            int lh = item.intParams.at("HEIGHT");
-            if (lw > 0 && lh > 0) {
-                const float matrixDeterminant = std::abs(item.matrix[0] * item.matrix[3] - item.matrix[1] * item.matrix[2]);
-                const float actualScreenArea = static_cast<float>(lw) * lh * item.scaleFactor * item.scaleFactor * matrixDeterminant;
-                const float visualAABBWidth = unclippedVisualMaxX - unclippedVisualMinX;
-                const float visualAABBHeight = unclippedVisualMaxY - unclippedVisualMinY;
-                const float visualAABBArea = visualAABBWidth * visualAABBHeight;
-
-                if (actualScreenArea > 0 && visualAABBArea > 0) {
-                    const float fillFactor = std::max(0.0f, std::min(1.0f, actualScreenArea / visualAABBArea));
-                    if (fillFactor < 0.85f) { // Only adjust if significantly non-axis-aligned
-                        const float scaleDownFactor = sqrtf(fillFactor);
-                        const float markingWidth = visualAABBWidth * scaleDownFactor;
-                        const float markingHeight = visualAABBHeight * scaleDownFactor;
-                        const float centerX = (unclippedVisualMinX + unclippedVisualMaxX) / 2.0f;
-                        const float centerY = (unclippedVisualMinY + unclippedVisualMaxY) / 2.0f;
-                        bounds.markingBounds.minX = static_cast<int>(floor(std::max(0.0f, centerX - markingWidth / 2.0f)));
-                        bounds.markingBounds.minY = static_cast<int>(floor(std::max(0.0f, centerY - markingHeight / 2.0f)));
-                        bounds.markingBounds.maxX = static_cast<int>(ceil(std::min(static_cast<float>(_canvasWidth), centerX + markingWidth / 2.0f)));
-                        bounds.markingBounds.maxY = static_cast<int>(ceil(std::min(static_cast<float>(_canvasHeight), centerY + markingHeight / 2.0f)));
-                    }
-                }
-            }
-        }
-        // Ensure marking bounds are valid
-        if (bounds.markingBounds.minX >= bounds.markingBounds.maxX || bounds.markingBounds.minY >= bounds.markingBounds.maxY) {
-            // Fallback to visual bounds if marking bounds became invalid
-            bounds.markingBounds.minX = bounds.minX;
-            bounds.markingBounds.minY = bounds.minY;
-            bounds.markingBounds.maxX = bounds.maxX;
-            bounds.markingBounds.maxY = bounds.maxY;
-        }
-    }
     return bounds;
 }
 
 
-void DisplayListRenderer::renderItem(const DisplayListItem& item) {
-    // The _drawing methods now take DisplayListItem directly
+void DisplayListRenderer::renderItem(MicroPatternsDrawing& drawing, const DisplayListItem& item) {
+    // The drawing methods take DisplayListItem directly
     switch (item.type) {
-        case CMD_FILL_RECT:   _drawing.fillRect(item); break;
-        case CMD_RECT:        _drawing.drawRect(item); break;
-        case CMD_FILL_CIRCLE: _drawing.fillCircle(item); break;
-        case CMD_CIRCLE:      _drawing.drawCircle(item); break;
-        case CMD_LINE:        _drawing.drawLine(item); break;
-        case CMD_PIXEL:       _drawing.drawPixel(item); break;
-        case CMD_FILL_PIXEL:  _drawing.drawFilledPixel(item); break;
+        case CMD_FILL_RECT:   drawing.fillRect(item); break;
+        case CMD_RECT:        drawing.drawRect(item); break;
+        case CMD_FILL_CIRCLE: drawing.fillCircle(item); break;
+        case CMD_CIRCLE:      drawing.drawCircle(item); break;
+        case CMD_LINE:        drawing.drawLine(item); break;
+        case CMD_PIXEL:       drawing.drawPixel(item); break;
+        case CMD_FILL_PIXEL:  drawing.drawFilledPixel(item); break;
         case CMD_DRAW:
-            if (item.stringParams.count("NAME")) {
-                String assetName = item.stringParams.at("NAME");
-                if (_assets.count(assetName)) {
-                    _drawing.drawAsset(item, _assets.at(assetName));
-                } else {
-                    log_w("DisplayListRenderer (Line %d): Asset '%s' not found for DRAW.", item.sourceLine, assetName.c_str());
-                }
+            if (item.draw.asset) {
+                drawing.drawAsset(item);
             } else {
-                 log_w("DisplayListRenderer (Line %d): DRAW command missing NAME parameter.", item.sourceLine);
+                log_w("DisplayListRenderer (Line %d): DRAW item has no asset.", item.sourceLine);
             }
             break;
         default:
@@ -258,56 +199,421 @@ void DisplayListRenderer::renderItem(const DisplayListItem& item) {
     }
 }
 
-void DisplayListRenderer::render(const std::vector<DisplayListItem>& displayList) {
-    _totalItems = displayList.size();
-    _renderedItems = 0;
-    _culledOffScreen = 0;
-    _culledByOcclusion = 0;
-    
-    _drawing.enablePixelOccupationMap(true); // Enable for this render pass
-    _occlusionBuffer.reset(); // Reset occlusion buffer state
-    _drawing.clearCanvas();   // Clear canvas to white (this will also call _drawing.resetPixelOccupationMap())
+// renderItem(), timed and counted per drawing command type
+void DisplayListRenderer::renderProfiledItem(RenderBand& band, const DisplayListItem& item) {
+    uint32_t start = profileCycles();
+    uint32_t pixels = band.drawing.getPixelsWritten();
+    renderItem(band.drawing, item);
+    int kind = renderProfileKind(item.type);
+    if (kind < 0) return;
+    band.kinds[kind].cycles += (uint32_t)(profileCycles() - start);
+    band.kinds[kind].items++;
+    band.kinds[kind].pixels += band.drawing.getPixelsWritten() - pixels;
+}
+
+void DisplayListRenderer::resetBandProfiles() {
+    for (RenderBand* band : _bands) memset(band->kinds, 0, sizeof(band->kinds));
+}
+
+void DisplayListRenderer::collectProfile(RenderProfile& profile) const {
+    profile.phaseCycles[RENDER_PHASE_BIN] += _binCycles;
+    profile.phaseCycles[RENDER_PHASE_RASTERISE] += _rasteriseCycles;
+    for (const RenderBand* band : _bands) profile.addKinds(band->kinds);
+}
 
-    // Iterate in reverse for back-to-front processing (last script command first).
-    // This allows foreground elements to mark pixels in pixelOccupationMap before background elements are processed.
+// Bins items into the bands their bounds bounds overlap, back to front (last script command
+// first) so foreground elements mark the occupation maps before background elements.
+void DisplayListRenderer::binItems(const std::vector<DisplayListItem>& displayList) {
+    for (RenderBand* band : _bands) band->items.clear(); // Keeps capacity for the next render
+
+    DisplayListItem copy;
     for (auto it = displayList.rbegin(); it != displayList.rend(); ++it) {
-        if (_interrupt_check_cb && _interrupt_check_cb()) {
-            log_i("DisplayListRenderer: Interrupt detected during rendering loop.");
-            return; // Stop rendering
+        const DisplayListItem& item = *it;
+        _totalItems += item.instanceCount;
+        // Copies of an instanced item are binned individually, last copy first
+        for (int32_t instance = item.instanceCount - 1; instance >= 0; --instance) {
+            if (item.instanceCount > 1) item.expandInstance(instance, copy);
+            ScreenBounds bounds = calculateScreenBounds(item.instanceCount > 1 ? copy : item);
+
+            // Off-screen, or zero-area bounds after clipping
+            if (bounds.isOffScreen || bounds.minX >= bounds.maxX || bounds.minY >= bounds.maxY) {
+                _culledOffScreen++;
+                continue;
+            }
+
+            BinnedItem binned = { &item, instance,
+                                  static_cast<int16_t>(bounds.minX), static_cast<int16_t>(bounds.minY),
+                                  static_cast<int16_t>(bounds.maxX), static_cast<int16_t>(bounds.maxY) };
+            for (RenderBand* band : _bands) {
+                // Same padding as the occlusion check: outline endpoints and circle radii are rounded
+                if (bounds.minY - 2 < band->y1 && bounds.maxY + 2 > band->y0) band->items.push_back(binned);
+            }
         }
+    }
+}
 
-        const DisplayListItem& item = *it;
-        ScreenBounds bounds = calculateScreenBounds(item);
+// Rotates the tracked input-dependent items; nullptr (streamed render) leaves them untracked
+void DisplayListRenderer::trackDependentItems(const std::vector<DisplayListItem>* displayList) {
+    _previousDependentItems.swap(_dependentItems);
+    _previousDependentOverflow = _dependentOverflow;
+    _dependentItems.clear();
+    _dependentOverflow = (displayList == nullptr);
+    if (!displayList) return;
 
-        if (bounds.isOffScreen) {
-            _culledOffScreen++;
-            continue;
+    for (size_t i = 0; i < displayList->size(); ++i) {
+        const DisplayListItem& item = (*displayList)[i];
+        if (!item.dependsOnInput) continue;
+        if (_dependentItems.size() >= RENDER_MAX_TRACKED_ITEMS) {
+            _dependentItems.clear();
+            _dependentOverflow = true;
+            return;
+        }
+        TrackedItem tracked = { i, item };
+        _dependentItems.push_back(tracked);
+    }
+}
+
+// Merges 'bounds' into the first region it touches, else adds it as a new region, or when
+// full merges it into the region that grows least.
+void DisplayListRenderer::addRegion(std::vector<ScreenBounds>& regions, const ScreenBounds& bounds) {
+    auto merge = [](ScreenBounds& into, const ScreenBounds& other) {
+        into.minX = std::min(into.minX, other.minX); into.minY = std::min(into.minY, other.minY);
+        into.maxX = std::max(into.maxX, other.maxX); into.maxY = std::max(into.maxY, other.maxY);
+    };
+    for (ScreenBounds& region : regions) {
+        if (bounds.minX <= region.maxX && bounds.maxX >= region.minX &&
+            bounds.minY <= region.maxY && bounds.maxY >= region.minY) {
+            merge(region, bounds);
+            return;
         }
-        
-        // Check for zero-area bounds after clipping
-        if (bounds.minX >= bounds.maxX || bounds.minY >= bounds.maxY) {
-            _culledOffScreen++;
+    }
+    if (static_cast<int>(regions.size()) < RENDER_MAX_CHANGED_REGIONS) {
+        regions.push_back(bounds);
+        return;
+    }
+    size_t best = 0;
+    int64_t bestGrowth = INT64_MAX;
+    for (size_t i = 0; i < regions.size(); ++i) {
+        ScreenBounds grown = regions[i];
+        merge(grown, bounds);
+        int64_t growth = (int64_t)(grown.maxX - grown.minX) * (grown.maxY - grown.minY) -
+                         (int64_t)(regions[i].maxX - regions[i].minX) * (regions[i].maxY - regions[i].minY);
+        if (growth < bestGrowth) { bestGrowth = growth; best = i; }
+    }
+    merge(regions[best], bounds);
+}
+
+void DisplayListRenderer::addItemRegions(std::vector<ScreenBounds>& regions, const DisplayListItem& item) const {
+    DisplayListItem copy;
+    for (int32_t instance = 0; instance < item.instanceCount; ++instance) {
+        if (item.instanceCount > 1) item.expandInstance(instance, copy);
+        ScreenBounds bounds = calculateScreenBounds(item.instanceCount > 1 ? copy : item);
+        if (!bounds.isOffScreen) addRegion(regions, bounds);
+    }
+}
+
+// Invariant items are identical and in the same order in both renders, so an input-dependent
+// item at the same display-list index and ordinal that draws the same pixels is stacked
+// exactly as before and cannot change the canvas.
+void DisplayListRenderer::getChangedRegions(std::vector<ScreenBounds>& out) const {
+    out.clear();
+    if (_dependentOverflow || _previousDependentOverflow) {
+        ScreenBounds all = { 0, 0, _canvasWidth, _canvasHeight, false };
+        out.push_back(all);
+        return;
+    }
+
+    size_t count = std::max(_dependentItems.size(), _previousDependentItems.size());
+    for (size_t k = 0; k < count; ++k) {
+        const TrackedItem* now = k < _dependentItems.size() ? &_dependentItems[k] : nullptr;
+        const TrackedItem* before = k < _previousDependentItems.size() ? &_previousDependentItems[k] : nullptr;
+        if (now && before && now->index == before->index && now->item.drawsSameAs(before->item)) continue;
+        if (now) addItemRegions(out, now->item);
+        if (before) addItemRegions(out, before->item);
+    }
+    for (ScreenBounds& region : out) { // Padded for rounding as the occlusion check, clipped to the canvas
+        region.minX = std::max(region.minX - 2, 0); region.minY = std::max(region.minY - 2, 0);
+        region.maxX = std::min(region.maxX + 2, _canvasWidth); region.maxY = std::min(region.maxY + 2, _canvasHeight);
+    }
+}
+
+// Picks the dirty regions of a partial render: the changed regions aligned outwards to
+// RENDER_REGION_ALIGN and re-merged. False if they cover too much of the canvas.
+bool DisplayListRenderer::selectDirtyRegions() {
+    std::vector<ScreenBounds> changed;
+    getChangedRegions(changed);
+
+    _dirtyRegions.clear();
+    for (ScreenBounds region : changed) {
+        region.minX = region.minX / RENDER_REGION_ALIGN * RENDER_REGION_ALIGN;
+        region.minY = region.minY / RENDER_REGION_ALIGN * RENDER_REGION_ALIGN;
+        region.maxX = std::min(_canvasWidth, (region.maxX + RENDER_REGION_ALIGN - 1) / RENDER_REGION_ALIGN * RENDER_REGION_ALIGN);
+        region.maxY = std::min(_canvasHeight, (region.maxY + RENDER_REGION_ALIGN - 1) / RENDER_REGION_ALIGN * RENDER_REGION_ALIGN);
+        addRegion(_dirtyRegions, region);
+    }
+
+    int64_t area = 0;
+    for (const ScreenBounds& region : _dirtyRegions) {
+        area += (int64_t)(region.maxX - region.minX) * (region.maxY - region.minY);
+    }
+    if (area * 100 > (int64_t)_canvasWidth * _canvasHeight * RENDER_PARTIAL_MAX_PERCENT) {
+        _dirtyRegions.clear();
+        return false;
+    }
+    return true;
+}
+
+bool DisplayListRenderer::startWorker() {
+    _workerStart = xSemaphoreCreateBinary();
+    _workerDone = xSemaphoreCreateBinary();
+    _bandMutex = xSemaphoreCreateMutex();
+    if (_workerStart && _workerDone && _bandMutex &&
+        xTaskCreatePinnedToCore(workerTaskFunction, "RenderWorker", RENDER_WORKER_STACK_SIZE, this,
+                                uxTaskPriorityGet(NULL), &_workerTask, tskNO_AFFINITY) == pdPASS) {
+        return true;
+    }
+    log_e("DisplayListRenderer: Failed to start band worker, rendering on one core.");
+    _workerTask = nullptr;
+    return false;
+}
+
+void DisplayListRenderer::workerTaskFunction(void* param) {
+    DisplayListRenderer* renderer = static_cast<DisplayListRenderer*>(param);
+    while (true) {
+        xSemaphoreTake(renderer->_workerStart, portMAX_DELAY);
+        esp_task_wdt_add(NULL); // Watched only while rendering, not while waiting for a pass
+        if (renderer->_streamRing) renderer->renderStream(*renderer->_streamRing);
+        else renderer->renderBands();
+        esp_task_wdt_delete(NULL);
+        xSemaphoreGive(renderer->_workerDone);
+    }
+}
+
+void DisplayListRenderer::renderBands() {
+    while (true) {
+        int index;
+        if (_bandMutex) xSemaphoreTake(_bandMutex, portMAX_DELAY);
+        index = _nextBand++;
+        if (_bandMutex) xSemaphoreGive(_bandMutex);
+        if (index >= static_cast<int>(_bands.size())) return;
+        renderBand(*_bands[index]);
+    }
+}
+
+// Processes the band's items front to back with its own occupation map and occlusion
+// buffer: the whole band, or in a partial render each dirty region overlapping it. Pixels
+// outside the rendered area are clipped, so it ends up exactly as in a full-canvas pass.
+void DisplayListRenderer::renderBand(RenderBand& band) {
+    if (band.done) return;
+    if (band.area == 0 && !band.areaStarted) band.drawing.enablePixelOccupationMap(true); // Enable for this render pass
+    size_t areas = _partialRender ? _dirtyRegions.size() : 1;
+    for (; band.area < areas; band.area++, band.nextItem = 0, band.areaStarted = false) {
+        ScreenBounds area = { 0, band.y0, _canvasWidth, band.y1, false };
+        if (_partialRender) {
+            area = _dirtyRegions[band.area];
+            if (area.minY >= band.y1 || area.maxY <= band.y0) continue;
+        }
+        if (!renderBandArea(band, area)) return; // Continued by the next slice
+    }
+    band.drawing.setClipRect(0, band.y0, _canvasWidth, band.y1);
+    band.drawing.enablePixelOccupationMap(false); // Disable after render pass (optional, good practice)
+    band.done = true;
+}
+
+bool DisplayListRenderer::renderBandArea(RenderBand& band, const ScreenBounds& area) {
+    int x0 = area.minX, y0 = std::max(area.minY, band.y0);
+    int x1 = area.maxX, y1 = std::min(area.maxY, band.y1);
+    band.drawing.setClipRect(x0, y0, x1, y1);
+    if (!band.areaStarted) {
+        band.occlusion.reset();
+        band.drawing.clearCanvas(); // Clears the area and the band's occupation map
+        band.areaStarted = true;
+    }
+
+    for (; band.nextItem < band.items.size(); ++band.nextItem) {
+        if (isSliceOver()) return false;
+        const BinnedItem& binned = band.items[band.nextItem];
+
+        // Padded for the rounding of outline endpoints and circle radii
+        int minX = std::max(binned.minX - 2, x0), minY = std::max(binned.minY - 2, y0);
+        int maxX = std::min(binned.maxX + 2, x1), maxY = std::min(binned.maxY + 2, y1);
+        if (minX >= maxX || minY >= maxY) continue; // Outside the area
+
+        // Exact check for any item: nothing is left to draw if every pixel it could touch is
+        // already covered.
+        if (band.occlusion.isAreaOccluded(minX, minY, maxX, maxY)) {
+            band.culledByOcclusion++;
             continue;
         }
 
-        if (item.isOpaque) { // Only check occlusion for opaque items
-            // Use visual bounds for occlusion check
-            if (_occlusionBuffer.isAreaOccluded(bounds.minX, bounds.minY, bounds.maxX, bounds.maxY)) {
-                _culledByOcclusion++;
-                continue;
-            }
+        if (binned.item->instanceCount > 1) {
+            DisplayListItem copy;
+            binned.item->expandInstance(binned.instance, copy);
+            renderProfiledItem(band, copy);
+        } else {
+            renderProfiledItem(band, *binned.item);
         }
+        if (isInterrupted()) return false; // Possibly cut short: drawn again, see resumeRender()
+        band.rendered++;
+    }
+    return true;
+}
 
-        renderItem(item);
-        _renderedItems++;
+void DisplayListRenderer::waitForWorker() {
+    while (xSemaphoreTake(_workerDone, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        esp_task_wdt_reset(); // The worker may still be on a heavy band
+    }
+}
+
+// Painter's order: every item is drawn in full into the bands it overlaps and later items
+// overwrite earlier ones, so no occupation map or occlusion buffer is involved.
+void DisplayListRenderer::renderStream(DisplayListRing& ring) {
+    ProfileScope timing(_rasteriseCycles); // On the worker: from the first item to the drained ring
+    for (RenderBand* band : _bands) {
+        band->rendered = band->culledByOcclusion = 0;
+        band->drawing.enablePixelOccupationMap(false);
+        band->drawing.setCoverageSink(nullptr);
+        band->drawing.clearCanvas();
+    }
 
-        if (item.isOpaque) {
-            // Use marking bounds to update occlusion buffer
-            _occlusionBuffer.markAreaOpaque(bounds.markingBounds.minX, bounds.markingBounds.minY,
-                                            bounds.markingBounds.maxX, bounds.markingBounds.maxY);
+    const DisplayListItem* items;
+    DisplayListItem copy; // Expanded copy of an instanced item
+    size_t count;
+    while ((count = ring.acquire(items)) > 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (isInterrupted()) {
+                ring.cancel(); // Also stops the producer
+                break;
+            }
+            _totalItems += items[i].instanceCount;
+            for (int32_t instance = 0; instance < items[i].instanceCount; ++instance) {
+                if (items[i].instanceCount > 1) items[i].expandInstance(instance, copy);
+                const DisplayListItem& item = items[i].instanceCount > 1 ? copy : items[i];
+                ScreenBounds bounds = calculateScreenBounds(item);
+                if (bounds.isOffScreen || bounds.minX >= bounds.maxX || bounds.minY >= bounds.maxY) {
+                    _culledOffScreen++;
+                    continue;
+                }
+                for (RenderBand* band : _bands) {
+                    if (bounds.minY - 2 < band->y1 && bounds.maxY + 2 > band->y0) { // Padding as in binItems
+                        renderProfiledItem(*band, item);
+                        band->rendered++;
+                    }
+                }
+            }
         }
+        ring.release(count);
     }
-    log_i("Render complete: Total=%d, Rendered=%d, OffScreen=%d, Occluded=%d, OverdrawSkippedPixels=%u",
-          _totalItems, _renderedItems, _culledOffScreen, _culledByOcclusion, _drawing.getOverdrawSkippedPixelsCount());
-    _drawing.enablePixelOccupationMap(false); // Disable after render pass (optional, good practice)
-}
\ No newline at end of file
+
+    for (RenderBand* band : _bands) band->drawing.setCoverageSink(&band->occlusion);
+}
+
+bool DisplayListRenderer::beginStream(DisplayListRing& ring) {
+    if (!ring.isAllocated()) return false;
+    abandonRender();
+    if (!_workerTask && !_workerFailed) _workerFailed = !startWorker();
+    if (!_workerTask) return false;
+
+    _totalItems = 0;
+    _renderedItems = 0;
+    _culledOffScreen = 0;
+    _culledByOcclusion = 0;
+    _binCycles = 0;
+    _rasteriseCycles = 0;
+    resetBandProfiles();
+    _partialRender = false;
+    _dirtyRegions.clear();
+    if (_targetCanvas == _renderCanvas) trackDependentItems(nullptr); // Streamed items are not kept
+    _streamRing = &ring;
+    xSemaphoreGive(_workerStart);
+    return true;
+}
+
+void DisplayListRenderer::endStream() {
+    if (!_streamRing) return;
+    waitForWorker();
+    _streamRing = nullptr;
+
+    if (isInterrupted()) {
+        log_i("DisplayListRenderer: Interrupt detected during streamed rendering.");
+        return;
+    }
+    for (RenderBand* band : _bands) _renderedItems += band->rendered;
+    log_i("Render complete (streamed): Total=%d, Rendered=%d, OffScreen=%d",
+          _totalItems, _renderedItems, _culledOffScreen);
+}
+
+void DisplayListRenderer::render(const std::vector<DisplayListItem>& displayList, bool allowPartial) {
+    beginRender(displayList, allowPartial);
+    resumeRender(0);
+}
+
+void DisplayListRenderer::beginRender(const std::vector<DisplayListItem>& displayList, bool allowPartial) {
+    abandonRender();
+    _totalItems = 0; // Counted by binItems
+    _renderedItems = 0;
+    _culledOffScreen = 0;
+    _culledByOcclusion = 0;
+    _binCycles = 0;
+    _rasteriseCycles = 0;
+    resetBandProfiles();
+
+    bool onRenderCanvas = (_targetCanvas == _renderCanvas);
+    if (onRenderCanvas) trackDependentItems(&displayList);
+    {
+        ProfileScope timing(_binCycles);
+        binItems(displayList);
+    }
+    _dirtyRegions.clear();
+    _partialRender = allowPartial && onRenderCanvas && selectDirtyRegions();
+    for (RenderBand* band : _bands) {
+        band->area = band->nextItem = 0;
+        band->areaStarted = band->done = false;
+        band->rendered = band->culledByOcclusion = 0;
+    }
+
+    if (!_workerTask && !_workerFailed) _workerFailed = !startWorker();
+    _renderPending = true;
+}
+
+bool DisplayListRenderer::resumeRender(uint32_t sliceMs) {
+    if (!_renderPending) return true;
+    _sliceDeadline = renderSliceDeadline(sliceMs);
+    _nextBand = 0; // Bands done are skipped
+    {
+        ProfileScope timing(_rasteriseCycles);
+        if (_workerTask) xSemaphoreGive(_workerStart);
+        renderBands(); // The worker claims bands concurrently
+        if (_workerTask) waitForWorker();
+    }
+    _sliceDeadline = 0;
+
+    for (RenderBand* band : _bands) {
+        if (band->done) continue;
+        if (isInterrupted()) log_i("DisplayListRenderer: Interrupt detected during rendering loop.");
+        return false;
+    }
+    _renderPending = false;
+
+    unsigned int overdrawSkipped = 0;
+    for (RenderBand* band : _bands) {
+        _renderedItems += band->rendered;
+        _culledByOcclusion += band->culledByOcclusion;
+        overdrawSkipped += band->drawing.getOverdrawSkippedPixelsCount();
+    }
+    log_i("Render complete%s: Total=%d, Rendered=%d, OffScreen=%d, Occluded=%d, OverdrawSkippedPixels=%u",
+          _partialRender ? " (partial)" : "", _totalItems, _renderedItems, _culledOffScreen, _culledByOcclusion, overdrawSkipped);
+    if (_partialRender) log_i("Partial render: %u dirty region(s)", (unsigned)_dirtyRegions.size());
+    return true;
+}
+
+void DisplayListRenderer::abandonRender() {
+    if (!_renderPending) return;
+    _renderPending = false;
+    for (RenderBand* band : _bands) {
+        if (band->done) continue;
+        band->drawing.setClipRect(0, band->y0, _canvasWidth, band->y1);
+        band->drawing.enablePixelOccupationMap(false);
+        band->done = true;
+    }
+}
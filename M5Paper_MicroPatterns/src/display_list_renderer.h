@@ -6,39 +6,125 @@
 #include "micropatterns_command.h" // For DisplayListItem, MicroPatternsAsset
 #include "micropatterns_drawing.h"
 #include "occlusion_buffer.h"
+#include "display_list_ring.h"
+#include "render_profiler.h"
+#include "render_slice.h"
 #include "display_manager.h" // For M5EPD_Canvas
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+const int RENDER_BAND_COUNT = 4;               // Horizontal bands, claimed by the render task and the worker
+const uint32_t RENDER_WORKER_STACK_SIZE = 8192; // Bytes
+const int RENDER_MAX_CHANGED_REGIONS = 16;      // Rectangles kept for input-dependent items
+const size_t RENDER_MAX_TRACKED_ITEMS = 256;    // Input-dependent items kept to diff the next render against
+const int RENDER_PARTIAL_MAX_PERCENT = 50;      // Partial render only while the dirty area stays below this share
+const int RENDER_REGION_ALIGN = 4;              // Dirty rectangles are aligned for partial EPD updates
 
 struct ScreenBounds {
     int minX, minY, maxX, maxY;
     bool isOffScreen;
-    struct { // For occlusion buffer marking, potentially smaller than visual bounds
-        int minX, minY, maxX, maxY;
-    } markingBounds;
+};
+
+// Display-list item (or one copy of an instanced item) binned into a band, with its
+// screen bounds (clipped to the canvas)
+struct BinnedItem {
+    const DisplayListItem* item;
+    int32_t instance; // Copy to expand if item->instanceCount > 1
+    int16_t minX, minY, maxX, maxY;
+};
+
+// Horizontal slice of the canvas with private drawing state: occupation map, occlusion buffer
+// and pattern tiles. Bands write disjoint framebuffer rows, so they are rendered without locking.
+struct RenderBand {
+    RenderBand(M5EPD_Canvas* canvas, int canvasWidth, int bandY0, int bandY1);
+
+    int y0, y1; // Rows [y0, y1)
+    MicroPatternsDrawing drawing;
+    OcclusionBuffer occlusion;
+    std::vector<BinnedItem> items; // Back to front
+    // Cursor of the render in progress: areas done (the band rows, or the dirty regions in a
+    // partial render), the next item of the current one and whether it was cleared
+    size_t area;
+    size_t nextItem;
+    bool areaStarted;
+    bool done;
+    int rendered;
+    int culledByOcclusion;
+    RenderKindProfile kinds[RENDER_PROFILE_KINDS]; // Of the last pass
 };
 
 class DisplayListRenderer {
 public:
     DisplayListRenderer(DisplayManager& displayMgr,
-                        const std::map<String, MicroPatternsAsset>& assets,
                         int canvasWidth, int canvasHeight);
+    ~DisplayListRenderer();
+
+    // Renders the whole canvas. With 'allowPartial' the canvas must still hold the previous
+    // (completed, non-streamed) render of the same program: only the changed regions are then
+    // cleared and re-rasterised, if they are small enough (see isPartialRender()).
+    // Returns early, with isRenderPending(), once the interrupt flag is set.
+    void render(const std::vector<DisplayListItem>& displayList, bool allowPartial = false);
+
+    // The same render as a resumable job: beginRender() bins the list, which must stay
+    // unchanged until the render completes or is abandoned, and each resumeRender() rasterises
+    // for about 'sliceMs' (0: no limit) or until the interrupt flag is set. Every band keeps a
+    // cursor (area, next item). An item cut short by the flag is drawn again from its start by
+    // the next slice: front to back with the occupation map, the rows it already wrote are
+    // skipped, so the frame ends up exactly as in one pass. True once the render is complete.
+    void beginRender(const std::vector<DisplayListItem>& displayList, bool allowPartial = false);
+    bool resumeRender(uint32_t sliceMs = 0);
+    bool isRenderPending() const { return _renderPending; }
+    // Drops the render in progress, e.g. before its display list changes. The canvas is left
+    // partly drawn. Implied by beginRender(), beginStream(), setTargetCanvas() and invalidatePatternTiles().
+    void abandonRender();
 
-    void render(const std::vector<DisplayListItem>& displayList);
+    // Streaming mode: the band worker rasterises items as they arrive in 'ring', in script
+    // (painter's) order and without occlusion culling, while the caller keeps generating.
+    // Returns false if no worker is available. endStream() waits until the ring is drained
+    // (the producer must have closed or cancelled it).
+    bool beginStream(DisplayListRing& ring);
+    void endStream();
 
-    // Stats (optional)
+    // Stats (optional). Instanced items count once per copy. Rendered and occluded counts
+    // are per band an item overlaps.
     int getTotalItems() const { return _totalItems; }
     int getRenderedItems() const { return _renderedItems; }
     int getCulledOffScreen() const { return _culledOffScreen; }
     int getCulledByOcclusion() const { return _culledByOcclusion; }
+    // Adds the bin and rasterise times and the per-command counters of the last render or
+    // stream to 'profile'
+    void collectProfile(RenderProfile& profile) const;
 
-    void setInterruptCheckCallback(std::function<bool()> cb);
+    // Regions that may differ from the previous render of the same program if the runtime
+    // reused its invariant segments: the bounds of the input-dependent items
+    // (DisplayListItem::dependsOnInput) that were added, removed or changed since the previous
+    // render, merged into at most RENDER_MAX_CHANGED_REGIONS rectangles [min, max). The whole
+    // canvas if either render had too many such items to track, or was streamed.
+    void getChangedRegions(std::vector<ScreenBounds>& out) const;
+
+    // After render(): true if only getDirtyRegions() were re-rendered, the rest of the canvas
+    // being left as it was. The regions are aligned to RENDER_REGION_ALIGN and may be empty.
+    bool isPartialRender() const { return _partialRender; }
+    const std::vector<ScreenBounds>& getDirtyRegions() const { return _dirtyRegions; }
+
+    // Redirects rendering to 'canvas' (same size; nullptr: back to the DisplayManager render
+    // canvas), e.g. for off-screen frames. Such renders are never partial and leave the
+    // dirty-rectangle tracking of the render canvas untouched.
+    void setTargetCanvas(M5EPD_Canvas* canvas);
+
+    // Polled per item and, while drawing, per span; set from any task (nullptr: never)
+    void setInterruptFlag(const volatile bool* flag);
+    // Must be called before the assets of previously rendered items are freed or reused
+    void invalidatePatternTiles();
 
 
 private:
     DisplayManager& _displayMgr; // To get canvas
-    MicroPatternsDrawing _drawing;
-    const std::map<String, MicroPatternsAsset>& _assets; // Reference to assets from parser
-    OcclusionBuffer _occlusionBuffer;
-    
+    M5EPD_Canvas* _renderCanvas; // DisplayManager render canvas
+    M5EPD_Canvas* _targetCanvas; // Canvas the bands currently draw into
+    std::vector<RenderBand*> _bands;
+
     int _canvasWidth;
     int _canvasHeight;
 
@@ -47,14 +133,56 @@ private:
     int _renderedItems;
     int _culledOffScreen;
     int _culledByOcclusion; // Items culled by occlusion buffer
+    uint64_t _binCycles;
+    uint64_t _rasteriseCycles;
+
+    // Input-dependent items with their display-list index, of this and the previous render
+    struct TrackedItem {
+        size_t index;
+        DisplayListItem item;
+    };
+    std::vector<TrackedItem> _dependentItems;
+    std::vector<TrackedItem> _previousDependentItems;
+    bool _dependentOverflow; // Not tracked: too many, or streamed
+    bool _previousDependentOverflow;
+
+    bool _partialRender;
+    std::vector<ScreenBounds> _dirtyRegions;
+
+    const volatile bool* _interruptFlag; // Not owned
+    bool _renderPending;     // Between beginRender() and the slice that completes it
+    uint32_t _sliceDeadline; // renderSliceDeadline() of the running slice, read by both tasks
 
-    std::function<bool()> _interrupt_check_cb;
+    // Band worker: started on the first render, can run on either core
+    TaskHandle_t _workerTask;
+    SemaphoreHandle_t _workerStart; // Given by render() to start a pass
+    SemaphoreHandle_t _workerDone;  // Given by the worker when no band is left
+    SemaphoreHandle_t _bandMutex;   // Guards _nextBand
+    int _nextBand;
+    bool _workerFailed;
+    DisplayListRing* _streamRing; // Set: the worker's pass consumes this ring instead of claiming bands
 
+    DisplayListRenderer(const DisplayListRenderer&);            // Non-copyable
+    DisplayListRenderer& operator=(const DisplayListRenderer&); // Non-copyable
 
-    ScreenBounds calculateScreenBounds(const DisplayListItem& item);
-    void renderItem(const DisplayListItem& item);
-    bool isAssetDataFullyOpaque(const MicroPatternsAsset* asset) const;
-    bool determineItemOpacity(const DisplayListItem& item) const;
+    ScreenBounds calculateScreenBounds(const DisplayListItem& item) const;
+    void trackDependentItems(const std::vector<DisplayListItem>* displayList); // nullptr: untracked
+    static void addRegion(std::vector<ScreenBounds>& regions, const ScreenBounds& bounds);
+    void addItemRegions(std::vector<ScreenBounds>& regions, const DisplayListItem& item) const;
+    bool selectDirtyRegions();
+    void binItems(const std::vector<DisplayListItem>& displayList);
+    bool startWorker();
+    static void workerTaskFunction(void* param);
+    void renderBands(); // Claims and renders bands until none is left
+    void renderBand(RenderBand& band); // From the band's cursor, until done or the slice ends
+    bool renderBandArea(RenderBand& band, const ScreenBounds& area); // False: the slice ended first
+    void renderStream(DisplayListRing& ring);
+    void waitForWorker();
+    bool isInterrupted() const { return _interruptFlag && *_interruptFlag; }
+    bool isSliceOver() const { return isInterrupted() || renderSliceExpired(_sliceDeadline); }
+    static void renderItem(MicroPatternsDrawing& drawing, const DisplayListItem& item);
+    static void renderProfiledItem(RenderBand& band, const DisplayListItem& item); // Into band.kinds
+    void resetBandProfiles();
 };
 
 #endif // DISPLAY_LIST_RENDERER_H
\ No newline at end of file
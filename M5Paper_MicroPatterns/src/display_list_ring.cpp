@@ -0,0 +1,123 @@
+#include "display_list_ring.h"
+#include "esp32-hal-log.h"
+#include <esp_heap_caps.h>
+#include <esp_task_wdt.h>
+#include <string.h> // For memcpy
+#include <algorithm> // For std::min
+
+static const TickType_t RING_WAIT_SLICE = pdMS_TO_TICKS(100); // Watchdog reset interval while blocked
+
+DisplayListRing::DisplayListRing(size_t capacity)
+    : _items(nullptr), _capacity(0), _head(0), _count(0), _closed(false), _cancelled(false) {
+    _mutex = xSemaphoreCreateMutex();
+    _spaceReady = xSemaphoreCreateBinary();
+    _itemsReady = xSemaphoreCreateBinary();
+
+    size_t bytes = capacity * sizeof(DisplayListItem);
+    void* mem = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) mem = malloc(bytes); // No PSRAM: internal heap
+    if (mem && _mutex && _spaceReady && _itemsReady) {
+        _items = static_cast<DisplayListItem*>(mem); // Trivially copyable: filled by memcpy only
+        _capacity = capacity;
+    } else {
+        free(mem);
+        log_e("DisplayListRing: Failed to allocate ring of %u items", (unsigned)capacity);
+    }
+}
+
+DisplayListRing::~DisplayListRing() {
+    free(_items); // heap_caps allocations are released with free()
+    if (_mutex) vSemaphoreDelete(_mutex);
+    if (_spaceReady) vSemaphoreDelete(_spaceReady);
+    if (_itemsReady) vSemaphoreDelete(_itemsReady);
+}
+
+void DisplayListRing::reset() {
+    _head = 0;
+    _count = 0;
+    _closed = false;
+    _cancelled = false;
+    if (_spaceReady) xSemaphoreTake(_spaceReady, 0); // Drop stale signals of the previous pass
+    if (_itemsReady) xSemaphoreTake(_itemsReady, 0);
+}
+
+bool DisplayListRing::push(const DisplayListItem* items, size_t count) {
+    if (!_items) return false;
+    while (count > 0) {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool cancelled = _cancelled;
+        size_t space = _capacity - _count;
+        size_t tail = (_head + _count) % _capacity;
+        size_t n = std::min(count, std::min(space, _capacity - tail)); // Contiguous free run
+        xSemaphoreGive(_mutex);
+
+        if (cancelled) return false;
+        if (n == 0) { // Full: wait for the consumer
+            if (xSemaphoreTake(_spaceReady, RING_WAIT_SLICE) != pdTRUE) esp_task_wdt_reset();
+            continue;
+        }
+        // Only the producer writes past the tail, so the copy needs no lock
+        memcpy(static_cast<void*>(_items + tail), items, n * sizeof(DisplayListItem));
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        _count += n;
+        xSemaphoreGive(_mutex);
+        xSemaphoreGive(_itemsReady);
+        items += n;
+        count -= n;
+    }
+    return !isCancelled();
+}
+
+void DisplayListRing::close() {
+    if (!_mutex) return;
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _closed = true;
+    xSemaphoreGive(_mutex);
+    if (_itemsReady) xSemaphoreGive(_itemsReady);
+}
+
+size_t DisplayListRing::acquire(const DisplayListItem*& items) {
+    if (!_items) return 0;
+    while (true) {
+        xSemaphoreTake(_mutex, portMAX_DELAY);
+        bool cancelled = _cancelled;
+        bool closed = _closed;
+        size_t head = _head;
+        size_t n = std::min(_count, _capacity - _head);
+        xSemaphoreGive(_mutex);
+
+        if (cancelled) return 0;
+        if (n > 0) {
+            items = _items + head;
+            return n;
+        }
+        if (closed) return 0;
+        if (xSemaphoreTake(_itemsReady, RING_WAIT_SLICE) != pdTRUE) esp_task_wdt_reset();
+    }
+}
+
+void DisplayListRing::release(size_t count) {
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    count = std::min(count, _count);
+    _head = (_head + count) % _capacity;
+    _count -= count;
+    xSemaphoreGive(_mutex);
+    xSemaphoreGive(_spaceReady);
+}
+
+bool DisplayListRing::isCancelled() const {
+    if (!_mutex) return true;
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    bool cancelled = _cancelled;
+    xSemaphoreGive(_mutex);
+    return cancelled;
+}
+
+void DisplayListRing::cancel() {
+    if (!_mutex) return;
+    xSemaphoreTake(_mutex, portMAX_DELAY);
+    _cancelled = true;
+    xSemaphoreGive(_mutex);
+    if (_spaceReady) xSemaphoreGive(_spaceReady);
+    if (_itemsReady) xSemaphoreGive(_itemsReady);
+}
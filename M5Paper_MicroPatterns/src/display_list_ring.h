@@ -0,0 +1,55 @@
+#ifndef DISPLAY_LIST_RING_H
+#define DISPLAY_LIST_RING_H
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "micropatterns_command.h" // For DisplayListItem
+
+const size_t DISPLAY_LIST_RING_DEFAULT_CAPACITY = 512; // Items (~45 KB, PSRAM when available)
+
+// Bounded single-producer/single-consumer queue of display-list items between the runtime
+// (generating) and the renderer (rasterising) in streaming mode. push() blocks while the
+// ring is full and acquire() while it is empty, resetting the calling task's watchdog while
+// they wait. Either side can cancel() the pass to release the other.
+class DisplayListRing {
+public:
+    explicit DisplayListRing(size_t capacity = DISPLAY_LIST_RING_DEFAULT_CAPACITY);
+    ~DisplayListRing();
+
+    bool isAllocated() const { return _items != nullptr; }
+    size_t capacity() const { return _capacity; }
+
+    // Empties the ring and reopens it for a new pass. Not concurrent with push/acquire.
+    void reset();
+
+    // Producer: copies 'count' items in, waiting for space. False if the pass was cancelled.
+    bool push(const DisplayListItem* items, size_t count);
+    // Producer: no more items; acquire() returns 0 once the ring is drained
+    void close();
+
+    // Consumer: waits for items and points 'items' at the oldest contiguous run. Returns its
+    // length, or 0 when the ring is closed and drained or the pass was cancelled.
+    size_t acquire(const DisplayListItem*& items);
+    // Consumer: frees the first 'count' items of the last acquired run
+    void release(size_t count);
+
+    void cancel();
+    bool isCancelled() const;
+
+private:
+    DisplayListItem* _items;
+    size_t _capacity;
+    size_t _head;  // Next item to read
+    size_t _count; // Items stored
+    bool _closed;
+    bool _cancelled;
+    SemaphoreHandle_t _mutex;      // Guards _head, _count and the flags
+    SemaphoreHandle_t _spaceReady; // Given when the consumer frees items
+    SemaphoreHandle_t _itemsReady; // Given when the producer adds items, closes or cancels
+
+    DisplayListRing(const DisplayListRing&);            // Non-copyable
+    DisplayListRing& operator=(const DisplayListRing&); // Non-copyable
+};
+
+#endif // DISPLAY_LIST_RING_H
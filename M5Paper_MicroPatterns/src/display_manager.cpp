@@ -1,7 +1,18 @@
 #include "display_manager.h"
 #include "esp32-hal-log.h"
+#include <string.h> // For memcpy
+#include <algorithm> // For std::min, std::max
 
-DisplayManager::DisplayManager() : _canvas(&M5.EPD), _indicatorCanvas(&M5.EPD), _isInitialized(false)
+// Waveform weights added to a tile's ghosting. A2 ghosts the most.
+static const uint8_t GHOST_WEIGHT_A2 = 2;
+static const uint8_t GHOST_WEIGHT_FAST = 1; // DU, DU4, GL16
+
+static const uint16_t LEVELS_BINARY = (1u << 0) | (1u << 15);
+static const uint16_t LEVELS_FOUR = LEVELS_BINARY | (1u << 5) | (1u << 10);
+
+DisplayManager::DisplayManager() : _canvas(&M5.EPD), _indicatorCanvas(&M5.EPD), _backCanvas(&M5.EPD),
+      _hasBackBuffer(false), _isInitialized(false), _canvasRevision(0),
+      _ghostingBudget(DISPLAY_DEFAULT_GHOSTING_BUDGET), _ghostTilesX(0), _ghostTilesY(0)
 {
     _epdMutex = xSemaphoreCreateMutex();
     if (_epdMutex == NULL)
@@ -51,6 +62,16 @@ bool DisplayManager::initializeEPD()
         _canvas.setTextColor(15);       // Default to black
         _canvas.setTextDatum(TC_DATUM); // Top-center for drawString
 
+        _hasBackBuffer = _backCanvas.createCanvas(_canvas.width(), _canvas.height());
+        if (!_hasBackBuffer)
+        {
+            log_w("DisplayManager: No memory for the back buffer, rendering into the displayed canvas.");
+        }
+
+        _ghostTilesX = (_canvas.width() + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE;
+        _ghostTilesY = (_canvas.height() + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE;
+        resetGhosting();
+
         _isInitialized = true;
         log_i("DisplayManager initialized EPD and Canvas (%d x %d).", _canvas.width(), _canvas.height());
 
@@ -72,6 +93,7 @@ void DisplayManager::showMessage(const String &text, int y_offset, uint16_t colo
     }
     if (xSemaphoreTake(_epdMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     { // Wait up to 500ms
+        _canvasRevision++;
         if (clear_first)
         {
             _canvas.fillCanvas(0); // White
@@ -106,7 +128,15 @@ void DisplayManager::showMessage(const String &text, int y_offset, uint16_t colo
         _canvas.drawString(text, _canvas.width() / 2, y_offset);
         log_i("DisplayManager: Drawing message: \"%s\"", text.c_str());
 
-        _canvas.pushCanvas(0, 0, full_update ? UPDATE_MODE_GC16 : UPDATE_MODE_DU4);
+        if (full_update)
+        {
+            _canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+            resetGhosting(); // The panel now shows exactly the canvas
+        }
+        else
+        {
+            pushCanvasScheduled(0, 0, _canvas.width(), _canvas.height());
+        }
 
         xSemaphoreGive(_epdMutex);
     }
@@ -126,6 +156,8 @@ void DisplayManager::pushCanvasUpdate(int32_t x, int32_t y, m5epd_update_mode_t
     if (xSemaphoreTake(_epdMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
         _canvas.pushCanvas(x, y, mode);
+        accountUpdate(0, 0, _canvas.width(), _canvas.height(), mode,
+                      levelsInRegion(0, 0, _canvas.width(), _canvas.height()) & ~LEVELS_BINARY);
         xSemaphoreGive(_epdMutex);
     }
     else
@@ -134,6 +166,246 @@ void DisplayManager::pushCanvasUpdate(int32_t x, int32_t y, m5epd_update_mode_t
     }
 }
 
+void DisplayManager::alignRegion(int32_t &x, int32_t &y, int32_t &w, int32_t &h) const
+{
+    int32_t x0 = std::max<int32_t>(0, x) & ~3;
+    int32_t x1 = std::min<int32_t>(_canvas.width(), (x + w + 3) & ~3);
+    int32_t y0 = std::max<int32_t>(0, y);
+    int32_t y1 = std::min<int32_t>(_canvas.height(), y + h);
+    x = x0;
+    y = y0;
+    w = std::max<int32_t>(0, x1 - x0);
+    h = std::max<int32_t>(0, y1 - y0);
+}
+
+bool DisplayManager::pushCanvasRegion(int32_t x, int32_t y, int32_t w, int32_t h, m5epd_update_mode_t mode)
+{
+    if (!_isInitialized)
+    {
+        log_e("DisplayManager not initialized, cannot push canvas region.");
+        return true;
+    }
+    alignRegion(x, y, w, h);
+    if (w == 0 || h == 0)
+        return true;
+    const uint8_t *src = static_cast<const uint8_t *>(_canvas.frameBuffer());
+    // The region's rows are copied (4bpp, two pixels per byte) into the scratch canvas
+    if (!src || !_indicatorCanvas.createCanvas(w, h))
+    {
+        log_w("DisplayManager: Cannot push region (%d,%d %dx%d), pushing the full canvas.", x, y, w, h);
+        _canvas.pushCanvas(0, 0, mode);
+        return false;
+    }
+    uint8_t *dst = static_cast<uint8_t *>(_indicatorCanvas.frameBuffer());
+    const int32_t srcStride = _canvas.width() / 2;
+    const int32_t dstStride = w / 2;
+    for (int32_t row = 0; row < h; ++row)
+    {
+        memcpy(dst + row * dstStride, src + (y + row) * srcStride + x / 2, dstStride);
+    }
+    _indicatorCanvas.pushCanvas(x, y, mode);
+    _indicatorCanvas.deleteCanvas();
+    return true;
+}
+
+void DisplayManager::resetGhosting()
+{
+    _tileGhosting.assign(_ghostTilesX * _ghostTilesY, 0);
+    _tileGray.assign(_ghostTilesX * _ghostTilesY, 1); // Panel content unknown
+}
+
+bool DisplayManager::saveGhosting(uint8_t *ghosting, uint8_t *gray, size_t tiles) const
+{
+    if (tiles != _tileGhosting.size())
+        return false;
+    memcpy(ghosting, _tileGhosting.data(), tiles);
+    memcpy(gray, _tileGray.data(), tiles);
+    return true;
+}
+
+bool DisplayManager::restoreGhosting(const uint8_t *ghosting, const uint8_t *gray, size_t tiles)
+{
+    if (tiles != _tileGhosting.size())
+        return false;
+    memcpy(_tileGhosting.data(), ghosting, tiles);
+    memcpy(_tileGray.data(), gray, tiles);
+    return true;
+}
+
+// Bit per 4bpp gray level present in [x0, x1) x [y0, y1) of the canvas. Stops early once the
+// region is known to need GL16. Whole bytes are scanned, so one pixel beyond an odd edge may count.
+uint16_t DisplayManager::levelsInRegion(int32_t x0, int32_t y0, int32_t x1, int32_t y1)
+{
+    const uint8_t *fb = static_cast<const uint8_t *>(_canvas.frameBuffer());
+    if (!fb)
+        return 0xFFFF;
+    const int32_t stride = _canvas.width() / 2;
+    const int32_t b0 = std::max<int32_t>(0, x0) / 2;
+    const int32_t b1 = (std::min<int32_t>(_canvas.width(), x1) + 1) / 2;
+    uint16_t levels = 0;
+    for (int32_t y = std::max<int32_t>(0, y0); y < std::min<int32_t>(_canvas.height(), y1); ++y)
+    {
+        const uint8_t *row = fb + y * stride;
+        for (int32_t b = b0; b < b1; ++b)
+        {
+            levels |= (1u << (row[b] >> 4)) | (1u << (row[b] & 0x0F));
+        }
+        if (levels & ~LEVELS_FOUR)
+            break;
+    }
+    return levels;
+}
+
+void DisplayManager::accountUpdate(int32_t x, int32_t y, int32_t w, int32_t h, m5epd_update_mode_t mode, bool gray)
+{
+    int32_t tx0 = std::max<int32_t>(0, x / DISPLAY_GHOST_TILE_SIZE);
+    int32_t ty0 = std::max<int32_t>(0, y / DISPLAY_GHOST_TILE_SIZE);
+    int32_t tx1 = std::min(_ghostTilesX, (x + w + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE);
+    int32_t ty1 = std::min(_ghostTilesY, (y + h + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE);
+    uint8_t weight = (mode == UPDATE_MODE_A2) ? GHOST_WEIGHT_A2 : GHOST_WEIGHT_FAST;
+    for (int32_t ty = ty0; ty < ty1; ++ty)
+    {
+        for (int32_t tx = tx0; tx < tx1; ++tx)
+        {
+            // Only tiles the update covers entirely lose their ghosting or gray levels
+            int32_t tileX = tx * DISPLAY_GHOST_TILE_SIZE, tileY = ty * DISPLAY_GHOST_TILE_SIZE;
+            bool covered = x <= tileX && y <= tileY &&
+                           x + w >= std::min<int32_t>(_canvas.width(), tileX + DISPLAY_GHOST_TILE_SIZE) &&
+                           y + h >= std::min<int32_t>(_canvas.height(), tileY + DISPLAY_GHOST_TILE_SIZE);
+            int32_t tile = ty * _ghostTilesX + tx;
+            if (mode == UPDATE_MODE_GC16)
+            {
+                if (covered)
+                    _tileGhosting[tile] = 0;
+            }
+            else
+            {
+                _tileGhosting[tile] = std::min<int>(255, _tileGhosting[tile] + weight);
+            }
+            if (gray)
+                _tileGray[tile] = 1;
+            else if (covered)
+                _tileGray[tile] = 0;
+        }
+    }
+}
+
+m5epd_update_mode_t DisplayManager::scheduleUpdate(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    if (_tileGhosting.empty())
+        return UPDATE_MODE_GC16; // Not initialized
+    uint16_t levels = levelsInRegion(x, y, x + w, y + h);
+    bool gray = (levels & ~LEVELS_BINARY) != 0;
+
+    int32_t tx0 = std::max<int32_t>(0, x / DISPLAY_GHOST_TILE_SIZE);
+    int32_t ty0 = std::max<int32_t>(0, y / DISPLAY_GHOST_TILE_SIZE);
+    int32_t tx1 = std::min(_ghostTilesX, (x + w + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE);
+    int32_t ty1 = std::min(_ghostTilesY, (y + h + DISPLAY_GHOST_TILE_SIZE - 1) / DISPLAY_GHOST_TILE_SIZE);
+    int maxGhosting = 0;
+    bool panelGray = false;
+    for (int32_t ty = ty0; ty < ty1; ++ty)
+    {
+        for (int32_t tx = tx0; tx < tx1; ++tx)
+        {
+            maxGhosting = std::max<int>(maxGhosting, _tileGhosting[ty * _ghostTilesX + tx]);
+            panelGray = panelGray || _tileGray[ty * _ghostTilesX + tx];
+        }
+    }
+
+    m5epd_update_mode_t mode;
+    if (!gray)
+        mode = panelGray ? UPDATE_MODE_DU : UPDATE_MODE_A2; // A2 only drives black/white to black/white
+    else if (!(levels & ~LEVELS_FOUR))
+        mode = UPDATE_MODE_DU4;
+    else
+        mode = UPDATE_MODE_GL16;
+    uint8_t weight = (mode == UPDATE_MODE_A2) ? GHOST_WEIGHT_A2 : GHOST_WEIGHT_FAST;
+    if (maxGhosting + weight > _ghostingBudget)
+    {
+        log_i("DisplayManager: Ghosting budget exhausted in (%d,%d %dx%d), GC16 cleanup.", x, y, w, h);
+        mode = UPDATE_MODE_GC16;
+    }
+    accountUpdate(x, y, w, h, mode, gray);
+    return mode;
+}
+
+m5epd_update_mode_t DisplayManager::pushCanvasScheduled(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    alignRegion(x, y, w, h); // Schedules and accounts what is actually pushed
+    m5epd_update_mode_t mode = scheduleUpdate(x, y, w, h);
+    if (x <= 0 && y <= 0 && x + w >= _canvas.width() && y + h >= _canvas.height())
+    {
+        _canvas.pushCanvas(0, 0, mode);
+    }
+    else if (!pushCanvasRegion(x, y, w, h, mode))
+    {
+        // The whole canvas went out with this waveform: charge the tiles outside the region too
+        // (the region's own tiles are charged twice, erring towards an earlier cleanup)
+        accountUpdate(0, 0, _canvas.width(), _canvas.height(), mode,
+                      levelsInRegion(0, 0, _canvas.width(), _canvas.height()) & ~LEVELS_BINARY);
+    }
+    return mode;
+}
+
+M5EPD_Canvas *DisplayManager::getRenderCanvas()
+{
+    return _hasBackBuffer ? &_backCanvas : &_canvas;
+}
+
+M5EPD_Canvas *DisplayManager::createSpareCanvas()
+{
+    if (!_isInitialized)
+        return nullptr;
+    M5EPD_Canvas *canvas = new M5EPD_Canvas(&M5.EPD);
+    if (!canvas->createCanvas(_canvas.width(), _canvas.height()))
+    {
+        log_w("DisplayManager: No memory for a spare canvas.");
+        delete canvas;
+        return nullptr;
+    }
+    return canvas;
+}
+
+void DisplayManager::releaseSpareCanvas(M5EPD_Canvas *canvas)
+{
+    if (!canvas)
+        return;
+    canvas->deleteCanvas();
+    delete canvas;
+}
+
+m5epd_update_mode_t DisplayManager::presentRegion(int32_t x, int32_t y, int32_t w, int32_t h)
+{
+    if (!_isInitialized)
+    {
+        log_e("DisplayManager not initialized, cannot present region.");
+        return UPDATE_MODE_NONE;
+    }
+    uint8_t *dst = static_cast<uint8_t *>(_canvas.frameBuffer());
+    const uint8_t *src = _hasBackBuffer ? static_cast<const uint8_t *>(_backCanvas.frameBuffer()) : nullptr;
+    if (src && dst)
+    {
+        // Whole bytes (two pixels) of each row
+        const int32_t stride = _canvas.width() / 2;
+        int32_t b0 = std::max<int32_t>(0, x) / 2;
+        int32_t b1 = (std::min<int32_t>(_canvas.width(), x + w) + 1) / 2;
+        int32_t y0 = std::max<int32_t>(0, y);
+        int32_t y1 = std::min<int32_t>(_canvas.height(), y + h);
+        if (b0 == 0 && b1 == stride && y0 < y1)
+        {
+            memcpy(dst + y0 * stride, src + y0 * stride, (size_t)stride * (y1 - y0));
+        }
+        else if (b0 < b1)
+        {
+            for (int32_t row = y0; row < y1; ++row)
+            {
+                memcpy(dst + row * stride + b0, src + row * stride + b0, b1 - b0);
+            }
+        }
+    }
+    return pushCanvasScheduled(x, y, w, h);
+}
+
 void DisplayManager::clearScreen(uint16_t color)
 {
     if (!_isInitialized)
@@ -144,8 +416,8 @@ void DisplayManager::clearScreen(uint16_t color)
     if (xSemaphoreTake(_epdMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
         _canvas.fillCanvas(color);
-        // Typically, a clearScreen implies a full update.
-        _canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+        _canvasRevision++;
+        pushCanvasScheduled(0, 0, _canvas.width(), _canvas.height());
         xSemaphoreGive(_epdMutex);
     }
     else
@@ -177,6 +449,7 @@ void DisplayManager::drawStartupIndicator()
 
         // 2. Draw on main _canvas for consistency (used as fallback)
         // Outer black rectangle
+        _canvasRevision++;
         _canvas.fillRect(region_screen_x, region_screen_y, region_w, region_h, 15); // BLACK
         // Inner white rectangle (flush with top edge)
         _canvas.fillRect(region_screen_x + outline_thickness,
@@ -185,6 +458,8 @@ void DisplayManager::drawStartupIndicator()
                          region_h - outline_thickness,
                          0); // WHITE
 
+        m5epd_update_mode_t mode = scheduleUpdate(region_screen_x, region_screen_y, region_w, region_h);
+
         // 3. Create a temporary canvas for the indicator region and push it for partial update
         // M5EPD_Canvas tempIndicatorCanvas(&M5.EPD); // Replaced with member _indicatorCanvas
         if (_indicatorCanvas.createCanvas(region_w, region_h))
@@ -198,7 +473,7 @@ void DisplayManager::drawStartupIndicator()
                                       region_w - (2 * outline_thickness),
                                       region_h - outline_thickness,
                                       0); // WHITE
-            _indicatorCanvas.pushCanvas(region_screen_x, region_screen_y, UPDATE_MODE_GC16);
+            _indicatorCanvas.pushCanvas(region_screen_x, region_screen_y, mode);
             _indicatorCanvas.deleteCanvas();
             log_i("DisplayManager: Drew startup indicator rectangle using temporary canvas for partial update.");
         }
@@ -206,7 +481,7 @@ void DisplayManager::drawStartupIndicator()
         {
             log_e("DisplayManager: Failed to create temporary canvas for startup indicator rectangle. Pushing full canvas.");
             // Fallback: push the main canvas (which has the indicator drawn on it)
-            _canvas.pushCanvas(0, 0, UPDATE_MODE_GC16);
+            _canvas.pushCanvas(0, 0, mode);
         }
 
         xSemaphoreGive(_epdMutex);
@@ -293,6 +568,7 @@ void DisplayManager::drawActivityIndicator(ActivityIndicatorType type)
 
         // 2. Draw on main _canvas for consistency (used as fallback)
         // Outer black rectangle part
+        _canvasRevision++;
         _canvas.fillRect(region_screen_x, region_screen_y, region_w, region_h, 15); // BLACK
         // Inner white rectangle part (flush with right screen edge, black border on LEFT)
         _canvas.fillRect(region_screen_x + outline_thickness, // Black border on LEFT
@@ -301,6 +577,8 @@ void DisplayManager::drawActivityIndicator(ActivityIndicatorType type)
                          region_h - (2 * outline_thickness),
                          0); // WHITE
 
+        m5epd_update_mode_t mode = scheduleUpdate(region_screen_x, region_screen_y, region_w, region_h);
+
         // 3. Create a temporary canvas for the indicator region and push it for partial update
         // M5EPD_Canvas tempIndicatorCanvas(&M5.EPD); // Replaced with member _indicatorCanvas
         if (_indicatorCanvas.createCanvas(region_w, region_h))
@@ -314,7 +592,7 @@ void DisplayManager::drawActivityIndicator(ActivityIndicatorType type)
                                       region_w - outline_thickness, // Width of white area
                                       region_h - (2 * outline_thickness),
                                       0); // WHITE
-            _indicatorCanvas.pushCanvas(region_screen_x, region_screen_y, UPDATE_MODE_DU4);
+            _indicatorCanvas.pushCanvas(region_screen_x, region_screen_y, mode);
             _indicatorCanvas.deleteCanvas();
             log_i("DisplayManager: Drew activity indicator rectangle (type %d at Y:%d) using temporary canvas for partial update.", type, region_screen_y);
         }
@@ -322,7 +600,7 @@ void DisplayManager::drawActivityIndicator(ActivityIndicatorType type)
         {
             log_e("DisplayManager: Failed to create temporary canvas for activity indicator rectangle. Pushing full canvas.");
             // Fallback: push the main canvas (which has the indicator drawn on it)
-            _canvas.pushCanvas(0, 0, UPDATE_MODE_DU4);
+            _canvas.pushCanvas(0, 0, mode);
         }
 
         xSemaphoreGive(_epdMutex);
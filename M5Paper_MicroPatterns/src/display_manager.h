@@ -4,8 +4,12 @@
 #include <M5EPD.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h" // For mutex
+#include <vector>
 // #include "event_defs.h" // No direct dependency found in this header, but if added later, path would need adjustment.
 
+const int32_t DISPLAY_GHOST_TILE_SIZE = 60;        // Ghosting is tracked per tile of this many pixels square
+const uint8_t DISPLAY_DEFAULT_GHOSTING_BUDGET = 12; // Fast-update weight a tile takes before a GC16 cleanup
+
 enum ActivityIndicatorType {
     ACTIVITY_PUSH,
     ACTIVITY_UP,
@@ -23,6 +27,29 @@ public:
     void showMessage(const String& text, int y_offset, uint16_t color, bool full_update = false, bool clear_first = false);
     void pushCanvasUpdate(int32_t x, int32_t y, m5epd_update_mode_t mode); // Pass x,y for partial updates
     void clearScreen(uint16_t color = 0); // Default to white
+    // Pushes only [x, x+w) x [y, y+h) of the canvas to the panel, clipped and widened to multiples
+    // of 4 pixels (EPD update granularity). Caller must hold lockEPD(). False if there was no
+    // memory to copy the region and the full canvas was pushed instead.
+    bool pushCanvasRegion(int32_t x, int32_t y, int32_t w, int32_t h, m5epd_update_mode_t mode);
+
+    // Update scheduler: picks the waveform for [x, x+w) x [y, y+h) of the canvas and accounts it.
+    // Binary content gets A2 (DU where the panel may still show gray), 4-level gray DU4, other
+    // content GL16. Each fast update adds to the ghosting of the tiles it touches; once one
+    // would exceed the ghosting budget, GC16 is returned instead and their ghosting is cleared.
+    m5epd_update_mode_t scheduleUpdate(int32_t x, int32_t y, int32_t w, int32_t h);
+    // Pushes the region (the whole canvas if it covers it) with the scheduled waveform.
+    // Caller must hold lockEPD().
+    m5epd_update_mode_t pushCanvasScheduled(int32_t x, int32_t y, int32_t w, int32_t h);
+    // Fast-update weight a tile may accumulate before being cleaned with GC16 (0: always GC16)
+    void setGhostingBudget(uint8_t budget) { _ghostingBudget = budget; }
+    // Update scheduler state of the 'tiles' tiles, row-major, to keep it across deep sleep.
+    // False if the canvas does not have that many tiles (or is not initialized).
+    bool saveGhosting(uint8_t* ghosting, uint8_t* gray, size_t tiles) const;
+    bool restoreGhosting(const uint8_t* ghosting, const uint8_t* gray, size_t tiles);
+
+    // Bumped whenever a DisplayManager method draws on the canvas (messages, indicators, clears),
+    // so a renderer can tell whether the canvas still holds its last frame
+    uint32_t getCanvasRevision() const { return _canvasRevision; }
 
     // Provides direct access to the canvas for complex drawing (e.g., by RenderController)
     // Access to this canvas MUST be synchronized externally if used by multiple tasks concurrently
@@ -30,6 +57,19 @@ public:
     // This method itself is safe, but using the canvas is not.
     M5EPD_Canvas* getCanvas();
 
+    // Canvas that renders draw into: a PSRAM back buffer, so rendering needs no lock and leaves
+    // the displayed canvas alone, or the displayed canvas itself if the back buffer could not be
+    // allocated (hasBackBuffer() false: then hold lockEPD() while rendering).
+    M5EPD_Canvas* getRenderCanvas();
+    bool hasBackBuffer() const { return _hasBackBuffer; }
+    // Copies [x, x+w) x [y, y+h) of the back buffer to the displayed canvas and pushes it with the
+    // scheduled waveform (see scheduleUpdate). Caller must hold lockEPD().
+    m5epd_update_mode_t presentRegion(int32_t x, int32_t y, int32_t w, int32_t h);
+
+    // Full-size 4bpp canvas for off-screen frames (e.g. speculative renders); nullptr if out of memory
+    M5EPD_Canvas* createSpareCanvas();
+    void releaseSpareCanvas(M5EPD_Canvas* canvas);
+
     // Utility
     int getWidth();
     int getHeight();
@@ -45,9 +85,24 @@ public:
 private:
     M5EPD_Canvas _canvas;
     M5EPD_Canvas _indicatorCanvas; // Canvas for temporary indicators (startup, activity)
+    M5EPD_Canvas _backCanvas;      // Render target, presented into _canvas under the mutex
+    bool _hasBackBuffer;
     SemaphoreHandle_t _epdMutex; // Mutex to protect EPD hardware access and canvas object
 
     bool _isInitialized;
+    volatile uint32_t _canvasRevision;
+
+    // Update scheduler state, per DISPLAY_GHOST_TILE_SIZE tile
+    uint8_t _ghostingBudget;
+    int32_t _ghostTilesX;
+    int32_t _ghostTilesY;
+    std::vector<uint8_t> _tileGhosting; // Accumulated fast-update weight since the last GC16
+    std::vector<uint8_t> _tileGray;     // Non-zero: the panel may show gray levels in the tile
+
+    void resetGhosting();
+    uint16_t levelsInRegion(int32_t x0, int32_t y0, int32_t x1, int32_t y1);
+    void accountUpdate(int32_t x, int32_t y, int32_t w, int32_t h, m5epd_update_mode_t mode, bool gray);
+    void alignRegion(int32_t &x, int32_t &y, int32_t &w, int32_t &h) const; // See pushCanvasRegion
 
     // _drawTextInternal removed, logic moved to showMessage
 };
@@ -3,11 +3,11 @@
 
 #include <Arduino.h>
 #include <ArduinoJson.h> // For script list if passed in messages
+#include "render_profiler.h"
 
 // --- Max String Lengths for Queue Items ---
 #define MAX_SCRIPT_ID_LEN 64
 #define MAX_ERROR_MSG_LEN 256
-#define MAX_SCRIPT_CONTENT_LEN 5600 // Increased to accommodate larger scripts (e.g. 5500 bytes)
 #define MAX_FETCH_MSG_LEN 128
 
 
@@ -73,12 +73,39 @@ struct RenderJobQueueItem {
 };
 
 // Internal String-based version
+// How RenderController produced the frame
+enum RenderMode : uint8_t {
+    RENDER_MODE_DISPLAY_LIST = 0, // Full display list, back to front with occlusion culling
+    RENDER_MODE_STREAMING,        // Streaming requested: generation and painter's-order rendering overlap
+    RENDER_MODE_BUDGET_FALLBACK,  // Display list exceeded its memory budget; re-run in streaming mode
+    RENDER_MODE_PARTIAL,          // Display list, only the regions changed since the previous frame re-rendered
+    RENDER_MODE_SPECULATIVE,      // Frame pre-rendered while idle, no render needed
+    RENDER_MODE_CACHED,           // Same inputs as a frame in the frame cache: decoded, no render needed
+    RENDER_MODE_UNCHANGED,        // Same frame as the one the render canvas already holds: nothing done
+};
+
+inline const char* renderModeName(RenderMode mode) {
+    switch (mode) {
+        case RENDER_MODE_STREAMING:       return "streaming";
+        case RENDER_MODE_BUDGET_FALLBACK: return "budget fallback";
+        case RENDER_MODE_PARTIAL:         return "partial";
+        case RENDER_MODE_SPECULATIVE:     return "speculative";
+        case RENDER_MODE_CACHED:          return "cached frame";
+        case RENDER_MODE_UNCHANGED:       return "unchanged";
+        default:                          return "display list";
+    }
+}
+
 struct RenderResultData {
     bool success;
     bool interrupted;
     String error_message;
     String script_id;
     ScriptExecState final_state;
+    RenderMode render_mode = RENDER_MODE_DISPLAY_LIST;
+    uint32_t content_hash = 0; // Of the script the frame was rendered from, 0 if unknown
+    uint32_t input_mask = 0;   // Inputs its program reads
+    RenderProfile profile;
 };
 
 // char[]-based version for queue
@@ -88,10 +115,18 @@ struct RenderResultQueueItem {
     char error_message[MAX_ERROR_MSG_LEN];
     char script_id[MAX_SCRIPT_ID_LEN];
     ScriptExecState final_state;
+    RenderMode render_mode;
+    uint32_t content_hash;
+    uint32_t input_mask;
+    RenderProfile profile;
 
     void fromRenderResultData(const RenderResultData& rrd) {
         success = rrd.success;
         interrupted = rrd.interrupted;
+        render_mode = rrd.render_mode;
+        content_hash = rrd.content_hash;
+        input_mask = rrd.input_mask;
+        profile = rrd.profile;
         strncpy(script_id, rrd.script_id.c_str(), MAX_SCRIPT_ID_LEN - 1);
         script_id[MAX_SCRIPT_ID_LEN - 1] = '\0';
         strncpy(error_message, rrd.error_message.c_str(), MAX_ERROR_MSG_LEN - 1);
@@ -103,9 +138,13 @@ struct RenderResultQueueItem {
         RenderResultData rrd;
         rrd.success = success;
         rrd.interrupted = interrupted;
+        rrd.render_mode = render_mode;
+        rrd.content_hash = content_hash;
+        rrd.input_mask = input_mask;
         rrd.script_id = String(script_id);
         rrd.error_message = String(error_message);
         rrd.final_state = final_state;
+        rrd.profile = profile;
         return rrd;
     }
 };
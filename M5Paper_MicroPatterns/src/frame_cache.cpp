@@ -0,0 +1,162 @@
+#include "frame_cache.h"
+#include "micropatterns_compiler.h" // For SLOT_HOUR .. SLOT_COUNTER
+#include "esp32-hal-log.h"
+#include <esp_heap_caps.h>
+
+static const size_t PACK_MAX_LITERAL = 128;
+static const size_t PACK_MAX_RUN = 129;
+
+FrameCache::FrameCache() : _bytesUsed(0), _useClock(0), _nextId(0) {
+    _entries.reserve(FRAME_CACHE_CAPACITY + 1);
+}
+
+FrameCache::~FrameCache() {
+    clear();
+}
+
+bool FrameCache::inputsMatch(uint32_t inputMask, const ScriptExecState& a, const ScriptExecState& b) {
+    return (!(inputMask & (1u << SLOT_COUNTER)) || a.counter == b.counter) &&
+           (!(inputMask & (1u << SLOT_HOUR)) || a.hour == b.hour) &&
+           (!(inputMask & (1u << SLOT_MINUTE)) || a.minute == b.minute) &&
+           (!(inputMask & (1u << SLOT_SECOND)) || a.second == b.second);
+}
+
+const FrameCache::Entry* FrameCache::findValidated(const String& fileId, uint32_t contentGeneration, const ScriptExecState& state) {
+    for (Entry& entry : _entries) {
+        if (entry.fileId == fileId && entry.contentGeneration == contentGeneration &&
+            inputsMatch(entry.inputMask, entry.state, state)) {
+            entry.lastUsed = ++_useClock;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+const FrameCache::Entry* FrameCache::find(const String& fileId, uint32_t contentHash, uint32_t contentGeneration,
+                                          const ScriptExecState& state) {
+    for (Entry& entry : _entries) {
+        if (entry.fileId == fileId && entry.contentHash == contentHash && inputsMatch(entry.inputMask, entry.state, state)) {
+            entry.contentGeneration = contentGeneration;
+            entry.lastUsed = ++_useClock;
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+size_t FrameCache::pack(const uint8_t* in, size_t bytes, uint8_t* out, size_t limit) {
+    size_t written = 0;
+    size_t i = 0;
+    while (i < bytes) {
+        size_t run = 1;
+        while (i + run < bytes && run < PACK_MAX_RUN && in[i + run] == in[i]) run++;
+        if (run >= 2) {
+            if (written + 2 > limit) return 0;
+            if (out) {
+                out[written] = (uint8_t)(run + 126);
+                out[written + 1] = in[i];
+            }
+            written += 2;
+            i += run;
+            continue;
+        }
+        // Literals up to the next run of three, which is cheaper as a repeat
+        size_t start = i;
+        while (i < bytes && i - start < PACK_MAX_LITERAL &&
+               !(i + 2 < bytes && in[i] == in[i + 1] && in[i] == in[i + 2])) {
+            i++;
+        }
+        size_t literal = i - start;
+        if (written + 1 + literal > limit) return 0;
+        if (out) {
+            out[written] = (uint8_t)(literal - 1);
+            memcpy(out + written + 1, in + start, literal);
+        }
+        written += 1 + literal;
+    }
+    return written;
+}
+
+bool FrameCache::decode(const Entry& entry, uint8_t* frameBuffer, size_t bytes) {
+    size_t in = 0;
+    size_t outPos = 0;
+    while (in < entry.size) {
+        uint8_t control = entry.data[in++];
+        if (control < 128) {
+            size_t literal = (size_t)control + 1;
+            if (in + literal > entry.size || outPos + literal > bytes) return false;
+            memcpy(frameBuffer + outPos, entry.data + in, literal);
+            in += literal;
+            outPos += literal;
+        } else {
+            size_t run = (size_t)control - 126;
+            if (in >= entry.size || outPos + run > bytes) return false;
+            memset(frameBuffer + outPos, entry.data[in++], run);
+            outPos += run;
+        }
+    }
+    return outPos == bytes;
+}
+
+const FrameCache::Entry* FrameCache::insert(const String& fileId, uint32_t contentHash, uint32_t contentGeneration,
+                                            uint32_t inputMask, const ScriptExecState& state,
+                                            const uint8_t* frameBuffer, size_t bytes) {
+    size_t packedSize = pack(frameBuffer, bytes, nullptr, FRAME_CACHE_MAX_FRAME_BYTES);
+    if (packedSize == 0) {
+        log_d("FrameCache: Frame of '%s' compresses to over %u bytes, not cached.", fileId.c_str(),
+              (unsigned)FRAME_CACHE_MAX_FRAME_BYTES);
+        return nullptr;
+    }
+
+    // Frames this one supersedes: other content of the script, or the same inputs
+    for (size_t i = _entries.size(); i-- > 0;) {
+        const Entry& entry = _entries[i];
+        if (entry.fileId == fileId && (entry.contentHash != contentHash || inputsMatch(inputMask, entry.state, state))) {
+            removeAt(i);
+        }
+    }
+    while (!_entries.empty() && (_entries.size() >= FRAME_CACHE_CAPACITY || _bytesUsed + packedSize > FRAME_CACHE_BUDGET_BYTES)) {
+        size_t lru = 0;
+        for (size_t i = 1; i < _entries.size(); ++i) {
+            if (_entries[i].lastUsed < _entries[lru].lastUsed) lru = i;
+        }
+        removeAt(lru);
+    }
+
+    // PSRAM only: the internal heap cannot spare a frame
+    uint8_t* data = (uint8_t*)heap_caps_malloc(packedSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!data) {
+        log_w("FrameCache: No PSRAM for a %u byte frame of '%s'.", (unsigned)packedSize, fileId.c_str());
+        return nullptr;
+    }
+    pack(frameBuffer, bytes, data, packedSize);
+
+    Entry entry;
+    entry.id = ++_nextId;
+    entry.fileId = fileId;
+    entry.contentHash = contentHash;
+    entry.contentGeneration = contentGeneration;
+    entry.inputMask = inputMask;
+    entry.state = state;
+    entry.data = data;
+    entry.size = packedSize;
+    entry.lastUsed = ++_useClock;
+    _entries.push_back(entry);
+    _bytesUsed += packedSize;
+    log_i("FrameCache: Stored frame of '%s' in %u bytes (%u%% of %u), %u frame(s) use %u bytes.",
+          fileId.c_str(), (unsigned)packedSize, (unsigned)(packedSize * 100 / bytes), (unsigned)bytes,
+          (unsigned)_entries.size(), (unsigned)_bytesUsed);
+    return &_entries.back();
+}
+
+void FrameCache::removeAt(size_t index) {
+    _bytesUsed -= _entries[index].size;
+    free(_entries[index].data); // heap_caps allocations are released with free()
+    _entries.erase(_entries.begin() + index);
+}
+
+void FrameCache::clear() {
+    for (Entry& entry : _entries) free(entry.data);
+    _entries.clear();
+    _bytesUsed = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "event_defs.h" // For ScriptExecState
+
+const size_t FRAME_CACHE_CAPACITY = 4;
+const size_t FRAME_CACHE_BUDGET_BYTES = 1024 * 1024; // PSRAM for all compressed frames together
+const size_t FRAME_CACHE_MAX_FRAME_BYTES = FRAME_CACHE_BUDGET_BYTES / FRAME_CACHE_CAPACITY; // Worse-compressing frames are not kept
+
+// Small LRU cache of rendered 4bpp framebuffers, PackBits-compressed in PSRAM. A frame is keyed
+// by fileId and content hash, and by the values of the inputs ($HOUR, $MINUTE, $SECOND,
+// $COUNTER) its program reads: any state that only differs in other inputs renders the same
+// image. Like ProgramCache, each entry remembers the content generation it was last checked
+// against, so a hit at that generation needs neither the content nor a compiled program.
+class FrameCache {
+public:
+    struct Entry {
+        uint32_t id = 0; // Unique per stored frame
+        String fileId;
+        uint32_t contentHash = 0;
+        uint32_t contentGeneration = 0;
+        uint32_t inputMask = 0; // Of the program that rendered the frame
+        ScriptExecState state;  // Inputs it was rendered with
+        uint8_t* data = nullptr;
+        size_t size = 0;
+        uint32_t lastUsed = 0;
+    };
+
+    FrameCache();
+    ~FrameCache();
+
+    // Frame of 'fileId' for 'state' if its content is known unchanged at 'contentGeneration', else nullptr
+    const Entry* findValidated(const String& fileId, uint32_t contentGeneration, const ScriptExecState& state);
+    // Frame rendered from exactly this content for 'state', else nullptr. A hit is revalidated
+    // at 'contentGeneration'.
+    const Entry* find(const String& fileId, uint32_t contentHash, uint32_t contentGeneration, const ScriptExecState& state);
+
+    // Compresses and stores 'frameBuffer', replacing frames of the same fileId rendered from other
+    // content or for the same inputs, then the least recently used ones while over budget.
+    // Returns the new entry, or nullptr if the frame compresses too badly or PSRAM is exhausted.
+    const Entry* insert(const String& fileId, uint32_t contentHash, uint32_t contentGeneration, uint32_t inputMask,
+                        const ScriptExecState& state, const uint8_t* frameBuffer, size_t bytes);
+
+    // Decompresses 'entry' into a framebuffer of 'bytes' bytes. False if the sizes disagree.
+    static bool decode(const Entry& entry, uint8_t* frameBuffer, size_t bytes);
+    // True if 'a' and 'b' agree on every input in 'inputMask' (bits 1 << SLOT_HOUR .. SLOT_COUNTER)
+    static bool inputsMatch(uint32_t inputMask, const ScriptExecState& a, const ScriptExecState& b);
+
+    void clear();
+    size_t size() const { return _entries.size(); }
+    size_t getBytesUsed() const { return _bytesUsed; }
+
+private:
+    std::vector<Entry> _entries;
+    size_t _bytesUsed;
+    uint32_t _useClock;
+    uint32_t _nextId;
+
+    // PackBits: a control byte c < 128 is followed by c + 1 literal bytes, c >= 128 by one
+    // byte repeated c - 126 times. With 'out' nullptr only measures. Returns 0 past 'limit'.
+    static size_t pack(const uint8_t* in, size_t bytes, uint8_t* out, size_t limit);
+    void removeAt(size_t index);
+};
+
+#endif // FRAME_CACHE_H
@@ -0,0 +1,113 @@
+#include "framebuffer_raster.h"
+#include "esp32-hal-log.h"
+#include <string.h> // For memset, memcpy
+#include <algorithm> // For std::min, std::max
+
+FramebufferRaster::FramebufferRaster() : _buffer(nullptr), _width(0), _height(0), _stride(0) {
+}
+
+void FramebufferRaster::attach(M5EPD_Canvas* canvas) {
+    _buffer = nullptr;
+    _width = _height = _stride = 0;
+    if (!canvas) return;
+
+    uint8_t* buffer = static_cast<uint8_t*>(canvas->frameBuffer());
+    int w = canvas->width();
+    if (!buffer || w <= 0 || (w & 1)) {
+        log_e("FramebufferRaster: Canvas must be allocated with an even width (width %d).", w);
+        return;
+    }
+    _buffer = buffer;
+    _width = w;
+    _height = canvas->height();
+    _stride = w / 2;
+}
+
+void FramebufferRaster::clear(uint8_t color) {
+    clearRows(0, _height, color);
+}
+
+void FramebufferRaster::clearRows(int y0, int y1, uint8_t color) {
+    if (!_buffer) return;
+    y0 = std::max(0, y0);
+    y1 = std::min(_height, y1);
+    if (y0 >= y1) return;
+    uint8_t packed = (color & 0x0F) | (color << 4);
+    memset(_buffer + (size_t)y0 * _stride, packed, (size_t)_stride * (y1 - y0));
+}
+
+void FramebufferRaster::fillSpan(int y, int x0, int x1, uint8_t color) {
+    if (!_buffer || y < 0 || y >= _height) return;
+    x0 = std::max(0, x0);
+    x1 = std::min(_width, x1);
+    if (x0 >= x1) return;
+
+    color &= 0x0F;
+    uint8_t* row = _buffer + y * _stride;
+    if (x0 & 1) { // Leading odd pixel: low nibble
+        row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | color;
+        x0++;
+    }
+    if (x1 & 1) { // Trailing even pixel: high nibble
+        x1--;
+        row[x1 >> 1] = (row[x1 >> 1] & 0x0F) | (color << 4);
+    }
+    if (x0 >= x1) return;
+
+    uint8_t packed = color | (color << 4);
+    uint8_t* p = row + (x0 >> 1);
+    uint8_t* end = row + (x1 >> 1);
+    while (p < end && (reinterpret_cast<uintptr_t>(p) & 3)) *p++ = packed;
+    uint32_t word = packed * 0x01010101u;
+    while (end - p >= 4) {
+        memcpy(p, &word, 4); // Aligned 32-bit store
+        p += 4;
+    }
+    while (p < end) *p++ = packed;
+}
+
+void FramebufferRaster::writeSpan(int y, int x0, int x1, const uint8_t* colors) {
+    if (!_buffer || y < 0 || y >= _height) return;
+    if (x0 < 0) { colors -= x0; x0 = 0; }
+    x1 = std::min(_width, x1);
+    if (x0 >= x1) return;
+
+    uint8_t* row = _buffer + y * _stride;
+    if (x0 & 1) {
+        row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | (*colors++ & 0x0F);
+        x0++;
+    }
+    uint8_t* p = row + (x0 >> 1);
+    for (; x0 + 1 < x1; x0 += 2, colors += 2) {
+        *p++ = (colors[0] << 4) | (colors[1] & 0x0F);
+    }
+    if (x0 < x1) {
+        *p = (*p & 0x0F) | (colors[0] << 4);
+    }
+}
+
+void FramebufferRaster::copySpan(int y, int x0, int x1, const uint8_t* src, int srcX) {
+    if (!_buffer || y < 0 || y >= _height) return;
+    if (x0 < 0) { srcX -= x0; x0 = 0; }
+    x1 = std::min(_width, x1);
+    if (x0 >= x1) return;
+
+    uint8_t* row = _buffer + y * _stride;
+    if ((x0 & 1) != (srcX & 1)) { // Nibbles misaligned: shift pixel by pixel
+        for (; x0 < x1; ++x0, ++srcX) {
+            uint8_t b = src[srcX >> 1];
+            setPixel(x0, y, (srcX & 1) ? (b & 0x0F) : (b >> 4));
+        }
+        return;
+    }
+    if (x0 & 1) {
+        row[x0 >> 1] = (row[x0 >> 1] & 0xF0) | (src[srcX >> 1] & 0x0F);
+        x0++; srcX++;
+    }
+    int bytes = (x1 - x0) >> 1;
+    memcpy(row + (x0 >> 1), src + (srcX >> 1), bytes);
+    x0 += bytes * 2; srcX += bytes * 2;
+    if (x0 < x1) {
+        row[x0 >> 1] = (row[x0 >> 1] & 0x0F) | (src[srcX >> 1] & 0xF0);
+    }
+}
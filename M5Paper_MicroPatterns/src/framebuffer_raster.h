@@ -0,0 +1,49 @@
+#ifndef FRAMEBUFFER_RASTER_H
+#define FRAMEBUFFER_RASTER_H
+
+#include <M5EPD.h>
+#include <stdint.h>
+
+// Direct writer for the M5EPD_Canvas 4bpp framebuffer: two pixels per byte, even x in the
+// high nibble, rows of width/2 bytes. Bypasses M5EPD_Canvas::drawPixel so horizontal spans
+// are written as whole bytes and 32-bit words of 8 packed pixels.
+// Coordinates are screen pixels. setPixel is unchecked; span writers clip to the canvas.
+class FramebufferRaster {
+public:
+    FramebufferRaster();
+
+    // Canvas must be 4bpp with an even width. Detaches (isAttached() == false) otherwise.
+    void attach(M5EPD_Canvas* canvas);
+    bool isAttached() const { return _buffer != nullptr; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    void clear(uint8_t color);
+    void clearRows(int y0, int y1, uint8_t color); // Rows [y0, y1)
+
+    inline void setPixel(int x, int y, uint8_t color) {
+        uint8_t* p = _buffer + y * _stride + (x >> 1);
+        if (x & 1) *p = (*p & 0xF0) | (color & 0x0F);
+        else       *p = (*p & 0x0F) | (color << 4);
+    }
+    inline uint8_t getPixel(int x, int y) const {
+        uint8_t b = _buffer[y * _stride + (x >> 1)];
+        return (x & 1) ? (b & 0x0F) : (b >> 4);
+    }
+
+    // Fills [x0, x1) on row y with one color
+    void fillSpan(int y, int x0, int x1, uint8_t color);
+    // Writes [x0, x1) on row y from colors[0 .. x1-x0), one 4-bit value per byte
+    void writeSpan(int y, int x0, int x1, const uint8_t* colors);
+    // Copies [x0, x1) on row y from a packed 4bpp row 'src' (same layout as the framebuffer),
+    // starting at its pixel srcX. With matching parity of x0 and srcX the bytes are memcpy'd.
+    void copySpan(int y, int x0, int x1, const uint8_t* src, int srcX);
+
+private:
+    uint8_t* _buffer;
+    int _width;
+    int _height;
+    int _stride; // Bytes per row
+};
+
+#endif // FRAMEBUFFER_RASTER_H
@@ -21,6 +21,8 @@ EventGroupHandle_t g_appEventGroup = NULL;
 // const EventBits_t FETCH_INTERRUPT_REQUESTED_BIT = (1 << 1); // Example
 EventGroupHandle_t g_renderTaskEventFlags = NULL;
 const EventBits_t RENDER_INTERRUPT_BIT = (1 << 0);
+// Set with RENDER_INTERRUPT_BIT; the render in progress polls it per span and stops at once
+static volatile bool s_renderInterruptFlag = false;
 
 
 // --- Global Manager Instances ---
@@ -35,10 +37,19 @@ NetworkManager* g_networkManager = nullptr;
 
 // --- Constants ---
 #define FRESH_START_THRESHOLD 10 // Perform full refresh every 10 reboots (approx)
-// Calculate capacity for script content JSON: content length + structural overhead + parsing buffer
-#define SCRIPT_CONTENT_JSON_CAPACITY (MAX_SCRIPT_CONTENT_LEN + 512)
 const TickType_t MAIN_LOOP_IDLE_DELAY = pdMS_TO_TICKS(50);
 const TickType_t SLEEP_IDLE_THRESHOLD_MS = 3000; // 3 seconds of inactivity before sleep
+// Deep sleep instead of light sleep between wakes: longer battery life, but every wake restarts
+// the firmware. Timer wakes then take the fast path (fastWakeFromDeepSleep); PUSH wakes a full boot.
+// Enabled with -DMICROPATTERNS_DEEP_SLEEP=1, see [env:m5stack-fire-deepsleep] in platformio.ini.
+#ifndef MICROPATTERNS_DEEP_SLEEP
+#define MICROPATTERNS_DEEP_SLEEP 0
+#endif
+const bool DEEP_SLEEP_MODE = MICROPATTERNS_DEEP_SLEEP != 0;
+const TickType_t EPD_UPDATE_SETTLE_DELAY = pdMS_TO_TICKS(500); // Longest waveform (GC16) before EPD power is cut
+const TickType_t RENDER_RESUME_DELAY = pdMS_TO_TICKS(300); // Quiet time after an input before a preempted render resumes
+
+static void fastWakeFromDeepSleep();
 
 // --- Main Setup ---
 void setup() {
@@ -53,6 +64,9 @@ void setup() {
     // SD card is not used, so SDEnable=false. Serial is used for logging. I2C for RTC/Touch. EPD is essential.
     M5.begin(true, false, true, true, true);
     log_i("M5.begin() completed.");
+    // After a deep sleep the main power latch is still held (SystemManager::goToDeepSleep)
+    gpio_hold_dis((gpio_num_t)M5EPD_MAIN_PWR_PIN);
+    gpio_deep_sleep_hold_dis();
 
     // Perform minimal early hardware setup (NVS, ISR service) after M5.begin ensures Serial is up.
     SysInit_EarlyHardware();
@@ -62,6 +76,10 @@ void setup() {
     esp_task_wdt_add(NULL);      // Add current task (setup) to watchdog
     esp_task_wdt_reset();
 
+    // Returns only if the normal boot has to run
+    fastWakeFromDeepSleep();
+    esp_task_wdt_reset();
+
     // 1. Create Queues and Event Groups
     g_inputEventQueue = xQueueCreate(10, sizeof(InputEvent));
     g_renderCommandQueue = xQueueCreate(1, sizeof(RenderJobQueueItem)); // Use RenderJobQueueItem
@@ -79,7 +97,7 @@ void setup() {
 
     // 2. Initialize Manager Classes
     // Order can be important if there are dependencies in constructors.
-    g_displayManager = new DisplayManager();
+    if (!g_displayManager) g_displayManager = new DisplayManager(); // May exist from the fast wake path
     if (!g_displayManager || !g_displayManager->initializeEPD()) { // Initialize EPD early for messages
         log_e("FATAL: DisplayManager initialization failed. Halting.");
         // No point trying to display error if display failed.
@@ -89,7 +107,7 @@ void setup() {
     g_displayManager->drawStartupIndicator(); // Draw startup indicator without clearing screen
     esp_task_wdt_reset();
 
-    g_systemManager = new SystemManager();
+    if (!g_systemManager) g_systemManager = new SystemManager();
     if (!g_systemManager || !g_systemManager->initialize()) { // Loads NVS settings
         log_e("FATAL: SystemManager initialization failed.");
         g_displayManager->showMessage("SysMgr Fail!", 150, 15, false, false);
@@ -97,12 +115,19 @@ void setup() {
     }
     esp_task_wdt_reset();
 
-    g_scriptManager = new ScriptManager();
+    if (!g_scriptManager) g_scriptManager = new ScriptManager();
     if (!g_scriptManager || !g_scriptManager->initialize()) { // Initializes SPIFFS
         log_e("FATAL: ScriptManager initialization failed.");
         g_displayManager->showMessage("ScrMgr Fail!", 150, 15, false, false);
         while(1) vTaskDelay(portMAX_DELAY);
     }
+    // The state fast wakes advanced since the last full boot is only in RTC memory so far
+    const BootSnapshot* bootSnapshot = bootSnapshotLoad();
+    if (bootSnapshot) {
+        log_i("Setup: Taking over the state of '%s' after %u fast wakes.", bootSnapshot->humanId, bootSnapshot->fastWakes);
+        g_scriptManager->saveScriptExecutionState(String(bootSnapshot->humanId), bootSnapshot->state);
+        bootSnapshotInvalidate(); // Written again before the next deep sleep
+    }
     esp_task_wdt_reset();
     
     g_networkManager = new NetworkManager(g_systemManager); // Pass SystemManager if needed for config
@@ -147,6 +172,191 @@ void setup() {
     vTaskDelete(NULL);
 }
 
+// State of a standard (non-recovery) render: increments the counter if a state was loaded,
+// starts it at 0 otherwise (first run for this script), and uses the current RTC time.
+static void applyFreshState(ScriptExecState& state) {
+    if (state.state_loaded) {
+        state.counter++;
+    } else {
+        state.counter = 0;
+    }
+    RTC_Time now_time = g_systemManager->getTime();
+    state.hour = now_time.hour;
+    state.minute = now_time.min;
+    state.second = now_time.sec;
+}
+
+// --- Boot snapshot ---
+// Frame RenderTask last presented, the basis of the boot snapshot sealed before deep sleep.
+// Written by RenderTask, copied by MainControlTask when it goes to sleep.
+static BootSnapshot s_presentedFrame;
+static bool s_presentedFrameValid = false;
+static portMUX_TYPE s_presentedFrameLock = portMUX_INITIALIZER_UNLOCKED;
+
+static void recordPresentedFrame(const RenderJobData& job, const String& content, const RenderResultData& result) {
+    if (!DEEP_SLEEP_MODE) return;
+    portENTER_CRITICAL(&s_presentedFrameLock);
+    bool sameContent = s_presentedFrameValid && job.file_id == s_presentedFrame.fileId &&
+                       result.content_hash == s_presentedFrame.contentHash;
+    strncpy(s_presentedFrame.humanId, job.script_id.c_str(), MAX_SCRIPT_ID_LEN - 1);
+    s_presentedFrame.humanId[MAX_SCRIPT_ID_LEN - 1] = '\0';
+    strncpy(s_presentedFrame.fileId, job.file_id.c_str(), MAX_SCRIPT_ID_LEN - 1);
+    s_presentedFrame.fileId[MAX_SCRIPT_ID_LEN - 1] = '\0';
+    s_presentedFrame.state = result.final_state;
+    s_presentedFrame.state.state_loaded = true; // So the next wake advances it
+    s_presentedFrame.contentHash = result.content_hash;
+    s_presentedFrame.inputMask = result.input_mask;
+    if (!content.isEmpty()) {
+        bool fits = content.length() < BOOT_SNAPSHOT_MAX_CONTENT; // With its terminator
+        s_presentedFrame.contentLength = fits ? content.length() : 0;
+        if (fits) memcpy(s_presentedFrame.content, content.c_str(), content.length() + 1);
+    } else if (!sameContent) {
+        s_presentedFrame.contentLength = 0; // Rendered from a cache: a fast wake reads it from SPIFFS
+    }
+    s_presentedFrameValid = result.content_hash != 0;
+    portEXIT_CRITICAL(&s_presentedFrameLock);
+}
+
+// Seals the boot snapshot of the panel image and deep-sleeps; does not return. Without a
+// presented frame (e.g. the last render failed) the next timer wake takes the full boot.
+// Caller holds the EPD lock.
+static void enterDeepSleep() {
+    static BootSnapshot snapshot; // Not on the task stack
+    portENTER_CRITICAL(&s_presentedFrameLock);
+    bool valid = s_presentedFrameValid;
+    memcpy(&snapshot, &s_presentedFrame, sizeof(snapshot));
+    portEXIT_CRITICAL(&s_presentedFrameLock);
+
+    M5EPD_Canvas* canvas = g_displayManager->getCanvas(); // What the panel shows, messages included
+    valid = valid && bootSnapshotHashTiles((const uint8_t*)canvas->frameBuffer(), canvas->width(), canvas->height(), snapshot.tileHashes) &&
+            g_displayManager->saveGhosting(snapshot.tileGhosting, snapshot.tileGray, BOOT_SNAPSHOT_TILES);
+    if (valid) {
+        snapshot.fastWakes = 0;
+        bootSnapshotStore(snapshot);
+        log_i("MainCtrl: Boot snapshot of '%s' (counter %d) sealed.", snapshot.humanId, snapshot.state.counter);
+    } else {
+        bootSnapshotInvalidate();
+        log_w("MainCtrl: No presented frame, the next wake takes the full boot.");
+    }
+    esp_task_wdt_delete(NULL);
+    g_systemManager->goToDeepSleep(SystemManager::DEFAULT_SLEEP_DURATION_S);
+}
+
+// Presents the tiles whose hash changed: one rectangle per run of tile rows with changes,
+// spanning the changed columns of those rows. Returns the number of tiles changed.
+static int presentChangedTiles(const uint32_t* before, const uint32_t* after) {
+    const int tilesX = (g_displayManager->getWidth() + BOOT_SNAPSHOT_TILE_SIZE - 1) / BOOT_SNAPSHOT_TILE_SIZE;
+    const int tilesY = BOOT_SNAPSHOT_TILES / tilesX;
+    int changed = 0;
+    int runStart = -1, runMinX = tilesX, runMaxX = -1;
+    for (int ty = 0; ty <= tilesY; ++ty) {
+        int rowMinX = tilesX, rowMaxX = -1;
+        for (int tx = 0; ty < tilesY && tx < tilesX; ++tx) {
+            if (before[ty * tilesX + tx] == after[ty * tilesX + tx]) continue;
+            rowMinX = std::min(rowMinX, tx);
+            rowMaxX = tx;
+            changed++;
+        }
+        if (rowMaxX >= 0) {
+            if (runStart < 0) runStart = ty;
+            runMinX = std::min(runMinX, rowMinX);
+            runMaxX = std::max(runMaxX, rowMaxX);
+        } else if (runStart >= 0) {
+            int32_t x = runMinX * BOOT_SNAPSHOT_TILE_SIZE, y = runStart * BOOT_SNAPSHOT_TILE_SIZE;
+            g_displayManager->presentRegion(x, y, std::min<int32_t>(g_displayManager->getWidth(), (runMaxX + 1) * BOOT_SNAPSHOT_TILE_SIZE) - x,
+                                            std::min<int32_t>(g_displayManager->getHeight(), ty * BOOT_SNAPSHOT_TILE_SIZE) - y);
+            runStart = -1;
+            runMinX = tilesX;
+            runMaxX = -1;
+        }
+    }
+    return changed;
+}
+
+// Renders the script of 'snapshot' for 'state' and pushes the tiles that changed, updating the
+// tile hashes and ghosting in 'snapshot'. False if the normal boot has to take over.
+static bool fastWakeRender(BootSnapshot& snapshot, const ScriptExecState& state) {
+    String content;
+    if (snapshot.contentLength > 0) {
+        content = snapshot.content;
+    } else if (String(snapshot.fileId) == ScriptManager::DEFAULT_SCRIPT_ID) {
+        content = ScriptManager::DEFAULT_SCRIPT_CONTENT;
+    } else {
+        g_scriptManager = new ScriptManager(); // Only SPIFFS: no script list or state table
+        if (!g_scriptManager->initialize() || !g_scriptManager->loadScriptContent(String(snapshot.fileId), content)) {
+            log_w("FastWake: Cannot read the content of '%s'.", snapshot.humanId);
+            return false;
+        }
+    }
+    if (ProgramCache::hashContent(content) != snapshot.contentHash) {
+        log_i("FastWake: Content of '%s' changed since the snapshot.", snapshot.humanId);
+        return false;
+    }
+
+    g_displayManager = new DisplayManager();
+    if (!g_displayManager->initializeEPD()) return false;
+    g_displayManager->restoreGhosting(snapshot.tileGhosting, snapshot.tileGray, BOOT_SNAPSHOT_TILES);
+
+    RenderController renderCtrl(*g_displayManager);
+    RenderResultData result = renderCtrl.renderScript(String(snapshot.humanId), String(snapshot.fileId), content, state, 0);
+    Serial.println(result.profile.toJson(snapshot.humanId, renderModeName(result.render_mode)));
+    M5EPD_Canvas* frame = g_displayManager->getRenderCanvas();
+    uint32_t tileHashes[BOOT_SNAPSHOT_TILES];
+    if (!result.success ||
+        !bootSnapshotHashTiles((const uint8_t*)frame->frameBuffer(), frame->width(), frame->height(), tileHashes)) {
+        log_w("FastWake: Render of '%s' failed: %s", snapshot.humanId, result.error_message.c_str());
+        return false;
+    }
+
+    int changed = presentChangedTiles(snapshot.tileHashes, tileHashes);
+    log_i("FastWake: %d of %d tiles of '%s' changed.", changed, BOOT_SNAPSHOT_TILES, snapshot.humanId);
+    if (changed > 0) vTaskDelay(EPD_UPDATE_SETTLE_DELAY);
+    memcpy(snapshot.tileHashes, tileHashes, sizeof(tileHashes));
+    g_displayManager->saveGhosting(snapshot.tileGhosting, snapshot.tileGray, BOOT_SNAPSHOT_TILES);
+    return true;
+}
+
+// --- Fast wake from deep sleep ---
+// A timer wake with a boot snapshot brings the panel up to date for the next state of the same
+// script and sleeps again, without the tasks, the script list, the state table or (for scripts
+// kept in the snapshot) SPIFFS. If the program reads none of the inputs that changed, nothing
+// is rendered at all. Returns whenever the normal boot has to run instead: the snapshot then
+// still holds the state, which setup() takes over.
+static void fastWakeFromDeepSleep() {
+    if (!DEEP_SLEEP_MODE || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER) return;
+    const BootSnapshot* stored = bootSnapshotLoad();
+    if (!stored) return;
+    if (stored->fastWakes >= BOOT_SNAPSHOT_MAX_FAST_WAKES) {
+        log_i("FastWake: %u fast wakes since the last full boot, booting.", stored->fastWakes);
+        return;
+    }
+    unsigned long startTime = millis();
+
+    g_systemManager = new SystemManager(); // NVS only
+    if (!g_systemManager->initialize() || g_systemManager->isFetchDue() || g_systemManager->isFullRefreshIntended()) {
+        log_i("FastWake: Fetch or full refresh due, booting.");
+        return;
+    }
+
+    static BootSnapshot snapshot; // Not on the setup task's stack
+    memcpy(&snapshot, stored, sizeof(snapshot));
+    ScriptExecState state = snapshot.state;
+    applyFreshState(state);
+    if (FrameCache::inputsMatch(snapshot.inputMask, snapshot.state, state)) {
+        log_i("FastWake: '%s' reads none of the inputs that changed, the panel is up to date.", snapshot.humanId);
+    } else if (!fastWakeRender(snapshot, state)) {
+        return;
+    }
+    snapshot.state = state; // Inputs are read-only for scripts
+    snapshot.state.state_loaded = true;
+    snapshot.fastWakes++;
+    bootSnapshotStore(snapshot);
+    log_i("FastWake: '%s' counter %d done in %lu ms.", snapshot.humanId, state.counter, millis() - startTime);
+
+    esp_task_wdt_delete(NULL);
+    g_systemManager->goToDeepSleep(SystemManager::DEFAULT_SLEEP_DURATION_S);
+}
+
 // Helper function to queue a render job
 // if useAsIsState is true, it uses the state directly from getScriptForExecution (for WiFi fail recovery)
 // if useAsIsState is false, it increments counter (if loaded) and uses current RTC time (for user-initiated re-render/next script etc.)
@@ -163,15 +373,7 @@ static bool triggerScriptRender(const String& humanIdToRender, bool useAsIsState
                 log_i("triggerScriptRender: humanIdToRender was empty, attempting to render default script '%s'", defaultJobData.script_id.c_str());
                 // For default script, always use 'fresh' state (useAsIsState = false effectively)
                 defaultJobData.initial_state = defaultScriptState; // Base state
-                if (defaultScriptState.state_loaded) { // Default script state_loaded should be false from getScriptForExecution
-                    defaultJobData.initial_state.counter++;
-                } else {
-                    defaultJobData.initial_state.counter = 0;
-                }
-                RTC_Time now_time = g_systemManager->getTime();
-                defaultJobData.initial_state.hour = now_time.hour;
-                defaultJobData.initial_state.minute = now_time.min;
-                defaultJobData.initial_state.second = now_time.sec;
+                applyFreshState(defaultJobData.initial_state); // Default script state_loaded should be false from getScriptForExecution
 
                 RenderJobQueueItem defaultJobQueueItem;
                 defaultJobQueueItem.fromRenderJobData(defaultJobData);
@@ -218,15 +420,7 @@ static bool triggerScriptRender(const String& humanIdToRender, bool useAsIsState
         jobData.initial_state = scriptState; // Base state from storage
 
         if (!useAsIsState) { // Standard render: increment counter (if loaded), use current RTC time
-            if (scriptState.state_loaded) {
-                jobData.initial_state.counter++; // Increment the counter from the loaded state
-            } else {
-                jobData.initial_state.counter = 0; // Ensure counter is 0 if state wasn't loaded (first run for this script)
-            }
-            RTC_Time now_time = g_systemManager->getTime();
-            jobData.initial_state.hour = now_time.hour;
-            jobData.initial_state.minute = now_time.min;
-            jobData.initial_state.second = now_time.sec;
+            applyFreshState(jobData.initial_state);
         }
         // If useAsIsState is true, jobData.initial_state is already set correctly to scriptState (from storage).
 
@@ -311,8 +505,8 @@ void MainControlTask_Function(void *pvParameters) {
     lastActivityTime = xTaskGetTickCount();
     esp_task_wdt_reset();
 
-    // 3. Check for full refresh intent
-    g_systemManager->incrementFreshStartCounter();
+    // 3. Check for full refresh intent. Waking from deep sleep is not a fresh start.
+    if (esp_reset_reason() != ESP_RST_DEEPSLEEP) g_systemManager->incrementFreshStartCounter();
     if (g_systemManager->getFreshStartCounter() == 1 || g_systemManager->getFreshStartCounter() > FRESH_START_THRESHOLD) {
         log_i("MainCtrl: Full refresh intended (counter: %d).", g_systemManager->getFreshStartCounter());
         g_systemManager->setFullRefreshIntended(true);
@@ -327,18 +521,7 @@ void MainControlTask_Function(void *pvParameters) {
     esp_task_wdt_reset();
 
     // 4. Initial fetch check
-    int lf_year, lf_month, lf_day, lf_hour, lf_min;
-    g_systemManager->getLastFetchTimestamp(lf_year, lf_month, lf_day, lf_hour, lf_min);
-    RTC_Date currentDate = g_systemManager->getDate();
-    RTC_Time currentTime = g_systemManager->getTime();
-    bool timeForFetch = false;
-    if (lf_year == -1 || currentDate.year != lf_year || currentDate.mon != lf_month || currentDate.day != lf_day) {
-        timeForFetch = true; // Different day or never fetched
-    } else { // Same day, check time interval (e.g., 2 hours)
-        int elapsed_minutes = (currentTime.hour - lf_hour) * 60 + (currentTime.min - lf_min);
-        if (elapsed_minutes < 0) elapsed_minutes += 24 * 60; // Crossed midnight
-        if (elapsed_minutes >= 120) timeForFetch = true;
-    }
+    bool timeForFetch = g_systemManager->isFetchDue();
 
     if (g_systemManager->isFullRefreshIntended() || timeForFetch) {
         log_i("MainCtrl: Triggering initial fetch (FullRefresh: %s, TimeForFetch: %s)",
@@ -382,6 +565,7 @@ void MainControlTask_Function(void *pvParameters) {
             // Stop ongoing render or fetch if significant input
             if (currentState == AppState::RENDERING_SCRIPT) { // Check if currently rendering
                 log_i("MainCtrl: Input received during render. Requesting interrupt.");
+                s_renderInterruptFlag = true;
                 xEventGroupSetBits(g_renderTaskEventFlags, RENDER_INTERRUPT_BIT);
                 // Preemptively change state to allow new render to be queued.
                 // The RenderTask will eventually send its (now hopefully interrupted) status.
@@ -439,8 +623,11 @@ void MainControlTask_Function(void *pvParameters) {
             String received_script_id(renderResultItem.script_id); // Construct String from char[]
             String received_error_message(renderResultItem.error_message); // Construct String from char[]
 
-            log_i("MainCtrl: Received render result for '%s'. Success: %s, Interrupted: %s",
-                  received_script_id.c_str(), renderResultItem.success ? "Yes":"No", renderResultItem.interrupted ? "Yes":"No");
+            log_i("MainCtrl: Received render result for '%s'. Success: %s, Interrupted: %s, Mode: %s",
+                  received_script_id.c_str(), renderResultItem.success ? "Yes":"No", renderResultItem.interrupted ? "Yes":"No",
+                  renderModeName(renderResultItem.render_mode));
+            // One JSON line per render for comparing scripts and firmware builds
+            Serial.println(renderResultItem.profile.toJson(received_script_id.c_str(), renderModeName(renderResultItem.render_mode)));
             
             if (renderResultItem.success) {
                 g_scriptManager->saveScriptExecutionState(received_script_id, renderResultItem.final_state);
@@ -545,6 +732,9 @@ void MainControlTask_Function(void *pvParameters) {
                                 }
                             }
                         }
+                    } else if (currentStillValid) {
+                        log_i("MainCtrl: Scripts changed in the fetch. Re-rendering current script '%s'.", currentLoadedScriptId.c_str());
+                        triggerScriptRender(currentLoadedScriptId, true, currentState, currentLoadedScriptId);
                     }
                 }
             } else if (fetchResultItem.status == FetchResultStatus::INTERRUPTED_BY_USER) {
@@ -583,6 +773,12 @@ void MainControlTask_Function(void *pvParameters) {
                 log_i("MainCtrl: EPD Mutex free. Going to light sleep.");
                 // User requested to not show "Sleeping..." message on EPD.
                 vTaskDelay(pdMS_TO_TICKS(10)); // Short delay before sleep
+                if (!g_scriptManager->flushScriptExecutionStates()) { // States not yet written by saveScriptExecutionState()
+                    log_w("MainCtrl: Failed to write script states before sleep.");
+                }
+                if (DEEP_SLEEP_MODE && g_displayManager->lockEPD(pdMS_TO_TICKS(100))) {
+                    enterDeepSleep(); // Does not return; the EPD lock is held into the sleep
+                }
                 
                 esp_task_wdt_delete(NULL); // Stop WDT for MainControlTask before sleeping
                 g_systemManager->goToLightSleep(SystemManager::DEFAULT_SLEEP_DURATION_S); // Use constant
@@ -622,19 +818,7 @@ void MainControlTask_Function(void *pvParameters) {
                 
                 // 2. If timer wakeup, check if fetch is due
                 if (g_systemManager->getWakeupCause() == ESP_SLEEP_WAKEUP_TIMER) {
-                    int ly, lm, ld, lh, lmin;
-                g_systemManager->getLastFetchTimestamp(ly, lm, ld, lh, lmin);
-                RTC_Date cd = g_systemManager->getDate();
-                RTC_Time ct = g_systemManager->getTime();
-                bool fetchDue = false;
-                if (ly == -1 || cd.year != ly || cd.mon != lm || cd.day != ld) {
-                    fetchDue = true;
-                } else {
-                    int elapsed = (ct.hour - lh) * 60 + (ct.min - lmin);
-                    if (elapsed < 0) elapsed += 24 * 60;
-                    if (elapsed >= 120) fetchDue = true;
-                }
-                if (fetchDue) {
+                if (g_systemManager->isFetchDue()) {
                     log_i("MainCtrl: Triggering fetch after timer wakeup.");
                     FetchJob fetchJob;
                     fetchJob.full_refresh = g_systemManager->isFullRefreshIntended();
@@ -677,19 +861,59 @@ void InputTask_Function(void *pvParameters) {
 }
 
 // --- Render Task ---
+// Pre-renders the next or previous script in the list into a spare framebuffer, with the
+// state a button press would render it with, so switching to it only needs an EPD update.
+// Runs at low priority and gives up as soon as a render job is queued. Renders at most one
+// frame per call; returns false if both neighbours were already up to date.
+static bool speculateAdjacentScript(RenderController& renderCtrl) {
+    if (!g_displayManager->hasBackBuffer()) return false; // Frames are copied into the back buffer
+    uint32_t contentGeneration = g_scriptManager->getContentGeneration();
+    for (int direction = 0; direction < 2; direction++) {
+        bool moveUp = direction == 1;
+        String humanId, fileId;
+        if (!g_scriptManager->getAdjacentScript(moveUp, humanId, fileId)) continue;
+        ScriptExecState state;
+        g_scriptManager->loadScriptExecutionState(humanId, state);
+        applyFreshState(state);
+        if (!renderCtrl.needsSpeculation(fileId, state, contentGeneration) ||
+            renderCtrl.hasCachedFrame(fileId, state, contentGeneration)) continue;
+
+        String content;
+        if (!renderCtrl.hasCachedProgram(fileId, contentGeneration) && !g_scriptManager->loadScriptContent(fileId, content)) {
+            log_w("RenderTask: Cannot load '%s' to pre-render it.", humanId.c_str());
+            continue;
+        }
+        vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 1);
+        renderCtrl.speculate(humanId, fileId, content, state, contentGeneration,
+                             []() { return uxQueueMessagesWaiting(g_renderCommandQueue) > 0; });
+        vTaskPrioritySet(NULL, RENDER_TASK_PRIORITY);
+        return true;
+    }
+    return false;
+}
+
 void RenderTask_Function(void *pvParameters) {
     esp_task_wdt_init(60, true); // Longer timeout for rendering, panic on WDT timeout
     esp_task_wdt_add(NULL);
 
     RenderController renderCtrl(*g_displayManager); // Create RenderController instance for this task
+    renderCtrl.setInterruptFlag(&s_renderInterruptFlag);
+    // Between render slices: a tick for the other tasks on this core, the idle task included
+    renderCtrl.setPreemptCheck([]() { vTaskDelay(1); return false; });
+    uint32_t presentedCanvasRevision = 0; // Canvas revision right after the last presented frame
 
     RenderJobQueueItem jobItem; // Use RenderJobQueueItem
-    // WDT timeout for RenderTask is 60s. We'll use a 30s queue receive timeout.
+    // WDT timeout for RenderTask is 60s. We'll use a 30s queue receive timeout,
+    // shortened while adjacent scripts remain to be pre-rendered.
     const TickType_t queueReceiveTimeout = pdMS_TO_TICKS(30000);
+    const TickType_t speculationIdleTimeout = pdMS_TO_TICKS(1500);
+    bool speculationPending = false;
 
     for (;;) {
         esp_task_wdt_reset(); // Reset WDT at the start of each loop iteration.
-        if (xQueueReceive(g_renderCommandQueue, &jobItem, queueReceiveTimeout) == pdTRUE) {
+        if (xQueueReceive(g_renderCommandQueue, &jobItem, speculationPending ? speculationIdleTimeout : queueReceiveTimeout) != pdTRUE) {
+            speculationPending = speculateAdjacentScript(renderCtrl); // Idle
+        } else {
             // Construct RenderJobData. Script content will be loaded into jobData.script_content.
             RenderJobData jobDataForRenderCtrl; // This will hold all data for RenderController
             jobDataForRenderCtrl.script_id = String(jobItem.human_id);
@@ -700,8 +924,23 @@ void RenderTask_Function(void *pvParameters) {
 
             log_i("RenderTask: Received job for human_id: %s, file_id: %s", jobDataForRenderCtrl.script_id.c_str(), jobDataForRenderCtrl.file_id.c_str());
 
-            // Load script content
-            if (jobDataForRenderCtrl.file_id == ScriptManager::DEFAULT_SCRIPT_ID) {
+            // Load script content, unless a compiled program for unchanged content is cached
+            // or the frame was pre-rendered while idle.
+            // The generation is read before loading so a concurrent save can only cause a reload.
+            uint32_t contentGeneration = g_scriptManager->getContentGeneration();
+            RenderResultData speculativeResult;
+            bool speculativeHit = g_displayManager->hasBackBuffer() &&
+                                  renderCtrl.takeSpeculativeFrame(jobDataForRenderCtrl.script_id, jobDataForRenderCtrl.file_id,
+                                                                  jobDataForRenderCtrl.initial_state, contentGeneration, speculativeResult);
+            speculationPending = true; // Neighbours change with the current script
+            uint32_t loadStart = profileCycles();
+            if (speculativeHit) {
+                log_i("RenderTask: Pre-rendered frame used for '%s', skipping content load.", jobDataForRenderCtrl.script_id.c_str());
+            } else if (renderCtrl.hasCachedFrame(jobDataForRenderCtrl.file_id, jobDataForRenderCtrl.initial_state, contentGeneration)) {
+                log_i("RenderTask: Frame cached for '%s' with these inputs, skipping content load.", jobDataForRenderCtrl.script_id.c_str());
+            } else if (renderCtrl.hasCachedProgram(jobDataForRenderCtrl.file_id, contentGeneration)) {
+                log_i("RenderTask: Compiled program cached for '%s', skipping content load.", jobDataForRenderCtrl.script_id.c_str());
+            } else if (jobDataForRenderCtrl.file_id == ScriptManager::DEFAULT_SCRIPT_ID) {
                 log_i("RenderTask: Using built-in default script content for '%s'", jobDataForRenderCtrl.script_id.c_str());
                 // Get default content directly from ScriptManager constant or method
                 // For simplicity, assuming ScriptManager::loadScriptContent handles DEFAULT_SCRIPT_ID correctly by returning built-in content.
@@ -723,6 +962,7 @@ void RenderTask_Function(void *pvParameters) {
                 }
                 continue; // Skip to next job
             }
+            uint32_t loadCycles = profileCycles() - loadStart;
             log_i("RenderTask: Content loaded for script ID: %s", jobDataForRenderCtrl.script_id.c_str());
             
             RenderResultData resultData; // To store result from RenderController
@@ -746,7 +986,13 @@ void RenderTask_Function(void *pvParameters) {
             // This means RenderController.h/cpp needs:
             // RenderResultData renderScript(const RenderJobData& job_meta_data, const String& script_content_payload);
 
-            if (g_displayManager->lockEPD(pdMS_TO_TICKS(1000))) { // Lock EPD, 1s timeout
+            // With a back buffer the render runs without the EPD lock, so indicators and messages
+            // stay responsive; the lock is only taken to present the result
+            bool renderOffLock = g_displayManager->hasBackBuffer();
+            uint32_t lockStart = profileCycles();
+            bool renderLocked = renderOffLock || g_displayManager->lockEPD(pdMS_TO_TICKS(1000)); // Lock EPD, 1s timeout
+            uint32_t renderLockCycles = profileCycles() - lockStart;
+            if (renderLocked) {
                 // Clear any pending interrupt bit before starting
                 xEventGroupClearBits(g_renderTaskEventFlags, RENDER_INTERRUPT_BIT);
                 
@@ -758,7 +1004,24 @@ void RenderTask_Function(void *pvParameters) {
                 // renderScript(const String& script_id, const String& script_content, const ScriptExecState& initial_state)
                 // (file_id is not directly needed by parser/runtime if content is provided)
                 
-                resultData = renderCtrl.renderScript(jobDataForRenderCtrl.script_id, script_content_for_parser, jobDataForRenderCtrl.initial_state);
+                if (speculativeHit) {
+                    resultData = speculativeResult; // Already in the render canvas, presented in full
+                } else {
+                    resultData = renderCtrl.renderScript(jobDataForRenderCtrl.script_id, jobDataForRenderCtrl.file_id, script_content_for_parser,
+                                                         jobDataForRenderCtrl.initial_state, contentGeneration);
+                    // A preempted render keeps its place: unless a job arrives first, it continues
+                    // once the input burst is over. Without a back buffer the EPD lock is held, so
+                    // only a job for the same frame resumes it.
+                    RenderJobQueueItem nextJob;
+                    while (renderOffLock && resultData.interrupted && renderCtrl.hasSuspendedRender() &&
+                           xQueuePeek(g_renderCommandQueue, &nextJob, RENDER_RESUME_DELAY) != pdTRUE) {
+                        xEventGroupClearBits(g_renderTaskEventFlags, RENDER_INTERRUPT_BIT);
+                        log_i("RenderTask: No new job, resuming the preempted render of '%s'.", jobDataForRenderCtrl.script_id.c_str());
+                        resultData = renderCtrl.resumeRender();
+                    }
+                }
+                resultData.profile.phaseCycles[RENDER_PHASE_LOAD] += loadCycles;
+                resultData.profile.phaseCycles[RENDER_PHASE_LOCK_WAIT] += renderLockCycles;
                 
                 // Check if MainControlTask signaled an interrupt during the process
                 EventBits_t uxBits = xEventGroupGetBits(g_renderTaskEventFlags);
@@ -787,18 +1050,37 @@ void RenderTask_Function(void *pvParameters) {
                 // determined by RenderController (likely false), and resultData.success also remains as determined.
 
 
-                // After rendering is complete (or interrupted), push the canvas
-                // The DisplayListRenderer now handles clearing the canvas.
-                // The final push to EPD happens here.
-                // Directly call canvas push since mutex is already held by RenderTask.
-                M5EPD_Canvas* canvas = g_displayManager->getCanvas();
-                if (canvas) {
-                    canvas->pushCanvas(0, 0, UPDATE_MODE_GC16); // Or appropriate mode
+                // After rendering is complete (or interrupted), present the render canvas.
+                // The DisplayListRenderer handles clearing it. A partial render is presented as
+                // its dirty regions while the displayed canvas still holds the previous frame.
+                lockStart = profileCycles();
+                bool presentLocked = !renderOffLock || g_displayManager->lockEPD(pdMS_TO_TICKS(1000));
+                resultData.profile.phaseCycles[RENDER_PHASE_LOCK_WAIT] += (uint32_t)(profileCycles() - lockStart);
+                if (!presentLocked) {
+                    log_e("RenderTask: Failed to lock EPD to present script %s", jobDataForRenderCtrl.script_id.c_str());
+                    resultData.success = false;
+                    resultData.error_message = "Failed to acquire display lock to show the render.";
                 } else {
-                    log_e("RenderTask: Failed to get canvas from DisplayManager.");
+                    ProfileScope pushTiming(resultData.profile.phaseCycles[RENDER_PHASE_PUSH]);
+                    bool frameShown = g_displayManager->getCanvasRevision() == presentedCanvasRevision;
+                    bool preempted = resultData.interrupted && renderCtrl.hasSuspendedRender();
+                    if (preempted) {
+                        log_i("RenderTask: Render of '%s' preempted, its partial frame is not pushed.", jobDataForRenderCtrl.script_id.c_str());
+                    } else if (resultData.render_mode == RENDER_MODE_UNCHANGED && frameShown) {
+                        log_i("RenderTask: Frame of '%s' is already on the panel, not pushed.", jobDataForRenderCtrl.script_id.c_str());
+                    } else if (resultData.render_mode == RENDER_MODE_PARTIAL && frameShown) {
+                        for (const ScreenBounds& region : renderCtrl.getDirtyRegions()) {
+                            g_displayManager->presentRegion(region.minX, region.minY, region.maxX - region.minX,
+                                                            region.maxY - region.minY);
+                        }
+                    } else {
+                        // Waveform picked from the content and the ghosting budget
+                        g_displayManager->presentRegion(0, 0, g_displayManager->getWidth(), g_displayManager->getHeight());
+                    }
+                    if (!preempted) presentedCanvasRevision = g_displayManager->getCanvasRevision();
+                    g_displayManager->unlockEPD(); // Unlock EPD
+                    if (resultData.success) recordPresentedFrame(jobDataForRenderCtrl, script_content_for_parser, resultData);
                 }
-                
-                g_displayManager->unlockEPD(); // Unlock EPD
             } else {
                 log_e("RenderTask: Failed to lock EPD for rendering script %s", jobDataForRenderCtrl.script_id.c_str());
                 resultData.script_id = jobDataForRenderCtrl.script_id; // Populate for error reporting
@@ -820,7 +1102,7 @@ void RenderTask_Function(void *pvParameters) {
             if (xQueueSend(g_renderStatusQueue, &resultQueueItem, pdMS_TO_TICKS(100)) != pdTRUE) {
                 log_e("RenderTask: Failed to send render status for %s", jobDataForRenderCtrl.script_id.c_str());
             }
-        } // Closes if (xQueueReceive...)
+        } // Closes if (xQueueReceive...) else
     } // Closes for (;;)
 } // Closes RenderTask_Function
 // --- Fetch Task ---
@@ -835,7 +1117,10 @@ void FetchTask_Function(void *pvParameters) {
 
     FetchJob job; // FetchJob is simple, no Strings, can remain as is
     DynamicJsonDocument serverListDoc(JSON_DOC_CAPACITY_SCRIPT_LIST);
-    DynamicJsonDocument scriptContentDoc(SCRIPT_CONTENT_JSON_CAPACITY); // From event_defs.h capacity
+    // Script content is streamed from the connection to SPIFFS, never held in full
+    const ContentChunkWriter writeContentChunk = [](const char *data, size_t length) {
+        return g_scriptManager->writeScriptContentChunk(data, length);
+    };
     
     // WDT timeout for FetchTask is 120s. We'll use a 60s queue receive timeout.
     const TickType_t queueReceiveTimeout = pdMS_TO_TICKS(60000);
@@ -849,7 +1134,6 @@ void FetchTask_Function(void *pvParameters) {
             
             // Clear JsonDocuments before use for this job
             serverListDoc.clear();
-            scriptContentDoc.clear();
 
             FetchResultData resultData; // Use FetchResultData for internal logic
             resultData.new_scripts_available = false; // Default
@@ -862,7 +1146,8 @@ void FetchTask_Function(void *pvParameters) {
                 resultData.message = "WiFi Connect Fail";
             } else {
                 esp_task_wdt_reset(); // After successful connect or attempt
-                // Perform fetch operations
+                // Perform fetch operations, the list and every script over one connection
+                g_networkManager->beginSession();
             
                 if (job.full_refresh) {
                     esp_task_wdt_reset(); // Before file system op
@@ -883,6 +1168,13 @@ void FetchTask_Function(void *pvParameters) {
                         if (!localListExists || localListDoc.as<JsonArray>().size() != serverList.size()) {
                             resultData.new_scripts_available = true;
                         }
+                        // Bumped by every downloaded script and by any change of the fileId mapping
+                        uint32_t contentGenerationBefore = g_scriptManager->getContentGeneration();
+                        // Incremental sync: keep the fileIds and content versions of scripts already stored
+                        if (localListExists) {
+                            g_scriptManager->carryOverSyncState(serverListDoc, localListDoc.as<JsonArrayConst>());
+                        }
+                        localListDoc.clear();
 
                         log_d("FetchTask: Before saveScriptList - serverListDoc type: isArray=%d, isObject=%d, isNull=%d, size=%d", serverListDoc.is<JsonArray>(), serverListDoc.is<JsonObject>(), serverListDoc.isNull(), serverListDoc.is<JsonArray>() ? serverListDoc.as<JsonArray>().size() : 0);
                         
@@ -926,6 +1218,7 @@ void FetchTask_Function(void *pvParameters) {
                                 bool allContentFetched = true;
                                 int successCount = 0;
                                 int failCount = 0;
+                                int unchangedCount = 0;
                                 
                                 for (JsonObject scriptInfo : serverList) {
                                     esp_task_wdt_reset(); // Inside loop, before each script content fetch
@@ -936,50 +1229,59 @@ void FetchTask_Function(void *pvParameters) {
                                         failCount++;
                                         continue;
                                     }
+                                    if (g_scriptManager->isScriptContentCurrent(scriptInfo)) {
+                                        log_i("FetchTask: Content of '%s' is unchanged, not downloading it", humanId);
+                                        unchangedCount++; successCount++;
+                                        continue;
+                                    }
                                     log_i("FetchTask: Fetching content for script '%s'", humanId);
-                                    
-                                    FetchResultStatus contentStatus = g_networkManager->fetchScriptContent(humanId, scriptContentDoc);
-                                    esp_task_wdt_reset(); // After fetchScriptContent call
 
-                                    if (contentStatus == FetchResultStatus::SUCCESS) {
-                                        if (!scriptContentDoc.is<JsonObject>() || !scriptContentDoc["content"].is<const char*>()) {
-                                            log_e("FetchTask: Invalid content response structure for '%s'", humanId);
-                                            allContentFetched = false; failCount++; continue;
-                                        }
-                                        const char* content = scriptContentDoc["content"].as<const char*>();
-                                        if (!content || strlen(content) == 0) {
-                                            log_e("FetchTask: Empty content for '%s'", humanId);
-                                            allContentFetched = false; failCount++; continue;
-                                        }
-                                        String fileId;
-                                        if (!scriptInfo["fileId"].isNull() && scriptInfo["fileId"].is<const char*>()) {
-                                            fileId = scriptInfo["fileId"].as<String>();
-                                            if (fileId.isEmpty() || fileId == "null" || !fileId.startsWith("s")) {
-                                                log_w("FetchTask: Script '%s' has invalid fileId '%s', generating short fileId", humanId, fileId.c_str());
-                                                fileId = g_scriptManager->generateShortFileId(humanId);
-                                                scriptInfo["fileId"] = fileId; scriptContentDoc["fileId"] = fileId;
-                                            }
-                                        } else {
-                                            log_w("FetchTask: Script '%s' has no fileId field or it's not a string, generating short fileId", humanId);
+                                    // The fileId names the file the content is streamed into
+                                    String fileId;
+                                    if (!scriptInfo["fileId"].isNull() && scriptInfo["fileId"].is<const char*>()) {
+                                        fileId = scriptInfo["fileId"].as<String>();
+                                        if (fileId.isEmpty() || fileId == "null" || !fileId.startsWith("s")) {
+                                            log_w("FetchTask: Script '%s' has invalid fileId '%s', generating short fileId", humanId, fileId.c_str());
                                             fileId = g_scriptManager->generateShortFileId(humanId);
-                                            scriptInfo["fileId"] = fileId; scriptContentDoc["fileId"] = fileId;
+                                            scriptInfo["fileId"] = fileId;
                                         }
-                                        log_i("FetchTask: Saving content for '%s' (length: %u bytes)", humanId, strlen(content));
-                                        esp_task_wdt_reset(); // Before saving script content
-                                        if (!g_scriptManager->saveScriptContent(fileId, content)) {
+                                    } else {
+                                        log_w("FetchTask: Script '%s' has no fileId field or it's not a string, generating short fileId", humanId);
+                                        fileId = g_scriptManager->generateShortFileId(humanId);
+                                        scriptInfo["fileId"] = fileId;
+                                    }
+                                    esp_task_wdt_reset(); // Before opening the content file
+                                    if (!g_scriptManager->beginScriptContentWrite(fileId)) {
+                                        log_e("FetchTask: Failed to open content file for '%s'", humanId);
+                                        allContentFetched = false; failCount++; continue;
+                                    }
+
+                                    size_t contentLength = 0;
+                                    FetchResultStatus contentStatus = g_networkManager->fetchScriptContent(humanId, writeContentChunk, contentLength);
+                                    esp_task_wdt_reset(); // After fetchScriptContent call
+
+                                    if (contentStatus == FetchResultStatus::SUCCESS) {
+                                        log_i("FetchTask: Saving content for '%s' (length: %u bytes)", humanId, contentLength);
+                                        if (!g_scriptManager->commitScriptContentWrite()) {
                                             log_e("FetchTask: Failed to save content for '%s'", humanId);
                                             allContentFetched = false; failCount++;
                                         } else {
                                             log_i("FetchTask: Successfully saved content for '%s'", humanId);
                                             successCount++;
+                                            // Recorded so that the next sync skips it until its content changes on the server
+                                            if (scriptInfo["contentHash"].is<const char*>()) {
+                                                scriptInfo["contentVersion"] = scriptInfo["contentHash"].as<String>();
+                                            }
                                         }
                                         esp_task_wdt_reset(); // After saving script content
                                     } else if (contentStatus == FetchResultStatus::INTERRUPTED_BY_USER) {
                                         log_i("FetchTask: Content fetch for '%s' interrupted by user", humanId);
+                                        g_scriptManager->abortScriptContentWrite(); // Keeps the previous content
                                         resultData.status = FetchResultStatus::INTERRUPTED_BY_USER;
                                         allContentFetched = false; break;
                                     } else {
                                         log_e("FetchTask: Failed to fetch content for '%s' (status: %d)", humanId, (int)contentStatus);
+                                        g_scriptManager->abortScriptContentWrite(); // Keeps the previous content
                                         allContentFetched = false; failCount++;
                                     }
                                     if (user_interrupt_flag_for_network_manager) {
@@ -987,7 +1289,17 @@ void FetchTask_Function(void *pvParameters) {
                                         break;
                                     }
                                 }
-                                log_i("FetchTask: Content fetch complete - Success: %d, Failed: %d, Total: %d", successCount, failCount, (int)serverList.size());
+                                log_i("FetchTask: Content fetch complete - Success: %d (unchanged: %d), Failed: %d, Total: %d",
+                                      successCount, unchangedCount, failCount, (int)serverList.size());
+                                if (successCount > unchangedCount) {
+                                    esp_task_wdt_reset(); // Before saving the downloaded content versions
+                                    if (!g_scriptManager->saveScriptList(serverListDoc)) {
+                                        log_w("FetchTask: Failed to save content versions, the next sync downloads them again");
+                                    }
+                                }
+                                if (successCount > unchangedCount || g_scriptManager->getContentGeneration() != contentGenerationBefore) {
+                                    resultData.new_scripts_available = true; // Changed content counts, not only a changed list
+                                }
 
                                 if (resultData.status != FetchResultStatus::INTERRUPTED_BY_USER) {
                                     if (allContentFetched) {
@@ -1010,7 +1322,7 @@ void FetchTask_Function(void *pvParameters) {
                     resultData.message = "Fetch List Fail";
                 }
                 esp_task_wdt_reset(); // Before disconnect
-                g_networkManager->disconnectWiFi();
+                g_networkManager->disconnectWiFi(); // Also ends the sync session and its TLS connection
                 esp_task_wdt_reset(); // After disconnect
             } // End if WiFi connected
 
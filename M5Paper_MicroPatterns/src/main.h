@@ -19,6 +19,7 @@
 #include "script_manager.h" // Also brings in JSON_DOC_CAPACITY_SCRIPT_LIST, JSON_DOC_CAPACITY_SCRIPT_STATES
 #include "network_manager.h"
 #include "render_controller.h"
+#include "boot_snapshot.h"
 
 // --- Task Configuration ---
 #define MAIN_CONTROL_TASK_PRIORITY (tskIDLE_PRIORITY + 2)
@@ -1,5 +1,6 @@
 #include "matrix_utils.h"
 #include <cstring> // For memcpy
+#include <cstdlib> // For abs
 
 void matrix_identity(float M[6]) {
     M[0] = 1.0f; M[1] = 0.0f;
@@ -60,4 +61,34 @@ void matrix_make_rotation(float M[6], float degrees) {
     matrix_identity(M);
     M[0] = c;  M[1] = s;
     M[2] = -s; M[3] = c;
-}
\ No newline at end of file
+}
+
+bool matrix_to_integer(const float M[6], int out[6]) {
+    for (int i = 0; i < 6; ++i) {
+        float r = roundf(M[i]);
+        // Linear part: absolute tolerance. Translation: relative, as rotation noise scales with it.
+        float tolerance = i < 4 ? 1e-5f : 1e-5f * std::max(1.0f, fabsf(M[i]));
+        if (!(fabsf(M[i] - r) <= tolerance) || fabsf(r) > 1048576.0f) return false;
+        out[i] = static_cast<int>(r);
+    }
+    return true;
+}
+
+TransformClass matrix_classify(const float M[6]) {
+    int I[6];
+    if (!matrix_to_integer(M, I)) return TRANSFORM_GENERAL;
+    if (I[0] == 1 && I[1] == 0 && I[2] == 0 && I[3] == 1) {
+        return (I[4] == 0 && I[5] == 0) ? TRANSFORM_IDENTITY : TRANSFORM_TRANSLATE;
+    }
+    // Signed permutation: one unit entry per row and column
+    bool diagonal = I[1] == 0 && I[2] == 0 && abs(I[0]) == 1 && abs(I[3]) == 1;
+    bool antiDiagonal = I[0] == 0 && I[3] == 0 && abs(I[1]) == 1 && abs(I[2]) == 1;
+    return (diagonal || antiDiagonal) ? TRANSFORM_QUARTER_TURN : TRANSFORM_GENERAL;
+}
+
+TransformClass matrix_classify_with_scale(TransformClass matrixClass, float scaleFactor) {
+    if (matrixClass == TRANSFORM_GENERAL) return TRANSFORM_GENERAL;
+    if (scaleFactor < 1.0f || scaleFactor > 4096.0f || scaleFactor != floorf(scaleFactor)) return TRANSFORM_GENERAL;
+    if (scaleFactor != 1.0f && matrixClass < TRANSFORM_SCALE) return TRANSFORM_SCALE;
+    return matrixClass;
+}
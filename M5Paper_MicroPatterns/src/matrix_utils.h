@@ -3,6 +3,7 @@
 
 #include <cmath> // For sinf, cosf, sqrtf
 #include <algorithm> // For std::min, std::max
+#include <stdint.h>
 
 // Represents a 2D affine transformation matrix:
 // [m0, m1, m2, m3, m4, m5] corresponds to:
@@ -31,6 +32,26 @@ void matrix_make_translation(float M[6], float dx, float dy);
 // Creates a rotation matrix in M (around 0,0) for angle in degrees
 void matrix_make_rotation(float M[6], float degrees);
 
+// Transform classes, from the cheapest rendering kernel to the fully general one.
+// Everything but TRANSFORM_GENERAL maps pixel centers exactly with integer math.
+enum TransformClass : uint8_t {
+    TRANSFORM_IDENTITY = 0,     // Identity matrix, scale 1
+    TRANSFORM_TRANSLATE,        // Integer translation, scale 1
+    TRANSFORM_SCALE,            // Integer translation, integer scale > 1
+    TRANSFORM_QUARTER_TURN,     // Rotation by a multiple of 90 degrees, integer translation and scale
+    TRANSFORM_GENERAL
+};
+
+// Rounds M to integers. Returns false unless every entry is an integer up to float noise
+// (sinf/cosf of multiples of 90 degrees are not exact zeros and ones).
+bool matrix_to_integer(const float M[6], int out[6]);
+
+// Classifies M alone: TRANSFORM_IDENTITY, TRANSLATE, QUARTER_TURN or GENERAL
+TransformClass matrix_classify(const float M[6]);
+
+// Refines a matrix class with the SCALE factor applied before the matrix
+TransformClass matrix_classify_with_scale(TransformClass matrixClass, float scaleFactor);
+
 // Constant for converting degrees to radians
 const float DEG_TO_RAD_FLOAT = M_PI / 180.0f;
 
@@ -5,7 +5,9 @@
 #include <vector>
 #include <list> // Added for std::list
 #include <map> // Use map for parameters
+#include <type_traits> // For std::is_trivially_copyable
 #include "matrix_utils.h" // For matrix_identity
+#include "render_arena.h" // For ArenaAllocator
 
 // Enum for command types
 enum CommandType {
@@ -47,41 +49,71 @@ struct ParamValue {
     ParamValue(String s, ValueType t = TYPE_STRING) : type(t), stringValue(s) {}
 };
 
+// Containers of the parsed command tree. They draw from the RenderArena current when they are
+// constructed (see RenderController::compileScript), so a whole parse is released at once.
+typedef std::vector<ParamValue, ArenaAllocator<ParamValue> > ParamList;
+typedef std::map<String, ParamValue, std::less<String>, ArenaAllocator<std::pair<const String, ParamValue> > > ParamMap;
+struct MicroPatternsCommand;
+typedef std::list<MicroPatternsCommand, ArenaAllocator<MicroPatternsCommand> > CommandList;
+
 // Structure for a parsed command
 struct MicroPatternsCommand {
     CommandType type = CMD_UNKNOWN;
     int lineNumber = 0;
-    std::map<String, ParamValue> params; // Use map for named parameters (Key = UPPERCASE NAME)
+    ParamMap params; // Use map for named parameters (Key = UPPERCASE NAME)
 
     // --- Fields for specific commands ---
 
     // For VAR command
     String varName; // UPPERCASE, no '$'
-    std::vector<ParamValue> initialExpressionTokens; // Stores tokenized expression (numbers, $VARS, operators)
+    ParamList initialExpressionTokens; // Stores tokenized expression (numbers, $VARS, operators)
 
     // For LET command
     String letTargetVar; // UPPERCASE, no '$'
-    std::vector<ParamValue> letExpressionTokens; // Stores tokenized expression
+    ParamList letExpressionTokens; // Stores tokenized expression
 
     // For REPEAT command
     ParamValue count; // Stores the parsed COUNT value (int or variable)
-    std::list<MicroPatternsCommand> nestedCommands; // Stores commands inside the REPEAT block
+    CommandList nestedCommands; // Stores commands inside the REPEAT block
 
     // For IF command
-    std::vector<ParamValue> conditionTokens; // Stores tokenized condition expression
-    std::list<MicroPatternsCommand> thenCommands;
-    std::list<MicroPatternsCommand> elseCommands; // Populated only if ELSE is present
+    ParamList conditionTokens; // Stores tokenized condition expression
+    CommandList thenCommands;
+    CommandList elseCommands; // Populated only if ELSE is present
 
     MicroPatternsCommand(CommandType t = CMD_UNKNOWN, int line = 0) : type(t), lineNumber(line) {}
 };
 
+// Run of set bits [start, end) within one asset row
+struct MicroPatternsAssetRun {
+    uint16_t start;
+    uint16_t end;
+};
+
 // Structure for defined patterns/assets
+// Pattern bitmap, packed and analysed once by the parser (MicroPatternsParser::parseDefinePattern)
 struct MicroPatternsAsset {
     String name; // Uppercase name (used as key)
     String originalName; // Original case name for display/errors
     int width = 0;
     int height = 0;
-    std::vector<uint8_t> data; // 0 or 1
+
+    // 1bpp rows of wordsPerRow words; pixel x of a row is bit (31 - (x & 31)) of word x >> 5.
+    // Padding bits past 'width' are zero.
+    std::vector<uint32_t> bits;
+    int wordsPerRow = 0;
+
+    bool isOpaque = false; // Every pixel set: a DRAW covers its whole box
+    // Tight bounds of the set pixels, max exclusive. Empty (minX == maxX) if no pixel is set.
+    int bboxMinX = 0, bboxMinY = 0, bboxMaxX = 0, bboxMaxY = 0;
+    // Set-pixel runs of row y are runs[rowRunStart[y] .. rowRunStart[y + 1])
+    std::vector<MicroPatternsAssetRun> runs;
+    std::vector<uint32_t> rowRunStart;
+
+    bool isValid() const { return width > 0 && height > 0 && bits.size() >= (size_t)wordsPerRow * height; }
+    const uint32_t* row(int y) const { return bits.data() + y * wordsPerRow; }
+    // 1 if pixel (x, y) is set; x and y must be in range
+    inline uint8_t bit(int x, int y) const { return (row(y)[x >> 5] >> (31 - (x & 31))) & 1; }
 };
 
 // Structure for drawing state
@@ -111,28 +143,86 @@ struct MicroPatternsState {
     }
 };
 
-// Structure for an item in the display list
+// Structure for an item in the display list.
+// Kept trivially copyable and allocation-free: operands are resolved by the runtime
+// into a per-type union, and DRAW references its asset directly. Items are stored
+// contiguously in a std::vector, so a list of thousands of items is one allocation.
 struct DisplayListItem {
     CommandType type = CMD_UNKNOWN;
     int sourceLine = 0;
 
-    // Resolved parameters
-    std::map<String, int> intParams;
-    std::map<String, String> stringParams; // For asset names, color keywords etc.
+    // Resolved operands (logical coordinates). Which member is valid depends on 'type'.
+    union {
+        struct { int x, y; } pixel;                                  // CMD_PIXEL, CMD_FILL_PIXEL
+        struct { int x1, y1, x2, y2; } line;                         // CMD_LINE
+        struct { int x, y, width, height; } rect;                    // CMD_RECT, CMD_FILL_RECT
+        struct { int x, y, radius; } circle;                         // CMD_CIRCLE, CMD_FILL_CIRCLE
+        struct { int x, y; const MicroPatternsAsset* asset; } draw;  // CMD_DRAW (asset never null)
+    };
 
     // Snapshotted rendering state
     float matrix[6];
     float inverseMatrix[6];
     float scaleFactor = 1.0f;
     uint8_t color = 15; // Resolved color (0=white, 15=black)
+    uint8_t transformClass = TRANSFORM_IDENTITY; // Of matrix + scaleFactor, picks the drawing kernel
     const MicroPatternsAsset* fillAsset = nullptr; // Pointer to asset, or nullptr for SOLID
 
     bool isOpaque = false; // Hint for occlusion culling
+    bool dependsOnInput = true; // May change with $HOUR/$MINUTE/$SECOND/$COUNTER (runtime analysis)
+
+    // Instancing (REPEAT bodies affine in $INDEX): the item stands for 'instanceCount' copies,
+    // copy i adding i * instanceDelta[k] to int operand k. The renderer expands copies lazily.
+    int32_t instanceCount = 1;
+    int32_t instanceDelta[4];
 
     DisplayListItem() {
+        rect.x = rect.y = rect.width = rect.height = 0; // Largest int-only member, zeroes all operands
+        draw.asset = nullptr;
+        instanceDelta[0] = instanceDelta[1] = instanceDelta[2] = instanceDelta[3] = 0;
         matrix_identity(matrix);
         matrix_identity(inverseMatrix);
     }
+
+    // Int operands in member order (x, y, ...): every union member starts with them
+    int* operands() { return &rect.x; }
+    const int* operands() const { return &rect.x; }
+    int operandCount() const {
+        switch (type) {
+            case CMD_LINE: case CMD_RECT: case CMD_FILL_RECT: return 4;
+            case CMD_CIRCLE: case CMD_FILL_CIRCLE: return 3;
+            case CMD_PIXEL: case CMD_FILL_PIXEL: case CMD_DRAW: return 2;
+            default: return 0;
+        }
+    }
+
+    // Copy 'index' of an instanced item as a plain item. Wraps like the runtime's int32 arithmetic.
+    void expandInstance(int32_t index, DisplayListItem& out) const {
+        out = *this;
+        out.instanceCount = 1;
+        int* ops = out.operands();
+        for (int k = 0; k < operandCount(); ++k) {
+            ops[k] = static_cast<int32_t>(static_cast<uint32_t>(ops[k]) +
+                                          static_cast<uint32_t>(index) * static_cast<uint32_t>(instanceDelta[k]));
+        }
+    }
+
+    // True if both items rasterise the same pixels (ignores sourceLine and derived fields)
+    bool drawsSameAs(const DisplayListItem& other) const {
+        if (type != other.type || instanceCount != other.instanceCount || color != other.color ||
+            scaleFactor != other.scaleFactor || fillAsset != other.fillAsset) return false;
+        if (type == CMD_DRAW && draw.asset != other.draw.asset) return false;
+        for (int k = 0; k < 6; ++k) {
+            if (matrix[k] != other.matrix[k]) return false;
+        }
+        for (int k = 0; k < operandCount(); ++k) {
+            if (operands()[k] != other.operands()[k]) return false;
+            if (instanceCount > 1 && instanceDelta[k] != other.instanceDelta[k]) return false;
+        }
+        return true;
+    }
 };
 
+static_assert(std::is_trivially_copyable<DisplayListItem>::value, "DisplayListItem must stay trivially copyable");
+
 #endif // MICROPATTERNS_COMMAND_H
\ No newline at end of file
@@ -0,0 +1,528 @@
+#include "micropatterns_compiler.h"
+#include "micropatterns_optimizer.h"
+#include "esp32-hal-log.h"
+
+const uint8_t COMPILER_COLOR_WHITE = 0;
+const uint8_t COMPILER_COLOR_BLACK = 15;
+
+void MicroPatternsProgram::clear() {
+    instructions.clear();
+    expressions.clear();
+    assets.clear();
+    matrices.clear();
+    slotNames.clear();
+    slotCount = SLOT_FIRST_USER;
+    buildId = 0;
+    inputMask = 0;
+}
+
+bool MicroPatternsProgram::appendExpression(const std::vector<ExprOp>& ops, ExprRef& outRef) {
+    outRef = ExprRef();
+    if (ops.empty()) return true;
+    if (expressions.size() + ops.size() > 0xFFFF) return false;
+    outRef.start = expressions.size();
+    outRef.length = ops.size();
+    expressions.insert(expressions.end(), ops.begin(), ops.end());
+    return true;
+}
+
+MicroPatternsCompiler::MicroPatternsCompiler()
+    : _program(nullptr), _optimizer(nullptr), _repeatDepth(0), _warningCount(0), _overflow(false) {
+}
+
+void MicroPatternsCompiler::compileError(const String& message, int lineNumber) {
+    log_e("Compile Error (Line %d): %s", lineNumber, message.c_str());
+    _warningCount++;
+}
+
+bool MicroPatternsCompiler::compile(const CommandList& commands,
+                                    const std::set<String>& declaredVariables,
+                                    const std::map<String, MicroPatternsAsset>& assets,
+                                    MicroPatternsProgram& outProgram) {
+    static uint32_t s_lastBuildId = 0;
+    outProgram.clear();
+    outProgram.buildId = ++s_lastBuildId;
+    _program = &outProgram;
+    _slotByName.clear();
+    _repeatDepth = 0;
+    _warningCount = 0;
+    _overflow = false;
+
+    // Assets are copied so instruction pointers stay valid after the parser is reset.
+    _program->assets = assets;
+
+    // Environment slots first, then one slot per declared variable.
+    static const char* const envNames[SLOT_FIRST_USER] = {
+        "$WIDTH", "$HEIGHT", "$HOUR", "$MINUTE", "$SECOND", "$COUNTER", "$INDEX"
+    };
+    for (int i = 0; i < SLOT_FIRST_USER; ++i) {
+        _program->slotNames.push_back(envNames[i]);
+        _slotByName[envNames[i]] = i;
+    }
+    for (const String& name : declaredVariables) { // UPPERCASE, no '$'
+        String key = "$" + name;
+        _slotByName[key] = _program->slotNames.size();
+        _program->slotNames.push_back(key);
+    }
+    _program->slotCount = _program->slotNames.size();
+
+    MicroPatternsIrBlock ir;
+    compileBlock(commands, ir);
+
+    if (_optimizer && !_overflow) {
+        _optimizer->optimize(ir, *_program);
+    }
+
+    // Linearise into a fresh, compacted expression pool
+    std::vector<ExprOp> pool;
+    pool.reserve(_program->expressions.size());
+    linearizeBlock(ir, pool);
+    _program->expressions.swap(pool);
+
+    MicroPatternsInstruction halt;
+    halt.op = OP_HALT;
+    emit(halt);
+
+    _program = nullptr;
+    if (_overflow) {
+        log_e("Compile failed: script too large for the expression pool.");
+        outProgram.clear();
+        return false;
+    }
+    for (const ExprOp& op : outProgram.expressions) { // Only live expressions remain after linearisation
+        if (op.code == EXPR_SLOT && op.value >= SLOT_HOUR && op.value <= SLOT_COUNTER) {
+            outProgram.inputMask |= 1u << op.value;
+        }
+    }
+    log_i("Compiled program: %d instructions, %d expression ops, %d slots, %d diagnostics.",
+          (int)outProgram.instructions.size(), (int)outProgram.expressions.size(), outProgram.slotCount, _warningCount);
+    return true;
+}
+
+int MicroPatternsCompiler::emit(const MicroPatternsInstruction& instr) {
+    _program->instructions.push_back(instr);
+    return _program->instructions.size() - 1;
+}
+
+void MicroPatternsCompiler::appendInstruction(const MicroPatternsInstruction& instr, MicroPatternsIrBlock& out) {
+    out.push_back(MicroPatternsIrNode());
+    out.back().instr = instr;
+}
+
+void MicroPatternsCompiler::compileBlock(const CommandList& commands, MicroPatternsIrBlock& out) {
+    for (const auto& cmd : commands) {
+        compileCommand(cmd, out);
+    }
+}
+
+// --- Linearisation ---
+
+ExprRef MicroPatternsCompiler::copyExpression(const ExprRef& ref, std::vector<ExprOp>& pool) {
+    ExprRef copy;
+    if (ref.length == 0) return copy;
+    if (pool.size() + ref.length > 0xFFFF) {
+        _overflow = true;
+        return copy;
+    }
+    copy.start = pool.size();
+    copy.length = ref.length;
+    pool.insert(pool.end(), _program->expressions.begin() + ref.start, _program->expressions.begin() + ref.start + ref.length);
+    return copy;
+}
+
+void MicroPatternsCompiler::relocate(MicroPatternsInstruction& instr, std::vector<ExprOp>& pool) {
+    for (int i = 0; i < 4; ++i) {
+        instr.args[i] = copyExpression(instr.args[i], pool);
+    }
+}
+
+void MicroPatternsCompiler::linearizeBlock(const MicroPatternsIrBlock& block, std::vector<ExprOp>& pool) {
+    for (const auto& node : block) {
+        MicroPatternsInstruction instr = node.instr;
+        relocate(instr, pool);
+
+        if (instr.op == OP_REPEAT_BEGIN) {
+            int beginIndex = emit(instr);
+            linearizeBlock(node.body, pool);
+
+            MicroPatternsInstruction endInstr;
+            endInstr.op = OP_REPEAT_END;
+            endInstr.type = CMD_ENDREPEAT;
+            endInstr.lineNumber = instr.lineNumber;
+            endInstr.target = beginIndex + 1;
+            int endIndex = emit(endInstr);
+            _program->instructions[beginIndex].target = endIndex + 1;
+        } else if (instr.op == OP_JUMP_IF_FALSE) {
+            int branchIndex = emit(instr);
+            linearizeBlock(node.body, pool);
+            if (node.elseBody.empty()) {
+                _program->instructions[branchIndex].target = _program->instructions.size();
+                continue;
+            }
+            MicroPatternsInstruction skipElse;
+            skipElse.op = OP_JUMP;
+            skipElse.type = CMD_ELSE;
+            skipElse.lineNumber = instr.lineNumber;
+            int skipIndex = emit(skipElse);
+            _program->instructions[branchIndex].target = _program->instructions.size();
+            linearizeBlock(node.elseBody, pool);
+            _program->instructions[skipIndex].target = _program->instructions.size();
+        } else {
+            emit(instr);
+        }
+    }
+}
+
+// --- Expressions ---
+
+ExprRef MicroPatternsCompiler::commitExpression(const std::vector<ExprOp>& ops) {
+    ExprRef ref;
+    if (!_program->appendExpression(ops, ref)) {
+        _overflow = true;
+    }
+    return ref;
+}
+
+ExprRef MicroPatternsCompiler::compileConst(int value) {
+    std::vector<ExprOp> ops(1);
+    ops[0].code = EXPR_CONST;
+    ops[0].value = value;
+    return commitExpression(ops);
+}
+
+// Appends the op for a single value token. Mirrors the runtime's variable resolution:
+// any problem is reported and the value becomes 0.
+bool MicroPatternsCompiler::appendValueOp(const ParamValue& val, int lineNumber, std::vector<ExprOp>& out) {
+    ExprOp op;
+    op.code = EXPR_CONST;
+    op.value = 0;
+    bool ok = true;
+    if (val.type == ParamValue::TYPE_INT) {
+        op.value = val.intValue;
+    } else if (val.type == ParamValue::TYPE_VARIABLE) {
+        String varName = val.stringValue;
+        varName.toUpperCase();
+        auto it = _slotByName.find(varName);
+        if (varName == "$INDEX" && _repeatDepth == 0) {
+            compileError("Variable $INDEX can only be used inside a REPEAT loop.", lineNumber);
+            ok = false;
+        } else if (it == _slotByName.end()) {
+            compileError("Undefined variable: " + val.stringValue, lineNumber);
+            ok = false;
+        } else {
+            op.code = EXPR_SLOT;
+            op.value = it->second;
+        }
+    } else {
+        compileError("Expected integer or variable, got: " + val.stringValue, lineNumber);
+        ok = false;
+    }
+    out.push_back(op);
+    return ok;
+}
+
+ExprRef MicroPatternsCompiler::compileValue(const ParamValue& val, int lineNumber) {
+    std::vector<ExprOp> ops;
+    appendValueOp(val, lineNumber, ops);
+    return commitExpression(ops);
+}
+
+static int operatorPrecedence(const String& op) {
+    if (op == "*" || op == "/" || op == "%") return 2;
+    if (op == "+" || op == "-") return 1;
+    return 0;
+}
+
+static ExprOpCode operatorCode(const String& op) {
+    if (op == "+") return EXPR_ADD;
+    if (op == "-") return EXPR_SUB;
+    if (op == "*") return EXPR_MUL;
+    if (op == "/") return EXPR_DIV;
+    return EXPR_MOD;
+}
+
+// Lowers an infix token list to RPN. The structural checks replicate the runtime's
+// two-pass evaluator exactly, so any token list it rejected compiles to constant 0.
+ExprRef MicroPatternsCompiler::compileExpression(const ParamList& tokens, int lineNumber) {
+    if (tokens.empty()) return ExprRef();
+
+    for (const auto& token : tokens) {
+        if (token.type != ParamValue::TYPE_INT && token.type != ParamValue::TYPE_VARIABLE && token.type != ParamValue::TYPE_OPERATOR) {
+            compileError("Unexpected token type in expression: " + token.stringValue, lineNumber);
+            return compileConst(0);
+        }
+    }
+    if (tokens.front().type == ParamValue::TYPE_OPERATOR || tokens.back().type == ParamValue::TYPE_OPERATOR) {
+        return compileConst(0);
+    }
+
+    // Pass 1 check (* / %): both neighbours must be values.
+    std::vector<bool> pass1IsValue;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        const ParamValue& token = tokens[i];
+        if (token.type == ParamValue::TYPE_OPERATOR && operatorPrecedence(token.stringValue) == 2) {
+            if (pass1IsValue.empty() || !pass1IsValue.back() || i + 1 >= tokens.size() || tokens[i + 1].type == ParamValue::TYPE_OPERATOR) {
+                compileError("Syntax error with operator " + token.stringValue, lineNumber);
+                return compileConst(0);
+            }
+            i++; // Right operand folds into the value already on pass1IsValue
+        } else {
+            pass1IsValue.push_back(token.type != ParamValue::TYPE_OPERATOR);
+        }
+    }
+    // Pass 2 check (+ -): value (op value)*
+    for (size_t i = 1; i < pass1IsValue.size(); i += 2) {
+        if (i + 1 >= pass1IsValue.size() || pass1IsValue[i] || !pass1IsValue[i + 1]) {
+            compileError("Syntax error in expression (AS pass).", lineNumber);
+            return compileConst(0);
+        }
+    }
+    for (const auto& token : tokens) {
+        if (token.type == ParamValue::TYPE_OPERATOR && operatorPrecedence(token.stringValue) == 0) {
+            compileError("Unexpected operator in AS pass: " + token.stringValue, lineNumber);
+            return compileConst(0);
+        }
+    }
+
+    // Shunting-yard; all operators are left-associative.
+    std::vector<ExprOp> output;
+    std::vector<const String*> opStack;
+    for (const auto& token : tokens) {
+        if (token.type != ParamValue::TYPE_OPERATOR) {
+            appendValueOp(token, lineNumber, output);
+            continue;
+        }
+        int prec = operatorPrecedence(token.stringValue);
+        while (!opStack.empty() && operatorPrecedence(*opStack.back()) >= prec) {
+            ExprOp op;
+            op.code = operatorCode(*opStack.back());
+            op.value = 0;
+            output.push_back(op);
+            opStack.pop_back();
+        }
+        opStack.push_back(&token.stringValue);
+    }
+    while (!opStack.empty()) {
+        ExprOp op;
+        op.code = operatorCode(*opStack.back());
+        op.value = 0;
+        output.push_back(op);
+        opStack.pop_back();
+    }
+    return commitExpression(output);
+}
+
+ExprRef MicroPatternsCompiler::compileIntParam(const String& paramName, const ParamMap& params, int defaultValue, int lineNumber) {
+    auto it = params.find(paramName); // paramName is already UPPERCASE
+    if (it != params.end()) {
+        const ParamValue& val = it->second;
+        if (val.type == ParamValue::TYPE_INT || val.type == ParamValue::TYPE_VARIABLE) {
+            return compileValue(val, lineNumber);
+        }
+        compileError("Parameter " + paramName + " requires an integer or variable.", lineNumber);
+    }
+    return compileConst(defaultValue);
+}
+
+bool MicroPatternsCompiler::compileCondition(const ParamList& tokens, int lineNumber, ExprRef& left, ExprRef& right, ComparisonOp& op) {
+    if (tokens.empty()) { compileError("Empty condition.", lineNumber); return false; }
+
+    int comparisonOpIndex = -1;
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        if (tokens[i].type != ParamValue::TYPE_OPERATOR) continue;
+        const String& opStr = tokens[i].stringValue;
+        ComparisonOp found;
+        if (opStr == "==") found = CMP_EQ;
+        else if (opStr == "!=") found = CMP_NE;
+        else if (opStr == "<") found = CMP_LT;
+        else if (opStr == ">") found = CMP_GT;
+        else if (opStr == "<=") found = CMP_LE;
+        else if (opStr == ">=") found = CMP_GE;
+        else continue;
+        if (comparisonOpIndex != -1) { compileError("Multiple comparison operators.", lineNumber); return false; }
+        comparisonOpIndex = i;
+        op = found;
+    }
+    if (comparisonOpIndex == -1) { compileError("No comparison operator in condition.", lineNumber); return false; }
+
+    ParamList leftTokens(tokens.begin(), tokens.begin() + comparisonOpIndex);
+    ParamList rightTokens(tokens.begin() + comparisonOpIndex + 1, tokens.end());
+    if (leftTokens.empty() || rightTokens.empty()) { compileError("Missing operand in condition.", lineNumber); return false; }
+
+    left = compileExpression(leftTokens, lineNumber);
+    right = compileExpression(rightTokens, lineNumber);
+    return true;
+}
+
+// --- Parameters resolved at compile time ---
+
+String MicroPatternsCompiler::resolveStringParam(const String& paramName, const ParamMap& params, const String& defaultValue, int lineNumber) {
+    auto it = params.find(paramName);
+    if (it != params.end()) {
+        if (it->second.type == ParamValue::TYPE_STRING) {
+            return it->second.stringValue;
+        }
+        compileError("Parameter " + paramName + " requires a string/keyword.", lineNumber);
+    }
+    return defaultValue;
+}
+
+String MicroPatternsCompiler::resolveAssetNameParam(const String& paramName, const ParamMap& params, int lineNumber) {
+    auto it = params.find(paramName);
+    if (it != params.end()) {
+        if (it->second.type == ParamValue::TYPE_STRING) {
+            String nameValue = it->second.stringValue;
+            nameValue.toUpperCase();
+            return nameValue; // SOLID or UPPERCASE pattern name
+        }
+        compileError("Parameter " + paramName + " requires SOLID or a pattern name string.", lineNumber);
+    }
+    return "SOLID"; // Default
+}
+
+const MicroPatternsAsset* MicroPatternsCompiler::findAsset(const String& upperName) const {
+    if (upperName == "SOLID") return nullptr;
+    auto it = _program->assets.find(upperName);
+    return it == _program->assets.end() ? nullptr : &it->second;
+}
+
+// --- Commands ---
+
+void MicroPatternsCompiler::compileCommand(const MicroPatternsCommand& cmd, MicroPatternsIrBlock& out) {
+    MicroPatternsInstruction instr;
+    instr.type = cmd.type;
+    instr.lineNumber = cmd.lineNumber;
+
+    switch (cmd.type) {
+        case CMD_VAR:
+        case CMD_LET: {
+            const String& name = (cmd.type == CMD_VAR) ? cmd.varName : cmd.letTargetVar;
+            auto it = _slotByName.find("$" + name);
+            if (it == _slotByName.end() || it->second < SLOT_FIRST_USER) {
+                compileError(String(cmd.type == CMD_VAR ? "VAR" : "LET") + ": Undeclared variable: $" + name, cmd.lineNumber);
+                return;
+            }
+            instr.op = (cmd.type == CMD_VAR) ? OP_VAR : OP_LET;
+            instr.target = it->second;
+            instr.args[0] = compileExpression(cmd.type == CMD_VAR ? cmd.initialExpressionTokens : cmd.letExpressionTokens, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        }
+        case CMD_COLOR: {
+            String colorName = resolveStringParam("NAME", cmd.params, "BLACK", cmd.lineNumber);
+            colorName.toUpperCase();
+            instr.op = OP_COLOR;
+            instr.aux = (colorName == "WHITE") ? COMPILER_COLOR_WHITE : COMPILER_COLOR_BLACK;
+            appendInstruction(instr, out);
+            return;
+        }
+        case CMD_FILL: {
+            String fillName = resolveAssetNameParam("NAME", cmd.params, cmd.lineNumber);
+            instr.op = OP_FILL;
+            instr.asset = findAsset(fillName);
+            if (fillName != "SOLID" && !instr.asset) {
+                compileError("Undefined fill pattern: " + fillName, cmd.lineNumber);
+            }
+            appendInstruction(instr, out);
+            return;
+        }
+        case CMD_RESET_TRANSFORMS:
+            instr.op = OP_RESET_TRANSFORMS;
+            appendInstruction(instr, out);
+            return;
+        case CMD_TRANSLATE:
+            instr.op = OP_TRANSLATE;
+            instr.args[0] = compileIntParam("DX", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("DY", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_ROTATE:
+            instr.op = OP_ROTATE;
+            instr.args[0] = compileIntParam("DEGREES", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_SCALE:
+            instr.op = OP_SCALE;
+            instr.args[0] = compileIntParam("FACTOR", cmd.params, 1, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+
+        // Drawing commands: operands in the same order as the DisplayListItem union members
+        case CMD_PIXEL:
+        case CMD_FILL_PIXEL:
+            instr.op = OP_EMIT;
+            instr.args[0] = compileIntParam("X", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("Y", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_LINE:
+            instr.op = OP_EMIT;
+            instr.args[0] = compileIntParam("X1", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("Y1", cmd.params, 0, cmd.lineNumber);
+            instr.args[2] = compileIntParam("X2", cmd.params, 0, cmd.lineNumber);
+            instr.args[3] = compileIntParam("Y2", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_RECT:
+        case CMD_FILL_RECT:
+            instr.op = OP_EMIT;
+            instr.args[0] = compileIntParam("X", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("Y", cmd.params, 0, cmd.lineNumber);
+            instr.args[2] = compileIntParam("WIDTH", cmd.params, 0, cmd.lineNumber);
+            instr.args[3] = compileIntParam("HEIGHT", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_CIRCLE:
+        case CMD_FILL_CIRCLE:
+            instr.op = OP_EMIT;
+            instr.args[0] = compileIntParam("X", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("Y", cmd.params, 0, cmd.lineNumber);
+            instr.args[2] = compileIntParam("RADIUS", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        case CMD_DRAW: {
+            String assetName = resolveAssetNameParam("NAME", cmd.params, cmd.lineNumber);
+            instr.asset = findAsset(assetName);
+            if (!instr.asset) {
+                compileError("DRAW: Invalid asset name '" + assetName + "'.", cmd.lineNumber);
+                return; // Invalid DRAW never reaches the display list
+            }
+            instr.op = OP_EMIT;
+            instr.args[0] = compileIntParam("X", cmd.params, 0, cmd.lineNumber);
+            instr.args[1] = compileIntParam("Y", cmd.params, 0, cmd.lineNumber);
+            appendInstruction(instr, out);
+            return;
+        }
+
+        // Control Flow
+        case CMD_REPEAT: {
+            instr.op = OP_REPEAT_BEGIN;
+            instr.args[0] = compileValue(cmd.count, cmd.lineNumber);
+            appendInstruction(instr, out);
+            _repeatDepth++;
+            compileBlock(cmd.nestedCommands, out.back().body);
+            _repeatDepth--;
+            return;
+        }
+        case CMD_IF: {
+            ComparisonOp cmp = CMP_EQ;
+            ExprRef left, right;
+            if (!compileCondition(cmd.conditionTokens, cmd.lineNumber, left, right, cmp)) {
+                // Invalid condition evaluates to false: only the ELSE branch can run
+                compileBlock(cmd.elseCommands, out);
+                return;
+            }
+            instr.op = OP_JUMP_IF_FALSE;
+            instr.args[0] = left;
+            instr.args[1] = right;
+            instr.aux = cmp;
+            appendInstruction(instr, out);
+            MicroPatternsIrNode& ifNode = out.back();
+            compileBlock(cmd.thenCommands, ifNode.body);
+            compileBlock(cmd.elseCommands, ifNode.elseBody);
+            return;
+        }
+        default: // CMD_UNKNOWN, CMD_DEFINE_PATTERN, CMD_NOOP, CMD_ENDREPEAT, CMD_ELSE, CMD_ENDIF
+            return;
+    }
+}
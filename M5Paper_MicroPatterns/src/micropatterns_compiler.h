@@ -0,0 +1,178 @@
+#ifndef MICROPATTERNS_COMPILER_H
+#define MICROPATTERNS_COMPILER_H
+
+#include <Arduino.h>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+#include "micropatterns_command.h" // For MicroPatternsCommand, MicroPatternsAsset, CommandType
+
+// --- Bytecode program produced by MicroPatternsCompiler and executed by MicroPatternsRuntime ---
+
+// Fixed variable slots for environment variables. User variables (VAR) follow at SLOT_FIRST_USER.
+enum EnvSlot {
+    SLOT_WIDTH = 0,
+    SLOT_HEIGHT,
+    SLOT_HOUR,
+    SLOT_MINUTE,
+    SLOT_SECOND,
+    SLOT_COUNTER,
+    SLOT_INDEX,      // Current REPEAT index; only referenced from inside REPEAT bodies
+    SLOT_FIRST_USER
+};
+
+// Expression opcodes. Expressions are stored in RPN form in the program's expression pool.
+enum ExprOpCode : uint8_t {
+    EXPR_CONST,  // push value
+    EXPR_SLOT,   // push slots[value]
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,    // Division by zero makes the whole expression evaluate to 0 (runtime error)
+    EXPR_MOD     // Modulo by zero makes the whole expression evaluate to 0 (runtime error)
+};
+
+struct ExprOp {
+    ExprOpCode code;
+    int32_t value; // Constant for EXPR_CONST, slot index for EXPR_SLOT, unused otherwise
+};
+
+// Reference to an RPN sequence in MicroPatternsProgram::expressions.
+struct ExprRef {
+    uint16_t start = 0;
+    uint16_t length = 0; // 0 = empty expression, evaluates to 0
+};
+
+// Maximum evaluation stack depth. With two precedence levels (* / % over + -) the RPN
+// produced by the compiler never needs more than 3 entries.
+const int EXPR_MAX_STACK_DEPTH = 4;
+
+enum ComparisonOp : uint8_t { CMP_EQ, CMP_NE, CMP_LT, CMP_GT, CMP_LE, CMP_GE };
+
+const int32_t REPEAT_INSTANCED = 1; // OP_REPEAT_BEGIN aux flag, set by the optimizer
+
+enum OpCode : uint8_t {
+    OP_VAR,              // slots[target] = eval(args[0]); marks the variable as declared
+    OP_SET,              // slots[target] = eval(args[0]); compiler temporaries (hoisted invariants)
+    OP_LET,              // slots[target] = eval(args[0]) if declared, runtime error otherwise
+    OP_COLOR,            // state.color = aux
+    OP_FILL,             // state.fillAsset = asset (nullptr for SOLID)
+    OP_RESET_TRANSFORMS,
+    OP_TRANSLATE,        // args[0]=DX, args[1]=DY
+    OP_ROTATE,           // args[0]=DEGREES
+    OP_SCALE,            // args[0]=FACTOR
+    OP_TRANSFORM,        // state.matrix *= program.matrices[aux..aux+5] (precomputed TRANSLATE/ROTATE sequence)
+    OP_EMIT,             // Emit a DisplayListItem of 'type'; operands in args[], asset for DRAW
+    OP_REPEAT_BEGIN,     // args[0]=COUNT; jumps to 'target' (past matching OP_REPEAT_END) if count <= 0.
+                         // aux=REPEAT_INSTANCED: the body is LET/SET and one OP_EMIT, affine in $INDEX (one instanced item)
+    OP_REPEAT_END,       // Next iteration: jumps to 'target' (first body instruction) while iterations remain
+    OP_JUMP_IF_FALSE,    // if !(eval(args[0]) aux eval(args[1])) jump to 'target'
+    OP_JUMP,             // jump to 'target'
+    OP_HALT
+};
+
+struct MicroPatternsInstruction {
+    OpCode op = OP_HALT;
+    CommandType type = CMD_UNKNOWN;  // Source command type (item type for OP_EMIT)
+    int lineNumber = 0;
+    ExprRef args[4];                 // Operand expressions, meaning depends on op/type
+    int32_t target = 0;              // Slot (VAR/LET) or instruction index (jumps/loops)
+    int32_t aux = 0;                 // Color (COLOR), ComparisonOp (JUMP_IF_FALSE), matrix offset (TRANSFORM) or loop flags (REPEAT_BEGIN)
+    const MicroPatternsAsset* asset = nullptr; // FILL pattern or DRAW asset (points into MicroPatternsProgram::assets)
+};
+
+// A compiled script. Owns a copy of the assets so instruction asset pointers stay valid
+// independently of the parser. Not copyable for the same reason.
+class MicroPatternsProgram {
+public:
+    MicroPatternsProgram() {}
+
+    std::vector<MicroPatternsInstruction> instructions; // Terminated by OP_HALT
+    std::vector<ExprOp> expressions;                    // RPN pool referenced by ExprRef
+    std::vector<float> matrices;                        // Precomputed matrices, 6 floats each (OP_TRANSFORM)
+    std::map<String, MicroPatternsAsset> assets;        // Key is UPPERCASE name
+    std::vector<String> slotNames;                      // "$NAME" per slot, for diagnostics
+    int slotCount = SLOT_FIRST_USER;
+    uint32_t buildId = 0;                               // Unique per compile (0 = never compiled), keys runtime caches
+    uint32_t inputMask = 0;                             // Bit (1 << slot) per input slot ($HOUR..$COUNTER) the code reads
+
+    // False if the output cannot depend on the input in 'slot' (SLOT_HOUR .. SLOT_COUNTER)
+    bool readsInput(int slot) const { return (inputMask >> slot) & 1; }
+
+    void clear();
+
+    // Appends an RPN sequence to the pool. Returns false if the 16-bit pool is full.
+    bool appendExpression(const std::vector<ExprOp>& ops, ExprRef& outRef);
+
+private:
+    MicroPatternsProgram(const MicroPatternsProgram&);            // Non-copyable
+    MicroPatternsProgram& operator=(const MicroPatternsProgram&); // Non-copyable
+};
+
+// Structured intermediate form built by the compiler before linearisation. Blocks stay
+// trees (REPEAT bodies, IF branches) so optimisation passes can insert, remove and clone
+// code without relocating jump targets.
+struct MicroPatternsIrNode {
+    MicroPatternsInstruction instr;              // OP_REPEAT_BEGIN: loop, OP_JUMP_IF_FALSE: IF, otherwise a plain instruction
+    std::list<MicroPatternsIrNode, ArenaAllocator<MicroPatternsIrNode> > body;     // REPEAT body or IF then-branch
+    std::list<MicroPatternsIrNode, ArenaAllocator<MicroPatternsIrNode> > elseBody; // IF else-branch
+};
+typedef std::list<MicroPatternsIrNode, ArenaAllocator<MicroPatternsIrNode> > MicroPatternsIrBlock; // Arena-backed like the command tree
+
+class MicroPatternsOptimizer;
+
+// Lowers the parser's command tree into a flat MicroPatternsProgram.
+// Static problems that the tree-walking runtime reported on every execution
+// (undefined variables, $INDEX outside REPEAT, malformed expressions, unknown patterns)
+// are reported once here and compiled to the same fallback values.
+class MicroPatternsCompiler {
+public:
+    MicroPatternsCompiler();
+
+    // Returns false only if the program could not be built (e.g. expression pool overflow).
+    bool compile(const CommandList& commands,
+                 const std::set<String>& declaredVariables,
+                 const std::map<String, MicroPatternsAsset>& assets,
+                 MicroPatternsProgram& outProgram);
+
+    int getWarningCount() const { return _warningCount; }
+
+    // Optional optimiser run on the intermediate form before linearisation (nullptr = none).
+    void setOptimizer(MicroPatternsOptimizer* optimizer) { _optimizer = optimizer; }
+
+private:
+    MicroPatternsProgram* _program;
+    MicroPatternsOptimizer* _optimizer;
+    std::map<String, int> _slotByName; // "$NAME" (uppercase) -> slot
+    int _repeatDepth;
+    int _warningCount;
+    bool _overflow;
+
+    void compileError(const String& message, int lineNumber);
+    void compileBlock(const CommandList& commands, MicroPatternsIrBlock& out);
+    void compileCommand(const MicroPatternsCommand& cmd, MicroPatternsIrBlock& out);
+    void appendInstruction(const MicroPatternsInstruction& instr, MicroPatternsIrBlock& out);
+
+    // Linearisation: flattens the IR into program instructions with resolved jump targets
+    // and compacts the expression pool to the expressions still referenced.
+    void linearizeBlock(const MicroPatternsIrBlock& block, std::vector<ExprOp>& pool);
+    void relocate(MicroPatternsInstruction& instr, std::vector<ExprOp>& pool);
+    int emit(const MicroPatternsInstruction& instr);
+
+    // Expression lowering
+    ExprRef compileConst(int value);
+    ExprRef compileValue(const ParamValue& val, int lineNumber);
+    ExprRef compileExpression(const ParamList& tokens, int lineNumber);
+    ExprRef compileIntParam(const String& paramName, const ParamMap& params, int defaultValue, int lineNumber);
+    bool compileCondition(const ParamList& tokens, int lineNumber, ExprRef& left, ExprRef& right, ComparisonOp& op);
+    bool appendValueOp(const ParamValue& val, int lineNumber, std::vector<ExprOp>& out);
+    ExprRef commitExpression(const std::vector<ExprOp>& ops);
+    ExprRef copyExpression(const ExprRef& ref, std::vector<ExprOp>& pool);
+
+    String resolveStringParam(const String& paramName, const ParamMap& params, const String& defaultValue, int lineNumber);
+    String resolveAssetNameParam(const String& paramName, const ParamMap& params, int lineNumber);
+    const MicroPatternsAsset* findAsset(const String& upperName) const;
+};
+
+#endif // MICROPATTERNS_COMPILER_H
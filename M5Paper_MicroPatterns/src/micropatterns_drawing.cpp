@@ -1,10 +1,11 @@
 #include "micropatterns_drawing.h"
-#include "micropatterns_drawing.h"
 #include <cmath> // For round, floor, ceil, sinf, cosf, fabs, sqrtf
 #include <algorithm> // For std::min, std::max
+#include <cstdlib> // For std::abs(int64_t)
 
 MicroPatternsDrawing::MicroPatternsDrawing(M5EPD_Canvas* canvas)
-    : _canvas(canvas), _interrupt_check_cb(nullptr), _usePixelOccupationMap(false), _overdrawSkippedPixels(0) {
+    : _canvas(canvas), _interruptFlag(nullptr), _usePixelOccupationMap(false), _overdrawSkippedPixels(0),
+      _pixelsWritten(0), _coverageSink(nullptr), _pixelsSinceYield(0), _yieldsSinceWdtReset(0) {
     if (_canvas) {
         _canvasWidth = _canvas->width();
         _canvasHeight = _canvas->height();
@@ -12,6 +13,11 @@ MicroPatternsDrawing::MicroPatternsDrawing(M5EPD_Canvas* canvas)
         _canvasWidth = 0;
         _canvasHeight = 0;
     }
+    _rowY0 = 0;
+    _rowY1 = _canvasHeight;
+    setClipRect(0, 0, _canvasWidth, _canvasHeight);
+    _raster.attach(_canvas);
+    _rowColors.assign(std::max(0, _canvasWidth), 0);
 }
 
 void MicroPatternsDrawing::setCanvas(M5EPD_Canvas* canvas) {
@@ -23,10 +29,11 @@ void MicroPatternsDrawing::setCanvas(M5EPD_Canvas* canvas) {
         _canvasWidth = 0;
         _canvasHeight = 0;
     }
-}
-
-void MicroPatternsDrawing::setInterruptCheckCallback(std::function<bool()> cb) {
-    _interrupt_check_cb = cb;
+    _rowY0 = 0;
+    _rowY1 = _canvasHeight;
+    setClipRect(0, 0, _canvasWidth, _canvasHeight);
+    _raster.attach(_canvas);
+    _rowColors.assign(std::max(0, _canvasWidth), 0);
 }
 
 void MicroPatternsDrawing::enablePixelOccupationMap(bool enable) {
@@ -36,45 +43,54 @@ void MicroPatternsDrawing::enablePixelOccupationMap(bool enable) {
     }
 }
 
+void MicroPatternsDrawing::setRowRange(int y0, int y1) {
+    _rowY0 = std::max(0, y0);
+    _rowY1 = std::max(_rowY0, std::min(_canvasHeight, y1));
+    setClipRect(0, _rowY0, _canvasWidth, _rowY1);
+    if (_usePixelOccupationMap) initPixelOccupationMap(); // Map covers the row range only
+}
+
+void MicroPatternsDrawing::setClipRect(int x0, int y0, int x1, int y1) {
+    _clipX0 = std::max(0, x0);
+    _clipX1 = std::max(_clipX0, std::min(_canvasWidth, x1));
+    _clipY0 = std::max(_rowY0, y0);
+    _clipY1 = std::max(_clipY0, std::min(_rowY1, y1));
+}
+
 void MicroPatternsDrawing::initPixelOccupationMap() {
-    if (_canvasWidth > 0 && _canvasHeight > 0) {
-        // Resize only if necessary or if size changed
-        if (_pixelOccupationMap.size() != (size_t)_canvasWidth * _canvasHeight) {
-            _pixelOccupationMap.resize((size_t)_canvasWidth * _canvasHeight, 0);
-        }
-        // No need to fill with 0 here, resetPixelOccupationMap will do it.
-    } else {
-        _pixelOccupationMap.clear();
-    }
+    _occupancy.resize(_canvasWidth, _rowY1 - _rowY0); // Clears it as well
 }
 
 void MicroPatternsDrawing::resetPixelOccupationMap() {
-    if (_usePixelOccupationMap && !_pixelOccupationMap.empty()) {
-        std::fill(_pixelOccupationMap.begin(), _pixelOccupationMap.end(), 0);
-    }
+    if (_usePixelOccupationMap) _occupancy.clear();
     _overdrawSkippedPixels = 0;
 }
 
 bool MicroPatternsDrawing::isPixelOccupied(int sx, int sy) const {
-    if (!_usePixelOccupationMap || sx < 0 || sx >= _canvasWidth || sy < 0 || sy >= _canvasHeight) {
+    if (!_usePixelOccupationMap || sx < 0 || sx >= _canvasWidth || sy < _rowY0 || sy >= _rowY1) {
         return false; // Not using map or out of bounds
     }
-    // Map should be initialized and sized correctly if _usePixelOccupationMap is true
-    if (_pixelOccupationMap.empty()) return false;
-    return _pixelOccupationMap[sy * _canvasWidth + sx] != 0;
+    if (!_occupancy.isAllocated()) return false;
+    return _occupancy.test(sx, sy - _rowY0);
 }
 
 void MicroPatternsDrawing::markPixelOccupied(int sx, int sy) {
-    if (!_usePixelOccupationMap || sx < 0 || sx >= _canvasWidth || sy < 0 || sy >= _canvasHeight) {
+    if (!_usePixelOccupationMap || sx < 0 || sx >= _canvasWidth || sy < _rowY0 || sy >= _rowY1) {
         return; // Not using map or out of bounds
     }
-    if (_pixelOccupationMap.empty()) return;
-    _pixelOccupationMap[sy * _canvasWidth + sx] = 1; // Mark as occupied (1 is sufficient)
+    if (!_occupancy.isAllocated()) return;
+    _occupancy.set(sx, sy - _rowY0);
 }
 
 void MicroPatternsDrawing::clearCanvas() {
-    if (_canvas) {
-        _canvas->fillCanvas(DRAWING_COLOR_WHITE);
+    if (_raster.isAttached()) {
+        if (_clipX0 == 0 && _clipX1 == _canvasWidth) {
+            _raster.clearRows(_clipY0, _clipY1, DRAWING_COLOR_WHITE);
+        } else {
+            for (int y = _clipY0; y < _clipY1; ++y) _raster.fillSpan(y, _clipX0, _clipX1, DRAWING_COLOR_WHITE);
+        }
+    } else if (_canvas) {
+        _canvas->fillRect(_clipX0, _clipY0, _clipX1 - _clipX0, _clipY1 - _clipY0, DRAWING_COLOR_WHITE);
     }
     if (_usePixelOccupationMap) {
         resetPixelOccupationMap(); // Also reset occupation map when canvas is cleared
@@ -106,7 +122,7 @@ void MicroPatternsDrawing::screenToLogicalBase(float screen_x, float screen_y, c
 // --- Raw Drawing ---
 void MicroPatternsDrawing::rawPixel(int sx, int sy, uint8_t color) {
     if (!_canvas) return;
-    if (sx >= 0 && sx < _canvasWidth && sy >= 0 && sy < _canvasHeight) {
+    if (sx >= _clipX0 && sx < _clipX1 && sy >= _clipY0 && sy < _clipY1) {
         if (_usePixelOccupationMap) {
             if (isPixelOccupied(sx, sy)) {
                 _overdrawSkippedPixels++;
@@ -114,34 +130,156 @@ void MicroPatternsDrawing::rawPixel(int sx, int sy, uint8_t color) {
             }
             markPixelOccupied(sx, sy);
         }
-        _canvas->drawPixel(sx, sy, color);
+        _pixelsWritten++;
+        if (_coverageSink) _coverageSink->markSpan(sy, sx, sx + 1);
+        if (_raster.isAttached()) _raster.setPixel(sx, sy, color);
+        else _canvas->drawPixel(sx, sy, color);
+    }
+}
+
+// Clips [sx0, sx1) on row sy and calls write(runStart, runEnd) for each stretch to draw.
+// With the occupation map enabled only the free stretches are written, and they are marked.
+template <typename Write>
+void MicroPatternsDrawing::forEachFreeRun(int sy, int sx0, int sx1, Write write) {
+    if (!_canvas || sy < _clipY0 || sy >= _clipY1) return;
+    sx0 = std::max(_clipX0, sx0);
+    sx1 = std::min(_clipX1, sx1);
+    if (sx0 >= sx1) return;
+
+    if (!_usePixelOccupationMap || !_occupancy.isAllocated()) {
+        if (_coverageSink) _coverageSink->markSpan(sy, sx0, sx1);
+        write(sx0, sx1);
+        _pixelsWritten += sx1 - sx0;
+        return;
+    }
+
+    int written = 0;
+    int runStart, runEnd;
+    for (int x = sx0; x < sx1 && _occupancy.findFreeRun(sy - _rowY0, x, sx1, runStart, runEnd); x = runEnd) {
+        _occupancy.markRange(sy - _rowY0, runStart, runEnd);
+        if (_coverageSink) _coverageSink->markSpan(sy, runStart, runEnd);
+        write(runStart, runEnd);
+        written += runEnd - runStart;
+    }
+    _overdrawSkippedPixels += (sx1 - sx0) - written;
+    _pixelsWritten += written;
+}
+
+// Writes [sx0, sx1) on row sy, either in one color or from colors[0 .. sx1-sx0)
+void MicroPatternsDrawing::rawSpan(int sy, int sx0, int sx1, uint8_t color, const uint8_t* colors) {
+    forEachFreeRun(sy, sx0, sx1, [&](int x0, int x1) {
+        writeSpan(sy, x0, x1, color, colors ? colors + (x0 - sx0) : nullptr);
+    });
+}
+
+// Writes [sx0, sx1) on row sy from the tile row for sy, copied in chunks of the tile width
+void MicroPatternsDrawing::rawTileSpan(int sy, int sx0, int sx1, const PatternTile& tile) {
+    const uint8_t* tileRow = tile.row(sy);
+    forEachFreeRun(sy, sx0, sx1, [&](int x0, int x1) {
+        while (x0 < x1) {
+            int offset = x0 % tile.width; // x0 >= 0 after clipping
+            int n = std::min(x1 - x0, tile.width - offset);
+            if (_raster.isAttached()) {
+                _raster.copySpan(sy, x0, x0 + n, tileRow, offset);
+            } else {
+                for (int i = 0; i < n; ++i) {
+                    uint8_t b = tileRow[(offset + i) >> 1];
+                    _canvas->drawPixel(x0 + i, sy, ((offset + i) & 1) ? (b & 0x0F) : (b >> 4));
+                }
+            }
+            x0 += n;
+        }
+    });
+}
+
+void MicroPatternsDrawing::writeSpan(int sy, int sx0, int sx1, uint8_t color, const uint8_t* colors) {
+    if (_raster.isAttached()) {
+        if (colors) _raster.writeSpan(sy, sx0, sx1, colors);
+        else _raster.fillSpan(sy, sx0, sx1, color);
+        return;
+    }
+    for (int x = sx0; x < sx1; ++x) {
+        _canvas->drawPixel(x, sy, colors ? colors[x - sx0] : color);
     }
 }
 
+// Yields and resets the watchdog at the same pixel cadence as the original per-pixel loops
+void MicroPatternsDrawing::paceRows(int pixels) {
+    _pixelsSinceYield += pixels;
+    if (_pixelsSinceYield < 2000) return;
+    _pixelsSinceYield = 0;
+    yield();
+    if (++_yieldsSinceWdtReset >= 4) {
+        _yieldsSinceWdtReset = 0;
+        esp_task_wdt_reset();
+    }
+}
+
+// Range of k in [0, n] for which 'origin + step * k' lies in [lo, hi). False if empty.
+static bool clipSteps(int64_t origin, int step, int lo, int hi, int64_t n, int64_t& k0, int64_t& k1) {
+    int64_t first = step > 0 ? lo - origin : origin - (hi - 1);
+    int64_t last = step > 0 ? hi - 1 - origin : origin - lo;
+    k0 = std::max<int64_t>(0, first);
+    k1 = std::min<int64_t>(n, last);
+    return k0 <= k1;
+}
+
+// Bresenham's line, clipped before stepping. Pixel k along the major axis (0 .. major) is
+// offset by m(k) = floor((2*k*minor + major) / (2*major)) along the minor axis, which is the
+// pixel sequence of the incremental algorithm, so only the visible steps are walked.
 void MicroPatternsDrawing::rawLine(int sx1, int sy1, int sx2, int sy2, uint8_t color) {
     if (!_canvas) return;
 
-    int dx_abs = abs(sx2 - sx1);
-    int dy_abs = -abs(sy2 - sy1); // dy is negative for typical algorithm
-    int current_sx = sx1;
-    int current_sy = sy1;
+    int64_t dx = std::abs((int64_t)sx2 - sx1);
+    int64_t dy = std::abs((int64_t)sy2 - sy1);
     int stepX = (sx1 < sx2) ? 1 : -1;
     int stepY = (sy1 < sy2) ? 1 : -1;
-    int err = dx_abs + dy_abs; // Error term
-
-    while (true) {
-        rawPixel(current_sx, current_sy, color);
-        if (current_sx == sx2 && current_sy == sy2) break;
-        int e2 = 2 * err;
-        if (e2 >= dy_abs) { // Favor X step
-            if (current_sx == sx2) break; // Reached end in X
-            err += dy_abs;
-            current_sx += stepX;
+    bool xMajor = dx >= dy;
+    int64_t major = xMajor ? dx : dy;
+    int64_t minor = xMajor ? dy : dx;
+    if (major == 0) {
+        rawPixel(sx1, sy1, color);
+        return;
+    }
+    if (major >= (int64_t(1) << 30)) return; // Step arithmetic below needs 2 * major * minor < 2^63
+
+    // Steps whose major coordinate is inside the clip rect
+    int64_t k0, k1;
+    if (xMajor ? !clipSteps(sx1, stepX, _clipX0, _clipX1, major, k0, k1)
+               : !clipSteps(sy1, stepY, _clipY0, _clipY1, major, k0, k1)) return;
+
+    // ... and whose minor offset m(k) is in [m0, m1]
+    int64_t m0, m1;
+    if (xMajor ? !clipSteps(sy1, stepY, _clipY0, _clipY1, minor, m0, m1)
+               : !clipSteps(sx1, stepX, _clipX0, _clipX1, minor, m0, m1)) return;
+    if (minor > 0) {
+        if (m0 > 0) k0 = std::max(k0, ((2 * m0 - 1) * major + 2 * minor - 1) / (2 * minor)); // First k with m(k) >= m0
+        k1 = std::min(k1, ((2 * m1 + 1) * major + 2 * minor - 1) / (2 * minor) - 1);         // Last k with m(k) <= m1
+        if (k0 > k1) return;
+    }
+
+    int64_t num = 2 * k0 * minor + major;
+    int64_t m = num / (2 * major);
+    int64_t rem = num % (2 * major);
+    if (xMajor) {
+        // Runs of steps on the same row are written as spans
+        int64_t runStart = k0;
+        for (int64_t k = k0; k <= k1; ++k) {
+            bool rowEnds = k == k1;
+            rem += 2 * minor;
+            if (rem >= 2 * major) rowEnds = true;
+            if (rowEnds) {
+                int xa = (int)(sx1 + stepX * runStart), xb = (int)(sx1 + stepX * k);
+                rawSpan((int)(sy1 + stepY * m), std::min(xa, xb), std::max(xa, xb) + 1, color, nullptr);
+                runStart = k + 1;
+            }
+            if (rem >= 2 * major) { rem -= 2 * major; m++; }
         }
-        if (e2 <= dx_abs) { // Favor Y step
-            if (current_sy == sy2) break; // Reached end in Y
-            err += dx_abs;
-            current_sy += stepY;
+    } else {
+        for (int64_t k = k0; k <= k1; ++k) {
+            rawPixel((int)(sx1 + stepX * m), (int)(sy1 + stepY * k), color);
+            rem += 2 * minor;
+            if (rem >= 2 * major) { rem -= 2 * major; m++; }
         }
     }
 }
@@ -150,127 +288,428 @@ void MicroPatternsDrawing::rawLine(int sx1, int sy1, int sx2, int sy2, uint8_t c
 uint8_t MicroPatternsDrawing::getFillColor(float screen_pixel_center_x, float screen_pixel_center_y, const DisplayListItem& item) {
     if (!item.fillAsset) {
         return item.color; // Solid fill
-    } else {
-        const MicroPatternsAsset& asset = *item.fillAsset;
-        if (asset.width <= 0 || asset.height <= 0 || asset.data.empty()) return DRAWING_COLOR_WHITE; // Default to white if asset invalid
-
-        float base_lx, base_ly;
-        screenToLogicalBase(screen_pixel_center_x, screen_pixel_center_y, item, base_lx, base_ly);
-
-        int assetX = static_cast<int>(floor(base_lx)) % asset.width;
-        int assetY = static_cast<int>(floor(base_ly)) % asset.height;
-        if (assetX < 0) assetX += asset.width;
-        if (assetY < 0) assetY += asset.height;
-
-        int index = assetY * asset.width + assetX;
-        if (index >= 0 && index < (int)asset.data.size()) {
-            uint8_t patternBit = asset.data[index]; // 0 or 1
-            if (item.color == DRAWING_COLOR_WHITE) { // Inverted mode for FILL
-                return patternBit == 1 ? DRAWING_COLOR_WHITE : DRAWING_COLOR_BLACK;
-            } else { // Normal mode (item.color is DRAWING_COLOR_BLACK) for FILL
-                return patternBit == 1 ? DRAWING_COLOR_BLACK : DRAWING_COLOR_WHITE;
-            }
+    }
+    float base_lx, base_ly;
+    screenToLogicalBase(screen_pixel_center_x, screen_pixel_center_y, item, base_lx, base_ly);
+    return patternColorAt(base_lx, base_ly, item);
+}
+
+// Pattern color at base logical coordinates; item.fillAsset must be set
+uint8_t MicroPatternsDrawing::patternColorAt(float base_lx, float base_ly, const DisplayListItem& item) const {
+    const MicroPatternsAsset& asset = *item.fillAsset;
+    if (!asset.isValid()) return DRAWING_COLOR_WHITE; // Default to white if asset invalid
+
+    int assetX = static_cast<int>(floor(base_lx)) % asset.width;
+    int assetY = static_cast<int>(floor(base_ly)) % asset.height;
+    if (assetX < 0) assetX += asset.width;
+    if (assetY < 0) assetY += asset.height;
+
+    uint8_t patternBit = asset.bit(assetX, assetY); // 0 or 1
+    if (item.color == DRAWING_COLOR_WHITE) { // Inverted mode for FILL
+        return patternBit == 1 ? DRAWING_COLOR_WHITE : DRAWING_COLOR_BLACK;
+    } else { // Normal mode (item.color is DRAWING_COLOR_BLACK) for FILL
+        return patternBit == 1 ? DRAWING_COLOR_BLACK : DRAWING_COLOR_WHITE;
+    }
+}
+
+// --- Scanline Coverage ---
+
+// Screen-row coverage of a transformed logical rectangle. A pixel is covered when its center,
+// mapped through the inverse matrix (optionally divided by the scale factor) and offset by
+// the origin, lies in [loX, hiX) x [loY, hiY). Both mapped coordinates are monotonic along a
+// row, so each row's covered pixels form one span. The span is solved from the rectangle
+// edges and then snapped to the exact per-pixel test at both ends, so it matches testing
+// every pixel of the bounding box.
+struct ScanlineCoverage {
+    const float* inv;
+    float divisor;  // 0 = test scaled logical coordinates directly
+    float originX, originY;
+    float loX, hiX, loY, hiY;
+    float scaledLoX, scaledHiX, scaledLoY, scaledHiY; // Same bounds in scaled logical space
+
+    void init(const float* inverseMatrix, float div, float ox, float oy, float x0, float x1, float y0, float y1) {
+        inv = inverseMatrix;
+        divisor = div;
+        originX = ox; originY = oy;
+        loX = x0; hiX = x1; loY = y0; hiY = y1;
+        float s = div != 0.0f ? div : 1.0f;
+        scaledLoX = (x0 + ox) * s; scaledHiX = (x1 + ox) * s;
+        scaledLoY = (y0 + oy) * s; scaledHiY = (y1 + oy) * s;
+    }
+
+    // Scaled logical coordinates -> tested coordinates
+    inline void toLocal(float u, float v, float& tx, float& ty) const {
+        if (divisor != 0.0f) { u /= divisor; v /= divisor; }
+        tx = u - originX;
+        ty = v - originY;
+    }
+
+    bool covers(int sx, int sy) const {
+        float u, v, tx, ty;
+        matrix_apply_to_point(inv, static_cast<float>(sx) + 0.5f, static_cast<float>(sy) + 0.5f, u, v);
+        toLocal(u, v, tx, ty);
+        return tx >= loX && tx < hiX && ty >= loY && ty < hiY;
+    }
+
+    // Narrows [lo, hi) (pixel center x) to where a*cx + c lies in [l, h). Returns false if the
+    // row is empty. a == 0 means the coordinate is constant along the row: decided exactly.
+    bool solveAxis(float a, float c, float l, float h, bool isX, int sy, int minX, float& lo, float& hi) const {
+        if (a == 0.0f) {
+            float u, v, tx, ty;
+            matrix_apply_to_point(inv, static_cast<float>(minX) + 0.5f, static_cast<float>(sy) + 0.5f, u, v);
+            toLocal(u, v, tx, ty);
+            float t = isX ? tx : ty;
+            return isX ? (t >= loX && t < hiX) : (t >= loY && t < hiY);
+        }
+        float xa = (l - c) / a;
+        float xb = (h - c) / a;
+        lo = std::max(lo, std::min(xa, xb));
+        hi = std::min(hi, std::max(xa, xb));
+        return true;
+    }
+
+    // Covered span [xs, xe) of row sy within [minX, maxX). Returns false if empty.
+    bool rowSpan(int sy, int minX, int maxX, int& xs, int& xe) const {
+        float cy = static_cast<float>(sy) + 0.5f;
+        float lo = static_cast<float>(minX - 2);
+        float hi = static_cast<float>(maxX + 2);
+        if (!solveAxis(inv[0], inv[2] * cy + inv[4], scaledLoX, scaledHiX, true, sy, minX, lo, hi)) return false;
+        if (!solveAxis(inv[1], inv[3] * cy + inv[5], scaledLoY, scaledHiY, false, sy, minX, lo, hi)) return false;
+
+        if (lo != lo || hi != hi) { // NaN: fall back to the whole row
+            xs = minX; xe = maxX;
+        } else {
+            lo = std::max(lo, static_cast<float>(minX - 2));
+            hi = std::min(hi, static_cast<float>(maxX + 2));
+            int estStart = static_cast<int>(ceil(lo - 0.5f));
+            int estEnd = std::max(estStart, static_cast<int>(ceil(hi - 0.5f)));
+            // The estimate is within a pixel of the exact span; widen by one and snap
+            xs = std::max(minX, estStart - 1);
+            xe = std::min(maxX, estEnd + 1);
         }
-        return item.color == DRAWING_COLOR_WHITE ? DRAWING_COLOR_BLACK : DRAWING_COLOR_WHITE; // Default on error
+        while (xs < xe && !covers(xs, sy)) xs++;
+        while (xe > xs && !covers(xe - 1, sy)) xe--;
+        if (xs == xe) return false;
+        while (xs > minX && covers(xs - 1, sy)) xs--;
+        while (xe < maxX && covers(xe, sy)) xe++;
+        return true;
     }
+};
+
+// --- Integer Kernels ---
+// For every class but TRANSFORM_GENERAL the matrix is an integer signed permutation, so pixel
+// centers map to half-integer logical coordinates. Working in doubled coordinates keeps the
+// containment and texel tests in integer math with the same results as the float path.
+
+static inline int floorDiv(int a, int b) {
+    int q = a / b;
+    return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
 }
 
-// --- Drawing Primitives ---
+static inline int floorMod(int a, int b) {
+    int r = a % b;
+    return r < 0 ? r + b : r;
+}
 
-void MicroPatternsDrawing::drawPixel(const DisplayListItem& item) {
-    if (!_canvas) return;
-    int lx = item.intParams.at("X");
-    int ly = item.intParams.at("Y");
+// Integer kernels need all corner arithmetic (doubled) to stay far from int overflow
+static inline bool fitsIntegerKernel(int a, int b, int s) {
+    const int limit = 1 << 20;
+    return a > -limit && a < limit && b > -limit && b < limit && s <= 4096 &&
+           static_cast<long long>(std::max(abs(a), abs(b))) * s < limit;
+}
 
-    float s_tl_x, s_tl_y, s_tr_x, s_tr_y, s_bl_x, s_bl_y, s_br_x, s_br_y;
-    transformPoint(static_cast<float>(lx), static_cast<float>(ly), item, s_tl_x, s_tl_y);
-    transformPoint(static_cast<float>(lx + 1), static_cast<float>(ly), item, s_tr_x, s_tr_y);
-    transformPoint(static_cast<float>(lx), static_cast<float>(ly + 1), item, s_bl_x, s_bl_y);
-    transformPoint(static_cast<float>(lx + 1), static_cast<float>(ly + 1), item, s_br_x, s_br_y);
+// Screen pixels covered by the scaled logical box [x0, x1) x [y0, y1): under a signed
+// permutation the image of a half-open box is the half-open box spanned by its corners
+static void integerCoverage(const int M[6], int x0, int y0, int x1, int y1, int& sx0, int& sy0, int& sx1, int& sy1) {
+    int ax = M[0] * x0 + M[2] * y0 + M[4], ay = M[1] * x0 + M[3] * y0 + M[5];
+    int bx = M[0] * x1 + M[2] * y1 + M[4], by = M[1] * x1 + M[3] * y1 + M[5];
+    sx0 = std::min(ax, bx); sx1 = std::max(ax, bx);
+    sy0 = std::min(ay, by); sy1 = std::max(ay, by);
+}
 
-    // Determine screen-space bounding box (rounded to int for iteration)
-    int min_sx = static_cast<int>(floor(std::min({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
-    int max_sx = static_cast<int>(ceil(std::max({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
-    int min_sy = static_cast<int>(floor(std::min({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
-    int max_sy = static_cast<int>(ceil(std::max({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
+template <TransformClass C, bool Pattern>
+void MicroPatternsDrawing::fillRectInteger(const DisplayListItem& item, const int M[6], int s, int lx, int ly, int lw, int lh) {
+    int sx0, sy0, sx1, sy1;
+    integerCoverage(M, lx * s, ly * s, (lx + lw) * s, (ly + lh) * s, sx0, sy0, sx1, sy1);
+    sx0 = std::max(_clipX0, sx0);
+    sy0 = std::max(_clipY0, sy0);
+    sx1 = std::min(_clipX1, sx1);
+    sy1 = std::min(_clipY1, sy1);
+    if (sx0 >= sx1 || sy0 >= sy1) return;
+
+    const bool axisAligned = C != TRANSFORM_QUARTER_TURN; // Pattern row is constant along a screen row
+    const int div2 = (C == TRANSFORM_SCALE || C == TRANSFORM_QUARTER_TURN) ? 2 * s : 2;
+    // Inverse of the signed permutation is its transpose
+    const int a = axisAligned ? 1 : M[0], b = axisAligned ? 0 : M[1];
+    const int c = axisAligned ? 0 : M[2], d = axisAligned ? 1 : M[3];
+    uint8_t* rowColors = _rowColors.data();
+    int prevTexelRow = 0;
+    bool rowValid = false;
+    // Large fills copy rows of the pre-expanded pattern; small ones are not worth a tile
+    const PatternTile* tile = nullptr;
+    if (Pattern && (long long)(sx1 - sx0) * (sy1 - sy0) >= PATTERN_TILE_MIN_FILL_PIXELS) {
+        tile = patternTile(item, M, s);
+    }
 
-    // Clip to canvas
-    min_sx = std::max(0, min_sx);
-    min_sy = std::max(0, min_sy);
-    max_sx = std::min(_canvasWidth, max_sx);
-    max_sy = std::min(_canvasHeight, max_sy);
+    for (int sy = sy0; sy < sy1; ++sy) {
+        if (isInterrupted()) return; // Check interrupt
+        if (Pattern && tile) {
+            rawTileSpan(sy, sx0, sx1, *tile);
+        } else if (Pattern) {
+            const MicroPatternsAsset& asset = *item.fillAsset;
+            uint8_t onColor = item.color == DRAWING_COLOR_WHITE ? DRAWING_COLOR_WHITE : DRAWING_COLOR_BLACK;
+            uint8_t offColor = onColor == DRAWING_COLOR_WHITE ? DRAWING_COLOR_BLACK : DRAWING_COLOR_WHITE;
+
+            int x2 = 2 * (sx0 - M[4]) + 1;
+            int y2 = 2 * (sy - M[5]) + 1;
+            int u2 = a * x2 + b * y2;
+            int v2 = c * x2 + d * y2;
+            if (axisAligned) {
+                int texelRow = floorMod(floorDiv(v2, div2), asset.height);
+                if (!rowValid || texelRow != prevTexelRow) { // Otherwise the previous row's colors repeat
+                    const uint32_t* patternRow = asset.row(texelRow);
+                    for (int i = 0; i < sx1 - sx0; ++i, u2 += 2) {
+                        int tx = floorMod(floorDiv(u2, div2), asset.width);
+                        rowColors[i] = ((patternRow[tx >> 5] >> (31 - (tx & 31))) & 1) ? onColor : offColor;
+                    }
+                    prevTexelRow = texelRow;
+                    rowValid = true;
+                }
+            } else {
+                for (int i = 0; i < sx1 - sx0; ++i, u2 += 2 * a, v2 += 2 * c) {
+                    int tx = floorMod(floorDiv(u2, div2), asset.width);
+                    int ty = floorMod(floorDiv(v2, div2), asset.height);
+                    rowColors[i] = asset.bit(tx, ty) ? onColor : offColor;
+                }
+            }
+            rawSpan(sy, sx0, sx1, 0, rowColors);
+        } else {
+            rawSpan(sy, sx0, sx1, item.color, nullptr);
+        }
+        paceRows(sx1 - sx0);
+    }
+    esp_task_wdt_reset();
+}
 
-    for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
-        for (int sx_iter = min_sx; sx_iter < max_sx; ++sx_iter) {
-            float screen_center_x = static_cast<float>(sx_iter) + 0.5f;
-            float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
-
-            float scaled_logical_x, scaled_logical_y;
-            matrix_apply_to_point(item.inverseMatrix, screen_center_x, screen_center_y, scaled_logical_x, scaled_logical_y);
-
-            float logical_pixel_start_x_scaled = static_cast<float>(lx) * item.scaleFactor;
-            float logical_pixel_end_x_scaled = static_cast<float>(lx + 1) * item.scaleFactor;
-            float logical_pixel_start_y_scaled = static_cast<float>(ly) * item.scaleFactor;
-            float logical_pixel_end_y_scaled = static_cast<float>(ly + 1) * item.scaleFactor;
-            
-            if (scaled_logical_x >= logical_pixel_start_x_scaled && scaled_logical_x < logical_pixel_end_x_scaled &&
-                scaled_logical_y >= logical_pixel_start_y_scaled && scaled_logical_y < logical_pixel_end_y_scaled) {
-                rawPixel(sx_iter, sy_iter, item.color);
+// Tile of item's fill pattern as it lands on screen under the integer matrix M and scale s
+const PatternTile* MicroPatternsDrawing::patternTile(const DisplayListItem& item, const int M[6], int s) {
+    const MicroPatternsAsset& asset = *item.fillAsset;
+    bool swapped = M[0] == 0; // Quarter turn exchanging axes
+    int periodX = (swapped ? asset.height : asset.width) * s;
+    int periodY = (swapped ? asset.width : asset.height) * s;
+
+    PatternTileKey key;
+    key.asset = &asset;
+    key.scale = s;
+    key.orientation = static_cast<uint8_t>((M[0] + 1) | ((M[1] + 1) << 2) | ((M[2] + 1) << 4) | ((M[3] + 1) << 6));
+    key.inverted = item.color == DRAWING_COLOR_WHITE;
+    key.phaseX = floorMod(M[4], periodX);
+    key.phaseY = floorMod(M[5], periodY);
+
+    const PatternTile* cached = _patternTiles.find(key);
+    if (cached) return cached;
+    PatternTile* tile = _patternTiles.insert(key, periodX, periodY);
+    if (!tile) return nullptr;
+
+    // Screen pixel (x, y) of the tile, in doubled logical coordinates as in fillRectInteger
+    uint8_t onColor = key.inverted ? DRAWING_COLOR_WHITE : DRAWING_COLOR_BLACK;
+    uint8_t offColor = key.inverted ? DRAWING_COLOR_BLACK : DRAWING_COLOR_WHITE;
+    int div2 = 2 * s;
+    for (int y = 0; y < tile->height; ++y) {
+        uint8_t* out = tile->pixels + y * tile->stride;
+        int y2 = 2 * (y - M[5]) + 1;
+        for (int x = 0; x < tile->width; ++x) {
+            int x2 = 2 * (x - M[4]) + 1;
+            int tx = floorMod(floorDiv(M[0] * x2 + M[1] * y2, div2), asset.width);
+            int ty = floorMod(floorDiv(M[2] * x2 + M[3] * y2, div2), asset.height);
+            uint8_t color = asset.bit(tx, ty) ? onColor : offColor;
+            if (x & 1) out[x >> 1] = (out[x >> 1] & 0xF0) | color;
+            else out[x >> 1] = color << 4;
+        }
+    }
+    return tile;
+}
+
+template <TransformClass C>
+void MicroPatternsDrawing::drawAssetInteger(const DisplayListItem& item, const int M[6], int s) {
+    const MicroPatternsAsset& asset = *item.draw.asset;
+    int ox = item.draw.x, oy = item.draw.y;
+    // Pixels outside the bounding box of set bits are never drawn
+    int sx0, sy0, sx1, sy1;
+    integerCoverage(M, (ox + asset.bboxMinX) * s, (oy + asset.bboxMinY) * s,
+                    (ox + asset.bboxMaxX) * s, (oy + asset.bboxMaxY) * s, sx0, sy0, sx1, sy1);
+    sx0 = std::max(_clipX0, sx0);
+    sy0 = std::max(_clipY0, sy0);
+    sx1 = std::min(_clipX1, sx1);
+    sy1 = std::min(_clipY1, sy1);
+    if (sx0 >= sx1 || sy0 >= sy1) return;
+
+    const bool axisAligned = C != TRANSFORM_QUARTER_TURN;
+    const int div2 = (C == TRANSFORM_SCALE || C == TRANSFORM_QUARTER_TURN) ? 2 * s : 2;
+
+    for (int sy = sy0; sy < sy1; ++sy) {
+        if (isInterrupted()) return;
+        if (axisAligned) {
+            // Each precomputed run of the asset row is one screen span
+            int iy = floorDiv(2 * (sy - M[5]) + 1, div2) - oy;
+            for (uint32_t r = asset.rowRunStart[iy]; r < asset.rowRunStart[iy + 1]; ++r) {
+                const MicroPatternsAssetRun& run = asset.runs[r];
+                int runX0 = M[4] + (ox + run.start) * s;
+                int runX1 = M[4] + (ox + run.end) * s;
+                rawSpan(sy, std::max(sx0, runX0), std::min(sx1, runX1), item.color, nullptr); // DRAW uses item.color
             }
+            paceRows(sx1 - sx0);
+            continue;
         }
+
+        int x2 = 2 * (sx0 - M[4]) + 1;
+        int y2 = 2 * (sy - M[5]) + 1;
+        int u2 = M[0] * x2 + M[1] * y2;
+        int v2 = M[2] * x2 + M[3] * y2;
+        int run_start = -1;
+        for (int sx = sx0; sx < sx1; ++sx, u2 += 2 * M[0], v2 += 2 * M[2]) {
+            if (asset.bit(floorDiv(u2, div2) - ox, floorDiv(v2, div2) - oy)) {
+                if (run_start < 0) run_start = sx;
+            } else if (run_start >= 0) {
+                rawSpan(sy, run_start, sx, item.color, nullptr);
+                run_start = -1;
+            }
+        }
+        if (run_start >= 0) rawSpan(sy, run_start, sx1, item.color, nullptr);
+        paceRows(sx1 - sx0);
     }
+    esp_task_wdt_reset();
 }
 
-void MicroPatternsDrawing::drawFilledPixel(const DisplayListItem& item) {
-    if (!_canvas) return;
-    int lx = item.intParams.at("X");
-    int ly = item.intParams.at("Y");
+// Runs the integer kernel for item's transform class. Returns false if the item needs the
+// general float path.
+bool MicroPatternsDrawing::fillRectFast(const DisplayListItem& item, int lx, int ly, int lw, int lh, bool usePattern) {
+    if (item.transformClass == TRANSFORM_GENERAL) return false;
+    int M[6];
+    if (!matrix_to_integer(item.matrix, M)) return false;
+    int s = static_cast<int>(item.scaleFactor);
+    if (!fitsIntegerKernel(lx, lx + lw, s) || !fitsIntegerKernel(ly, ly + lh, s)) return false;
+
+    bool pattern = usePattern && item.fillAsset;
+    if (pattern) {
+        const MicroPatternsAsset& asset = *item.fillAsset;
+        if (!asset.isValid()) return false;
+    }
+
+    switch (item.transformClass) {
+        case TRANSFORM_IDENTITY:
+        case TRANSFORM_TRANSLATE: // Identity is a zero translation; both run the scale-1 kernel
+            if (pattern) fillRectInteger<TRANSFORM_TRANSLATE, true>(item, M, 1, lx, ly, lw, lh);
+            else fillRectInteger<TRANSFORM_TRANSLATE, false>(item, M, 1, lx, ly, lw, lh);
+            return true;
+        case TRANSFORM_SCALE:
+            if (pattern) fillRectInteger<TRANSFORM_SCALE, true>(item, M, s, lx, ly, lw, lh);
+            else fillRectInteger<TRANSFORM_SCALE, false>(item, M, s, lx, ly, lw, lh);
+            return true;
+        case TRANSFORM_QUARTER_TURN:
+            if (pattern) fillRectInteger<TRANSFORM_QUARTER_TURN, true>(item, M, s, lx, ly, lw, lh);
+            else fillRectInteger<TRANSFORM_QUARTER_TURN, false>(item, M, s, lx, ly, lw, lh);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MicroPatternsDrawing::drawAssetFast(const DisplayListItem& item) {
+    if (item.transformClass == TRANSFORM_GENERAL) return false;
+    const MicroPatternsAsset& asset = *item.draw.asset;
+    int M[6];
+    if (!matrix_to_integer(item.matrix, M)) return false;
+    int s = static_cast<int>(item.scaleFactor);
+    if (!fitsIntegerKernel(item.draw.x, item.draw.x + asset.width, s) ||
+        !fitsIntegerKernel(item.draw.y, item.draw.y + asset.height, s)) return false;
+
+    switch (item.transformClass) {
+        case TRANSFORM_IDENTITY:
+        case TRANSFORM_TRANSLATE: drawAssetInteger<TRANSFORM_TRANSLATE>(item, M, 1); return true;
+        case TRANSFORM_SCALE: drawAssetInteger<TRANSFORM_SCALE>(item, M, s); return true;
+        case TRANSFORM_QUARTER_TURN: drawAssetInteger<TRANSFORM_QUARTER_TURN>(item, M, s); return true;
+        default: return false;
+    }
+}
+
+// --- Drawing Primitives ---
+
+// Fills the logical rect [lx, lx+lw) x [ly, ly+lh). A screen pixel is covered when its
+// center maps inside the (scaled) rect. Each row's covered span is solved by the scanline
+// coverage and written in item.color or, with usePattern, in the fill pattern color. Pattern
+// lookups step the logical coordinates along the span instead of re-transforming each pixel.
+void MicroPatternsDrawing::fillLogicalRect(const DisplayListItem& item, int lx, int ly, int lw, int lh, bool usePattern) {
+    if (fillRectFast(item, lx, ly, lw, lh, usePattern)) return;
 
     float s_tl_x, s_tl_y, s_tr_x, s_tr_y, s_bl_x, s_bl_y, s_br_x, s_br_y;
     transformPoint(static_cast<float>(lx), static_cast<float>(ly), item, s_tl_x, s_tl_y);
-    transformPoint(static_cast<float>(lx + 1), static_cast<float>(ly), item, s_tr_x, s_tr_y);
-    transformPoint(static_cast<float>(lx), static_cast<float>(ly + 1), item, s_bl_x, s_bl_y);
-    transformPoint(static_cast<float>(lx + 1), static_cast<float>(ly + 1), item, s_br_x, s_br_y);
+    transformPoint(static_cast<float>(lx + lw), static_cast<float>(ly), item, s_tr_x, s_tr_y);
+    transformPoint(static_cast<float>(lx), static_cast<float>(ly + lh), item, s_bl_x, s_bl_y);
+    transformPoint(static_cast<float>(lx + lw), static_cast<float>(ly + lh), item, s_br_x, s_br_y);
 
+    // Determine screen-space bounding box (rounded to int for iteration)
     int min_sx = static_cast<int>(floor(std::min({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
     int max_sx = static_cast<int>(ceil(std::max({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
     int min_sy = static_cast<int>(floor(std::min({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
     int max_sy = static_cast<int>(ceil(std::max({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
 
-    min_sx = std::max(0, min_sx);
-    min_sy = std::max(0, min_sy);
-    max_sx = std::min(_canvasWidth, max_sx);
-    max_sy = std::min(_canvasHeight, max_sy);
+    // Clip to canvas
+    min_sx = std::max(_clipX0, min_sx);
+    min_sy = std::max(_clipY0, min_sy);
+    max_sx = std::min(_clipX1, max_sx);
+    max_sy = std::min(_clipY1, max_sy);
+    if (min_sx >= max_sx || min_sy >= max_sy) return;
+
+    ScanlineCoverage coverage;
+    coverage.init(item.inverseMatrix, 0.0f, 0.0f, 0.0f,
+                  static_cast<float>(lx) * item.scaleFactor, static_cast<float>(lx + lw) * item.scaleFactor,
+                  static_cast<float>(ly) * item.scaleFactor, static_cast<float>(ly + lh) * item.scaleFactor);
+
+    bool pattern = usePattern && item.fillAsset;
+    uint8_t* rowColors = _rowColors.data();
+    float du = item.inverseMatrix[0]; // Scaled logical step per screen pixel along a row
+    float dv = item.inverseMatrix[1];
 
     for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
-        for (int sx_iter = min_sx; sx_iter < max_sx; ++sx_iter) {
-            float screen_center_x = static_cast<float>(sx_iter) + 0.5f;
-            float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
-
-            float scaled_logical_x, scaled_logical_y;
-            matrix_apply_to_point(item.inverseMatrix, screen_center_x, screen_center_y, scaled_logical_x, scaled_logical_y);
-            
-            float logical_pixel_start_x_scaled = static_cast<float>(lx) * item.scaleFactor;
-            float logical_pixel_end_x_scaled = static_cast<float>(lx + 1) * item.scaleFactor;
-            float logical_pixel_start_y_scaled = static_cast<float>(ly) * item.scaleFactor;
-            float logical_pixel_end_y_scaled = static_cast<float>(ly + 1) * item.scaleFactor;
-
-            if (scaled_logical_x >= logical_pixel_start_x_scaled && scaled_logical_x < logical_pixel_end_x_scaled &&
-                scaled_logical_y >= logical_pixel_start_y_scaled && scaled_logical_y < logical_pixel_end_y_scaled) {
-                uint8_t fillColor = getFillColor(screen_center_x, screen_center_y, item);
-                rawPixel(sx_iter, sy_iter, fillColor);
+        if (isInterrupted()) return; // Check interrupt
+        int xs, xe;
+        if (!coverage.rowSpan(sy_iter, min_sx, max_sx, xs, xe)) continue;
+
+        if (pattern) {
+            float u, v;
+            matrix_apply_to_point(item.inverseMatrix, static_cast<float>(xs) + 0.5f, static_cast<float>(sy_iter) + 0.5f, u, v);
+            for (int i = 0; i < xe - xs; ++i, u += du, v += dv) {
+                rowColors[i] = item.scaleFactor == 0.0f
+                    ? patternColorAt(u, v, item)
+                    : patternColorAt(u / item.scaleFactor, v / item.scaleFactor, item);
             }
+            rawSpan(sy_iter, xs, xe, 0, rowColors);
+        } else {
+            rawSpan(sy_iter, xs, xe, item.color, nullptr);
         }
+        paceRows(xe - xs);
     }
+    esp_task_wdt_reset();
+}
+
+void MicroPatternsDrawing::drawPixel(const DisplayListItem& item) {
+    if (!_canvas) return;
+    fillLogicalRect(item, item.pixel.x, item.pixel.y, 1, 1, false); // PIXEL ignores the fill pattern
+}
+
+void MicroPatternsDrawing::drawFilledPixel(const DisplayListItem& item) {
+    if (!_canvas) return;
+    fillLogicalRect(item, item.pixel.x, item.pixel.y, 1, 1, true);
 }
 
 
 void MicroPatternsDrawing::drawLine(const DisplayListItem& item) {
     if (!_canvas) return;
-    int lx1 = item.intParams.at("X1");
-    int ly1 = item.intParams.at("Y1");
-    int lx2 = item.intParams.at("X2");
-    int ly2 = item.intParams.at("Y2");
+    int lx1 = item.line.x1;
+    int ly1 = item.line.y1;
+    int lx2 = item.line.x2;
+    int ly2 = item.line.y2;
 
     float sx1_f, sy1_f, sx2_f, sy2_f;
     transformPoint(static_cast<float>(lx1), static_cast<float>(ly1), item, sx1_f, sy1_f);
@@ -281,10 +720,10 @@ void MicroPatternsDrawing::drawLine(const DisplayListItem& item) {
 
 void MicroPatternsDrawing::drawRect(const DisplayListItem& item) {
     if (!_canvas) return;
-    int lx = item.intParams.at("X");
-    int ly = item.intParams.at("Y");
-    int lw = item.intParams.at("WIDTH");
-    int lh = item.intParams.at("HEIGHT");
+    int lx = item.rect.x;
+    int ly = item.rect.y;
+    int lw = item.rect.width;
+    int lh = item.rect.height;
     if (lw <= 0 || lh <= 0) return;
 
     float s_tl_x, s_tl_y, s_tr_x, s_tr_y, s_bl_x, s_bl_y, s_br_x, s_br_y;
@@ -301,69 +740,15 @@ void MicroPatternsDrawing::drawRect(const DisplayListItem& item) {
 
 void MicroPatternsDrawing::fillRect(const DisplayListItem& item) {
     if (!_canvas) return;
-    int lx = item.intParams.at("X");
-    int ly = item.intParams.at("Y");
-    int lw = item.intParams.at("WIDTH");
-    int lh = item.intParams.at("HEIGHT");
-    if (lw <= 0 || lh <= 0) return;
-
-    float s_tl_x, s_tl_y, s_tr_x, s_tr_y, s_bl_x, s_bl_y, s_br_x, s_br_y;
-    transformPoint(static_cast<float>(lx), static_cast<float>(ly), item, s_tl_x, s_tl_y);
-    transformPoint(static_cast<float>(lx + lw), static_cast<float>(ly), item, s_tr_x, s_tr_y);
-    transformPoint(static_cast<float>(lx), static_cast<float>(ly + lh), item, s_bl_x, s_bl_y);
-    transformPoint(static_cast<float>(lx + lw), static_cast<float>(ly + lh), item, s_br_x, s_br_y);
-
-    int min_sx = static_cast<int>(floor(std::min({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
-    int max_sx = static_cast<int>(ceil(std::max({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
-    int min_sy = static_cast<int>(floor(std::min({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
-    int max_sy = static_cast<int>(ceil(std::max({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
-
-    min_sx = std::max(0, min_sx);
-    min_sy = std::max(0, min_sy);
-    max_sx = std::min(_canvasWidth, max_sx);
-    max_sy = std::min(_canvasHeight, max_sy);
-
-    int pixelCount = 0;
-    for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
-        if (_interrupt_check_cb && _interrupt_check_cb()) return; // Check interrupt
-        for (int sx_iter = min_sx; sx_iter < max_sx; ++sx_iter) {
-            if (_interrupt_check_cb && _interrupt_check_cb()) return; // Check interrupt
-    
-            if (pixelCount > 0 && pixelCount % 2000 == 0) { // Yield less frequently for fillRect
-                yield();
-                if (pixelCount % 8000 == 0) {
-                    esp_task_wdt_reset();
-                }
-            }
-            pixelCount++;
-    
-            float screen_center_x = static_cast<float>(sx_iter) + 0.5f;
-            float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
-
-            float scaled_logical_x, scaled_logical_y;
-            matrix_apply_to_point(item.inverseMatrix, screen_center_x, screen_center_y, scaled_logical_x, scaled_logical_y);
-
-            float logical_rect_start_x_scaled = static_cast<float>(lx) * item.scaleFactor;
-            float logical_rect_end_x_scaled = static_cast<float>(lx + lw) * item.scaleFactor;
-            float logical_rect_start_y_scaled = static_cast<float>(ly) * item.scaleFactor;
-            float logical_rect_end_y_scaled = static_cast<float>(ly + lh) * item.scaleFactor;
-
-            if (scaled_logical_x >= logical_rect_start_x_scaled && scaled_logical_x < logical_rect_end_x_scaled &&
-                scaled_logical_y >= logical_rect_start_y_scaled && scaled_logical_y < logical_rect_end_y_scaled) {
-                uint8_t fillColor = getFillColor(screen_center_x, screen_center_y, item);
-                // No check for DRAWING_COLOR_WHITE, draw all pixels for fill.
-                rawPixel(sx_iter, sy_iter, fillColor);
-            }
-        }
-    }
-    esp_task_wdt_reset(); // Ensure WDT is reset after the loop
+    if (item.rect.width <= 0 || item.rect.height <= 0) return;
+    fillLogicalRect(item, item.rect.x, item.rect.y, item.rect.width, item.rect.height, true);
 }
 
 void MicroPatternsDrawing::drawCircle(const DisplayListItem& item) {
     if (!_canvas) return;
-    int lcx = item.intParams.at("X");
-    int lcy = item.intParams.at("Y");
-    int lr = item.intParams.at("RADIUS");
+    int lcx = item.circle.x;
+    int lcy = item.circle.y;
+    int lr = item.circle.radius;
     if (lr <= 0) return;
      
     float scx_f, scy_f;
@@ -378,30 +763,46 @@ void MicroPatternsDrawing::drawCircle(const DisplayListItem& item) {
     int scaledRadius = static_cast<int>(round(screen_radius_approx));
     if (scaledRadius < 1) scaledRadius = 1;
 
-    int x_coord = scaledRadius;
-    int y_coord = 0;
-    int err = 1 - scaledRadius;
-
-    while (x_coord >= y_coord) {
-        rawPixel(scx + x_coord, scy + y_coord, item.color); rawPixel(scx + y_coord, scy + x_coord, item.color);
-        rawPixel(scx - y_coord, scy + x_coord, item.color); rawPixel(scx - x_coord, scy + y_coord, item.color);
-        rawPixel(scx - x_coord, scy - y_coord, item.color); rawPixel(scx - y_coord, scy - x_coord, item.color);
-        rawPixel(scx + y_coord, scy - x_coord, item.color); rawPixel(scx + x_coord, scy - y_coord, item.color);
-        y_coord++;
-        if (err <= 0) {
-            err += 2 * y_coord + 1;
-        } else {
-            x_coord--;
-            err += 2 * (y_coord - x_coord) + 1;
+    // Midpoint circle. At offset y the octant point is at x(y), the largest x with
+    // x * (x - 1) <= r^2 - y^2, so the walk can start at any offset: only the offsets whose
+    // rows (scy +- y) or columns (scx +- y) cross the clip rect can plot a visible pixel.
+    int64_t r = scaledRadius;
+    if (scx + r < _clipX0 || scx - r >= _clipX1 || scy + r < _clipY0 || scy - r >= _clipY1) return;
+    struct OffsetRange { int64_t from, to; };
+    OffsetRange ranges[4] = {
+        { (int64_t)_clipY0 - scy, (int64_t)_clipY1 - 1 - scy }, { (int64_t)scy - (_clipY1 - 1), (int64_t)scy - _clipY0 },
+        { (int64_t)_clipX0 - scx, (int64_t)_clipX1 - 1 - scx }, { (int64_t)scx - (_clipX1 - 1), (int64_t)scx - _clipX0 } };
+    std::sort(ranges, ranges + 4, [](const OffsetRange& a, const OffsetRange& b) { return a.from < b.from; });
+
+    int64_t next = 0;     // First offset not walked yet
+    int64_t x_coord = -1; // x(next - 1), -1 before the first walk
+    for (const OffsetRange& range : ranges) {
+        int64_t y_coord = std::max(range.from, next);
+        bool resync = y_coord != next || x_coord < 0;
+        for (; y_coord <= range.to; ++y_coord) {
+            int64_t d = r * r - y_coord * y_coord;
+            if (resync) {
+                x_coord = d > 0 ? (int64_t)((1.0 + sqrt(1.0 + 4.0 * (double)d)) / 2) : 0;
+                while ((x_coord + 1) * x_coord <= d) x_coord++;
+                resync = false;
+            }
+            while (x_coord >= y_coord && x_coord * (x_coord - 1) > d) x_coord--;
+            if (x_coord < y_coord) return; // Past the octant
+            int x = (int)x_coord, y = (int)y_coord;
+            rawPixel(scx + x, scy + y, item.color); rawPixel(scx + y, scy + x, item.color);
+            rawPixel(scx - y, scy + x, item.color); rawPixel(scx - x, scy + y, item.color);
+            rawPixel(scx - x, scy - y, item.color); rawPixel(scx - y, scy - x, item.color);
+            rawPixel(scx + y, scy - x, item.color); rawPixel(scx + x, scy - y, item.color);
         }
+        next = std::max(next, range.to + 1);
     }
 }
 
 void MicroPatternsDrawing::fillCircle(const DisplayListItem& item) {
     if (!_canvas) return;
-    int lcx = item.intParams.at("X");
-    int lcy = item.intParams.at("Y");
-    int lr = item.intParams.at("RADIUS");
+    int lcx = item.circle.x;
+    int lcy = item.circle.y;
+    int lr = item.circle.radius;
     if (lr <= 0) return;
 
     float logical_radius = static_cast<float>(lr);
@@ -428,101 +829,135 @@ void MicroPatternsDrawing::fillCircle(const DisplayListItem& item) {
     int min_sy = static_cast<int>(floor(min_sy_f));
     int max_sy = static_cast<int>(ceil(max_sy_f));
     
-    min_sx = std::max(0, min_sx);
-    min_sy = std::max(0, min_sy);
-    max_sx = std::min(_canvasWidth, max_sx);
-    max_sy = std::min(_canvasHeight, max_sy);
+    min_sx = std::max(_clipX0, min_sx);
+    min_sy = std::max(_clipY0, min_sy);
+    max_sx = std::min(_clipX1, max_sx);
+    max_sy = std::min(_clipY1, max_sy);
+
+    if (min_sx >= max_sx || min_sy >= max_sy) return;
 
     float logical_radius_sq = logical_radius * logical_radius;
-    int pixelCount = 0;
-    
+    bool pattern = item.fillAsset != nullptr;
+    uint8_t* rowColors = _rowColors.data();
+    auto inside = [&](int sx, int sy) {
+        float base_logical_x, base_logical_y;
+        screenToLogicalBase(static_cast<float>(sx) + 0.5f, static_cast<float>(sy) + 0.5f, item, base_logical_x, base_logical_y);
+        float dx = base_logical_x - lcx;
+        float dy = base_logical_y - lcy;
+        return dx * dx + dy * dy <= logical_radius_sq;
+    };
+
+    // Logical position along a row is affine in sx: p(sx) = p0 + (sx - min_sx) * step. Each row is
+    // then one span, solved from |p(sx) - c|^2 <= r^2 and refined with the per-pixel test at its ends.
+    float p0x, p0y, p1x, p1y;
+    screenToLogicalBase(static_cast<float>(min_sx) + 0.5f, 0.5f, item, p0x, p0y);
+    screenToLogicalBase(static_cast<float>(min_sx) + 1.5f, 0.5f, item, p1x, p1y);
+    float stepX = p1x - p0x, stepY = p1y - p0y;
+    float rowX, rowY, rowNextX, rowNextY;
+    screenToLogicalBase(static_cast<float>(min_sx) + 0.5f, 1.5f, item, rowNextX, rowNextY);
+    float rowStepX = rowNextX - p0x, rowStepY = rowNextY - p0y;
+    double stepSq = (double)stepX * stepX + (double)stepY * stepY;
+    if (stepSq <= 0.0) return; // Degenerate transform (SCALE 0)
+
     for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
-        if (_interrupt_check_cb && _interrupt_check_cb()) return; // Check interrupt
-        for (int sx_iter = min_sx; sx_iter < max_sx; ++sx_iter) {
-            if (_interrupt_check_cb && _interrupt_check_cb()) return; // Check interrupt
-    
-            if (pixelCount > 0 && pixelCount % 2000 == 0) {
-                yield();
-                if (pixelCount % 8000 == 0) {
-                    esp_task_wdt_reset();
+        if (isInterrupted()) return; // Check interrupt
+        rowX = p0x + rowStepX * sy_iter - lcx;
+        rowY = p0y + rowStepY * sy_iter - lcy;
+        double b = (double)rowX * stepX + (double)rowY * stepY;
+        double c = (double)rowX * rowX + (double)rowY * rowY - logical_radius_sq;
+        double disc = b * b - stepSq * c;
+        double mid = -b / stepSq;
+        double half = disc > 0.0 ? sqrt(disc) / stepSq : 0.0;
+        int span_start = std::max(min_sx, min_sx + static_cast<int>(ceil(mid - half)));
+        int span_end = std::min(max_sx, min_sx + static_cast<int>(floor(mid + half)) + 1);
+        if (span_start >= span_end) { // Empty or a single pixel in reach of rounding
+            span_start = std::max(min_sx, std::min(max_sx - 1, min_sx + static_cast<int>(round(mid))));
+            span_end = span_start + 1;
+        }
+        while (span_start < span_end && !inside(span_start, sy_iter)) span_start++;
+        while (span_end > span_start && !inside(span_end - 1, sy_iter)) span_end--;
+        while (span_start > min_sx && inside(span_start - 1, sy_iter)) span_start--;
+        while (span_end < max_sx && inside(span_end, sy_iter)) span_end++;
+
+        if (span_start < span_end) {
+            if (pattern) {
+                float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
+                for (int sx_iter = span_start; sx_iter < span_end; ++sx_iter) {
+                    rowColors[sx_iter - min_sx] = getFillColor(static_cast<float>(sx_iter) + 0.5f, screen_center_y, item);
                 }
             }
-            pixelCount++;
-    
-            float screen_center_x = static_cast<float>(sx_iter) + 0.5f;
-            float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
-
-            float base_logical_x, base_logical_y;
-            screenToLogicalBase(screen_center_x, screen_center_y, item, base_logical_x, base_logical_y);
-
-            float dx = base_logical_x - lcx;
-            float dy = base_logical_y - lcy;
-
-            if (dx * dx + dy * dy <= logical_radius_sq) {
-                uint8_t fillColor = getFillColor(screen_center_x, screen_center_y, item);
-                rawPixel(sx_iter, sy_iter, fillColor);
-            }
+            rawSpan(sy_iter, span_start, span_end, item.color, pattern ? rowColors + (span_start - min_sx) : nullptr);
         }
+        paceRows(span_end - span_start);
     }
     esp_task_wdt_reset();
 }
 
-void MicroPatternsDrawing::drawAsset(const DisplayListItem& item, const MicroPatternsAsset& asset) {
-    if (!_canvas || asset.width <= 0 || asset.height <= 0 || asset.data.empty()) return;
-    int lx_asset_origin = item.intParams.at("X");
-    int ly_asset_origin = item.intParams.at("Y");
+void MicroPatternsDrawing::drawAsset(const DisplayListItem& item) {
+    if (!_canvas || !item.draw.asset) return;
+    const MicroPatternsAsset& asset = *item.draw.asset;
+    if (!asset.isValid() || asset.bboxMinX >= asset.bboxMaxX) return; // Nothing set, nothing drawn
+    if (drawAssetFast(item)) return;
+
+    int lx_asset_origin = item.draw.x;
+    int ly_asset_origin = item.draw.y;
+    // Only the bounding box of set bits can be drawn
+    int box_x0 = lx_asset_origin + asset.bboxMinX, box_x1 = lx_asset_origin + asset.bboxMaxX;
+    int box_y0 = ly_asset_origin + asset.bboxMinY, box_y1 = ly_asset_origin + asset.bboxMaxY;
 
     float s_tl_x, s_tl_y, s_tr_x, s_tr_y, s_bl_x, s_bl_y, s_br_x, s_br_y;
-    transformPoint(static_cast<float>(lx_asset_origin), static_cast<float>(ly_asset_origin), item, s_tl_x, s_tl_y);
-    transformPoint(static_cast<float>(lx_asset_origin + asset.width), static_cast<float>(ly_asset_origin), item, s_tr_x, s_tr_y);
-    transformPoint(static_cast<float>(lx_asset_origin), static_cast<float>(ly_asset_origin + asset.height), item, s_bl_x, s_bl_y);
-    transformPoint(static_cast<float>(lx_asset_origin + asset.width), static_cast<float>(ly_asset_origin + asset.height), item, s_br_x, s_br_y);
+    transformPoint(static_cast<float>(box_x0), static_cast<float>(box_y0), item, s_tl_x, s_tl_y);
+    transformPoint(static_cast<float>(box_x1), static_cast<float>(box_y0), item, s_tr_x, s_tr_y);
+    transformPoint(static_cast<float>(box_x0), static_cast<float>(box_y1), item, s_bl_x, s_bl_y);
+    transformPoint(static_cast<float>(box_x1), static_cast<float>(box_y1), item, s_br_x, s_br_y);
 
     int min_sx = static_cast<int>(floor(std::min({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
     int max_sx = static_cast<int>(ceil(std::max({s_tl_x, s_tr_x, s_bl_x, s_br_x})));
     int min_sy = static_cast<int>(floor(std::min({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
     int max_sy = static_cast<int>(ceil(std::max({s_tl_y, s_tr_y, s_bl_y, s_br_y})));
 
-    min_sx = std::max(0, min_sx);
-    min_sy = std::max(0, min_sy);
-    max_sx = std::min(_canvasWidth, max_sx);
-    max_sy = std::min(_canvasHeight, max_sy);
-
-    int pixelCount = 0;
-    for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
-        if (_interrupt_check_cb && _interrupt_check_cb()) return;
-        for (int sx_iter = min_sx; sx_iter < max_sx; ++sx_iter) {
-            if (_interrupt_check_cb && _interrupt_check_cb()) return;
-            
-             if (pixelCount > 0 && pixelCount % 1000 == 0) {
-                yield();
-                 if (pixelCount % 4000 == 0) {
-                    esp_task_wdt_reset();
-                }
-            }
-            pixelCount++;
-    
-            float screen_center_x = static_cast<float>(sx_iter) + 0.5f;
-            float screen_center_y = static_cast<float>(sy_iter) + 0.5f;
+    min_sx = std::max(_clipX0, min_sx);
+    min_sy = std::max(_clipY0, min_sy);
+    max_sx = std::min(_clipX1, max_sx);
+    max_sy = std::min(_clipY1, max_sy);
 
-            float base_logical_x, base_logical_y;
-            screenToLogicalBase(screen_center_x, screen_center_y, item, base_logical_x, base_logical_y);
+    if (min_sx >= max_sx || min_sy >= max_sy) return;
 
-            float asset_local_x = base_logical_x - lx_asset_origin;
-            float asset_local_y = base_logical_y - ly_asset_origin;
+    // Covered pixels are those whose center falls inside the set-bit box; the asset texel comes
+    // from the logical position stepped along the span
+    ScanlineCoverage coverage;
+    coverage.init(item.inverseMatrix, item.scaleFactor,
+                  static_cast<float>(lx_asset_origin), static_cast<float>(ly_asset_origin),
+                  static_cast<float>(asset.bboxMinX), static_cast<float>(asset.bboxMaxX),
+                  static_cast<float>(asset.bboxMinY), static_cast<float>(asset.bboxMaxY));
 
-            if (asset_local_x >= 0 && asset_local_x < asset.width &&
-                asset_local_y >= 0 && asset_local_y < asset.height) {
-                
-                int asset_ix = static_cast<int>(floor(asset_local_x));
-                int asset_iy = static_cast<int>(floor(asset_local_y));
-                int asset_data_index = asset_iy * asset.width + asset_ix;
+    float du = item.inverseMatrix[0];
+    float dv = item.inverseMatrix[1];
 
-                if (asset_data_index >= 0 && asset_data_index < (int)asset.data.size() && asset.data[asset_data_index] == 1) {
-                    rawPixel(sx_iter, sy_iter, item.color); // DRAW uses item.color
-                }
+    for (int sy_iter = min_sy; sy_iter < max_sy; ++sy_iter) {
+        if (isInterrupted()) return;
+        int xs, xe;
+        if (!coverage.rowSpan(sy_iter, min_sx, max_sx, xs, xe)) continue;
+
+        float u, v;
+        matrix_apply_to_point(item.inverseMatrix, static_cast<float>(xs) + 0.5f, static_cast<float>(sy_iter) + 0.5f, u, v);
+        int run_start = -1;
+        for (int sx_iter = xs; sx_iter < xe; ++sx_iter, u += du, v += dv) {
+            float asset_local_x, asset_local_y;
+            coverage.toLocal(u, v, asset_local_x, asset_local_y);
+            // Stepping may drift past the texel grid at the span ends; clamp into the box
+            int asset_ix = std::min(asset.bboxMaxX - 1, std::max(asset.bboxMinX, static_cast<int>(floor(asset_local_x))));
+            int asset_iy = std::min(asset.bboxMaxY - 1, std::max(asset.bboxMinY, static_cast<int>(floor(asset_local_y))));
+
+            if (asset.bit(asset_ix, asset_iy)) {
+                if (run_start < 0) run_start = sx_iter;
+            } else if (run_start >= 0) {
+                rawSpan(sy_iter, run_start, sx_iter, item.color, nullptr); // DRAW uses item.color
+                run_start = -1;
             }
         }
+        if (run_start >= 0) rawSpan(sy_iter, run_start, xe, item.color, nullptr);
+        paceRows(xe - xs);
     }
     esp_task_wdt_reset();
-}
\ No newline at end of file
+}
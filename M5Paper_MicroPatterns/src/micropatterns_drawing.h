@@ -3,9 +3,16 @@
 
 #include <M5EPD.h>
 #include <esp_task_wdt.h> // For watchdog reset functions
-#include <functional> // For std::function
+#include <vector>
 #include "micropatterns_command.h" // For DisplayListItem, MicroPatternsAsset, MicroPatternsState
 #include "matrix_utils.h" // For matrix operations
+#include "framebuffer_raster.h"
+#include "pattern_tile_cache.h"
+#include "occupancy_bitmap.h"
+#include "occlusion_buffer.h"
+
+// Pattern fills smaller than this are expanded per row instead of through a cached tile
+const int PATTERN_TILE_MIN_FILL_PIXELS = 1024;
 
 // Define colors (consistent with runtime)
 const uint8_t DRAWING_COLOR_WHITE = 0;
@@ -16,8 +23,19 @@ public:
     MicroPatternsDrawing(M5EPD_Canvas* canvas);
 
     void setCanvas(M5EPD_Canvas* canvas);
-    void setInterruptCheckCallback(std::function<bool()> cb);
+    // Restricts all writes, clearCanvas and the occupation map to rows [y0, y1) (default: the
+    // whole canvas). Drawings with disjoint row ranges share no state and may run concurrently.
+    void setRowRange(int y0, int y1);
+    // Further restricts writes and clearCanvas to [x0, x1) x [y0, y1) within the row range, e.g.
+    // to re-render one dirty rectangle. The occupation map still covers the whole row range.
+    // setRowRange resets the clip to the full rows.
+    void setClipRect(int x0, int y0, int x1, int y1);
+    // Drawing stops at the next span (row) once *flag is set, from any task (nullptr: never).
+    // An item cut short this way is only partly drawn.
+    void setInterruptFlag(const volatile bool* flag) { _interruptFlag = flag; }
     void clearCanvas();
+    // Drops cached pattern tiles; required whenever assets may have been freed or recycled
+    void clearPatternTiles() { _patternTiles.clear(); }
 
     // Drawing primitives now take DisplayListItem to get resolved params and snapshotted state
     void drawPixel(const DisplayListItem& item);
@@ -26,17 +44,30 @@ public:
     void fillRect(const DisplayListItem& item);
     void drawCircle(const DisplayListItem& item);
     void fillCircle(const DisplayListItem& item);
-    void drawAsset(const DisplayListItem& item, const MicroPatternsAsset& asset); // Asset passed in
+    void drawAsset(const DisplayListItem& item); // Asset taken from item.draw.asset
     void drawFilledPixel(const DisplayListItem& item);
 
 private:
     M5EPD_Canvas* _canvas;
     int _canvasWidth;
     int _canvasHeight;
-    std::function<bool()> _interrupt_check_cb;
-    std::vector<uint8_t> _pixelOccupationMap;
+    int _rowY0; // Row range set by setRowRange
+    int _rowY1;
+    int _clipX0; // Clip rectangle set by setClipRect, within the row range
+    int _clipY0;
+    int _clipX1;
+    int _clipY1;
+    const volatile bool* _interruptFlag; // Not owned
+    OccupancyBitmap _occupancy; // Pixel occupation map, 1 bit per pixel
     bool _usePixelOccupationMap;
     unsigned int _overdrawSkippedPixels; // For stats
+    uint32_t _pixelsWritten; // Running total, for profiling
+    FramebufferRaster _raster; // Direct 4bpp framebuffer access for spans
+    std::vector<uint8_t> _rowColors; // Per-row pattern colors for span writes (canvas width)
+    PatternTileCache _patternTiles;
+    OcclusionBuffer* _coverageSink; // Not owned
+    int _pixelsSinceYield;
+    int _yieldsSinceWdtReset;
 
     void initPixelOccupationMap(); // Initialize map if needed
 
@@ -45,7 +76,11 @@ public: // Made public for DisplayListRenderer
     void resetPixelOccupationMap(); // Clears the map
     bool isPixelOccupied(int sx, int sy) const;
     void markPixelOccupied(int sx, int sy);
+    // Receives every span and pixel actually written (nullptr to disable)
+    void setCoverageSink(OcclusionBuffer* sink) { _coverageSink = sink; }
     unsigned int getOverdrawSkippedPixelsCount() const { return _overdrawSkippedPixels; }
+    // Pixels written since construction; take differences around the work to measure
+    uint32_t getPixelsWritten() const { return _pixelsWritten; }
 
 
     // Transformation helpers using float math and matrices, now use DisplayListItem's state
@@ -55,9 +90,31 @@ private:
     // Raw drawing on canvas using screen coordinates (sx, sy)
     void rawPixel(int sx, int sy, uint8_t color);
     void rawLine(int sx1, int sy1, int sx2, int sy2, uint8_t color);
+    // Writes [sx0, sx1) on row sy in 'color', or from colors[0 .. sx1-sx0) if colors is set.
+    // Clips and honours the occupation map.
+    void rawSpan(int sy, int sx0, int sx1, uint8_t color, const uint8_t* colors);
+    void writeSpan(int sy, int sx0, int sx1, uint8_t color, const uint8_t* colors);
+    void rawTileSpan(int sy, int sx0, int sx1, const PatternTile& tile);
+    template <typename Write>
+    void forEachFreeRun(int sy, int sx0, int sx1, Write write);
+    void paceRows(int pixels); // Amortised yield/watchdog reset for span loops
+    bool isInterrupted() const { return _interruptFlag && *_interruptFlag; }
+
+    // Shared coverage loop for FILL_RECT, PIXEL and FILL_PIXEL
+    void fillLogicalRect(const DisplayListItem& item, int lx, int ly, int lw, int lh, bool usePattern);
+
+    // Integer kernels for every transform class but TRANSFORM_GENERAL (see DisplayListItem::transformClass)
+    bool fillRectFast(const DisplayListItem& item, int lx, int ly, int lw, int lh, bool usePattern);
+    bool drawAssetFast(const DisplayListItem& item);
+    const PatternTile* patternTile(const DisplayListItem& item, const int M[6], int s);
+    template <TransformClass C, bool Pattern>
+    void fillRectInteger(const DisplayListItem& item, const int M[6], int s, int lx, int ly, int lw, int lh);
+    template <TransformClass C>
+    void drawAssetInteger(const DisplayListItem& item, const int M[6], int s);
 
     // Helper for fill patterns. Takes screen pixel center coordinates and DisplayListItem's state.
     uint8_t getFillColor(float screen_pixel_center_x, float screen_pixel_center_y, const DisplayListItem& item);
+    uint8_t patternColorAt(float base_lx, float base_ly, const DisplayListItem& item) const;
 };
 
 #endif // MICROPATTERNS_DRAWING_H
\ No newline at end of file
@@ -0,0 +1,731 @@
+#include "micropatterns_optimizer.h"
+#include "matrix_utils.h"
+#include "esp32-hal-log.h"
+#include <climits>
+
+// Upper bound on the number of IR nodes a single unrolled loop may expand to.
+const int OPTIMIZER_MAX_UNROLLED_NODES = 64;
+
+MicroPatternsOptimizer::MicroPatternsOptimizer() : _program(nullptr), _tempCount(0) {
+}
+
+void MicroPatternsOptimizer::optimize(MicroPatternsIrBlock& ir, MicroPatternsProgram& program) {
+    _program = &program;
+    _stats = MicroPatternsOptimizerStats();
+    _tempCount = 0;
+
+    if (_config.enableConstantFolding) {
+        foldProgram(ir);
+    }
+    if (_config.enableLoopUnrolling) {
+        unrollBlock(ir);
+        // Unrolled bodies read $INDEX as constants now; fold them
+        if (_config.enableConstantFolding && _stats.loopsUnrolled > 0) {
+            foldProgram(ir);
+        }
+    }
+    if (_config.enableDeadCodeElimination) {
+        eliminateDeadCode(ir);
+    }
+    if (_config.enableInvariantHoisting) {
+        hoistBlock(ir);
+    }
+    if (_config.enableTransformSequencing) {
+        sequenceTransforms(ir);
+    }
+    if (_config.enableInstancing) {
+        markInstancedLoops(ir); // Last: hoisting leaves innermost loops with just their EMIT
+    }
+
+    if (_config.logOptimizationStats) {
+        log_i("Optimizer: %d folded, %d substituted, %d unrolled, %d hoisted, %d dead, %d transforms sequenced, %d instanced",
+              _stats.constantsFolded, _stats.constantsValuesSubstituted, _stats.loopsUnrolled,
+              _stats.invariantsHoisted, _stats.deadCodeEliminated, _stats.transformsSequenced,
+              _stats.loopsInstanced);
+    }
+    _program = nullptr;
+}
+
+// --- Expression helpers ---
+
+void MicroPatternsOptimizer::readExpression(const ExprRef& ref, std::vector<ExprOp>& out) const {
+    out.assign(_program->expressions.begin() + ref.start, _program->expressions.begin() + ref.start + ref.length);
+}
+
+// Pool entries are never modified in place (cloned IR nodes share them), so a rewritten
+// expression is appended. On pool overflow the original is kept.
+bool MicroPatternsOptimizer::replaceExpression(ExprRef& ref, const std::vector<ExprOp>& ops) {
+    ExprRef replacement;
+    if (!_program->appendExpression(ops, replacement)) return false;
+    ref = replacement;
+    return true;
+}
+
+bool MicroPatternsOptimizer::isConstant(const ExprRef& ref, int32_t& value) const {
+    if (ref.length == 0) { value = 0; return true; }
+    const ExprOp& op = _program->expressions[ref.start];
+    if (ref.length == 1 && op.code == EXPR_CONST) { value = op.value; return true; }
+    return false;
+}
+
+bool MicroPatternsOptimizer::readsSlot(const ExprRef& ref, const std::vector<uint8_t>& slots) const {
+    for (int i = 0; i < ref.length; ++i) {
+        const ExprOp& op = _program->expressions[ref.start + i];
+        if (op.code == EXPR_SLOT && slots[op.value]) return true;
+    }
+    return false;
+}
+
+// An expression may be evaluated speculatively only if it cannot raise a runtime error:
+// every DIV/MOD must have a non-zero constant divisor.
+bool MicroPatternsOptimizer::isSafeToHoist(const ExprRef& ref) const {
+    for (int i = 0; i < ref.length; ++i) {
+        const ExprOp& op = _program->expressions[ref.start + i];
+        if (op.code != EXPR_DIV && op.code != EXPR_MOD) continue;
+        const ExprOp& divisor = _program->expressions[ref.start + i - 1];
+        if (divisor.code != EXPR_CONST || divisor.value == 0) return false;
+    }
+    return true;
+}
+
+// --- Constant folding ---
+
+struct FoldFragment {
+    bool isConst;
+    int32_t value;
+    std::vector<ExprOp> ops; // Only used when !isConst
+};
+
+// Folds an RPN expression symbolically. Operations that would overflow int32 or divide by
+// zero are left for the runtime, so its results and error messages are unchanged.
+bool MicroPatternsOptimizer::foldExpression(ExprRef& ref) {
+    if (ref.length == 0) return false;
+    std::vector<FoldFragment> stack;
+    int substituted = 0;
+
+    for (int i = 0; i < ref.length; ++i) {
+        const ExprOp op = _program->expressions[ref.start + i];
+        FoldFragment frag;
+        if (op.code == EXPR_CONST) {
+            frag.isConst = true; frag.value = op.value;
+            stack.push_back(frag);
+            continue;
+        }
+        if (op.code == EXPR_SLOT) {
+            if (_isConst[op.value]) {
+                frag.isConst = true; frag.value = _constValue[op.value];
+                substituted++;
+            } else {
+                frag.isConst = false; frag.value = 0; frag.ops.push_back(op);
+            }
+            stack.push_back(frag);
+            continue;
+        }
+
+        FoldFragment b = stack.back(); stack.pop_back();
+        FoldFragment a = stack.back(); stack.pop_back();
+        if (a.isConst && b.isConst) {
+            int64_t l = a.value, r = b.value, result = 0;
+            bool foldable = true;
+            switch (op.code) {
+                case EXPR_ADD: result = l + r; break;
+                case EXPR_SUB: result = l - r; break;
+                case EXPR_MUL: result = l * r; break;
+                case EXPR_DIV: if (r == 0) foldable = false; else result = l / r; break;
+                case EXPR_MOD: if (r == 0) foldable = false; else result = l % r; break;
+                default: foldable = false; break;
+            }
+            if (foldable && result >= INT_MIN && result <= INT_MAX) {
+                frag.isConst = true; frag.value = static_cast<int32_t>(result);
+                stack.push_back(frag);
+                continue;
+            }
+        } else if (b.isConst && ((b.value == 0 && (op.code == EXPR_ADD || op.code == EXPR_SUB)) ||
+                                 (b.value == 1 && (op.code == EXPR_MUL || op.code == EXPR_DIV)))) {
+            stack.push_back(a); // x+0, x-0, x*1, x/1
+            continue;
+        } else if (a.isConst && ((a.value == 0 && op.code == EXPR_ADD) || (a.value == 1 && op.code == EXPR_MUL))) {
+            stack.push_back(b); // 0+x, 1*x
+            continue;
+        }
+
+        frag.isConst = false; frag.value = 0;
+        if (a.isConst) { ExprOp c = { EXPR_CONST, a.value }; frag.ops.push_back(c); }
+        else frag.ops.swap(a.ops);
+        if (b.isConst) { ExprOp c = { EXPR_CONST, b.value }; frag.ops.push_back(c); }
+        else frag.ops.insert(frag.ops.end(), b.ops.begin(), b.ops.end());
+        frag.ops.push_back(op);
+        stack.push_back(frag);
+    }
+
+    std::vector<ExprOp> folded;
+    if (stack.back().isConst) {
+        ExprOp c = { EXPR_CONST, stack.back().value };
+        folded.push_back(c);
+    } else {
+        folded.swap(stack.back().ops);
+    }
+    if (folded.size() == ref.length) {
+        if (substituted == 0 || !replaceExpression(ref, folded)) return false;
+        _stats.constantsValuesSubstituted += substituted;
+        return true;
+    }
+    if (!replaceExpression(ref, folded)) return false;
+    _stats.constantsValuesSubstituted += substituted;
+    _stats.constantsFolded++;
+    return true;
+}
+
+// A user variable is constant if its only write is a top-level VAR (always executed,
+// exactly once) with a constant value. Reads after that VAR can use the value directly;
+// earlier reads still see the runtime's initial 0 and are left alone.
+void MicroPatternsOptimizer::countWrites(const MicroPatternsIrBlock& block, bool topLevel) {
+    for (const auto& node : block) {
+        const MicroPatternsInstruction& instr = node.instr;
+        if (instr.op == OP_VAR || instr.op == OP_LET || instr.op == OP_SET) {
+            _writeCount[instr.target]++;
+            if (instr.op != OP_VAR || !topLevel) _substitutable[instr.target] = 0;
+        }
+        countWrites(node.body, false);
+        countWrites(node.elseBody, false);
+    }
+}
+
+void MicroPatternsOptimizer::foldProgram(MicroPatternsIrBlock& ir) {
+    int slotCount = _program->slotCount;
+    _writeCount.assign(slotCount, 0);
+    _substitutable.assign(slotCount, 1);
+    _isConst.assign(slotCount, 0);
+    _constValue.assign(slotCount, 0);
+    countWrites(ir, true);
+
+    if (_config.canvasWidth > 0 && _config.canvasHeight > 0) {
+        _isConst[SLOT_WIDTH] = 1; _constValue[SLOT_WIDTH] = _config.canvasWidth;
+        _isConst[SLOT_HEIGHT] = 1; _constValue[SLOT_HEIGHT] = _config.canvasHeight;
+    }
+    foldBlock(ir, true);
+}
+
+void MicroPatternsOptimizer::foldBlock(MicroPatternsIrBlock& block, bool topLevel) {
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        MicroPatternsInstruction& instr = it->instr;
+        for (int i = 0; i < 4; ++i) {
+            foldExpression(instr.args[i]);
+        }
+
+        if (instr.op == OP_VAR && topLevel && _writeCount[instr.target] == 1 && _substitutable[instr.target]) {
+            int32_t value;
+            if (isConstant(instr.args[0], value)) {
+                _isConst[instr.target] = 1;
+                _constValue[instr.target] = value;
+            }
+        } else if (instr.op == OP_REPEAT_BEGIN) {
+            int32_t count;
+            if (isConstant(instr.args[0], count) && count == 0) {
+                it = block.erase(it);
+                _stats.deadCodeEliminated++;
+                continue;
+            }
+            foldBlock(it->body, false);
+        } else if (instr.op == OP_JUMP_IF_FALSE) {
+            int32_t left, right;
+            if (isConstant(instr.args[0], left) && isConstant(instr.args[1], right)) {
+                bool conditionMet;
+                switch (instr.aux) {
+                    case CMP_EQ: conditionMet = left == right; break;
+                    case CMP_NE: conditionMet = left != right; break;
+                    case CMP_LT: conditionMet = left < right; break;
+                    case CMP_GT: conditionMet = left > right; break;
+                    case CMP_LE: conditionMet = left <= right; break;
+                    default:     conditionMet = left >= right; break;
+                }
+                // Branch contents are folded as nested code: their VARs were not counted as top-level
+                MicroPatternsIrBlock& taken = conditionMet ? it->body : it->elseBody;
+                foldBlock(taken, false);
+                block.splice(it, taken);
+                it = block.erase(it);
+                _stats.deadCodeEliminated++;
+                continue;
+            }
+            foldBlock(it->body, false);
+            foldBlock(it->elseBody, false);
+        }
+        ++it;
+    }
+}
+
+// --- Loop unrolling ---
+
+int MicroPatternsOptimizer::countNodes(const MicroPatternsIrBlock& block) const {
+    int count = 0;
+    for (const auto& node : block) {
+        count += 1 + countNodes(node.body) + countNodes(node.elseBody);
+    }
+    return count;
+}
+
+// Replaces reads of this loop level's $INDEX with a constant. Nested REPEAT bodies have
+// their own $INDEX, but their COUNT is evaluated at this level.
+bool MicroPatternsOptimizer::substituteIndex(MicroPatternsIrBlock& block, int32_t index) {
+    std::vector<ExprOp> ops;
+    for (auto& node : block) {
+        for (int i = 0; i < 4; ++i) {
+            ExprRef& ref = node.instr.args[i];
+            bool readsIndex = false;
+            readExpression(ref, ops);
+            for (auto& op : ops) {
+                if (op.code == EXPR_SLOT && op.value == SLOT_INDEX) {
+                    op.code = EXPR_CONST;
+                    op.value = index;
+                    readsIndex = true;
+                }
+            }
+            if (readsIndex && !replaceExpression(ref, ops)) return false;
+        }
+        if (node.instr.op != OP_REPEAT_BEGIN && !substituteIndex(node.body, index)) return false;
+        if (!substituteIndex(node.elseBody, index)) return false;
+    }
+    return true;
+}
+
+void MicroPatternsOptimizer::unrollBlock(MicroPatternsIrBlock& block) {
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        unrollBlock(it->body);
+        unrollBlock(it->elseBody);
+
+        int32_t count;
+        if (it->instr.op != OP_REPEAT_BEGIN || !isConstant(it->instr.args[0], count) ||
+            count < 1 || count > _config.loopUnrollThreshold ||
+            count * countNodes(it->body) > OPTIMIZER_MAX_UNROLLED_NODES) {
+            ++it;
+            continue;
+        }
+
+        MicroPatternsIrBlock unrolled;
+        bool ok = true;
+        for (int32_t i = 0; i < count && ok; ++i) {
+            MicroPatternsIrBlock copy(it->body);
+            ok = substituteIndex(copy, i);
+            unrolled.splice(unrolled.end(), copy);
+        }
+        if (!ok) { // Expression pool full, keep the loop
+            ++it;
+            continue;
+        }
+        block.splice(it, unrolled);
+        it = block.erase(it);
+        _stats.loopsUnrolled++;
+    }
+}
+
+// --- Dead code elimination ---
+
+void MicroPatternsOptimizer::collectReads(const MicroPatternsIrBlock& block, std::vector<uint8_t>& reads) const {
+    for (const auto& node : block) {
+        for (int i = 0; i < 4; ++i) {
+            const ExprRef& ref = node.instr.args[i];
+            for (int k = 0; k < ref.length; ++k) {
+                const ExprOp& op = _program->expressions[ref.start + k];
+                if (op.code == EXPR_SLOT) reads[op.value] = 1;
+            }
+        }
+        collectReads(node.body, reads);
+        collectReads(node.elseBody, reads);
+    }
+}
+
+bool MicroPatternsOptimizer::removeUnusedWrites(MicroPatternsIrBlock& block, const std::vector<uint8_t>& reads) {
+    bool removed = false;
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        OpCode op = it->instr.op;
+        if ((op == OP_VAR || op == OP_LET || op == OP_SET) && !reads[it->instr.target]) {
+            it = block.erase(it);
+            _stats.deadCodeEliminated++;
+            removed = true;
+            continue;
+        }
+        if (removeUnusedWrites(it->body, reads)) removed = true;
+        if (removeUnusedWrites(it->elseBody, reads)) removed = true;
+        ++it;
+    }
+    return removed;
+}
+
+bool MicroPatternsOptimizer::containsOp(const MicroPatternsIrBlock& block, OpCode a, OpCode b, OpCode c) const {
+    for (const auto& node : block) {
+        OpCode op = node.instr.op;
+        if (op == a || op == b || op == c) return true;
+        if (containsOp(node.body, a, b, c) || containsOp(node.elseBody, a, b, c)) return true;
+    }
+    return false;
+}
+
+// Removes state changes overwritten before anything observes them. Within a block only
+// an EMIT or a nested block observes state; at the end of the top-level block all
+// pending changes are dead.
+void MicroPatternsOptimizer::removeOverwrittenState(MicroPatternsIrBlock& block, bool topLevel) {
+    typedef MicroPatternsIrBlock::iterator NodeIt;
+    NodeIt none = block.end();
+    NodeIt pendingColor = none, pendingFill = none, pendingScale = none;
+    std::vector<NodeIt> pendingTransforms; // TRANSLATE, ROTATE and RESET_TRANSFORMS
+
+    NodeIt it = block.begin();
+    while (it != block.end()) {
+        switch (it->instr.op) {
+            case OP_COLOR:
+                if (pendingColor != none) { block.erase(pendingColor); _stats.deadCodeEliminated++; }
+                pendingColor = it;
+                break;
+            case OP_FILL:
+                if (pendingFill != none) { block.erase(pendingFill); _stats.deadCodeEliminated++; }
+                pendingFill = it;
+                break;
+            case OP_SCALE:
+                if (pendingScale != none) { block.erase(pendingScale); _stats.deadCodeEliminated++; }
+                pendingScale = it;
+                break;
+            case OP_RESET_TRANSFORMS:
+                if (pendingScale != none) { block.erase(pendingScale); _stats.deadCodeEliminated++; }
+                pendingScale = none;
+                for (NodeIt dead : pendingTransforms) { block.erase(dead); _stats.deadCodeEliminated++; }
+                pendingTransforms.clear();
+                pendingTransforms.push_back(it);
+                break;
+            case OP_TRANSLATE:
+            case OP_ROTATE:
+                pendingTransforms.push_back(it);
+                break;
+            case OP_REPEAT_BEGIN:
+            case OP_JUMP_IF_FALSE:
+                removeOverwrittenState(it->body, false);
+                removeOverwrittenState(it->elseBody, false);
+                pendingColor = pendingFill = pendingScale = none; // Nested code may draw
+                pendingTransforms.clear();
+                break;
+            case OP_EMIT:
+                pendingColor = pendingFill = pendingScale = none;
+                pendingTransforms.clear();
+                break;
+            default: // VAR, LET, SET do not touch drawing state
+                break;
+        }
+        ++it;
+    }
+
+    if (!topLevel) return;
+    if (pendingColor != none) { block.erase(pendingColor); _stats.deadCodeEliminated++; }
+    if (pendingFill != none) { block.erase(pendingFill); _stats.deadCodeEliminated++; }
+    if (pendingScale != none) { block.erase(pendingScale); _stats.deadCodeEliminated++; }
+    for (NodeIt dead : pendingTransforms) { block.erase(dead); _stats.deadCodeEliminated++; }
+}
+
+// Removes state changes that set the value already in effect. The top-level block starts
+// from the runtime's initial state (black, solid fill, identity transform).
+void MicroPatternsOptimizer::removeRedundantState(MicroPatternsIrBlock& block, bool topLevel) {
+    bool colorKnown = topLevel, fillKnown = topLevel, identityKnown = topLevel;
+    int32_t color = 15;
+    const MicroPatternsAsset* fill = nullptr;
+
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        const MicroPatternsInstruction& instr = it->instr;
+        bool redundant = false;
+        switch (instr.op) {
+            case OP_COLOR:
+                redundant = colorKnown && color == instr.aux;
+                colorKnown = true; color = instr.aux;
+                break;
+            case OP_FILL:
+                redundant = fillKnown && fill == instr.asset;
+                fillKnown = true; fill = instr.asset;
+                break;
+            case OP_RESET_TRANSFORMS:
+                redundant = identityKnown;
+                identityKnown = true;
+                break;
+            case OP_TRANSLATE:
+            case OP_ROTATE:
+            case OP_SCALE:
+                identityKnown = false;
+                break;
+            case OP_REPEAT_BEGIN:
+            case OP_JUMP_IF_FALSE:
+                removeRedundantState(it->body, false);
+                removeRedundantState(it->elseBody, false);
+                if (containsOp(it->body, OP_COLOR) || containsOp(it->elseBody, OP_COLOR)) colorKnown = false;
+                if (containsOp(it->body, OP_FILL) || containsOp(it->elseBody, OP_FILL)) fillKnown = false;
+                if (containsOp(it->body, OP_TRANSLATE, OP_ROTATE, OP_SCALE) ||
+                    containsOp(it->elseBody, OP_TRANSLATE, OP_ROTATE, OP_SCALE)) identityKnown = false;
+                break;
+            default:
+                break;
+        }
+        if (redundant) {
+            it = block.erase(it);
+            _stats.deadCodeEliminated++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+void MicroPatternsOptimizer::eliminateDeadCode(MicroPatternsIrBlock& ir) {
+    // Removing a write can make the variables it read unused in turn
+    std::vector<uint8_t> reads;
+    do {
+        reads.assign(_program->slotCount, 0);
+        collectReads(ir, reads);
+    } while (removeUnusedWrites(ir, reads));
+
+    removeOverwrittenState(ir, true);
+    removeRedundantState(ir, true);
+
+    // Drop loops and branches left empty
+    removeEmptyBlocks(ir);
+}
+
+void MicroPatternsOptimizer::removeEmptyBlocks(MicroPatternsIrBlock& block) {
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        removeEmptyBlocks(it->body);
+        removeEmptyBlocks(it->elseBody);
+        OpCode op = it->instr.op;
+        int32_t count;
+        // A negative constant count still reports its runtime error; keep that loop
+        bool keepForError = op == OP_REPEAT_BEGIN && !(isConstant(it->instr.args[0], count) && count >= 0);
+        if ((op == OP_REPEAT_BEGIN || op == OP_JUMP_IF_FALSE) && it->body.empty() && it->elseBody.empty() && !keepForError) {
+            it = block.erase(it);
+            _stats.deadCodeEliminated++;
+        } else {
+            ++it;
+        }
+    }
+}
+
+// --- Invariant hoisting ---
+
+void MicroPatternsOptimizer::collectWrites(const MicroPatternsIrBlock& block, std::vector<uint8_t>& writes) const {
+    for (const auto& node : block) {
+        OpCode op = node.instr.op;
+        if (op == OP_VAR || op == OP_LET || op == OP_SET) writes[node.instr.target] = 1;
+        collectWrites(node.body, writes);
+        collectWrites(node.elseBody, writes);
+    }
+}
+
+void MicroPatternsOptimizer::hoistBlock(MicroPatternsIrBlock& block) {
+    for (MicroPatternsIrBlock::iterator it = block.begin(); it != block.end(); ++it) {
+        hoistBlock(it->body); // Innermost loops first; their preheaders become part of this body
+        hoistBlock(it->elseBody);
+        if (it->instr.op == OP_REPEAT_BEGIN) {
+            hoistFromLoop(block, it);
+        }
+    }
+}
+
+// Moves expressions that cannot change between iterations into temporaries set before the
+// loop. Only whole operand expressions are hoisted, and only if evaluating them early
+// cannot raise a runtime error.
+void MicroPatternsOptimizer::hoistFromLoop(MicroPatternsIrBlock& parent, MicroPatternsIrBlock::iterator loop) {
+    std::vector<uint8_t> writes(_program->slotCount, 0);
+    collectWrites(loop->body, writes);
+    writes[SLOT_INDEX] = 1;
+
+    MicroPatternsIrBlock preheader;
+
+    // Temporaries already hoisted out of inner loops move out further if still invariant
+    MicroPatternsIrBlock::iterator it = loop->body.begin();
+    while (it != loop->body.end()) {
+        MicroPatternsIrBlock::iterator next = it;
+        ++next;
+        if (it->instr.op == OP_SET && !readsSlot(it->instr.args[0], writes) && isSafeToHoist(it->instr.args[0])) {
+            preheader.splice(preheader.end(), loop->body, it);
+        }
+        it = next;
+    }
+
+    std::vector<std::vector<ExprOp> > hoisted;
+    std::vector<int> tempSlots;
+    hoistExpressions(loop->body, writes, hoisted, tempSlots, preheader, loop->instr.lineNumber);
+
+    parent.splice(loop, preheader);
+}
+
+void MicroPatternsOptimizer::hoistExpressions(MicroPatternsIrBlock& block, const std::vector<uint8_t>& writes,
+                                              std::vector<std::vector<ExprOp> >& hoisted, std::vector<int>& tempSlots,
+                                              MicroPatternsIrBlock& preheader, int lineNumber) {
+    std::vector<ExprOp> ops;
+    for (auto& node : block) {
+        for (int i = 0; i < 4; ++i) {
+            ExprRef& ref = node.instr.args[i];
+            if (ref.length <= 1 || readsSlot(ref, writes) || !isSafeToHoist(ref)) continue;
+            readExpression(ref, ops);
+
+            int slot = -1;
+            for (size_t h = 0; h < hoisted.size(); ++h) {
+                if (hoisted[h].size() != ops.size()) continue;
+                bool same = true;
+                for (size_t k = 0; k < ops.size() && same; ++k) {
+                    same = hoisted[h][k].code == ops[k].code && hoisted[h][k].value == ops[k].value;
+                }
+                if (same) { slot = tempSlots[h]; break; }
+            }
+
+            std::vector<ExprOp> read(1);
+            read[0].code = EXPR_SLOT;
+            if (slot < 0) {
+                read[0].value = _program->slotCount;
+                ExprRef original = ref;
+                if (!replaceExpression(ref, read)) return; // Pool full
+                slot = _program->slotCount++;
+                _program->slotNames.push_back("$~T" + String(_tempCount++));
+                hoisted.push_back(ops);
+                tempSlots.push_back(slot);
+
+                MicroPatternsIrNode set;
+                set.instr.op = OP_SET;
+                set.instr.type = CMD_LET;
+                set.instr.lineNumber = lineNumber;
+                set.instr.target = slot;
+                set.instr.args[0] = original;
+                preheader.push_back(set);
+                _stats.invariantsHoisted++;
+            } else {
+                read[0].value = slot;
+                if (!replaceExpression(ref, read)) return;
+            }
+        }
+        hoistExpressions(node.body, writes, hoisted, tempSlots, preheader, lineNumber);
+        hoistExpressions(node.elseBody, writes, hoisted, tempSlots, preheader, lineNumber);
+    }
+}
+
+// --- Transform sequencing ---
+
+// Runs of TRANSLATE/ROTATE with constant operands become one OP_TRANSFORM whose matrix
+// is the product of the run, precomputed here.
+void MicroPatternsOptimizer::sequenceTransforms(MicroPatternsIrBlock& block) {
+    MicroPatternsIrBlock::iterator it = block.begin();
+    while (it != block.end()) {
+        sequenceTransforms(it->body);
+        sequenceTransforms(it->elseBody);
+
+        float combined[6];
+        matrix_identity(combined);
+        int runLength = 0;
+        MicroPatternsIrBlock::iterator runEnd = it;
+        while (runEnd != block.end()) {
+            const MicroPatternsInstruction& instr = runEnd->instr;
+            int32_t a, b;
+            float op[6];
+            if (instr.op == OP_TRANSLATE && isConstant(instr.args[0], a) && isConstant(instr.args[1], b)) {
+                matrix_make_translation(op, static_cast<float>(a), static_cast<float>(b));
+            } else if (instr.op == OP_ROTATE && isConstant(instr.args[0], a)) {
+                matrix_make_rotation(op, static_cast<float>(a));
+            } else {
+                break;
+            }
+            matrix_multiply(combined, combined, op);
+            runLength++;
+            ++runEnd;
+        }
+
+        if (runLength < 2) {
+            ++it;
+            continue;
+        }
+
+        MicroPatternsInstruction merged;
+        merged.op = OP_TRANSFORM;
+        merged.type = it->instr.type;
+        merged.lineNumber = it->instr.lineNumber;
+        merged.aux = _program->matrices.size();
+        _program->matrices.insert(_program->matrices.end(), combined, combined + 6);
+
+        it = block.erase(it, runEnd);
+        MicroPatternsIrNode node;
+        node.instr = merged;
+        block.insert(it, node);
+        _stats.transformsSequenced += runLength - 1;
+    }
+}
+
+// --- Instancing ---
+
+// Slot classes tracked through a loop body by the instancing analysis
+enum InstanceSlotClass : uint8_t {
+    INSTANCE_INVARIANT = 0, // Same value in every iteration
+    INSTANCE_AFFINE,        // Affine in $INDEX (assigned earlier in the iteration, or $INDEX itself)
+    INSTANCE_CARRIED        // Written later in the body: the value comes from the previous iteration
+};
+
+// A loop whose body is assignments and a single EMIT, all affine in $INDEX, draws items that
+// differ by a constant step per iteration. The runtime runs the body at $INDEX 0 and 1 and
+// emits one instanced item instead of 'count' items, then runs the assignments once more
+// for the last iteration so variables end with their usual values.
+void MicroPatternsOptimizer::markInstancedLoops(MicroPatternsIrBlock& block) {
+    for (auto& node : block) {
+        markInstancedLoops(node.body);
+        markInstancedLoops(node.elseBody);
+        if (node.instr.op != OP_REPEAT_BEGIN) continue;
+
+        std::vector<uint8_t> classes(_program->slotCount, INSTANCE_INVARIANT);
+        collectWrites(node.body, classes); // Written slots are loop-carried until assigned in the iteration
+        for (uint8_t& c : classes) if (c) c = INSTANCE_CARRIED;
+        classes[SLOT_INDEX] = INSTANCE_AFFINE;
+
+        int emits = 0;
+        bool affine = true;
+        for (auto it = node.body.begin(); it != node.body.end() && affine; ++it) {
+            const MicroPatternsInstruction& instr = it->instr;
+            bool varies = false;
+            if (instr.op == OP_LET || instr.op == OP_SET) {
+                // Evaluated out of order: must not raise errors either
+                affine = isSafeToHoist(instr.args[0]) && isAffineInIndex(instr.args[0], classes, varies);
+                classes[instr.target] = varies ? INSTANCE_AFFINE : INSTANCE_INVARIANT;
+            } else if (instr.op == OP_EMIT) {
+                emits++;
+                for (int i = 0; i < 4 && affine; ++i) {
+                    affine = isSafeToHoist(instr.args[i]) && isAffineInIndex(instr.args[i], classes, varies);
+                }
+            } else {
+                affine = false; // State changes, nested control flow
+            }
+        }
+        if (!affine || emits != 1) continue;
+        node.instr.aux = REPEAT_INSTANCED;
+        _stats.loopsInstanced++;
+    }
+}
+
+// Structurally affine in $INDEX: varying terms are only added, subtracted or multiplied by
+// invariant terms. The identity holds in wrapping int32 arithmetic too, so instances match
+// the iterations exactly. 'varies' is set if the result depends on $INDEX.
+bool MicroPatternsOptimizer::isAffineInIndex(const ExprRef& ref, const std::vector<uint8_t>& classes, bool& varies) const {
+    bool dependsOnIndex[EXPR_MAX_STACK_DEPTH];
+    int sp = 0;
+    varies = false;
+    for (int i = 0; i < ref.length; ++i) {
+        const ExprOp& op = _program->expressions[ref.start + i];
+        if (op.code == EXPR_CONST || op.code == EXPR_SLOT) {
+            uint8_t c = op.code == EXPR_SLOT ? classes[op.value] : (uint8_t)INSTANCE_INVARIANT;
+            if (c == INSTANCE_CARRIED || sp >= EXPR_MAX_STACK_DEPTH) return false;
+            dependsOnIndex[sp++] = c == INSTANCE_AFFINE;
+            continue;
+        }
+        if (sp < 2) return false;
+        bool a = dependsOnIndex[sp - 2], b = dependsOnIndex[sp - 1];
+        sp--;
+        switch (op.code) {
+            case EXPR_ADD:
+            case EXPR_SUB: dependsOnIndex[sp - 1] = a || b; break;
+            case EXPR_MUL: if (a && b) return false; dependsOnIndex[sp - 1] = a || b; break;
+            default:       if (a || b) return false; dependsOnIndex[sp - 1] = false; break; // DIV, MOD
+        }
+    }
+    varies = sp > 0 && dependsOnIndex[0];
+    return true;
+}
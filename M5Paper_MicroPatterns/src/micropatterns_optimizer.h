@@ -0,0 +1,103 @@
+#ifndef MICROPATTERNS_OPTIMIZER_H
+#define MICROPATTERNS_OPTIMIZER_H
+
+#include <Arduino.h>
+#include <vector>
+#include "micropatterns_compiler.h" // For MicroPatternsIrBlock, MicroPatternsProgram, ExprOp
+
+// Optimisation switches. Names follow the emulator's compiler.js optimizationConfig.
+struct MicroPatternsOptimizerConfig {
+    bool enableConstantFolding = true;      // Fold constant expressions, substitute constant variables
+    bool enableLoopUnrolling = true;        // Unroll small loops with a constant count
+    int loopUnrollThreshold = 8;            // Maximum loop count to unroll
+    bool enableInvariantHoisting = true;    // Hoist loop-invariant expressions (LET values, IF conditions, ...)
+    bool enableDeadCodeElimination = true;  // Remove code with no effect
+    bool enableTransformSequencing = true;  // Combine TRANSLATE/ROTATE sequences into one matrix
+    bool enableInstancing = true;           // Emit loops drawing one item affine in $INDEX as one instanced item
+    bool logOptimizationStats = false;      // Log optimisation statistics after each run
+
+    // Canvas size substituted for $WIDTH/$HEIGHT when folding. 0 = treat as unknown.
+    int canvasWidth = 0;
+    int canvasHeight = 0;
+};
+
+// Counters for the last optimize() call, named like compiler.js secondPassStats.
+struct MicroPatternsOptimizerStats {
+    int constantsFolded = 0;            // Expressions shortened by folding
+    int constantsValuesSubstituted = 0; // Variable reads replaced by their constant value
+    int loopsUnrolled = 0;
+    int invariantsHoisted = 0;
+    int deadCodeEliminated = 0;         // Instructions or blocks removed
+    int transformsSequenced = 0;        // TRANSLATE/ROTATE instructions merged away
+    int loopsInstanced = 0;
+};
+
+// Rewrites the compiler's structured IR in place. Every pass preserves the display list
+// the unoptimised program would generate; diagnostics for removed code may be dropped.
+class MicroPatternsOptimizer {
+public:
+    MicroPatternsOptimizer();
+
+    void setConfig(const MicroPatternsOptimizerConfig& config) { _config = config; }
+    const MicroPatternsOptimizerConfig& getConfig() const { return _config; }
+
+    void optimize(MicroPatternsIrBlock& ir, MicroPatternsProgram& program);
+
+    const MicroPatternsOptimizerStats& getStats() const { return _stats; }
+
+private:
+    MicroPatternsOptimizerConfig _config;
+    MicroPatternsOptimizerStats _stats;
+    MicroPatternsProgram* _program;
+    int _tempCount;
+
+    // Constant folding state, per slot
+    std::vector<int> _writeCount;
+    std::vector<uint8_t> _substitutable; // Only written by top-level VARs
+    std::vector<uint8_t> _isConst;       // Value known at the current point of the fold
+    std::vector<int32_t> _constValue;
+
+    // Expression helpers
+    void readExpression(const ExprRef& ref, std::vector<ExprOp>& out) const;
+    bool replaceExpression(ExprRef& ref, const std::vector<ExprOp>& ops);
+    bool isConstant(const ExprRef& ref, int32_t& value) const;
+    bool readsSlot(const ExprRef& ref, const std::vector<uint8_t>& slots) const;
+    bool isSafeToHoist(const ExprRef& ref) const;
+
+    // Constant folding
+    void foldProgram(MicroPatternsIrBlock& ir);
+    void countWrites(const MicroPatternsIrBlock& block, bool topLevel);
+    void foldBlock(MicroPatternsIrBlock& block, bool topLevel);
+    bool foldExpression(ExprRef& ref);
+
+    // Loop unrolling
+    void unrollBlock(MicroPatternsIrBlock& block);
+    int countNodes(const MicroPatternsIrBlock& block) const;
+    bool substituteIndex(MicroPatternsIrBlock& block, int32_t index);
+
+    // Dead code elimination
+    void eliminateDeadCode(MicroPatternsIrBlock& ir);
+    void collectReads(const MicroPatternsIrBlock& block, std::vector<uint8_t>& reads) const;
+    bool removeUnusedWrites(MicroPatternsIrBlock& block, const std::vector<uint8_t>& reads);
+    void removeOverwrittenState(MicroPatternsIrBlock& block, bool topLevel);
+    void removeRedundantState(MicroPatternsIrBlock& block, bool topLevel);
+    void removeEmptyBlocks(MicroPatternsIrBlock& block);
+    bool containsOp(const MicroPatternsIrBlock& block, OpCode a, OpCode b = OP_HALT, OpCode c = OP_HALT) const;
+
+    // Invariant hoisting
+    void hoistBlock(MicroPatternsIrBlock& block);
+    void collectWrites(const MicroPatternsIrBlock& block, std::vector<uint8_t>& writes) const;
+    void hoistFromLoop(MicroPatternsIrBlock& parent, MicroPatternsIrBlock::iterator loop);
+    void hoistExpressions(MicroPatternsIrBlock& block, const std::vector<uint8_t>& writes,
+                          std::vector<std::vector<ExprOp> >& hoisted, std::vector<int>& tempSlots,
+                          MicroPatternsIrBlock& preheader, int lineNumber);
+
+    // Transform sequencing
+    void sequenceTransforms(MicroPatternsIrBlock& block);
+
+    // Instancing
+    void markInstancedLoops(MicroPatternsIrBlock& block);
+    bool isAffineInIndex(const ExprRef& ref, const std::vector<uint8_t>& classes, bool& varies) const;
+};
+
+#endif // MICROPATTERNS_OPTIMIZER_H
@@ -1,13 +1,16 @@
 #include "micropatterns_parser.h"
 #include <ctype.h> // For isdigit, isspace, isalnum
+#include <string.h> // For strlen, memset
+#include <limits.h> // For INT_MIN, LONG_MAX
 #include "esp32-hal-log.h" // For log_w warning
+#include <algorithm> // For std::min, std::max
 
 MicroPatternsParser::MicroPatternsParser() {
     reset();
 }
 
 void MicroPatternsParser::reset() {
-    _commands.clear();
+    _commands = CommandList(); // Takes the allocator of the arena current now
     _assets.clear();
     _commandStack.clear(); // Clear the stack on reset
     _errors.clear();
@@ -19,7 +22,7 @@ void MicroPatternsParser::addError(const String& message) {
     _errors.push_back("Line " + String(_lineNumber) + ": " + message);
 }
 
-const std::list<MicroPatternsCommand>& MicroPatternsParser::getCommands() const { // Changed to std::list
+const CommandList& MicroPatternsParser::getCommands() const { // Changed to std::list
     return _commands;
 }
 
@@ -59,23 +62,112 @@ bool MicroPatternsParser::validateVariableUsage(const String& varRefWithDollar)
     return true;
 }
 
+// --- ScriptTextView ---
+ScriptTextView ScriptTextView::trimmed() const {
+    int start = 0, stop = length;
+    while (start < stop && isspace(data[start])) start++;
+    while (stop > start && isspace(data[stop - 1])) stop--;
+    return sub(start, stop);
+}
+
+int ScriptTextView::indexOf(char c, int start) const {
+    for (int i = start; i < length; ++i) {
+        if (data[i] == c) return i;
+    }
+    return -1;
+}
+
+bool ScriptTextView::startsWithIgnoreCase(const char* upperPrefix) const {
+    int n = strlen(upperPrefix);
+    if (n > length) return false;
+    for (int i = 0; i < n; ++i) {
+        if (toupper(data[i]) != upperPrefix[i]) return false;
+    }
+    return true;
+}
+
+bool ScriptTextView::endsWithIgnoreCase(const char* upperSuffix) const {
+    int n = strlen(upperSuffix);
+    return n <= length && from(length - n).startsWithIgnoreCase(upperSuffix);
+}
+
+String ScriptTextView::toUpperString() const {
+    String upper = toString();
+    upper.toUpperCase();
+    return upper;
+}
+
+// --- Command keywords ---
+// Case-insensitive FNV-1a hash of a command name, looked up in an open-addressed table built on
+// first use; the keyword itself is only compared on a hash match.
+struct CommandKeyword {
+    const char* name;
+    CommandType type;
+};
+
+static const CommandKeyword COMMAND_KEYWORDS[] = {
+    { "DEFINE", CMD_DEFINE_PATTERN }, { "VAR", CMD_VAR }, { "LET", CMD_LET }, { "REPEAT", CMD_REPEAT },
+    { "ENDREPEAT", CMD_ENDREPEAT }, { "IF", CMD_IF }, { "ELSE", CMD_ELSE }, { "ENDIF", CMD_ENDIF },
+    { "COLOR", CMD_COLOR }, { "FILL", CMD_FILL }, { "DRAW", CMD_DRAW }, { "RESET_TRANSFORMS", CMD_RESET_TRANSFORMS },
+    { "TRANSLATE", CMD_TRANSLATE }, { "ROTATE", CMD_ROTATE }, { "SCALE", CMD_SCALE }, { "PIXEL", CMD_PIXEL },
+    { "FILL_PIXEL", CMD_FILL_PIXEL }, { "LINE", CMD_LINE }, { "RECT", CMD_RECT }, { "FILL_RECT", CMD_FILL_RECT },
+    { "CIRCLE", CMD_CIRCLE }, { "FILL_CIRCLE", CMD_FILL_CIRCLE },
+};
+static const int COMMAND_KEYWORD_COUNT = sizeof(COMMAND_KEYWORDS) / sizeof(COMMAND_KEYWORDS[0]);
+static const int KEYWORD_TABLE_SIZE = 64; // Power of two, well above COMMAND_KEYWORD_COUNT
+
+static uint32_t keywordHash(const char* s, int n) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < n; ++i) {
+        h ^= (uint8_t)toupper(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// CMD_UNKNOWN if 'name' is not a command keyword
+static CommandType lookupCommand(ScriptTextView name) {
+    struct Table {
+        int8_t slots[KEYWORD_TABLE_SIZE]; // Index into COMMAND_KEYWORDS, -1 = empty
+        Table() {
+            memset(slots, -1, sizeof(slots));
+            for (int k = 0; k < COMMAND_KEYWORD_COUNT; ++k) {
+                uint32_t i = keywordHash(COMMAND_KEYWORDS[k].name, strlen(COMMAND_KEYWORDS[k].name));
+                while (slots[i & (KEYWORD_TABLE_SIZE - 1)] >= 0) i++;
+                slots[i & (KEYWORD_TABLE_SIZE - 1)] = k;
+            }
+        }
+    };
+    static const Table table;
+
+    for (uint32_t i = keywordHash(name.data, name.length);; ++i) {
+        int k = table.slots[i & (KEYWORD_TABLE_SIZE - 1)];
+        if (k < 0) return CMD_UNKNOWN;
+        const char* keyword = COMMAND_KEYWORDS[k].name;
+        if ((int)strlen(keyword) == name.length && name.startsWithIgnoreCase(keyword)) return COMMAND_KEYWORDS[k].type;
+    }
+}
+
+static bool isArithmeticOperator(char c) {
+    return c == '+' || c == '-' || c == '*' || c == '/' || c == '%';
+}
+
 
 bool MicroPatternsParser::parse(const String& scriptText) {
+    return parse(scriptText.c_str(), scriptText.length());
+}
+
+bool MicroPatternsParser::parse(const char* scriptText, size_t length) {
     reset();
-    String currentLine;
+    ScriptTextView script(scriptText, (int)length);
     int start = 0;
-    int end = scriptText.indexOf('\n');
 
-    while (start < scriptText.length()) {
+    while (start < script.length) {
         _lineNumber++;
-        if (end == -1) {
-            currentLine = scriptText.substring(start);
-        } else {
-            currentLine = scriptText.substring(start, end);
-        }
-        currentLine.trim(); // Remove leading/trailing whitespace
+        int end = script.indexOf('\n', start);
+        ScriptTextView currentLine = script.sub(start, end == -1 ? script.length : end).trimmed();
 
-        if (currentLine.length() > 0 && !currentLine.startsWith("#")) {
+        if (currentLine.length > 0 && !currentLine.startsWith('#')) {
             if (!processLine(currentLine)) {
                 // Stop parsing on first major error? Or collect all?
                 // For now, let's collect all errors.
@@ -86,7 +178,6 @@ bool MicroPatternsParser::parse(const String& scriptText) {
             break; // Reached end of script
         }
         start = end + 1;
-        end = scriptText.indexOf('\n', start);
     }
 
     // After parsing all lines, check if any blocks are unclosed
@@ -102,20 +193,17 @@ bool MicroPatternsParser::parse(const String& scriptText) {
     return _errors.empty(); // Return true if no errors occurred
 }
 
-bool MicroPatternsParser::processLine(const String& line) {
+bool MicroPatternsParser::processLine(ScriptTextView line) {
     int firstSpace = line.indexOf(' ');
-    String commandNameStr;
-    String argsString = "";
+    ScriptTextView commandName = line;
+    ScriptTextView argsString;
 
-    if (firstSpace == -1) {
-        commandNameStr = line;
-    } else {
-        commandNameStr = line.substring(0, firstSpace);
-        argsString = line.substring(firstSpace + 1);
-        argsString.trim();
+    if (firstSpace != -1) {
+        commandName = line.sub(0, firstSpace);
+        argsString = line.from(firstSpace + 1).trimmed();
     }
 
-    commandNameStr.toUpperCase(); // Commands are case-insensitive
+    CommandType commandType = lookupCommand(commandName); // Commands are case-insensitive
 
     MicroPatternsCommand cmd;
     cmd.lineNumber = _lineNumber;
@@ -124,19 +212,19 @@ bool MicroPatternsParser::processLine(const String& line) {
     bool isElse = false;       // Flag for ELSE
 
     // --- Handle block ends and ELSE first ---
-    if (commandNameStr == "ENDREPEAT") {
+    if (commandType == CMD_ENDREPEAT) {
         if (_commandStack.empty() || _commandStack.back()->type != CMD_REPEAT) {
             addError("Unexpected ENDREPEAT without matching REPEAT.");
             return false;
         }
         isBlockEnd = true;
-    } else if (commandNameStr == "ENDIF") {
+    } else if (commandType == CMD_ENDIF) {
          if (_commandStack.empty() || _commandStack.back()->type != CMD_IF) {
             addError("Unexpected ENDIF without matching IF.");
             return false;
         }
         isBlockEnd = true;
-    } else if (commandNameStr == "ELSE") {
+    } else if (commandType == CMD_ELSE) {
         if (_commandStack.empty() || _commandStack.back()->type != CMD_IF) {
             addError("Unexpected ELSE without matching IF.");
             return false;
@@ -174,76 +262,39 @@ bool MicroPatternsParser::processLine(const String& line) {
 
 
     // --- Handle regular commands and block starts ---
-    if (commandNameStr == "DEFINE") {
-        String defineArgs = argsString;
-        defineArgs.trim();
-        String upperDefineArgs = defineArgs;
-        upperDefineArgs.toUpperCase();
-        if (!upperDefineArgs.startsWith("PATTERN ")) {
+    switch (commandType) {
+    case CMD_DEFINE_PATTERN:
+        if (!argsString.startsWithIgnoreCase("PATTERN ")) {
              addError("DEFINE command must be followed by 'PATTERN'.");
              return false;
         }
-        String patternArgs = defineArgs.substring(8); // Length of "PATTERN "
-        patternArgs.trim();
-        if (!parseDefinePattern(patternArgs)) return false;
+        if (!parseDefinePattern(argsString.from(8).trimmed())) return false; // Length of "PATTERN "
         cmd.type = CMD_NOOP; // Handled at parse time
-    } else if (commandNameStr == "VAR") {
-        String varName;
-        std::vector<ParamValue> tokens;
-        if (!parseVar(argsString, varName, tokens)) return false;
+        break;
+    case CMD_VAR:
+        if (!parseVar(argsString, cmd.varName, cmd.initialExpressionTokens)) return false;
         cmd.type = CMD_VAR;
-        cmd.varName = varName;
-        cmd.initialExpressionTokens = tokens;
-    } else if (commandNameStr == "LET") {
-        String targetVar;
-        std::vector<ParamValue> tokens;
-        if (!parseLet(argsString, targetVar, tokens)) return false;
+        break;
+    case CMD_LET:
+        if (!parseLet(argsString, cmd.letTargetVar, cmd.letExpressionTokens)) return false;
         cmd.type = CMD_LET;
-        cmd.letTargetVar = targetVar;
-        cmd.letExpressionTokens = tokens;
-    } else if (commandNameStr == "REPEAT") {
-        ParamValue countVal;
-        if (!parseRepeat(argsString, countVal)) return false;
+        break;
+    case CMD_REPEAT:
+        if (!parseRepeat(argsString, cmd.count)) return false;
         cmd.type = CMD_REPEAT;
-        cmd.count = countVal;
         isBlockStart = true;
-    } else if (commandNameStr == "IF") {
-        std::vector<ParamValue> conditionTokens;
-        if (!parseIf(argsString, conditionTokens)) return false;
+        break;
+    case CMD_IF:
+        if (!parseIf(argsString, cmd.conditionTokens)) return false;
         cmd.type = CMD_IF;
-        cmd.conditionTokens = conditionTokens;
         isBlockStart = true;
-    } else if (commandNameStr == "COLOR") {
-        cmd.type = CMD_COLOR;
-    } else if (commandNameStr == "FILL") {
-        cmd.type = CMD_FILL;
-    } else if (commandNameStr == "DRAW") {
-        cmd.type = CMD_DRAW;
-    } else if (commandNameStr == "RESET_TRANSFORMS") {
-        cmd.type = CMD_RESET_TRANSFORMS;
-    } else if (commandNameStr == "TRANSLATE") {
-        cmd.type = CMD_TRANSLATE;
-    } else if (commandNameStr == "ROTATE") {
-        cmd.type = CMD_ROTATE;
-    } else if (commandNameStr == "SCALE") {
-        cmd.type = CMD_SCALE;
-    } else if (commandNameStr == "PIXEL") {
-        cmd.type = CMD_PIXEL;
-    } else if (commandNameStr == "FILL_PIXEL") {
-        cmd.type = CMD_FILL_PIXEL;
-    } else if (commandNameStr == "LINE") {
-        cmd.type = CMD_LINE;
-    } else if (commandNameStr == "RECT") {
-        cmd.type = CMD_RECT;
-    } else if (commandNameStr == "FILL_RECT") {
-        cmd.type = CMD_FILL_RECT;
-    } else if (commandNameStr == "CIRCLE") {
-        cmd.type = CMD_CIRCLE;
-    } else if (commandNameStr == "FILL_CIRCLE") {
-        cmd.type = CMD_FILL_CIRCLE;
-    } else {
-        addError("Unknown command: " + commandNameStr);
+        break;
+    case CMD_UNKNOWN:
+        addError("Unknown command: " + commandName.toUpperString());
         return false;
+    default: // Drawing and state commands with KEY=VALUE parameters
+        cmd.type = commandType;
+        break;
     }
 
     // Parse parameters for commands that use the generic KEY=VALUE format
@@ -257,7 +308,6 @@ bool MicroPatternsParser::processLine(const String& line) {
             return false;
         }
     }
-
     // Add the command to the correct list (top-level or nested)
     if (cmd.type != CMD_NOOP) { // Don't add NOOP commands
         if (_commandStack.empty()) {
@@ -296,39 +346,29 @@ bool MicroPatternsParser::processLine(const String& line) {
 }
 
 // Parses REPEAT COUNT=value
-bool MicroPatternsParser::parseRepeat(const String& argsString, ParamValue& outCount) {
-    String trimmedArgs = argsString;
-    trimmedArgs.trim();
-    String upperArgs = trimmedArgs;
-    upperArgs.toUpperCase();
+bool MicroPatternsParser::parseRepeat(ScriptTextView argsString, ParamValue& outCount) {
+    ScriptTextView trimmedArgs = argsString.trimmed();
 
-    if (!upperArgs.startsWith("COUNT=")) {
+    if (!trimmedArgs.startsWithIgnoreCase("COUNT=")) {
         addError("REPEAT requires COUNT= parameter.");
         return false;
     }
 
-    int equalsPos = trimmedArgs.indexOf('='); // Find the first '='
-    if (equalsPos == -1) { // Should be caught by startsWith, but defensive
-        addError("Invalid format for REPEAT COUNT parameter. Missing '='.");
-        return false;
-    }
-
     // The value is everything after "COUNT="
-    String countValueStr = trimmedArgs.substring(equalsPos + 1);
-    countValueStr.trim();
+    ScriptTextView countValueStr = trimmedArgs.from(6).trimmed();
 
-    if (countValueStr.length() == 0) {
+    if (countValueStr.isEmpty()) {
         addError("Missing value for REPEAT COUNT.");
         return false;
     }
 
     // Attempt to parse the value string. parseValue expects a single token.
-    // If countValueStr contains multiple tokens (e.g., "10 EXTRA"), parseValue will likely
-    // treat it as a single string "10 EXTRA", and subsequent type checks will fail.
+    // If countValueStr contains multiple tokens (e.g., "10 EXTRA"), parseValue will
+    // treat it as a single string "10 EXTRA", and the type check below fails.
     outCount = parseValue(countValueStr);
 
     if (outCount.type != ParamValue::TYPE_INT && outCount.type != ParamValue::TYPE_VARIABLE) {
-        addError("REPEAT COUNT value must be an integer or a variable ($var). Got: '" + countValueStr + "' which parsed as type " + String(outCount.type));
+        addError("REPEAT COUNT value must be an integer or a variable ($var). Got: '" + countValueStr.toString() + "' which parsed as type " + String(outCount.type));
         return false;
     }
 
@@ -339,31 +379,22 @@ bool MicroPatternsParser::parseRepeat(const String& argsString, ParamValue& outC
             return false;
         }
     }
-    
-    // Check if the original countValueStr was indeed just a single valid token.
-    // This is implicitly handled because parseValue would return a TYPE_STRING for "10 EXTRA",
-    // which would then fail the type check above.
 
     return true;
 }
 
 // Parses IF condition THEN
-bool MicroPatternsParser::parseIf(const String& argsString, std::vector<ParamValue>& outConditionTokens) {
-    String trimmedArgs = argsString;
-    trimmedArgs.trim();
-    String upperArgs = trimmedArgs;
-    upperArgs.toUpperCase();
-
-    int thenPos = upperArgs.lastIndexOf(" THEN");
-    if (thenPos == -1 || thenPos != upperArgs.length() - 5) { // Check it's at the very end
+bool MicroPatternsParser::parseIf(ScriptTextView argsString, ParamList& outConditionTokens) {
+    ScriptTextView trimmedArgs = argsString.trimmed();
+
+    if (!trimmedArgs.endsWithIgnoreCase(" THEN")) { // At the very end
         addError("IF requires ' THEN' at the end of the condition.");
         return false;
     }
 
-    String conditionStr = trimmedArgs.substring(0, thenPos);
-    conditionStr.trim();
+    ScriptTextView conditionStr = trimmedArgs.sub(0, trimmedArgs.length - 5).trimmed();
 
-    if (conditionStr.length() == 0) {
+    if (conditionStr.isEmpty()) {
         addError("Missing condition for IF statement.");
         return false;
     }
@@ -378,9 +409,40 @@ bool MicroPatternsParser::parseIf(const String& argsString, std::vector<ParamVal
 }
 
 
+void MicroPatternsParser::analyzeAsset(MicroPatternsAsset& asset) {
+    asset.runs.clear();
+    asset.rowRunStart.assign(asset.height + 1, 0);
+    asset.bboxMinX = asset.width; asset.bboxMinY = asset.height;
+    asset.bboxMaxX = 0; asset.bboxMaxY = 0;
+    size_t setCount = 0;
+
+    for (int y = 0; y < asset.height; ++y) {
+        asset.rowRunStart[y] = static_cast<uint32_t>(asset.runs.size());
+        int x = 0;
+        while (x < asset.width) {
+            while (x < asset.width && !asset.bit(x, y)) x++;
+            if (x >= asset.width) break;
+            int start = x;
+            while (x < asset.width && asset.bit(x, y)) x++;
+            MicroPatternsAssetRun run = { static_cast<uint16_t>(start), static_cast<uint16_t>(x) };
+            asset.runs.push_back(run);
+            setCount += x - start;
+            asset.bboxMinX = std::min(asset.bboxMinX, start);
+            asset.bboxMaxX = std::max(asset.bboxMaxX, x);
+            asset.bboxMinY = std::min(asset.bboxMinY, y);
+            asset.bboxMaxY = y + 1;
+        }
+    }
+    asset.rowRunStart[asset.height] = static_cast<uint32_t>(asset.runs.size());
+    if (setCount == 0) {
+        asset.bboxMinX = asset.bboxMinY = asset.bboxMaxX = asset.bboxMaxY = 0;
+    }
+    asset.isOpaque = setCount == (size_t)asset.width * asset.height;
+}
+
 // Parses the arguments for DEFINE PATTERN NAME=... WIDTH=... HEIGHT=... DATA=...
-bool MicroPatternsParser::parseDefinePattern(const String& argsString) {
-    std::map<String, ParamValue> patternParams;
+bool MicroPatternsParser::parseDefinePattern(ScriptTextView argsString) {
+    ParamMap patternParams;
     if (!parseParams(argsString, patternParams)) {
         return false; // Error already added by parseParams
     }
@@ -416,6 +478,10 @@ bool MicroPatternsParser::parseDefinePattern(const String& argsString) {
         addError("Pattern WIDTH and HEIGHT must be positive.");
         return false;
     }
+    if (asset.width > 65535 || asset.height > 65535) {
+        addError("Pattern WIDTH and HEIGHT must be at most 65535.");
+        return false;
+    }
     if (asset.width > 20 || asset.height > 20) {
          log_w("Line %d: Pattern '%s' dimensions (%dx%d) exceed recommended maximum (20x20).", _lineNumber, asset.originalName.c_str(), asset.width, asset.height);
     }
@@ -435,17 +501,19 @@ bool MicroPatternsParser::parseDefinePattern(const String& argsString) {
         }
     }
 
-    asset.data.reserve(expectedLen);
+    // Pack to 1bpp rows. Opacity, bounding box and row runs are derived once here.
+    asset.wordsPerRow = (asset.width + 31) / 32;
+    asset.bits.assign((size_t)asset.wordsPerRow * asset.height, 0);
     for (int i = 0; i < dataStr.length(); ++i) {
-        if (dataStr[i] == '0') {
-            asset.data.push_back(0);
-        } else if (dataStr[i] == '1') {
-            asset.data.push_back(1);
-        } else {
+        if (dataStr[i] == '1') {
+            int x = i % asset.width, y = i / asset.width;
+            asset.bits[y * asset.wordsPerRow + (x >> 5)] |= 0x80000000u >> (x & 31);
+        } else if (dataStr[i] != '0') {
             addError("DATA string must contain only '0' or '1'. Found '" + String(dataStr[i]) + "' in pattern '" + asset.originalName + "'.");
             return false;
         }
     }
+    analyzeAsset(asset);
 
     if (_assets.count(asset.name)) {
         addError("Pattern '" + asset.originalName + "' (or equivalent case) already defined.");
@@ -461,25 +529,23 @@ bool MicroPatternsParser::parseDefinePattern(const String& argsString) {
 }
 
 // Parses VAR $name [= expression]
-bool MicroPatternsParser::parseVar(const String& argsString, String& outVarName, std::vector<ParamValue>& outTokens) {
+bool MicroPatternsParser::parseVar(ScriptTextView argsString, String& outVarName, ParamList& outTokens) {
     outTokens.clear();
-    String trimmedArgs = argsString;
-    trimmedArgs.trim();
+    ScriptTextView trimmedArgs = argsString.trimmed();
 
-    if (!trimmedArgs.startsWith("$")) {
+    if (!trimmedArgs.startsWith('$')) {
         addError("VAR requires a variable name starting with '$'.");
         return false;
     }
 
     int equalsPos = trimmedArgs.indexOf('=');
-    int nameEndPos = trimmedArgs.length();
-    String expressionPart = "";
+    int nameEndPos = trimmedArgs.length;
+    ScriptTextView expressionPart;
 
     if (equalsPos != -1) {
         nameEndPos = equalsPos;
-        expressionPart = trimmedArgs.substring(equalsPos + 1);
-        expressionPart.trim();
-        if (expressionPart.length() == 0) {
+        expressionPart = trimmedArgs.from(equalsPos + 1).trimmed();
+        if (expressionPart.isEmpty()) {
             addError("Missing expression after '=' in VAR declaration.");
             return false;
         }
@@ -487,26 +553,20 @@ bool MicroPatternsParser::parseVar(const String& argsString, String& outVarName,
         // Check for trailing characters after name if no '='
         int spacePos = trimmedArgs.indexOf(' ');
         if (spacePos != -1) {
-             String extraContent = trimmedArgs.substring(spacePos);
-             extraContent.trim(); // Trim in place
-             addError("Invalid VAR syntax. Use 'VAR $name' or 'VAR $name = expression'. Found extra content: '" + extraContent + "'");
+             addError("Invalid VAR syntax. Use 'VAR $name' or 'VAR $name = expression'. Found extra content: '" +
+                      trimmedArgs.from(spacePos).trimmed().toString() + "'");
              return false;
         }
     }
 
-    String varRef = trimmedArgs.substring(0, nameEndPos);
-    varRef.trim();
-    if (varRef.length() <= 1) { // Just "$"
+    ScriptTextView varRefView = trimmedArgs.sub(0, nameEndPos).trimmed();
+    if (varRefView.length <= 1) { // Just "$"
         addError("Invalid variable name '$' in VAR declaration.");
         return false;
     }
-    outVarName = varRef.substring(1); // Extract name after '$'
-    outVarName.toUpperCase(); // Ensure case-insensitive variable names
+    String varRef = varRefView.toString(); // For error messages
+    outVarName = varRefView.from(1).toUpperString(); // Name after '$', case-insensitive
 
-    if (outVarName.length() == 0) { // Should be caught by length check, but defensive
-        addError("Invalid variable name in VAR declaration.");
-        return false;
-    }
     // Check for valid characters (basic check)
     for (char c : outVarName) {
         if (!isalnum(c) && c != '_') {
@@ -528,7 +588,7 @@ bool MicroPatternsParser::parseVar(const String& argsString, String& outVarName,
     // Add variable to declared list *before* parsing expression
     _declaredVariables.insert(outVarName);
 
-    if (expressionPart.length() > 0) {
+    if (!expressionPart.isEmpty()) {
         if (!parseExpression(expressionPart, outTokens)) {
             // Error already added by parseExpression
             // Remove the variable from declared list if expression parsing failed? No, keep it declared.
@@ -541,10 +601,9 @@ bool MicroPatternsParser::parseVar(const String& argsString, String& outVarName,
 
 
 // Parses LET $name = expression
-bool MicroPatternsParser::parseLet(const String& argsString, String& outTargetVarName, std::vector<ParamValue>& outTokens) {
+bool MicroPatternsParser::parseLet(ScriptTextView argsString, String& outTargetVarName, ParamList& outTokens) {
      outTokens.clear();
-     String trimmedArgs = argsString;
-     trimmedArgs.trim();
+     ScriptTextView trimmedArgs = argsString.trimmed();
 
      int equalsPos = trimmedArgs.indexOf('=');
      if (equalsPos == -1) {
@@ -552,31 +611,28 @@ bool MicroPatternsParser::parseLet(const String& argsString, String& outTargetVa
          return false;
      }
 
-     String targetVarStr = trimmedArgs.substring(0, equalsPos);
-     targetVarStr.trim();
-     String expressionStr = trimmedArgs.substring(equalsPos + 1);
-     expressionStr.trim();
+     ScriptTextView targetVarStr = trimmedArgs.sub(0, equalsPos).trimmed();
+     ScriptTextView expressionStr = trimmedArgs.from(equalsPos + 1).trimmed();
 
-     if (!targetVarStr.startsWith("$") || targetVarStr.length() <= 1) {
+     if (!targetVarStr.startsWith('$') || targetVarStr.length <= 1) {
          addError("LET target variable must start with '$' followed by a name.");
          return false;
      }
-     if (expressionStr.length() == 0) {
+     if (expressionStr.isEmpty()) {
          addError("LET statement requires an expression after '='.");
          return false;
      }
 
-     outTargetVarName = targetVarStr.substring(1);
-     outTargetVarName.toUpperCase(); // Ensure case-insensitive variable names
+     outTargetVarName = targetVarStr.from(1).toUpperString(); // Ensure case-insensitive variable names
 
      // Check if variable was declared (case-insensitive)
      if (_declaredVariables.find(outTargetVarName) == _declaredVariables.end()) {
-         addError("Cannot assign to undeclared variable: " + targetVarStr);
+         addError("Cannot assign to undeclared variable: " + targetVarStr.toString());
          return false;
      }
      // Check if trying to assign to an environment variable
      if (isEnvVar(outTargetVarName)) {
-          addError("Cannot assign to environment variable: " + targetVarStr);
+          addError("Cannot assign to environment variable: " + targetVarStr.toString());
           return false;
      }
 
@@ -594,34 +650,33 @@ bool MicroPatternsParser::parseLet(const String& argsString, String& outTargetVa
 
 
 // Parses "KEY=VALUE KEY2="VALUE 2" KEY3=$VAR" into the params map
-// Parses "KEY=VALUE KEY2="VALUE 2" KEY3=$VAR" into the params map
-bool MicroPatternsParser::parseParams(const String& argsString, std::map<String, ParamValue>& params) {
-    String remainingArgs = argsString;
-    remainingArgs.trim();
-    const char* ptr = remainingArgs.c_str();
+bool MicroPatternsParser::parseParams(ScriptTextView argsString, ParamMap& params) {
+    ScriptTextView remainingArgs = argsString.trimmed();
+    const char* ptr = remainingArgs.data;
+    const char* end = remainingArgs.end();
 
-    while (*ptr != '\0') {
-        while (*ptr != '\0' && isspace(*ptr)) ptr++;
-        if (*ptr == '\0') break;
+    while (ptr < end) {
+        while (ptr < end && isspace(*ptr)) ptr++;
+        if (ptr == end) break;
 
         const char* keyStart = ptr;
-        while (*ptr != '\0' && *ptr != '=' && !isspace(*ptr)) ptr++;
+        while (ptr < end && *ptr != '=' && !isspace(*ptr)) ptr++;
         String key(keyStart, ptr - keyStart);
         key.toUpperCase(); // Ensure case-insensitive parameter names
 
         if (key.length() == 0) {
-            addError("Empty parameter name found near '" + String(keyStart) + "'.");
+            addError("Empty parameter name found near '" + String(keyStart, end - keyStart) + "'.");
             return false;
         }
 
-        while (*ptr != '\0' && isspace(*ptr)) ptr++;
-        if (*ptr != '=') {
+        while (ptr < end && isspace(*ptr)) ptr++;
+        if (ptr == end || *ptr != '=') {
             addError("Missing '=' after parameter name '" + key + "'.");
             return false;
         }
         ptr++; // Skip '='
-        while (*ptr != '\0' && isspace(*ptr)) ptr++;
-        if (*ptr == '\0') {
+        while (ptr < end && isspace(*ptr)) ptr++;
+        if (ptr == end) {
             addError("Missing value for parameter '" + key + "'.");
             return false;
         }
@@ -632,64 +687,52 @@ bool MicroPatternsParser::parseParams(const String& argsString, std::map<String,
         if (*ptr == '"') {
             ptr++; // Skip opening quote
             const char* valueStart = ptr;
-            String tempVal = "";
-            while (*ptr != '\0') {
-                if (*ptr == '"') {
-                    break; // Found closing quote
-                }
-                if (*ptr == '\\' && *(ptr + 1) != '\0') { // Handle escapes
-                    ptr++; // Move to the escaped character
-                    if (*ptr == '"' || *ptr == '\\') {
-                        tempVal += *ptr; // Add escaped quote or backslash
-                    } else {
-                        // Keep the backslash and the character if it's not a known escape
-                        tempVal += '\\';
-                        tempVal += *ptr;
-                    }
-                } else {
-                    tempVal += *ptr;
+            bool hasEscapes = false;
+            while (ptr < end && *ptr != '"') { // Find the closing quote
+                if (*ptr == '\\' && ptr + 1 < end) {
+                    hasEscapes = true;
+                    ptr++; // An escaped quote does not close the literal
                 }
                 ptr++;
             }
 
-            if (*ptr != '"') {
+            if (ptr == end) {
                 addError("Unterminated string literal for parameter '" + key + "'.");
                 return false;
             }
-            valueString = tempVal; // Store unquoted, unescaped string
+            if (!hasEscapes) {
+                valueString = String(valueStart, ptr - valueStart); // Common case: copied in one go
+            } else {
+                valueString.reserve(ptr - valueStart);
+                for (const char* p = valueStart; p < ptr; ++p) {
+                    if (*p == '\\') { // Handle escapes
+                        p++; // Move to the escaped character
+                        if (*p != '"' && *p != '\\') {
+                            // Keep the backslash and the character if it's not a known escape
+                            valueString += '\\';
+                        }
+                    }
+                    valueString += *p;
+                }
+            }
+            // Stored unquoted, unescaped
             valueType = ParamValue::TYPE_STRING;
             ptr++; // Skip closing quote
         } else {
-            // Unquoted value (number, variable, keyword)
+            // Unquoted value (number, variable, keyword), up to the next space
             const char* valueStart = ptr;
-            // Value ends at the next space unless it's part of the next KEY=
-            while (*ptr != '\0' && !isspace(*ptr)) {
+            while (ptr < end && !isspace(*ptr)) {
                  ptr++;
             }
-            // Look ahead to see if the next non-space is KEY=
-            const char* lookahead = ptr;
-            while (*lookahead != '\0' && isspace(*lookahead)) lookahead++;
-            const char* nextKeyStart = lookahead;
-            while (*lookahead != '\0' && *lookahead != '=' && !isspace(*lookahead)) lookahead++;
-            bool nextIsKey = (*lookahead == '=');
-
-            // If the next thing is not KEY=, the space might be part of the value (e.g., in conditions)
-            // However, for standard params, values don't contain spaces.
-            // Let parseValue handle the type detection.
-            valueString = String(valueStart, ptr - valueStart);
-            if (valueString.length() == 0) {
-                 addError("Missing value for parameter '" + key + "'.");
-                 return false;
-            }
             // parseValue determines type (INT, VARIABLE, STRING keyword)
-            ParamValue parsedVal = parseValue(valueString);
-            valueString = parsedVal.stringValue; // May contain $VAR or keyword
-            valueType = parsedVal.type;
+            ParamValue parsedVal = parseValue(ScriptTextView(valueStart, ptr - valueStart));
             // If it was parsed as int, store int value
-            if (valueType == ParamValue::TYPE_INT) {
+            if (parsedVal.type == ParamValue::TYPE_INT) {
                  params[key] = ParamValue(parsedVal.intValue);
                  continue; // Skip storing stringValue below
             }
+            valueString = parsedVal.stringValue; // May contain $VAR or keyword
+            valueType = parsedVal.type;
         }
 
         if (params.count(key)) {
@@ -698,75 +741,67 @@ bool MicroPatternsParser::parseParams(const String& argsString, std::map<String,
         }
         params[key] = ParamValue(valueString, valueType);
 
-        while (*ptr != '\0' && isspace(*ptr)) ptr++;
+        while (ptr < end && isspace(*ptr)) ptr++;
     }
 
     return true;
 }
 
 // Parses a single unquoted value string. Determines if it's an integer, variable, or keyword string.
-ParamValue MicroPatternsParser::parseValue(const String& valueString) {
-    if (valueString.startsWith("$")) {
-        if (valueString.length() <= 1 || !isalpha(valueString[1])) { // Must start with $ followed by letter
+ParamValue MicroPatternsParser::parseValue(ScriptTextView valueString) {
+    if (valueString.startsWith('$')) {
+        if (valueString.length <= 1 || !isalpha(valueString[1])) { // Must start with $ followed by letter
              // Error will be caught later by validateVariableUsage if needed
              // Return as string for now
-             return ParamValue(valueString, ParamValue::TYPE_STRING);
+             return ParamValue(valueString.toString(), ParamValue::TYPE_STRING);
         }
         // Store the variable name including '$', case preserved for potential errors,
         // but runtime/validation should use uppercase.
-        return ParamValue(valueString, ParamValue::TYPE_VARIABLE);
+        return ParamValue(valueString.toString(), ParamValue::TYPE_VARIABLE);
     }
 
     // Check if it's an integer
-    bool isNegative = false;
-    int startIndex = 0;
-    if (valueString.startsWith("-")) {
-        isNegative = true;
-        startIndex = 1;
-    }
-    bool allDigits = true;
-    if (valueString.length() == startIndex) { // Handle just "-"
-        allDigits = false;
-    }
-    for (int i = startIndex; i < valueString.length(); ++i) {
-        if (!isdigit(valueString[i])) {
-            allDigits = false;
-            break;
-        }
+    bool isNegative = valueString.startsWith('-');
+    int startIndex = isNegative ? 1 : 0;
+    bool allDigits = valueString.length > startIndex; // Not just "-"
+    for (int i = startIndex; allDigits && i < valueString.length; ++i) {
+        allDigits = isdigit(valueString[i]);
     }
 
     if (allDigits) {
-        // Use strtol for robust conversion and range check potential
-        char* endptr;
-        long val = strtol(valueString.c_str(), &endptr, 10);
-        if (*endptr == '\0') { // Ensure entire string was consumed
-             // Check if value fits in int (Arduino int is usually 16 or 32 bit)
-             if (val >= INT_MIN && val <= INT_MAX) {
-                 return ParamValue((int)val);
-             } else {
-                  addError("Integer value out of range: " + valueString);
-                  return ParamValue(0); // Return dummy value
-             }
+        // Accumulate as strtol() would, saturating at LONG_MIN/LONG_MAX
+        long val = 0;
+        for (int i = startIndex; i < valueString.length; ++i) {
+            int digit = valueString[i] - '0';
+            if (isNegative) {
+                val = (val < (LONG_MIN + digit) / 10) ? LONG_MIN : val * 10 - digit;
+            } else {
+                val = (val > (LONG_MAX - digit) / 10) ? LONG_MAX : val * 10 + digit;
+            }
+        }
+        // Check if value fits in int (Arduino int is usually 16 or 32 bit)
+        if (val >= INT_MIN && val <= INT_MAX) {
+            return ParamValue((int)val);
         }
-        // If strtol failed to parse the whole string as integer, fall through to string
+        addError("Integer value out of range: " + valueString.toString());
+        return ParamValue(0); // Return dummy value
     }
 
     // Otherwise, treat as a string (e.g., keyword like BLACK, WHITE, SOLID)
     // Runtime will handle validation of keywords.
-    return ParamValue(valueString, ParamValue::TYPE_STRING);
+    return ParamValue(valueString.toString(), ParamValue::TYPE_STRING);
 }
 
 // Parses an expression string like "10 + $VAR * 2" into tokens.
 // Operators (+, -, *, /, %) are stored as TYPE_OPERATOR.
 // Numbers are TYPE_INT. Variables are TYPE_VARIABLE.
-// Revised implementation to fix state management bugs.
-bool MicroPatternsParser::parseExpression(const String& expressionString, std::vector<ParamValue>& tokens) {
+bool MicroPatternsParser::parseExpression(ScriptTextView expressionString, ParamList& tokens) {
     tokens.clear();
-    String currentToken;
     enum Expectation { EXPECT_VALUE, EXPECT_OPERATOR } expected = EXPECT_VALUE;
     bool unaryMinusPossible = true; // Allow unary minus at start or after operator
+    const int length = expressionString.length;
 
-    for (int i = 0; i < expressionString.length(); ++i) {
+    for (int i = 0; i < length; ++i) {
         char c = expressionString[i];
 
         if (isspace(c)) {
@@ -781,13 +816,12 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
                 return false;
             }
 
-            currentToken = "";
+            int tokenStart = i; // The token is [tokenStart, i] once consumed
             // Handle potential unary minus
             if (c == '-') {
-                currentToken += c;
                 i++; // Move past '-'
                 // Ensure something follows the unary minus
-                if (i >= expressionString.length()) {
+                if (i >= length) {
                      addError("Syntax error in expression: Incomplete expression after unary '-'.");
                      return false;
                 }
@@ -801,25 +835,23 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
 
             // Parse Variable
             if (c == '$') {
-                currentToken += c;
                 i++; // Move past '$'
                 // Ensure variable name starts correctly
-                if (i >= expressionString.length() || !isalpha(expressionString[i])) {
+                if (i >= length || !isalpha(expressionString[i])) {
                      addError("Syntax error in expression: Expected letter after '$'.");
                      return false;
                 }
-                currentToken += expressionString[i]; // Add first letter
-                i++;
+                i++; // Past the first letter
                 // Consume the rest of the variable name
-                while (i < expressionString.length() && (isalnum(expressionString[i]) || expressionString[i] == '_')) {
-                    currentToken += expressionString[i];
+                while (i < length && (isalnum(expressionString[i]) || expressionString[i] == '_')) {
                     i++;
                 }
+                ScriptTextView token = expressionString.sub(tokenStart, i);
                 i--; // Decrement because the outer loop will increment
 
-                ParamValue val = parseValue(currentToken); // parseValue handles $VARNAME format
+                ParamValue val = parseValue(token); // parseValue handles $VARNAME format
                 if (val.type != ParamValue::TYPE_VARIABLE) { // Should be variable
-                     addError("Internal parser error: Expected variable token for '" + currentToken + "'.");
+                     addError("Internal parser error: Expected variable token for '" + token.toString() + "'.");
                      return false;
                 }
                  if (!validateVariableUsage(val.stringValue)) return false;
@@ -827,18 +859,17 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
 
             // Parse Number (potentially after unary minus)
             } else if (isdigit(c)) {
-                 currentToken += c; // Add first digit
-                 i++;
+                 i++; // Past the first digit
                  // Consume the rest of the digits
-                 while (i < expressionString.length() && isdigit(expressionString[i])) {
-                     currentToken += expressionString[i];
+                 while (i < length && isdigit(expressionString[i])) {
                      i++;
                  }
+                 ScriptTextView token = expressionString.sub(tokenStart, i);
                  i--; // Decrement because the outer loop will increment
 
-                 ParamValue val = parseValue(currentToken); // parseValue handles numbers
+                 ParamValue val = parseValue(token); // parseValue handles numbers
                  if (val.type != ParamValue::TYPE_INT) { // Should be int
-                      addError("Internal parser error: Expected integer token for '" + currentToken + "'.");
+                      addError("Internal parser error: Expected integer token for '" + token.toString() + "'.");
                       return false;
                  }
                  tokens.push_back(val);
@@ -854,7 +885,7 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
 
         }
         // --- Try parsing an operator ---
-        else if (String("+-*/%").indexOf(c) != -1) {
+        else if (isArithmeticOperator(c)) {
              if (expected != EXPECT_OPERATOR) {
                  addError("Syntax error in expression: Unexpected operator '" + String(c) + "'. Expected value.");
                  return false;
@@ -873,10 +904,7 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
     // Final checks after loop
     if (tokens.empty()) {
         // Allow empty expression only if the input string itself was empty or whitespace only
-        // Create a temporary copy to call trim() on, as trim() modifies the string
-        String tempExpression = expressionString;
-        tempExpression.trim();
-        if (tempExpression.length() > 0) {
+        if (!expressionString.trimmed().isEmpty()) {
             addError("Empty expression parsed from non-empty input.");
             return false;
         }
@@ -896,46 +924,42 @@ bool MicroPatternsParser::parseExpression(const String& expressionString, std::v
 
 // Parses a condition string (e.g., "$COUNTER > 10", "$X % 2 == 0") into tokens.
 // Reuses expression parser logic but might need adjustments for specific condition syntax like modulo.
-bool MicroPatternsParser::parseCondition(const String& conditionString, std::vector<ParamValue>& tokens) {
+bool MicroPatternsParser::parseCondition(ScriptTextView conditionString, ParamList& tokens) {
     tokens.clear();
     // For now, treat conditions like expressions. Runtime will interpret operators differently.
     // This handles "value op value" and "$var % literal op value" if parsed correctly.
     // We need to ensure comparison operators are tokenized.
 
-    String currentToken;
+    int tokenStart = -1; // The value being read is the run [tokenStart, i) of the condition (-1: none)
     enum State { NONE, NUMBER, VARIABLE } state = NONE;
-    bool expectValue = true;
+    const int length = conditionString.length;
 
-    for (int i = 0; i < conditionString.length(); ++i) {
+    for (int i = 0; i < length; ++i) {
         char c = conditionString[i];
-        char next_c = (i + 1 < conditionString.length()) ? conditionString[i+1] : '\0';
+        char next_c = (i + 1 < length) ? conditionString[i+1] : '\0';
+        ScriptTextView currentToken = (tokenStart < 0) ? ScriptTextView() : conditionString.sub(tokenStart, i);
 
         if (isspace(c)) {
-            if (currentToken.length() > 0) {
+            if (!currentToken.isEmpty()) {
                 ParamValue val = parseValue(currentToken);
                 if (val.type == ParamValue::TYPE_VARIABLE && !validateVariableUsage(val.stringValue)) return false;
                 tokens.push_back(val);
-                currentToken = "";
+                tokenStart = -1;
                 state = NONE;
             }
             continue; // Skip whitespace
         }
 
-        String op_found = "";
+        int opLength = 0;
         // Check for two-character operators first
-        if (next_c != '\0') {
-            String two_char_op = String(c) + String(next_c);
-            if (two_char_op == "==" || two_char_op == "!=" || two_char_op == "<=" || two_char_op == ">=") {
-                op_found = two_char_op;
-            }
+        if (next_c == '=' && (c == '=' || c == '!' || c == '<' || c == '>')) {
+            opLength = 2;
         }
 
         // If not a two-char op, check for one-character comparison or arithmetic ops
-        if (op_found.length() == 0) {
-            if (c == '<' || c == '>') {
-                op_found = String(c);
-            } else if (String("+-*/%").indexOf(c) != -1) { // Arithmetic ops
-                op_found = String(c);
+        if (opLength == 0) {
+            if (c == '<' || c == '>' || isArithmeticOperator(c)) {
+                opLength = 1;
             } else if (c == '=') { // Single '=' is an error in conditions
                 addError("Invalid operator '=' in condition. Use '==' for comparison.");
                 return false;
@@ -945,65 +969,56 @@ bool MicroPatternsParser::parseCondition(const String& conditionString, std::vec
             }
         }
 
-        if (op_found.length() > 0) { // An operator was found
+        if (opLength > 0) { // An operator was found
             // Process any preceding token (value)
-            if (currentToken.length() > 0) {
+            if (!currentToken.isEmpty()) {
                 ParamValue val = parseValue(currentToken);
                 if (val.type == ParamValue::TYPE_VARIABLE && !validateVariableUsage(val.stringValue)) return false;
                 tokens.push_back(val);
-                currentToken = "";
             }
             // Add the operator token
-            tokens.push_back(ParamValue(op_found, ParamValue::TYPE_OPERATOR));
-            i += (op_found.length() - 1); // Advance index if it was a two-character operator
+            tokens.push_back(ParamValue(conditionString.sub(i, i + opLength).toString(), ParamValue::TYPE_OPERATOR));
+            tokenStart = -1;
+            i += opLength - 1; // Advance index if it was a two-character operator
             state = NONE; // Reset state, expecting a value next
         } else { // Character is part of a value (number or variable)
             if (c == '$') {
-                 if (currentToken.length() > 0 && state != NONE) { // Cannot have $ in middle of number/var
-                     addError("Syntax error: Unexpected '$' in token '" + currentToken + "'.");
+                 if (!currentToken.isEmpty() && state != NONE) { // Cannot have $ in middle of number/var
+                     addError("Syntax error: Unexpected '$' in token '" + currentToken.toString() + "'.");
                      return false;
                  }
                  state = VARIABLE;
-                 currentToken += c;
             } else if (isdigit(c)) {
                 if (state == NONE || state == NUMBER) {
                     state = NUMBER;
-                    currentToken += c;
-                } else if (state == VARIABLE) { // Allow digits in variable names, e.g., $var1
-                    currentToken +=c;
-                } else {
-                    addError("Syntax error: Unexpected digit '" + String(c) + "' in token '" + currentToken + "'.");
-                    return false;
-                }
+                } // Digits are also allowed in variable names, e.g., $var1
             } else if (c == '-') { // Handle unary minus or part of a number
                 if (state == NONE && (tokens.empty() || tokens.back().type == ParamValue::TYPE_OPERATOR)) {
                     // Valid start of a negative number
                     state = NUMBER;
-                    currentToken += c;
                 } else {
-                    addError("Syntax error: Unexpected '-' in token '" + currentToken + "'. Use as unary operator or for subtraction.");
+                    addError("Syntax error: Unexpected '-' in token '" + currentToken.toString() + "'. Use as unary operator or for subtraction.");
                     return false;
                 }
             } else if (isalpha(c) || c == '_') {
-                if (state == NONE && currentToken.length() == 0) { // Start of a potential keyword or bare string (invalid in conditions unless variable)
+                if (state == NONE && currentToken.isEmpty()) { // Start of a potential keyword or bare string (invalid in conditions unless variable)
                     addError("Invalid character '" + String(c) + "' in condition. Values must be numbers or variables ($var).");
                     return false;
-                } else if (state == VARIABLE) {
-                    currentToken += c; // Append to variable name
-                } else {
-                     addError("Invalid character '" + String(c) + "' in condition token '" + currentToken + "'.");
+                } else if (state != VARIABLE) {
+                     addError("Invalid character '" + String(c) + "' in condition token '" + currentToken.toString() + "'.");
                      return false;
-                }
+                } // Else part of the variable name
             } else {
                  addError("Invalid character '" + String(c) + "' in condition.");
                  return false;
             }
+            if (tokenStart < 0) tokenStart = i;
         }
     } // End for loop
 
     // Add the last token
-    if (currentToken.length() > 0) {
-        ParamValue val = parseValue(currentToken);
+    if (tokenStart >= 0) {
+        ParamValue val = parseValue(conditionString.from(tokenStart));
         if (val.type == ParamValue::TYPE_VARIABLE && !validateVariableUsage(val.stringValue)) return false;
         tokens.push_back(val);
     }
@@ -1021,4 +1036,4 @@ bool MicroPatternsParser::parseCondition(const String& conditionString, std::vec
 
 
     return true;
-}
\ No newline at end of file
+}
@@ -8,6 +8,29 @@
 #include <set> // For declared variables
 #include "micropatterns_command.h"
 
+// Non-owning view of part of the script text. The parser tokenizes in place through views and
+// only creates Strings for the values stored in the command tree (and for error messages).
+struct ScriptTextView {
+    const char* data;
+    int length;
+
+    ScriptTextView() : data(""), length(0) {}
+    ScriptTextView(const char* d, int n) : data(d), length(n) {}
+
+    char operator[](int i) const { return data[i]; }
+    const char* end() const { return data + length; }
+    bool isEmpty() const { return length == 0; }
+    ScriptTextView sub(int start, int stop) const { return ScriptTextView(data + start, stop - start); } // [start, stop)
+    ScriptTextView from(int start) const { return ScriptTextView(data + start, length - start); }
+    ScriptTextView trimmed() const; // Without leading and trailing whitespace, as String::trim()
+    int indexOf(char c, int start = 0) const; // -1 if absent
+    bool startsWith(char c) const { return length > 0 && data[0] == c; }
+    bool startsWithIgnoreCase(const char* upperPrefix) const;
+    bool endsWithIgnoreCase(const char* upperSuffix) const;
+    String toString() const { return String(data, length); }
+    String toUpperString() const;
+};
+
 class MicroPatternsParser {
 public:
     MicroPatternsParser();
@@ -15,16 +38,18 @@ public:
     // Parses the script and returns true if successful (no errors).
     // Commands, assets, errors, and declared variables are stored internally.
     bool parse(const String& scriptText);
+    // Same, over a buffer that only needs to live for the duration of the call
+    bool parse(const char* scriptText, size_t length);
 
     // Getters
-    const std::list<MicroPatternsCommand>& getCommands() const; // Changed to std::list
+    const CommandList& getCommands() const; // Changed to std::list
     const std::map<String, MicroPatternsAsset>& getAssets() const;
     const std::vector<String>& getErrors() const;
     const std::set<String>& getDeclaredVariables() const; // Returns set of declared var names (UPPERCASE, no '$')
     void reset(); // Moved to public
 
 private:
-    std::list<MicroPatternsCommand> _commands; // Changed to std::list
+    CommandList _commands; // Changed to std::list
     std::map<String, MicroPatternsAsset> _assets; // Key is UPPERCASE name
     std::vector<String> _errors;
     std::set<String> _declaredVariables; // Store declared var names (UPPERCASE, no '$')
@@ -33,18 +58,19 @@ private:
 
     // void reset(); // Moved to public
     void addError(const String& message);
-    bool processLine(const String& line);
-    bool parseDefinePattern(const String& argsString);
-    bool parseVar(const String& argsString, String& outVarName, std::vector<ParamValue>& outTokens);
-    bool parseLet(const String& argsString, String& outTargetVarName, std::vector<ParamValue>& outTokens);
-    bool parseRepeat(const String& argsString, ParamValue& outCount);
-    bool parseIf(const String& argsString, std::vector<ParamValue>& outConditionTokens);
-    bool parseParams(const String& argsString, std::map<String, ParamValue>& params);
-    ParamValue parseValue(const String& valueString);
+    bool processLine(ScriptTextView line);
+    bool parseDefinePattern(ScriptTextView argsString);
+    static void analyzeAsset(MicroPatternsAsset& asset); // Fills opacity, bounding box and row runs from the packed bits
+    bool parseVar(ScriptTextView argsString, String& outVarName, ParamList& outTokens);
+    bool parseLet(ScriptTextView argsString, String& outTargetVarName, ParamList& outTokens);
+    bool parseRepeat(ScriptTextView argsString, ParamValue& outCount);
+    bool parseIf(ScriptTextView argsString, ParamList& outConditionTokens);
+    bool parseParams(ScriptTextView argsString, ParamMap& params);
+    ParamValue parseValue(ScriptTextView valueString);
     // Parses an expression string into a vector of tokens (numbers, variables, operators)
-    bool parseExpression(const String& expressionString, std::vector<ParamValue>& tokens);
+    bool parseExpression(ScriptTextView expressionString, ParamList& tokens);
     // Parses a condition string into a vector of tokens (similar to expression, but used by IF)
-    bool parseCondition(const String& conditionString, std::vector<ParamValue>& tokens);
+    bool parseCondition(ScriptTextView conditionString, ParamList& tokens);
     // Helper to check if a variable name (UPPERCASE, no '$') is an environment variable
     bool isEnvVar(const String& upperCaseName) const;
     // Helper to validate variable usage in expressions/conditions
@@ -3,409 +3,672 @@
 #include <Arduino.h>
 #include "matrix_utils.h"
 
-const uint8_t RUNTIME_COLOR_WHITE = 0;
-const uint8_t RUNTIME_COLOR_BLACK = 15;
-
-MicroPatternsRuntime::MicroPatternsRuntime(int canvasWidth, int canvasHeight, const std::map<String, MicroPatternsAsset>& assets)
-    : _assets(assets), _interrupt_requested(false), _interrupt_check_cb(nullptr),
+MicroPatternsRuntime::MicroPatternsRuntime(int canvasWidth, int canvasHeight)
+    : _interrupt_requested(false), _interruptFlag(nullptr), _resumePc(-1), _sliceDeadline(0),
       _canvasWidth(canvasWidth), _canvasHeight(canvasHeight) {
+    _slots.assign(SLOT_FIRST_USER, 0);
+    _declared.assign(SLOT_FIRST_USER, 1);
+    _slots[SLOT_WIDTH] = _canvasWidth;
+    _slots[SLOT_HEIGHT] = _canvasHeight;
     resetStateAndList();
-    _environment["$WIDTH"] = _canvasWidth;
-    _environment["$HEIGHT"] = _canvasHeight;
-    _environment["$HOUR"] = 0;
-    _environment["$MINUTE"] = 0;
-    _environment["$SECOND"] = 0;
-    _environment["$COUNTER"] = 0;
 }
 
 int MicroPatternsRuntime::getCounter() const {
-    return _environment.count("$COUNTER") ? _environment.at("$COUNTER") : 0;
+    return _slots[SLOT_COUNTER];
 }
 
 void MicroPatternsRuntime::getTime(int& hour, int& minute, int& second) const {
-    hour = _environment.count("$HOUR") ? _environment.at("$HOUR") : 0;
-    minute = _environment.count("$MINUTE") ? _environment.at("$MINUTE") : 0;
-    second = _environment.count("$SECOND") ? _environment.at("$SECOND") : 0;
-}
-
-void MicroPatternsRuntime::setCommands(const std::list<MicroPatternsCommand>* commands) {
-    _commands = commands;
+    hour = _slots[SLOT_HOUR];
+    minute = _slots[SLOT_MINUTE];
+    second = _slots[SLOT_SECOND];
 }
 
-void MicroPatternsRuntime::setDeclaredVariables(const std::set<String>* declaredVariables) {
-    _declaredVariables = declaredVariables;
+void MicroPatternsRuntime::setProgram(const MicroPatternsProgram* program) {
+    if (program != _program) abandonSuspended();
+    _program = program;
+    int slotCount = _program ? _program->slotCount : SLOT_FIRST_USER;
+    _slots.resize(slotCount, 0); // Environment slots keep their values
+    _declared.resize(slotCount, 0);
 }
 
 void MicroPatternsRuntime::resetStateAndList() {
     _currentState = MicroPatternsState();
-    _variables.clear();
-    _environment.erase("$INDEX");
-    _displayList.clear();
-    // _displayList.reserve(200); // Pre-allocate some space if average list size is known
+    _inverseDirty = false;
+    _matrixClass = TRANSFORM_IDENTITY;
+    // User variables are undeclared until their VAR executes
+    std::fill(_slots.begin() + SLOT_FIRST_USER, _slots.end(), 0);
+    std::fill(_declared.begin() + SLOT_FIRST_USER, _declared.end(), 0);
+    _slots[SLOT_INDEX] = 0;
+    _loopStack.clear();
+    _displayList.clear(); // Keeps capacity for the next generation
+    _budgetExceeded = false;
+}
+
+void MicroPatternsRuntime::releaseDisplayList() {
+    std::vector<DisplayListItem>().swap(_displayList);
 }
 
 void MicroPatternsRuntime::setCounter(int counter) {
-    _environment["$COUNTER"] = counter;
+    _slots[SLOT_COUNTER] = counter;
 }
 
 void MicroPatternsRuntime::setTime(int hour, int minute, int second) {
-    _environment["$HOUR"] = hour;
-    _environment["$MINUTE"] = minute;
-    _environment["$SECOND"] = second;
+    _slots[SLOT_HOUR] = hour;
+    _slots[SLOT_MINUTE] = minute;
+    _slots[SLOT_SECOND] = second;
 }
 
 void MicroPatternsRuntime::runtimeError(const String& message, int lineNumber) {
     log_e("Runtime Error (Line %d): %s", lineNumber, message.c_str());
 }
 
-int MicroPatternsRuntime::resolveValue(const ParamValue& val, int lineNumber, int loopIndex) {
-    if (val.type == ParamValue::TYPE_INT) {
-        return val.intValue;
-    } else if (val.type == ParamValue::TYPE_VARIABLE) {
-        String varName = val.stringValue;
-        varName.toUpperCase();
-        if (varName == "$INDEX") {
-            if (loopIndex < 0) {
-                runtimeError("Variable $INDEX can only be used inside a REPEAT loop.", lineNumber);
-                return 0;
-            }
-            return loopIndex;
-        }
-        if (_environment.count(varName)) return _environment.at(varName);
-        if (_variables.count(varName)) return _variables.at(varName);
-        runtimeError("Undefined variable: " + val.stringValue, lineNumber);
-        return 0;
+// Evaluates an RPN expression. A division or modulo by zero makes the whole expression 0.
+int MicroPatternsRuntime::evaluate(const ExprRef& ref, int lineNumber) {
+    const ExprOp* op = _program->expressions.data() + ref.start;
+    _expressionEvaluations++;
+    if (ref.length == 1) { // Fast path: single constant or variable
+        return op->code == EXPR_CONST ? op->value : _slots[op->value];
     }
-    runtimeError("Expected integer or variable, got: " + val.stringValue, lineNumber);
-    return 0;
-}
-
-int MicroPatternsRuntime::resolveIntParam(const String& paramName, const std::map<String, ParamValue>& params, int defaultValue, int lineNumber, int loopIndex) {
-    String upperParamName = paramName;
-    upperParamName.toUpperCase();
-    if (params.count(upperParamName)) {
-        const ParamValue& val = params.at(upperParamName);
-        if (val.type == ParamValue::TYPE_INT || val.type == ParamValue::TYPE_VARIABLE) {
-            return resolveValue(val, lineNumber, loopIndex);
+    if (ref.length == 0) return 0;
+
+    int32_t stack[EXPR_MAX_STACK_DEPTH];
+    int sp = 0;
+    const ExprOp* end = op + ref.length;
+    for (; op != end; ++op) {
+        switch (op->code) {
+            case EXPR_CONST: stack[sp++] = op->value; break;
+            case EXPR_SLOT:  stack[sp++] = _slots[op->value]; break;
+            case EXPR_ADD:   sp--; stack[sp - 1] += stack[sp]; break;
+            case EXPR_SUB:   sp--; stack[sp - 1] -= stack[sp]; break;
+            case EXPR_MUL:   sp--; stack[sp - 1] *= stack[sp]; break;
+            case EXPR_DIV:
+                sp--;
+                if (stack[sp] == 0) { runtimeError("Division by zero.", lineNumber); return 0; }
+                stack[sp - 1] /= stack[sp];
+                break;
+            case EXPR_MOD:
+                sp--;
+                if (stack[sp] == 0) { runtimeError("Modulo by zero.", lineNumber); return 0; }
+                stack[sp - 1] %= stack[sp];
+                break;
         }
-        runtimeError("Parameter " + paramName + " requires an integer or variable.", lineNumber);
     }
-    return defaultValue;
+    return stack[0];
 }
 
-String MicroPatternsRuntime::resolveStringParam(const String& paramName, const std::map<String, ParamValue>& params, const String& defaultValue, int lineNumber) {
-    String upperParamName = paramName;
-    upperParamName.toUpperCase();
-    if (params.count(upperParamName)) {
-        const ParamValue& val = params.at(upperParamName);
-        if (val.type == ParamValue::TYPE_STRING) {
-            return val.stringValue;
-        }
-        runtimeError("Parameter " + paramName + " requires a string/keyword.", lineNumber);
+bool MicroPatternsRuntime::determineItemOpacity(const DisplayListItem& item) const {
+    if (item.type == CMD_FILL_RECT || item.type == CMD_FILL_CIRCLE || item.type == CMD_FILL_PIXEL || item.type == CMD_PIXEL) {
+        return true;
     }
-    return defaultValue;
+    if (item.type == CMD_DRAW) {
+        return item.draw.asset && item.draw.asset->isOpaque; // Precomputed by the parser
+    }
+    return false;
 }
 
-String MicroPatternsRuntime::resolveAssetNameParam(const String& paramName, const std::map<String, ParamValue>& params, int lineNumber) {
-    String upperParamName = paramName;
-    upperParamName.toUpperCase();
-    if (params.count(upperParamName)) {
-        const ParamValue& val = params.at(upperParamName);
-        if (val.type == ParamValue::TYPE_STRING) {
-            String nameValue = val.stringValue;
-            nameValue.toUpperCase();
-            return nameValue; // SOLID or UPPERCASE pattern name
-        }
-        runtimeError("Parameter " + paramName + " requires SOLID or a pattern name string.", lineNumber);
+
+inline void MicroPatternsRuntime::assign(const MicroPatternsInstruction& instr) {
+    if (instr.op == OP_LET && !_declared[instr.target]) {
+        runtimeError("LET: Undeclared variable: " + _program->slotNames[instr.target], instr.lineNumber);
+        return;
     }
-    return "SOLID"; // Default
+    _slots[instr.target] = evaluate(instr.args[0], instr.lineNumber);
+    if (instr.op == OP_VAR) _declared[instr.target] = 1;
 }
 
-int MicroPatternsRuntime::evaluateExpression(const std::vector<ParamValue>& tokens, int lineNumber, int loopIndex) {
-    if (tokens.empty()) return 0;
-
-    std::vector<ParamValue> resolvedTokens;
-    for (const auto& token : tokens) {
-        if (token.type == ParamValue::TYPE_VARIABLE) {
-            resolvedTokens.push_back(ParamValue(resolveValue(token, lineNumber, loopIndex)));
-        } else if (token.type == ParamValue::TYPE_INT || token.type == ParamValue::TYPE_OPERATOR) {
-            resolvedTokens.push_back(token);
-        } else {
-            runtimeError("Unexpected token type in expression: " + token.stringValue, lineNumber);
-            return 0;
-        }
+void MicroPatternsRuntime::generateDisplayList(uint32_t sliceMs) {
+    abandonSuspended();
+    if (!_program || _program->instructions.empty()) {
+        log_e("Runtime not properly initialized for display list generation.");
+        return;
     }
-    
-    // Basic structural checks (simplified for brevity, more robust checks in JS version)
-    if (resolvedTokens.empty() && !tokens.empty()) { /* Error if original tokens not empty but resolved is */ return 0; }
-    if (resolvedTokens.empty() && tokens.empty()) { return 0; } // Empty expression is 0
-    if (resolvedTokens.back().type == ParamValue::TYPE_OPERATOR) { /* Error */ return 0; }
-    if (resolvedTokens.front().type == ParamValue::TYPE_OPERATOR) { /* Error */ return 0; }
-
-
-    std::vector<ParamValue> pass1Result; // For MDM operators (*, /, %)
-    for (size_t i = 0; i < resolvedTokens.size(); ++i) {
-        const ParamValue& currentToken = resolvedTokens[i];
-        if (currentToken.type == ParamValue::TYPE_OPERATOR && (currentToken.stringValue == "*" || currentToken.stringValue == "/" || currentToken.stringValue == "%")) {
-            if (pass1Result.empty() || pass1Result.back().type != ParamValue::TYPE_INT || i + 1 >= resolvedTokens.size() || resolvedTokens[i+1].type != ParamValue::TYPE_INT) {
-                runtimeError("Syntax error with operator " + currentToken.stringValue, lineNumber); return 0;
-            }
-            int leftVal = pass1Result.back().intValue; pass1Result.pop_back();
-            int rightVal = resolvedTokens[i+1].intValue;
-            int result = 0;
-            if (currentToken.stringValue == "*") result = leftVal * rightVal;
-            else if (currentToken.stringValue == "/") { if (rightVal == 0) { runtimeError("Division by zero.", lineNumber); return 0; } result = leftVal / rightVal; }
-            else if (currentToken.stringValue == "%") { if (rightVal == 0) { runtimeError("Modulo by zero.", lineNumber); return 0; } result = leftVal % rightVal; }
-            pass1Result.push_back(ParamValue(result));
-            i++; // Skip right operand
-        } else {
-            pass1Result.push_back(currentToken);
-        }
+    if (_program->buildId == 0 || _program->buildId != _analyzedBuildId) {
+        analyzeDependencies(); // Also drops the segment cache of the previous program
     }
+    resetStateAndList(); // Clears _displayList and resets _currentState and user variables
+    clearInterrupt();
 
-    if (pass1Result.empty()) return 0; // Should not happen if resolvedTokens was not empty
-    int finalResult = pass1Result[0].intValue; // Must start with a number
-    for (size_t i = 1; i < pass1Result.size(); i += 2) {
-        if (i + 1 >= pass1Result.size() || pass1Result[i].type != ParamValue::TYPE_OPERATOR || pass1Result[i+1].type != ParamValue::TYPE_INT) {
-            runtimeError("Syntax error in expression (AS pass).", lineNumber); return 0;
-        }
-        String op = pass1Result[i].stringValue;
-        int rightVal = pass1Result[i+1].intValue;
-        if (op == "+") finalResult += rightVal;
-        else if (op == "-") finalResult -= rightVal;
-        else { runtimeError("Unexpected operator in AS pass: " + op, lineNumber); return 0; }
+    _reusedSegments = false;
+    _reusedItemCount = 0;
+    _expressionEvaluations = 0;
+    _matrixInversions = 0;
+    _recordedSegments = false;
+    _activeSegment = -1;
+    _segmentBoundary = (_segmentCaching && !_streamOutput && !_segments.empty()) ? 0 : -1;
+    runSlice(0, sliceMs);
+}
+
+void MicroPatternsRuntime::resumeDisplayList(uint32_t sliceMs) {
+    if (_resumePc < 0) return;
+    int pc = _resumePc;
+    _resumePc = -1;
+    clearInterrupt();
+    runSlice(pc, sliceMs);
+}
+
+// Everything execute() works on (variables, drawing state, loop stack, segment bookkeeping
+// and the list) is kept in members, so a suspended run needs no more than its pc
+void MicroPatternsRuntime::runSlice(int pc, uint32_t sliceMs) {
+    esp_task_wdt_reset();
+    _sliceDeadline = renderSliceDeadline(sliceMs);
+    if (!execute(pc) && _resumePc < 0 && _recordedSegments) {
+        invalidateSegmentCache(); // Incomplete run: recorded segments may miss their effects
     }
-    return finalResult;
+    esp_task_wdt_reset();
+}
+
+void MicroPatternsRuntime::abandonSuspended() {
+    if (_resumePc < 0) return;
+    _resumePc = -1;
+    if (_recordedSegments) invalidateSegmentCache(); // Recorded by a run that never completed
 }
 
-bool MicroPatternsRuntime::evaluateCondition(const std::vector<ParamValue>& tokens, int lineNumber, int loopIndex) {
-    if (tokens.empty()) { runtimeError("Empty condition.", lineNumber); return false; }
-    
-    int comparisonOpIndex = -1; String comparisonOp = "";
-    for (size_t i = 0; i < tokens.size(); ++i) {
-        if (tokens[i].type == ParamValue::TYPE_OPERATOR) {
-            const String& opStr = tokens[i].stringValue;
-            if (opStr == "==" || opStr == "!=" || opStr == "<" || opStr == ">" || opStr == "<=" || opStr == ">=") {
-                if (comparisonOpIndex != -1) { runtimeError("Multiple comparison operators.", lineNumber); return false; }
-                comparisonOpIndex = i; comparisonOp = opStr;
+bool MicroPatternsRuntime::execute(int pc) {
+    const MicroPatternsInstruction* code = _program->instructions.data();
+    uint32_t executed = 0;
+
+    while (true) {
+        if (pc == _segmentBoundary) {
+            pc = crossSegmentBoundary(pc);
+            continue;
+        }
+        const MicroPatternsInstruction& instr = code[pc];
+
+        // Interrupt checks, slice ends and yields are amortised over blocks of instructions.
+        // Both stop before instr, which the resumed run starts with.
+        if ((++executed & 0x3F) == 0) {
+            if (_interrupt_requested || (_interruptFlag && *_interruptFlag)) {
+                _interrupt_requested = true;
+                _resumePc = pc;
+                return false;
+            }
+            if ((executed & 0x3FF) == 0) {
+                if (renderSliceExpired(_sliceDeadline)) {
+                    _resumePc = pc;
+                    return false;
+                }
+                yield();
+                if ((executed & 0xFFF) == 0) esp_task_wdt_reset();
             }
         }
+
+        switch (instr.op) {
+            case OP_VAR:
+            case OP_SET:
+            case OP_LET:
+                assign(instr);
+                pc++;
+                break;
+            case OP_COLOR:
+                _currentState.color = static_cast<uint8_t>(instr.aux);
+                pc++;
+                break;
+            case OP_FILL:
+                _currentState.fillAsset = instr.asset;
+                pc++;
+                break;
+            case OP_RESET_TRANSFORMS:
+                _currentState.scale = 1.0f;
+                matrix_identity(_currentState.matrix);
+                matrix_identity(_currentState.inverseMatrix);
+                _inverseDirty = false;
+                _matrixClass = TRANSFORM_IDENTITY;
+                pc++;
+                break;
+            case OP_TRANSLATE: {
+                float dx = static_cast<float>(evaluate(instr.args[0], instr.lineNumber));
+                float dy = static_cast<float>(evaluate(instr.args[1], instr.lineNumber));
+                float T_op[6]; matrix_make_translation(T_op, dx, dy);
+                matrix_multiply(_currentState.matrix, _currentState.matrix, T_op);
+                _inverseDirty = true;
+                pc++;
+                break;
+            }
+            case OP_ROTATE: {
+                float degrees = static_cast<float>(evaluate(instr.args[0], instr.lineNumber));
+                float R_op[6]; matrix_make_rotation(R_op, degrees);
+                matrix_multiply(_currentState.matrix, _currentState.matrix, R_op);
+                _inverseDirty = true;
+                pc++;
+                break;
+            }
+            case OP_TRANSFORM:
+                matrix_multiply(_currentState.matrix, _currentState.matrix, &_program->matrices[instr.aux]);
+                _inverseDirty = true;
+                pc++;
+                break;
+            case OP_SCALE:
+                _currentState.scale = std::max(1, evaluate(instr.args[0], instr.lineNumber));
+                pc++;
+                break;
+            case OP_EMIT:
+                if (!emitToOutput(pc, 0)) return false;
+                pc++;
+                break;
+            case OP_REPEAT_BEGIN: {
+                int count = evaluate(instr.args[0], instr.lineNumber);
+                if (count < 0) runtimeError("REPEAT count negative.", instr.lineNumber);
+                if (count <= 0) { pc = instr.target; break; }
+                if (instr.aux == REPEAT_INSTANCED) {
+                    if (!emitToOutput(pc, count)) return false;
+                    pc = instr.target;
+                    break;
+                }
+                LoopFrame frame = { 0, count, _slots[SLOT_INDEX] };
+                _loopStack.push_back(frame);
+                _slots[SLOT_INDEX] = 0;
+                pc++;
+                break;
+            }
+            case OP_REPEAT_END: {
+                LoopFrame& frame = _loopStack.back();
+                if (++frame.iteration < frame.count) {
+                    _slots[SLOT_INDEX] = frame.iteration;
+                    pc = instr.target;
+                } else {
+                    _slots[SLOT_INDEX] = frame.savedIndex;
+                    _loopStack.pop_back();
+                    pc++;
+                }
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                int left = evaluate(instr.args[0], instr.lineNumber);
+                int right = evaluate(instr.args[1], instr.lineNumber);
+                bool conditionMet;
+                switch (instr.aux) {
+                    case CMP_EQ: conditionMet = left == right; break;
+                    case CMP_NE: conditionMet = left != right; break;
+                    case CMP_LT: conditionMet = left < right; break;
+                    case CMP_GT: conditionMet = left > right; break;
+                    case CMP_LE: conditionMet = left <= right; break;
+                    default:     conditionMet = left >= right; break;
+                }
+                pc = conditionMet ? pc + 1 : instr.target;
+                break;
+            }
+            case OP_JUMP:
+                pc = instr.target;
+                break;
+            case OP_HALT:
+            default:
+                if (_streamOutput && !flushStream()) _interrupt_requested = true;
+                return true;
+        }
     }
-    if (comparisonOpIndex == -1) { runtimeError("No comparison operator in condition.", lineNumber); return false; }
-
-    std::vector<ParamValue> leftTokens(tokens.begin(), tokens.begin() + comparisonOpIndex);
-    std::vector<ParamValue> rightTokens(tokens.begin() + comparisonOpIndex + 1, tokens.end());
-    if (leftTokens.empty() || rightTokens.empty()) { runtimeError("Missing operand in condition.", lineNumber); return false; }
-
-    int leftValue = evaluateExpression(leftTokens, lineNumber, loopIndex);
-    int rightValue = evaluateExpression(rightTokens, lineNumber, loopIndex);
-
-    if (comparisonOp == "==") return leftValue == rightValue;
-    if (comparisonOp == "!=") return leftValue != rightValue;
-    if (comparisonOp == "<")  return leftValue < rightValue;
-    if (comparisonOp == ">")  return leftValue > rightValue;
-    if (comparisonOp == "<=") return leftValue <= rightValue;
-    if (comparisonOp == ">=") return leftValue >= rightValue;
-    runtimeError("Unknown comparison operator: " + comparisonOp, lineNumber);
-    return false;
 }
 
-bool MicroPatternsRuntime::isAssetDataFullyOpaque(const MicroPatternsAsset* asset) const {
-    if (!asset || asset->data.empty()) return false;
-    for (uint8_t pixelValue : asset->data) {
-        if (pixelValue == 0) return false; // 0 is transparent for DRAW
-    }
-    return true;
+bool MicroPatternsRuntime::flushStream() {
+    bool ok = _displayList.empty() || _streamOutput->push(_displayList.data(), _displayList.size());
+    _displayList.clear(); // Keeps capacity for the next chunk
+    return ok;
 }
 
-bool MicroPatternsRuntime::determineItemOpacity(CommandType type, const std::map<String, ParamValue>& params, const String& assetNameParamValue) const {
-    if (type == CMD_FILL_RECT || type == CMD_FILL_CIRCLE || type == CMD_FILL_PIXEL || type == CMD_PIXEL) {
-        return true;
+// Emits the OP_EMIT at 'pc' (count 0), or the instances of the REPEAT_INSTANCED loop at 'pc',
+// into the list or the stream. Returns false once the list budget is exceeded or the stream
+// was cancelled.
+bool MicroPatternsRuntime::emitToOutput(int pc, int count) {
+    const MicroPatternsInstruction& instr = _program->instructions[pc];
+    if (!_streamOutput && _listBudgetItems && _displayList.size() >= _listBudgetItems) {
+        log_w("Display list budget of %u items exceeded (Line %d).", (unsigned)_listBudgetItems, instr.lineNumber);
+        _budgetExceeded = true;
+        esp_task_wdt_reset();
+        return false;
     }
-    if (type == CMD_DRAW) {
-        // assetNameParamValue is already resolved, uppercase name or "SOLID"
-        if (assetNameParamValue != "SOLID" && _assets.count(assetNameParamValue)) {
-            return isAssetDataFullyOpaque(&_assets.at(assetNameParamValue));
-        }
+    if (count > 0) emitInstances(pc, count);
+    else emitItem(instr);
+    if (_streamOutput && _displayList.size() >= RUNTIME_STREAM_CHUNK_ITEMS && !flushStream()) {
+        _interrupt_requested = true;
+        esp_task_wdt_reset();
         return false;
     }
-    return false;
+    return true;
 }
 
-
-void MicroPatternsRuntime::generateDisplayList() {
-    if (!_commands || !_declaredVariables) {
-        log_e("Runtime not properly initialized for display list generation.");
-        return;
-    }
-    resetStateAndList(); // Clears _displayList and resets _currentState, _variables
-    esp_task_wdt_reset();
-    clearInterrupt();
-
-    int commandCounter = 0;
-    for (const auto& cmd : *_commands) {
-        processCommandForDisplayList(cmd, -1); // loopIndex = -1 for top-level
-        commandCounter++;
-        if (commandCounter > 0 && commandCounter % 50 == 0) { // Yield less frequently
-            yield();
-            if (commandCounter % 150 == 0) {
-                 esp_task_wdt_reset();
+// The optimizer guarantees the body (assignments and one EMIT) is affine in $INDEX and cannot
+// fail, so copy i equals copy 0 plus i times the step between copies 0 and 1. The assignments
+// run once more for the last iteration, leaving variables as the full loop would.
+void MicroPatternsRuntime::emitInstances(int loopPc, int count) {
+    const MicroPatternsInstruction* body = _program->instructions.data() + loopPc + 1;
+    const MicroPatternsInstruction* end = _program->instructions.data() + _program->instructions[loopPc].target - 1; // OP_REPEAT_END
+    int32_t savedIndex = _slots[SLOT_INDEX];
+    size_t itemIndex = _displayList.size();
+
+    int passes = std::min(count, 2);
+    for (int pass = 0; pass < passes; ++pass) {
+        _slots[SLOT_INDEX] = pass;
+        for (const MicroPatternsInstruction* instr = body; instr != end; ++instr) {
+            if (instr->op != OP_EMIT) {
+                assign(*instr);
+            } else if (pass == 0) {
+                emitItem(*instr);
+            } else {
+                DisplayListItem& item = _displayList[itemIndex];
+                const int* base = item.operands();
+                bool varies = false;
+                for (int k = 0; k < item.operandCount(); ++k) {
+                    uint32_t next = static_cast<uint32_t>(evaluate(instr->args[k], instr->lineNumber));
+                    item.instanceDelta[k] = static_cast<int32_t>(next - static_cast<uint32_t>(base[k]));
+                    varies = varies || item.instanceDelta[k] != 0;
+                }
+                if (varies) item.instanceCount = count; // Identical copies would paint the same pixels
             }
         }
-        if (_interrupt_requested) break;
     }
-    esp_task_wdt_reset();
+    if (count > 2) {
+        _slots[SLOT_INDEX] = count - 1;
+        for (const MicroPatternsInstruction* instr = body; instr != end; ++instr) {
+            if (instr->op != OP_EMIT) assign(*instr);
+        }
+    }
+    _slots[SLOT_INDEX] = savedIndex;
 }
 
 const std::vector<DisplayListItem>& MicroPatternsRuntime::getDisplayList() const {
     return _displayList;
 }
 
-void MicroPatternsRuntime::processCommandForDisplayList(const MicroPatternsCommand& cmd, int loopIndex) {
-    if (_interrupt_requested || (_interrupt_check_cb && _interrupt_check_cb())) {
-        _interrupt_requested = true;
-        return;
+void MicroPatternsRuntime::emitItem(const MicroPatternsInstruction& instr) {
+    if (_listBudgetItems && _displayList.size() == _displayList.capacity()) {
+        // Grow as usual, but never allocate past the budget
+        size_t grown = std::max<size_t>(16, _displayList.capacity() * 2);
+        _displayList.reserve(std::max(_displayList.size() + 1, std::min(grown, _listBudgetItems)));
+    }
+    _displayList.emplace_back();
+    DisplayListItem& dlItem = _displayList.back();
+    dlItem.type = instr.type;
+    dlItem.sourceLine = instr.lineNumber;
+    dlItem.dependsOnInput = _dependentInstr[&instr - _program->instructions.data()] != 0;
+
+    // The inverse and class are only needed by emitted items; compute them once per transform change
+    if (_inverseDirty) {
+        matrix_invert(_currentState.inverseMatrix, _currentState.matrix); // Keeps the previous inverse if singular
+        _matrixInversions++;
+        _matrixClass = matrix_classify(_currentState.matrix);
+        _inverseDirty = false;
     }
 
-    DisplayListItem dlItem;
-    dlItem.type = cmd.type;
-    dlItem.sourceLine = cmd.lineNumber;
-
-    // Snapshot current state common to most drawing items
+    // Snapshot current state
     memcpy(dlItem.matrix, _currentState.matrix, sizeof(float) * 6);
     memcpy(dlItem.inverseMatrix, _currentState.inverseMatrix, sizeof(float) * 6);
     dlItem.scaleFactor = _currentState.scale;
+    dlItem.transformClass = matrix_classify_with_scale(_matrixClass, _currentState.scale);
     dlItem.color = _currentState.color;
     dlItem.fillAsset = _currentState.fillAsset;
-    
-    // Temp storage for resolved asset name for opacity check
-    String resolvedAssetNameForOpacity = "";
 
-
-    switch (cmd.type) {
-        case CMD_VAR: {
-            String varKey = "$" + cmd.varName;
-            _variables[varKey] = cmd.initialExpressionTokens.empty() ? 0 : evaluateExpression(cmd.initialExpressionTokens, cmd.lineNumber, loopIndex);
-            return; // VAR does not generate a display list item
-        }
-        case CMD_LET: {
-            String targetVarKey = "$" + cmd.letTargetVar;
-            if (_variables.count(targetVarKey)) {
-                _variables[targetVarKey] = cmd.letExpressionTokens.empty() ? 0 : evaluateExpression(cmd.letExpressionTokens, cmd.lineNumber, loopIndex);
-            } else {
-                runtimeError("LET: Undeclared variable: " + targetVarKey, cmd.lineNumber);
-            }
-            return; // LET does not generate a display list item
-        }
-        case CMD_COLOR: {
-            String colorName = resolveStringParam("NAME", cmd.params, "BLACK", cmd.lineNumber);
-            colorName.toUpperCase();
-            _currentState.color = (colorName == "WHITE") ? RUNTIME_COLOR_WHITE : RUNTIME_COLOR_BLACK;
-            return; // State change, no display list item
-        }
-        case CMD_FILL: {
-            String fillName = resolveAssetNameParam("NAME", cmd.params, cmd.lineNumber); // SOLID or UPPERCASE pattern
-            _currentState.fillAsset = (fillName == "SOLID" || !_assets.count(fillName)) ? nullptr : &_assets.at(fillName);
-            if (fillName != "SOLID" && !_assets.count(fillName)) {
-                runtimeError("Undefined fill pattern: " + fillName, cmd.lineNumber);
-            }
-            return; // State change
-        }
-        case CMD_RESET_TRANSFORMS:
-            _currentState.scale = 1.0f;
-            matrix_identity(_currentState.matrix);
-            matrix_identity(_currentState.inverseMatrix);
-            return; // State change
-        case CMD_TRANSLATE: {
-            float dx = static_cast<float>(resolveIntParam("DX", cmd.params, 0, cmd.lineNumber, loopIndex));
-            float dy = static_cast<float>(resolveIntParam("DY", cmd.params, 0, cmd.lineNumber, loopIndex));
-            float T_op[6]; matrix_make_translation(T_op, dx, dy);
-            matrix_multiply(_currentState.matrix, _currentState.matrix, T_op);
-            if (!matrix_invert(_currentState.inverseMatrix, _currentState.matrix)) { /* error */ }
-            return; // State change
-        }
-        case CMD_ROTATE: {
-            float degrees = static_cast<float>(resolveIntParam("DEGREES", cmd.params, 0, cmd.lineNumber, loopIndex));
-            float R_op[6]; matrix_make_rotation(R_op, degrees);
-            matrix_multiply(_currentState.matrix, _currentState.matrix, R_op);
-            if (!matrix_invert(_currentState.inverseMatrix, _currentState.matrix)) { /* error */ }
-            return; // State change
-        }
-        case CMD_SCALE:
-            _currentState.scale = std::max(1, resolveIntParam("FACTOR", cmd.params, 1, cmd.lineNumber, loopIndex));
-            return; // State change
-
-        // Drawing commands - resolve params and add to list
+    switch (instr.type) {
         case CMD_PIXEL:
-            dlItem.intParams["X"] = resolveIntParam("X", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y"] = resolveIntParam("Y", cmd.params, 0, cmd.lineNumber, loopIndex);
-            break;
         case CMD_FILL_PIXEL:
-            dlItem.intParams["X"] = resolveIntParam("X", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y"] = resolveIntParam("Y", cmd.params, 0, cmd.lineNumber, loopIndex);
+            dlItem.pixel.x = evaluate(instr.args[0], instr.lineNumber);
+            dlItem.pixel.y = evaluate(instr.args[1], instr.lineNumber);
             break;
         case CMD_LINE:
-            dlItem.intParams["X1"] = resolveIntParam("X1", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y1"] = resolveIntParam("Y1", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["X2"] = resolveIntParam("X2", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y2"] = resolveIntParam("Y2", cmd.params, 0, cmd.lineNumber, loopIndex);
+            dlItem.line.x1 = evaluate(instr.args[0], instr.lineNumber);
+            dlItem.line.y1 = evaluate(instr.args[1], instr.lineNumber);
+            dlItem.line.x2 = evaluate(instr.args[2], instr.lineNumber);
+            dlItem.line.y2 = evaluate(instr.args[3], instr.lineNumber);
             break;
         case CMD_RECT:
         case CMD_FILL_RECT:
-            dlItem.intParams["X"] = resolveIntParam("X", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y"] = resolveIntParam("Y", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["WIDTH"] = resolveIntParam("WIDTH", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["HEIGHT"] = resolveIntParam("HEIGHT", cmd.params, 0, cmd.lineNumber, loopIndex);
+            dlItem.rect.x = evaluate(instr.args[0], instr.lineNumber);
+            dlItem.rect.y = evaluate(instr.args[1], instr.lineNumber);
+            dlItem.rect.width = evaluate(instr.args[2], instr.lineNumber);
+            dlItem.rect.height = evaluate(instr.args[3], instr.lineNumber);
             break;
         case CMD_CIRCLE:
         case CMD_FILL_CIRCLE:
-            dlItem.intParams["X"] = resolveIntParam("X", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y"] = resolveIntParam("Y", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["RADIUS"] = resolveIntParam("RADIUS", cmd.params, 0, cmd.lineNumber, loopIndex);
+            dlItem.circle.x = evaluate(instr.args[0], instr.lineNumber);
+            dlItem.circle.y = evaluate(instr.args[1], instr.lineNumber);
+            dlItem.circle.radius = evaluate(instr.args[2], instr.lineNumber);
             break;
         case CMD_DRAW:
-            dlItem.intParams["X"] = resolveIntParam("X", cmd.params, 0, cmd.lineNumber, loopIndex);
-            dlItem.intParams["Y"] = resolveIntParam("Y", cmd.params, 0, cmd.lineNumber, loopIndex);
-            resolvedAssetNameForOpacity = resolveAssetNameParam("NAME", cmd.params, cmd.lineNumber);
-            dlItem.stringParams["NAME"] = resolvedAssetNameForOpacity;
-            if (resolvedAssetNameForOpacity == "SOLID" || !_assets.count(resolvedAssetNameForOpacity)) {
-                runtimeError("DRAW: Invalid asset name '" + resolvedAssetNameForOpacity + "'.", cmd.lineNumber);
-                return; // Don't add invalid DRAW to list
+            dlItem.draw.x = evaluate(instr.args[0], instr.lineNumber);
+            dlItem.draw.y = evaluate(instr.args[1], instr.lineNumber);
+            dlItem.draw.asset = instr.asset; // Validated by the compiler
+            break;
+        default:
+            break;
+    }
+
+    // Determine opacity for the item being added
+    dlItem.isOpaque = determineItemOpacity(dlItem);
+}
+
+// --- Input dependencies and segment cache ---
+
+void MicroPatternsRuntime::setSegmentCaching(bool enable) {
+    _segmentCaching = enable;
+    if (!enable) invalidateSegmentCache();
+}
+
+void MicroPatternsRuntime::invalidateSegmentCache() {
+    for (auto& segment : _segments) segment.cached = false;
+    std::vector<DisplayListItem>().swap(_segmentItems);
+}
+
+bool MicroPatternsRuntime::readsInput(const ExprRef& ref, const DependencyScan& scan) const {
+    for (int i = 0; i < ref.length; ++i) {
+        const ExprOp& op = _program->expressions[ref.start + i];
+        if (op.code == EXPR_SLOT && (scan.slots[op.value] & TAINT_VALUE)) return true;
+    }
+    return false;
+}
+
+// Splits the top level of the program into alternating dependent and invariant segments.
+// A forward taint scan follows the inputs: assignments of tainted values or under tainted
+// control (IF conditions, REPEAT counts) taint their slot, and state changes taint their part
+// of the drawing state. Only unconditional top-level code clears a taint.
+void MicroPatternsRuntime::analyzeDependencies() {
+    const MicroPatternsInstruction* code = _program->instructions.data();
+    int slotCount = _program->slotCount;
+    _analyzedBuildId = _program->buildId;
+    _segments.clear();
+    invalidateSegmentCache();
+    _dependentInstr.assign(_program->instructions.size(), 0);
+
+    DependencyScan scan;
+    scan.slots.assign(slotCount, 0);
+    scan.slots[SLOT_HOUR] = scan.slots[SLOT_MINUTE] = scan.slots[SLOT_SECOND] = scan.slots[SLOT_COUNTER] = TAINT_VALUE;
+    scan.state = 0;
+    std::vector<uint8_t> segmentWrites(slotCount, 0);
+    auto closeSegment = [&]() {
+        if (_segments.empty()) return;
+        for (int slot = 0; slot < slotCount; ++slot) {
+            if (segmentWrites[slot]) _segments.back().writtenSlots.push_back(slot);
+        }
+        std::fill(segmentWrites.begin(), segmentWrites.end(), 0);
+    };
+
+    int dependentSegments = 0;
+    int pc = 0;
+    while (code[pc].op != OP_HALT) {
+        scan.written.assign(slotCount, 0);
+        scan.stateWrites = 0;
+        bool dependent = false;
+        int next = analyzeNode(pc, false, true, scan, dependent);
+        // Code that reads no input but may leave an input-derived value behind (an assignment
+        // that need not run, over a tainted value) cannot be replayed from a snapshot either
+        for (int slot = 0; slot < slotCount && !dependent; ++slot) {
+            dependent = scan.written[slot] && scan.slots[slot];
+        }
+        dependent = dependent || (scan.stateWrites & scan.state);
+
+        if (_segments.empty() || _segments.back().dependent != dependent) {
+            closeSegment();
+            ProgramSegment segment;
+            segment.beginPc = pc;
+            segment.dependent = dependent;
+            segment.stateWrites = 0;
+            segment.cached = false;
+            segment.itemBegin = segment.itemEnd = 0;
+            segment.endInverseDirty = false;
+            segment.endMatrixClass = TRANSFORM_IDENTITY;
+            _segments.push_back(segment);
+            if (dependent) dependentSegments++;
+        }
+        _segments.back().endPc = next;
+        _segments.back().stateWrites |= scan.stateWrites;
+        for (int slot = 0; slot < slotCount; ++slot) segmentWrites[slot] |= scan.written[slot];
+        pc = next;
+    }
+    closeSegment();
+    log_i("Runtime: %d of %d top-level segments depend on $HOUR/$MINUTE/$SECOND/$COUNTER.",
+          dependentSegments, (int)_segments.size());
+}
+
+// Scans the instruction, loop or IF at 'pc' and returns the pc after it. 'control' is set if
+// reaching it depends on the inputs. Sets 'dependent' if anything in it does.
+int MicroPatternsRuntime::analyzeNode(int pc, bool control, bool topLevel, DependencyScan& scan, bool& dependent) {
+    const MicroPatternsInstruction* code = _program->instructions.data();
+    const MicroPatternsInstruction& instr = code[pc];
+    int next = pc + 1;
+    bool depends = control;
+    uint8_t part = 0; // StatePart written
+
+    switch (instr.op) {
+        case OP_VAR:
+        case OP_SET:
+        case OP_LET: {
+            uint8_t& taint = scan.slots[instr.target];
+            // A LET assigns only if the VAR has run
+            depends = depends || readsInput(instr.args[0], scan) || (instr.op == OP_LET && (taint & TAINT_DECLARED));
+            scan.written[instr.target] = 1;
+            if (depends) taint |= TAINT_VALUE;
+            else if (topLevel) taint &= ~TAINT_VALUE;
+            if (instr.op == OP_VAR) {
+                if (control) taint |= TAINT_DECLARED;
+                else if (topLevel) taint &= ~TAINT_DECLARED;
             }
             break;
-        
-        // Control Flow
-        case CMD_REPEAT: {
-            int count = resolveValue(cmd.count, cmd.lineNumber, loopIndex);
-            if (count < 0) { runtimeError("REPEAT count negative.", cmd.lineNumber); return; }
-            esp_task_wdt_reset();
-            int previousIndex = _environment.count("$INDEX") ? _environment.at("$INDEX") : -1;
-            for (int i = 0; i < count; ++i) {
-                _environment["$INDEX"] = i;
-                for (const auto& nestedCmd : cmd.nestedCommands) {
-                    processCommandForDisplayList(nestedCmd, i);
-                    if (_interrupt_requested) break;
-                }
-                if (_interrupt_requested) break;
-                if (i > 0 && i % 20 == 0) { yield(); if (i % 60 == 0) esp_task_wdt_reset(); }
+        }
+        case OP_COLOR:
+            part = STATE_COLOR;
+            break;
+        case OP_FILL:
+            part = STATE_FILL;
+            break;
+        case OP_RESET_TRANSFORMS:
+            part = STATE_MATRIX | STATE_SCALE;
+            break;
+        case OP_SCALE:
+            depends = depends || readsInput(instr.args[0], scan);
+            part = STATE_SCALE;
+            break;
+        case OP_TRANSLATE:
+        case OP_ROTATE:
+        case OP_TRANSFORM: // Multiplied into the current matrix
+            depends = depends || readsInput(instr.args[0], scan) || readsInput(instr.args[1], scan) ||
+                      (scan.state & STATE_MATRIX);
+            part = STATE_MATRIX;
+            break;
+        case OP_EMIT:
+            depends = depends || scan.state != 0;
+            for (int i = 0; i < 4 && !depends; ++i) depends = readsInput(instr.args[i], scan);
+            break;
+        case OP_REPEAT_BEGIN: {
+            bool bodyControl = control || readsInput(instr.args[0], scan);
+            depends = bodyControl;
+            int bodyEnd = instr.target - 1; // OP_REPEAT_END
+            // Until nothing new is tainted: assignments late in the body reach earlier reads
+            // in the next iteration
+            while (true) {
+                std::vector<uint8_t> slotsBefore = scan.slots;
+                uint8_t stateBefore = scan.state;
+                for (int p = pc + 1; p < bodyEnd; ) p = analyzeNode(p, bodyControl, false, scan, dependent);
+                if (scan.slots == slotsBefore && scan.state == stateBefore) break;
             }
-            if (previousIndex != -1) _environment["$INDEX"] = previousIndex; else _environment.erase("$INDEX");
-            return; // REPEAT block expanded, no single item for REPEAT itself
+            next = instr.target;
+            break;
         }
-        case CMD_IF: {
-            bool conditionMet = evaluateCondition(cmd.conditionTokens, cmd.lineNumber, loopIndex);
-            const auto& commandsToRun = conditionMet ? cmd.thenCommands : cmd.elseCommands;
-            for (const auto& nestedCmd : commandsToRun) {
-                processCommandForDisplayList(nestedCmd, loopIndex); // Pass outer loopIndex
-                if (_interrupt_requested) break;
+        case OP_JUMP_IF_FALSE: {
+            bool branchControl = control || readsInput(instr.args[0], scan) || readsInput(instr.args[1], scan);
+            depends = branchControl;
+            int thenEnd = instr.target;
+            next = instr.target;
+            if (instr.target - 1 > pc && code[instr.target - 1].op == OP_JUMP) { // Then-branch skips an ELSE branch
+                thenEnd = instr.target - 1;
+                next = code[thenEnd].target;
             }
-            return; // IF block expanded
+            for (int p = pc + 1; p < thenEnd; ) p = analyzeNode(p, branchControl, false, scan, dependent);
+            for (int p = instr.target; p < next; ) p = analyzeNode(p, branchControl, false, scan, dependent);
+            break;
         }
-        default: // CMD_UNKNOWN, CMD_DEFINE_PATTERN, CMD_NOOP, CMD_ENDREPEAT, CMD_ELSE, CMD_ENDIF
-            return; // Do not add to display list
+        default: // OP_REPEAT_END and OP_JUMP are consumed with their constructs
+            break;
     }
 
-    // Determine opacity for the item being added
-    dlItem.isOpaque = determineItemOpacity(dlItem.type, cmd.params, resolvedAssetNameForOpacity);
-    _displayList.push_back(dlItem);
-}
\ No newline at end of file
+    if (part) {
+        scan.stateWrites |= part;
+        if (depends) scan.state |= part;
+        else if (topLevel) scan.state &= ~part;
+    }
+    if (depends) {
+        _dependentInstr[pc] = 1;
+        dependent = true;
+    }
+    return next;
+}
+
+// Called when execution reaches the start of the next top-level segment: records the
+// invariant segment that just ended if it is not cached yet, then replays cached invariant
+// segments instead of executing them.
+int MicroPatternsRuntime::crossSegmentBoundary(int pc) {
+    if (_activeSegment >= 0) {
+        ProgramSegment& ended = _segments[_activeSegment];
+        if (!ended.dependent && !ended.cached) recordSegment(ended);
+    }
+    _activeSegment++;
+    while (_activeSegment < static_cast<int>(_segments.size())) {
+        const ProgramSegment& segment = _segments[_activeSegment];
+        size_t count = segment.itemEnd - segment.itemBegin;
+        if (segment.dependent || !segment.cached ||
+            (_listBudgetItems && _displayList.size() + count > _listBudgetItems)) {
+            break; // Executed (over budget: stops with the usual diagnostics)
+        }
+        replaySegment(segment);
+        pc = segment.endPc;
+        _activeSegment++;
+    }
+    _segmentItemStart = _displayList.size();
+    _segmentBoundary = _activeSegment < static_cast<int>(_segments.size()) ? _segments[_activeSegment].endPc : -1;
+    return pc;
+}
+
+void MicroPatternsRuntime::recordSegment(ProgramSegment& segment) {
+    segment.itemBegin = _segmentItems.size();
+    _segmentItems.insert(_segmentItems.end(), _displayList.begin() + _segmentItemStart, _displayList.end());
+    segment.itemEnd = _segmentItems.size();
+    segment.slotValues.clear();
+    segment.slotDeclared.clear();
+    for (int slot : segment.writtenSlots) {
+        segment.slotValues.push_back(_slots[slot]);
+        segment.slotDeclared.push_back(_declared[slot]);
+    }
+    segment.endState = _currentState;
+    segment.endInverseDirty = _inverseDirty;
+    segment.endMatrixClass = _matrixClass;
+    segment.cached = true;
+    _recordedSegments = true;
+}
+
+// Invariant segments read no input-derived value, so their items and effects are the same
+// in every generation. Only the parts of the state they change are restored.
+void MicroPatternsRuntime::replaySegment(const ProgramSegment& segment) {
+    _displayList.insert(_displayList.end(), _segmentItems.begin() + segment.itemBegin,
+                        _segmentItems.begin() + segment.itemEnd);
+    _reusedItemCount += segment.itemEnd - segment.itemBegin;
+    _reusedSegments = true;
+    for (size_t i = 0; i < segment.writtenSlots.size(); ++i) {
+        _slots[segment.writtenSlots[i]] = segment.slotValues[i];
+        _declared[segment.writtenSlots[i]] = segment.slotDeclared[i];
+    }
+    if (segment.stateWrites & STATE_MATRIX) {
+        memcpy(_currentState.matrix, segment.endState.matrix, sizeof(_currentState.matrix));
+        memcpy(_currentState.inverseMatrix, segment.endState.inverseMatrix, sizeof(_currentState.inverseMatrix));
+        _inverseDirty = segment.endInverseDirty;
+        _matrixClass = segment.endMatrixClass;
+    }
+    if (segment.stateWrites & STATE_SCALE) _currentState.scale = segment.endState.scale;
+    if (segment.stateWrites & STATE_COLOR) _currentState.color = segment.endState.color;
+    if (segment.stateWrites & STATE_FILL) _currentState.fillAsset = segment.endState.fillAsset;
+}
@@ -3,25 +3,60 @@
 
 #include <M5EPD.h>
 #include <vector>
-#include <list> // Added for std::list
-#include <map>
-#include <set> // Include set for declared variables check
-#include <functional> // For std::function
+#include <algorithm> // For std::fill, std::max
 #include <esp_task_wdt.h> // For watchdog resets
-#include "micropatterns_command.h" // For MicroPatternsCommand, DisplayListItem, MicroPatternsAsset, MicroPatternsState
+#include "micropatterns_command.h" // For DisplayListItem, MicroPatternsAsset, MicroPatternsState
+#include "micropatterns_compiler.h" // For MicroPatternsProgram
+#include "display_list_ring.h"
+#include "render_slice.h"
 // MicroPatternsDrawing is no longer directly used by runtime
 
+const size_t RUNTIME_STREAM_CHUNK_ITEMS = 32; // Items emitted between pushes in streaming mode
+const size_t RUNTIME_DEFAULT_LIST_BUDGET_BYTES = 2 * 1024 * 1024; // Display-list memory budget
+
+// Executes a compiled MicroPatternsProgram to produce the display list.
 class MicroPatternsRuntime {
 public:
-    MicroPatternsRuntime(int canvasWidth, int canvasHeight, const std::map<String, MicroPatternsAsset>& assets);
-
-    void setCommands(const std::list<MicroPatternsCommand>* commands);
-    void setDeclaredVariables(const std::set<String>* declaredVariables);
-
-    // Generates the display list from the script commands
-    void generateDisplayList();
+    MicroPatternsRuntime(int canvasWidth, int canvasHeight);
+
+    // The program must outlive the runtime (or be replaced before the next generateDisplayList).
+    void setProgram(const MicroPatternsProgram* program);
+
+    // Generates the display list from the compiled program. With 'sliceMs', generation also
+    // stops after about that long; it stops as well once the interrupt flag is set. In both cases
+    // isSuspended() is then true and resumeDisplayList() continues from the instruction it
+    // stopped at. Starting a new generation or changing the program abandons a suspended one.
+    void generateDisplayList(uint32_t sliceMs = 0);
+    void resumeDisplayList(uint32_t sliceMs = 0);
+    bool isSuspended() const { return _resumePc >= 0; }
+    // Complete list, except in streaming mode where it only holds the chunk being filled
     const std::vector<DisplayListItem>& getDisplayList() const;
 
+    // Streaming mode (ring != nullptr): items are pushed to the ring in chunks as they are
+    // emitted instead of being kept. A cancelled ring interrupts generation.
+    void setStreamOutput(DisplayListRing* ring) { _streamOutput = ring; }
+
+    // Outside streaming mode, generation stops (isBudgetExceeded()) instead of growing the
+    // display list past 'maxBytes' of items. 0 disables the limit.
+    void setDisplayListBudget(size_t maxBytes) { _listBudgetItems = maxBytes / sizeof(DisplayListItem); }
+    bool isBudgetExceeded() const { return _budgetExceeded; }
+    void releaseDisplayList(); // Frees the list's memory (e.g. before a streaming re-run)
+
+    // Input dependencies: each program is analysed once for code that depends, directly or
+    // through VAR/LET/IF/REPEAT and the drawing state, on $HOUR/$MINUTE/$SECOND/$COUNTER.
+    // Emitted items carry the result in DisplayListItem::dependsOnInput. With segment caching
+    // (default on, not used in streaming mode) the items and variable effects of invariant
+    // top-level code are kept from the first complete generation and copied afterwards, so
+    // re-generation only executes the dependent segments.
+    void setSegmentCaching(bool enable);
+    void invalidateSegmentCache();
+    // True if the last generation reused cached segments
+    bool reusedCachedSegments() const { return _reusedSegments; }
+    size_t getReusedItemCount() const { return _reusedItemCount; }
+    // Work done by the last generation, for profiling
+    uint32_t getExpressionEvaluations() const { return _expressionEvaluations; }
+    uint32_t getMatrixInversions() const { return _matrixInversions; }
+
     void setCounter(int counter);
     void setTime(int hour, int minute, int second);
 
@@ -33,39 +68,97 @@ public:
     void requestInterrupt() { _interrupt_requested = true; }
     bool isInterrupted() const { return _interrupt_requested; }
     void clearInterrupt() { _interrupt_requested = false; }
-    
-    void setInterruptCheckCallback(std::function<bool()> cb) { _interrupt_check_cb = cb; }
+
+    // Polled every few dozen instructions; set from any task to stop generation (nullptr: never)
+    void setInterruptFlag(const volatile bool* flag) { _interruptFlag = flag; }
 
 private:
     volatile bool _interrupt_requested;
-    std::function<bool()> _interrupt_check_cb;
+    const volatile bool* _interruptFlag; // Not owned
+    int _resumePc;                       // Where a suspended generation continues (-1: none)
+    uint32_t _sliceDeadline;             // renderSliceDeadline() of the running slice
 
-    const std::map<String, MicroPatternsAsset>& _assets;
-    const std::list<MicroPatternsCommand>* _commands = nullptr;
-    const std::set<String>* _declaredVariables = nullptr;
+    const MicroPatternsProgram* _program = nullptr;
 
     std::vector<DisplayListItem> _displayList;
+    DisplayListRing* _streamOutput = nullptr;
+    size_t _listBudgetItems = RUNTIME_DEFAULT_LIST_BUDGET_BYTES / sizeof(DisplayListItem); // 0: unlimited
+    bool _budgetExceeded = false;
     MicroPatternsState _currentState; // Used to track state during display list generation
-    std::map<String, int> _variables;
-    std::map<String, int> _environment;
+    bool _inverseDirty;               // _currentState.inverseMatrix is stale (computed lazily in emitItem)
+    TransformClass _matrixClass;      // Class of _currentState.matrix, refreshed with the inverse
+    std::vector<int32_t> _slots;      // Environment slots followed by user variables
+    std::vector<uint8_t> _declared;   // Per slot: VAR has executed (LET requires it)
+
+    struct LoopFrame {
+        int32_t iteration;
+        int32_t count;
+        int32_t savedIndex; // $INDEX of the enclosing loop, restored on exit
+    };
+    std::vector<LoopFrame> _loopStack;
     
     int _canvasWidth;
     int _canvasHeight;
 
+    // Top-level code range that either depends on the inputs or not, with the cache of an
+    // invariant segment: its items and what it leaves in the variables and drawing state.
+    struct ProgramSegment {
+        int beginPc, endPc;              // Top-level instructions [beginPc, endPc)
+        bool dependent;
+        uint8_t stateWrites;             // STATE_* parts of _currentState the segment changes
+        std::vector<int> writtenSlots;
+        bool cached;
+        size_t itemBegin, itemEnd;       // Range in _segmentItems
+        std::vector<int32_t> slotValues; // Per writtenSlots entry
+        std::vector<uint8_t> slotDeclared;
+        MicroPatternsState endState;
+        bool endInverseDirty;
+        TransformClass endMatrixClass;
+    };
+    enum StatePart : uint8_t { STATE_MATRIX = 1, STATE_SCALE = 2, STATE_COLOR = 4, STATE_FILL = 8 };
+
+    // Forward taint scan of the analysis
+    enum SlotTaint : uint8_t { TAINT_VALUE = 1, TAINT_DECLARED = 2 }; // Declaration runs under dependent control
+    struct DependencyScan {
+        std::vector<uint8_t> slots;   // SlotTaint bits per slot
+        uint8_t state;                // StatePart bits derived from the inputs
+        std::vector<uint8_t> written; // Slots assigned by the current top-level node
+        uint8_t stateWrites;
+    };
+
+    bool _segmentCaching = true;
+    uint32_t _analyzedBuildId = 0;
+    std::vector<uint8_t> _dependentInstr; // Per instruction: its effect depends on the inputs
+    std::vector<ProgramSegment> _segments;
+    std::vector<DisplayListItem> _segmentItems;
+    int _activeSegment;   // Index in _segments while executing, -1 before the first
+    int _segmentBoundary; // End pc of the active segment (-1: none)
+    size_t _segmentItemStart;
+    bool _recordedSegments;
+    bool _reusedSegments = false;
+    size_t _reusedItemCount = 0;
+    uint32_t _expressionEvaluations = 0;
+    uint32_t _matrixInversions = 0;
+
+    void analyzeDependencies();
+    int analyzeNode(int pc, bool control, bool topLevel, DependencyScan& scan, bool& dependent);
+    bool readsInput(const ExprRef& ref, const DependencyScan& scan) const;
+    int crossSegmentBoundary(int pc); // Returns the pc to continue at
+    void recordSegment(ProgramSegment& segment);
+    void replaySegment(const ProgramSegment& segment);
+
+    bool execute(int pc); // Runs the program from pc; false if it stopped before OP_HALT
+    void runSlice(int pc, uint32_t sliceMs);
+    void abandonSuspended();
     void resetStateAndList();
-    // Processes a command and adds to _displayList, potentially recursively for blocks
-    void processCommandForDisplayList(const MicroPatternsCommand& cmd, int loopIndex = -1);
-
-    int resolveIntParam(const String& paramName, const std::map<String, ParamValue>& params, int defaultValue, int lineNumber, int loopIndex);
-    String resolveStringParam(const String& paramName, const std::map<String, ParamValue>& params, const String& defaultValue, int lineNumber);
-    String resolveAssetNameParam(const String& paramName, const std::map<String, ParamValue>& params, int lineNumber);
-
-    int resolveValue(const ParamValue& val, int lineNumber, int loopIndex);
-    int evaluateExpression(const std::vector<ParamValue>& tokens, int lineNumber, int loopIndex);
-    bool evaluateCondition(const std::vector<ParamValue>& tokens, int lineNumber, int loopIndex);
-
-    bool isAssetDataFullyOpaque(const MicroPatternsAsset* asset) const;
-    bool determineItemOpacity(CommandType type, const std::map<String, ParamValue>& params, const String& assetNameParamValue) const;
+    int evaluate(const ExprRef& ref, int lineNumber);
+    void emitItem(const MicroPatternsInstruction& instr);
+    void assign(const MicroPatternsInstruction& instr); // OP_VAR, OP_SET, OP_LET
+    void emitInstances(int loopPc, int count);           // REPEAT_INSTANCED loop at loopPc
+    bool emitToOutput(int pc, int count);                // false: generation must stop
+    bool flushStream(); // Pushes and clears _displayList; false if the ring was cancelled
+
+    bool determineItemOpacity(const DisplayListItem& item) const;
 };
 
-#endif // MICROPATTERNS_RUNTIME_H
\ No newline at end of file
+#endif // MICROPATTERNS_RUNTIME_H
@@ -46,7 +46,12 @@ const char *NetworkManager::ROOT_CA_CERT_DEFAULT =
     "emyPxgcYxn/eR44/KJ4EBs+lVDR3veyJm+kXQ99b21/+jh5Xos1AnX5iItreGCc=\n"
     "-----END CERTIFICATE-----\n";
 
-NetworkManager::NetworkManager(SystemManager *sysMgr) : _sysMgr(sysMgr), _interruptRequestFlag(nullptr) {}
+NetworkManager::NetworkManager(SystemManager *sysMgr)
+    : _sysMgr(sysMgr), _interruptRequestFlag(nullptr), _sessionActive(false), _sessionRequests(0), _sessionConnections(0)
+{
+    _httpsClient.setCACert(ROOT_CA_CERT_DEFAULT);
+    _http.setReuse(false); // Only kept alive within a session
+}
 
 void NetworkManager::setInterruptFlag(volatile bool *flag)
 {
@@ -133,8 +138,51 @@ bool NetworkManager::connectWiFi(TickType_t timeout)
     return false;
 }
 
+void NetworkManager::beginSession()
+{
+    if (_sessionActive)
+        return;
+    _sessionActive = true;
+    _sessionRequests = 0;
+    _sessionConnections = 0;
+    _http.setReuse(true); // HTTP/1.1 keep-alive
+    log_d("beginSession: API requests now share one connection");
+}
+
+void NetworkManager::endSession()
+{
+    if (!_sessionActive)
+        return;
+    _sessionActive = false;
+    _http.setReuse(false);
+    _http.end();
+    _httpsClient.stop();
+    log_i("endSession: %d requests over %d TLS connections", _sessionRequests, _sessionConnections);
+}
+
+void NetworkManager::noteSessionRequest()
+{
+    if (!_sessionActive)
+        return;
+    _sessionRequests++;
+    if (_httpsClient.connected()) {
+        log_d("Reusing the open TLS connection (request %d of the session)", _sessionRequests);
+    } else {
+        _sessionConnections++; // First request, or the server closed the connection
+    }
+}
+
+void NetworkManager::finishRequest(bool responseConsumed)
+{
+    _http.end(); // Keeps the connection open if it is reusable
+    if (_sessionActive && !responseConsumed) {
+        _httpsClient.stop(); // Unread response bytes would be taken for the next response
+    }
+}
+
 void NetworkManager::disconnectWiFi()
 {
+    endSession();
     if (WiFi.status() == WL_CONNECTED)
     {
         log_i("Disconnecting WiFi.");
@@ -215,9 +263,7 @@ FetchResultStatus NetworkManager::fetchScriptList(JsonDocument &outListDoc)
         return FetchResultStatus::NO_WIFI;
     }
 
-    WiFiClientSecure httpsClient;
-    httpsClient.setCACert(ROOT_CA_CERT_DEFAULT);
-    HTTPClient http;
+    HTTPClient &http = _http; // Kept alive within a session
 
     String listUrl = String(API_BASE_URL_DEFAULT) + "/api/device/scripts/" + String(USER_ID_DEFAULT);
     log_i("fetchScriptList: Fetching from %s", listUrl.c_str());
@@ -229,7 +275,8 @@ FetchResultStatus NetworkManager::fetchScriptList(JsonDocument &outListDoc)
     }
 
     // Begin HTTP connection
-    if (!http.begin(httpsClient, listUrl)) {
+    noteSessionRequest();
+    if (!http.begin(_httpsClient, listUrl)) {
         log_e("fetchScriptList: HTTPClient.begin failed for URL: %s", listUrl.c_str());
         return FetchResultStatus::GENUINE_ERROR;
     }
@@ -251,7 +298,7 @@ FetchResultStatus NetworkManager::fetchScriptList(JsonDocument &outListDoc)
     // Check for interrupt after request
     if (_interruptRequestFlag && *_interruptRequestFlag) {
         log_i("fetchScriptList: Interrupted after HTTP request");
-        http.end();
+        finishRequest(false);
         return FetchResultStatus::INTERRUPTED_BY_USER;
     }
     
@@ -267,7 +314,7 @@ FetchResultStatus NetworkManager::fetchScriptList(JsonDocument &outListDoc)
             
             if (contentLength <= 0) {
                 log_w("fetchScriptList: Server returned empty response");
-                http.end();
+                finishRequest(false);
                 return FetchResultStatus::GENUINE_ERROR;
             }
             
@@ -371,20 +418,301 @@ FetchResultStatus NetworkManager::fetchScriptList(JsonDocument &outListDoc)
         log_e("fetchScriptList: HTTP request failed: %s", http.errorToString(httpCode).c_str());
     }
     
-    // Cleanup
-    http.end();
+    // Cleanup. Bytes left after the parsed array mean the response was not fully read.
+    finishRequest(status == FetchResultStatus::SUCCESS && _httpsClient.available() == 0);
     log_d("fetchScriptList: HTTP connection closed. Status: %d", (int)status);
     return status;
 }
 
-FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, JsonDocument &outScriptDoc)
+// Stream sink for HTTPClient::writeToStream() that picks the string value of the top-level
+// "content" member out of the JSON script response as it arrives. Escapes are decoded and the
+// bytes passed on in SCRIPT_CONTENT_CHUNK_BYTES chunks; the rest of the response is only
+// scanned, so memory use is fixed whatever the size of the script.
+class ContentFieldStream : public Stream
 {
-    // Clear output document first
-    outScriptDoc.clear();
-    
-    // memoryUsage() is deprecated for JsonDocument and returns 0.
-    // log_d("fetchScriptContent: Document memory usage: %u bytes", outScriptDoc.memoryUsage());
-    
+public:
+    ContentFieldStream(const ContentChunkWriter &writeChunk, volatile bool *interruptFlag)
+        : _writeChunk(writeChunk), _interruptFlag(interruptFlag), _state(BEFORE_ROOT), _error(nullptr),
+          _depth(0), _expectKey(false), _awaitingValue(false), _matchingKey(false), _keyLength(0), _keyIsContent(false),
+          _contentFound(false), _unicodeDigits(0), _unicodeValue(0), _highSurrogate(0), _buffered(0), _contentLength(0) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t size) override
+    {
+        if (_interruptFlag && *_interruptFlag)
+            fail("Interrupted");
+        if (_state == FAILED)
+            return 0; // Makes writeToStream() give up
+        esp_task_wdt_reset();
+        for (size_t i = 0; i < size && _state != FAILED && _state != DONE; i++)
+            consume((char)data[i]);
+        return (_state == FAILED) ? 0 : size;
+    }
+    // Not readable: only written to by writeToStream()
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+
+    // Passes on the last partial chunk. True if the response was a complete object with a
+    // string 'content' member; otherwise getError() says why.
+    bool finish()
+    {
+        if (_state == DONE && !_contentFound)
+            fail("Missing required 'content' field or it is null");
+        else if (_state != DONE && _state != FAILED)
+            fail("Truncated JSON response");
+        if (_state == DONE)
+            flushChunk();
+        return _state == DONE;
+    }
+    const char *getError() const { return _error ? _error : ""; }
+    size_t getContentLength() const { return _contentLength; }
+
+private:
+    enum State
+    {
+        BEFORE_ROOT,       // Leading whitespace
+        IN_DOCUMENT,       // Outside strings
+        IN_STRING,         // A key, or a value that is skipped
+        IN_STRING_ESCAPE,
+        IN_CONTENT,        // The content string, passed on
+        IN_CONTENT_ESCAPE,
+        IN_CONTENT_UNICODE, // Hex digits of a \uXXXX escape
+        DONE,              // Root object closed, anything after it is ignored
+        FAILED
+    };
+
+    const ContentChunkWriter &_writeChunk;
+    volatile bool *_interruptFlag;
+    State _state;
+    const char *_error;
+    int _depth;          // Of nested objects and arrays, 1 in the root object
+    bool _expectKey;     // Next string in the root object is a member name
+    bool _awaitingValue; // Between a member's ':' and its value
+    bool _matchingKey;   // The string being read is a member name: compared to "content"
+    int _keyLength;
+    bool _keyIsContent;
+    bool _contentFound;
+    int _unicodeDigits;
+    uint32_t _unicodeValue;
+    uint32_t _highSurrogate; // First half of a UTF-16 pair, waiting for the second
+    char _buffer[SCRIPT_CONTENT_CHUNK_BYTES];
+    size_t _buffered;
+    size_t _contentLength;
+
+    void fail(const char *error)
+    {
+        if (_state == FAILED) return;
+        _state = FAILED;
+        _error = error;
+    }
+
+    void flushChunk()
+    {
+        if (_buffered > 0 && !_writeChunk(_buffer, _buffered))
+            fail("Failed to store script content");
+        _buffered = 0;
+    }
+
+    void putByte(char c)
+    {
+        _buffer[_buffered++] = c;
+        _contentLength++;
+        if (_buffered == sizeof(_buffer))
+            flushChunk();
+    }
+
+    void putCodePoint(uint32_t cp) // As UTF-8
+    {
+        if (cp < 0x80) {
+            putByte((char)cp);
+        } else if (cp < 0x800) {
+            putByte((char)(0xC0 | (cp >> 6)));
+            putByte((char)(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            putByte((char)(0xE0 | (cp >> 12)));
+            putByte((char)(0x80 | ((cp >> 6) & 0x3F)));
+            putByte((char)(0x80 | (cp & 0x3F)));
+        } else {
+            putByte((char)(0xF0 | (cp >> 18)));
+            putByte((char)(0x80 | ((cp >> 12) & 0x3F)));
+            putByte((char)(0x80 | ((cp >> 6) & 0x3F)));
+            putByte((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    void unicodeEscapeDone()
+    {
+        uint32_t cp = _unicodeValue;
+        if (_highSurrogate) {
+            if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                cp = 0x10000 + ((_highSurrogate - 0xD800) << 10) + (cp - 0xDC00);
+                _highSurrogate = 0;
+                putCodePoint(cp);
+                return;
+            }
+            putCodePoint(_highSurrogate);
+            _highSurrogate = 0;
+        }
+        if (cp >= 0xD800 && cp <= 0xDBFF)
+            _highSurrogate = cp;
+        else
+            putCodePoint(cp);
+    }
+
+    void consumeContent(char c)
+    {
+        if (_highSurrogate && c != '\\') {
+            putCodePoint(_highSurrogate); // Unpaired
+            _highSurrogate = 0;
+        }
+        if (c == '"') {
+            _state = IN_DOCUMENT;
+        } else if (c == '\\') {
+            _state = IN_CONTENT_ESCAPE;
+        } else {
+            putByte(c);
+        }
+    }
+
+    void consumeContentEscape(char c)
+    {
+        _state = IN_CONTENT;
+        if (_highSurrogate && c != 'u') {
+            putCodePoint(_highSurrogate); // Unpaired
+            _highSurrogate = 0;
+        }
+        switch (c) {
+        case '"': case '\\': case '/': putByte(c); break;
+        case 'b': putByte('\b'); break;
+        case 'f': putByte('\f'); break;
+        case 'n': putByte('\n'); break;
+        case 'r': putByte('\r'); break;
+        case 't': putByte('\t'); break;
+        case 'u':
+            _state = IN_CONTENT_UNICODE;
+            _unicodeDigits = 0;
+            _unicodeValue = 0;
+            break;
+        default: fail("Invalid escape in 'content' string"); break;
+        }
+    }
+
+    void consumeUnicodeDigit(char c)
+    {
+        int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (digit < 0) {
+            fail("Invalid \\u escape in 'content' string");
+            return;
+        }
+        _unicodeValue = (_unicodeValue << 4) | digit;
+        if (++_unicodeDigits == 4) {
+            _state = IN_CONTENT;
+            unicodeEscapeDone();
+        }
+    }
+
+    void consumeString(char c)
+    {
+        if (c == '"') {
+            _state = IN_DOCUMENT;
+            if (_matchingKey) {
+                _matchingKey = false;
+                _keyIsContent = (_keyLength == 7); // All 7 characters matched
+                _expectKey = false;
+            }
+        } else if (c == '\\') {
+            _state = IN_STRING_ESCAPE;
+            _keyLength = -1; // An escaped member name is never taken for "content"
+        } else if (_matchingKey) {
+            static const char CONTENT_KEY[] = "content";
+            if (_keyLength >= 0 && _keyLength < 7 && c == CONTENT_KEY[_keyLength])
+                _keyLength++;
+            else
+                _keyLength = -1;
+        }
+    }
+
+    // A value starts at depth 1: the one of a member named "content" is the script
+    bool beginValue(char c)
+    {
+        _awaitingValue = false;
+        if (!_keyIsContent)
+            return false;
+        _keyIsContent = false;
+        if (_contentFound)
+            return false; // Repeated member: the first one is kept
+        if (c == '"') {
+            _contentFound = true;
+            _state = IN_CONTENT;
+            return true;
+        }
+        fail(c == 'n' ? "Missing required 'content' field or it is null" : "'content' field is not a string");
+        return true;
+    }
+
+    void consumeDocument(char c)
+    {
+        if (isspace((unsigned char)c))
+            return;
+        if (_depth == 1 && _awaitingValue && beginValue(c))
+            return;
+        switch (c) {
+        case '{': case '[':
+            _depth++;
+            break;
+        case '}': case ']':
+            if (--_depth == 0)
+                _state = DONE;
+            break;
+        case ',':
+            if (_depth == 1)
+                _expectKey = true;
+            break;
+        case ':':
+            if (_depth == 1)
+                _awaitingValue = true;
+            break;
+        case '"':
+            _state = IN_STRING;
+            _matchingKey = (_depth == 1 && _expectKey);
+            _keyLength = 0;
+            break;
+        default:
+            break; // Numbers, true, false, null
+        }
+    }
+
+    void consume(char c)
+    {
+        switch (_state) {
+        case BEFORE_ROOT:
+            if (isspace((unsigned char)c))
+                return;
+            if (c != '{') {
+                fail("Expected JSON object");
+                return;
+            }
+            _state = IN_DOCUMENT;
+            _depth = 1;
+            _expectKey = true;
+            break;
+        case IN_DOCUMENT: consumeDocument(c); break;
+        case IN_STRING: consumeString(c); break;
+        case IN_STRING_ESCAPE: _state = IN_STRING; break;
+        case IN_CONTENT: consumeContent(c); break;
+        case IN_CONTENT_ESCAPE: consumeContentEscape(c); break;
+        case IN_CONTENT_UNICODE: consumeUnicodeDigit(c); break;
+        default: break;
+        }
+    }
+};
+
+FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, const ContentChunkWriter &writeChunk, size_t &outContentLength)
+{
+    outContentLength = 0;
+
     if (humanId.isEmpty())
     {
         log_e("fetchScriptContent: humanId is empty");
@@ -397,9 +725,7 @@ FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, Json
         return FetchResultStatus::NO_WIFI;
     }
 
-    WiFiClientSecure httpsClient;
-    httpsClient.setCACert(ROOT_CA_CERT_DEFAULT);
-    HTTPClient http;
+    HTTPClient &http = _http; // Kept alive within a session
 
     String scriptUrl = String(API_BASE_URL_DEFAULT) + "/api/scripts/" + String(USER_ID_DEFAULT) + "/" + humanId;
     log_i("fetchScriptContent: Fetching script '%s' from %s", humanId.c_str(), scriptUrl.c_str());
@@ -411,7 +737,8 @@ FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, Json
     }
 
     // Begin HTTP connection
-    if (!http.begin(httpsClient, scriptUrl)) {
+    noteSessionRequest();
+    if (!http.begin(_httpsClient, scriptUrl)) {
         log_e("fetchScriptContent: HTTPClient.begin failed for URL: %s", scriptUrl.c_str());
         return FetchResultStatus::GENUINE_ERROR;
     }
@@ -433,103 +760,60 @@ FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, Json
     // Check for interrupt after request
     if (_interruptRequestFlag && *_interruptRequestFlag) {
         log_i("fetchScriptContent: Interrupted after HTTP request");
-        http.end();
+        finishRequest(false);
         return FetchResultStatus::INTERRUPTED_BY_USER;
     }
 
     FetchResultStatus status = FetchResultStatus::GENUINE_ERROR; // Default to error
+    int bytesRead = 0; // Negative: HTTPC_ERROR_* from writeToStream()
 
     if (httpCode > 0) {
         log_d("fetchScriptContent: Received HTTP status code: %d", httpCode);
         
         if (httpCode == HTTP_CODE_OK) {
-            // Get content length for diagnostics
+            // Get content length for diagnostics, -1 for a chunked response
             int contentLength = http.getSize();
             log_d("fetchScriptContent: Content length: %d bytes", contentLength);
             
-            if (contentLength <= 0) {
+            if (contentLength == 0) {
                 log_w("fetchScriptContent: Server returned empty response");
-                http.end();
+                finishRequest(false);
                 return FetchResultStatus::GENUINE_ERROR;
             }
             
-            // Heuristic check for very large content. MAX_SCRIPT_CONTENT_LEN is 5600.
-            // JsonDocument for script content is SCRIPT_CONTENT_JSON_CAPACITY (MAX_SCRIPT_CONTENT_LEN + 512)
-            if (contentLength > (MAX_SCRIPT_CONTENT_LEN + 200)) { // If content is larger than expected max + buffer
-                log_w("fetchScriptContent: Content length (%d) is large and might exceed typical document memory capacity (expected max script: %d)",
-                     contentLength, MAX_SCRIPT_CONTENT_LEN);
-                // Continue anyway, ArduinoJson might handle it with truncation or reallocation
-            }
-            
-            // Reset watchdog before JSON parsing
+            // Reset watchdog before streaming the body
             esp_task_wdt_reset();
             
-            // Deserialize from stream for memory efficiency
-            log_d("fetchScriptContent: Deserializing JSON response");
-            DeserializationError error = deserializeJson(outScriptDoc, http.getStream());
-            
-            if (error) {
-                log_e("fetchScriptContent: JSON parse error for '%s': %s",
-                     humanId.c_str(), error.c_str());
-                
-                // Try to log response for debugging if it's small
-                if (contentLength < 500) {
-                    // Re-request to get the payload for logging
-                    String responseBody = http.getString();
-                    log_e("fetchScriptContent: Response body: %s", responseBody.c_str());
-                }
-                
-                outScriptDoc.clear();
+            // Decode the content field straight from the connection, chunked encoding included
+            log_d("fetchScriptContent: Streaming JSON response");
+            ContentFieldStream contentStream(writeChunk, _interruptRequestFlag);
+            bytesRead = http.writeToStream(&contentStream);
+            bool complete = contentStream.finish();
+            outContentLength = contentStream.getContentLength();
+
+            if (_interruptRequestFlag && *_interruptRequestFlag) {
+                log_i("fetchScriptContent: Interrupted while streaming the response");
+                status = FetchResultStatus::INTERRUPTED_BY_USER;
+            } else if (!complete) {
+                log_e("fetchScriptContent: Invalid response for '%s': %s (transfer: %s)",
+                      humanId.c_str(), contentStream.getError(),
+                      bytesRead < 0 ? http.errorToString(bytesRead).c_str() : "complete");
+            } else if (outContentLength == 0) {
+                log_e("fetchScriptContent: Empty content for '%s'", humanId.c_str());
             } else {
-                log_d("fetchScriptContent: JSON successfully parsed");
+                if (bytesRead < 0) { // The JSON object was complete before the error
+                    log_w("fetchScriptContent: Transfer error after the response: %s", http.errorToString(bytesRead).c_str());
+                }
+                log_i("fetchScriptContent: Script '%s' fetched successfully. Content length: %u bytes",
+                      humanId.c_str(), outContentLength);
                 
-                // Validate response format
-                if (!outScriptDoc.is<JsonObject>()) {
-                    log_e("fetchScriptContent: Expected JSON object but got %s",
-                         outScriptDoc.is<JsonArray>() ? "array" : "unknown type");
-                    outScriptDoc.clear();
-                } else {
-                    // Check for 'content' field which should be a string
-                    JsonObject scriptObj = outScriptDoc.as<JsonObject>();
-                    
-                    if (scriptObj["content"].isNull()) { // Use isNull for existence check
-                        log_e("fetchScriptContent: Missing required 'content' field or it is null");
-                        
-                        // Log available fields for debugging
-                        String fields;
-                        for (JsonPair p : scriptObj) {
-                            fields += String(p.key().c_str()) + " ";
-                        }
-                        log_e("fetchScriptContent: Available fields: %s", fields.c_str());
-                        
-                        outScriptDoc.clear();
-                    } else if (!scriptObj["content"].is<const char*>()) {
-                        log_e("fetchScriptContent: 'content' field is not a string. Type: %s",
-                              scriptObj["content"].is<JsonObject>() ? "object" :
-                              scriptObj["content"].is<JsonArray>() ? "array" :
-                              scriptObj["content"].is<bool>() ? "bool" :
-                              scriptObj["content"].is<int>() ? "number" : "unknown");
-                        
-                        outScriptDoc.clear();
-                    } else {
-                        // Success! We have a valid script content response
-                        const char* contentStr = scriptObj["content"].as<const char*>();
-                        size_t contentLen = contentStr ? strlen(contentStr) : 0;
-                        
-                        log_i("fetchScriptContent: Script '%s' fetched successfully. Content length: %u bytes",
-                              humanId.c_str(), contentLen);
-                        log_d("fetchScriptContent: Parsed doc type: isArray=%d, isObject=%d, isNull=%d", outScriptDoc.is<JsonArray>(), outScriptDoc.is<JsonObject>(), outScriptDoc.isNull());
-                        
-                        // Check for excessively small content that might indicate a problem
-                        if (contentLen < 10) {
-                            log_w("fetchScriptContent: Content is suspiciously short (%u bytes): %s",
-                                 contentLen, contentStr);
-                            // Continue anyway - might be a legitimately short script
-                        }
-                        
-                        status = FetchResultStatus::SUCCESS;
-                    }
+                // Check for excessively small content that might indicate a problem
+                if (outContentLength < 10) {
+                    log_w("fetchScriptContent: Content is suspiciously short (%u bytes)", outContentLength);
+                    // Continue anyway - might be a legitimately short script
                 }
+                
+                status = FetchResultStatus::SUCCESS;
             }
         } else {
             log_w("fetchScriptContent: HTTP error: %d (%s)",
@@ -547,8 +831,8 @@ FetchResultStatus NetworkManager::fetchScriptContent(const String &humanId, Json
         log_e("fetchScriptContent: HTTP request failed: %s", http.errorToString(httpCode).c_str());
     }
     
-    // Cleanup
-    http.end();
+    // Cleanup. A transfer error leaves the connection in an unknown state, even after a complete object.
+    finishRequest(status == FetchResultStatus::SUCCESS && bytesRead >= 0);
     log_d("fetchScriptContent: HTTP connection closed. Status: %d", (int)status);
     return status;
-}
\ No newline at end of file
+}
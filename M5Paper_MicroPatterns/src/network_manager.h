@@ -6,8 +6,14 @@
 #include <HTTPClient.h>
 #include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
+#include <functional>
 #include "event_defs.h" // For FetchResultStatus
 
+const size_t SCRIPT_CONTENT_CHUNK_BYTES = 512; // Decoded script content is passed on in chunks of this size
+
+// Receives the script content as it is downloaded. Returns false to abort the download.
+typedef std::function<bool(const char *data, size_t length)> ContentChunkWriter;
+
 // Forward declaration
 class SystemManager;
 
@@ -30,9 +36,20 @@ public:
     // Fetches the script list. Parses into outListDoc.
     // Checks interruptFlag periodically.
     FetchResultStatus fetchScriptList(JsonDocument &outListDoc);
-    // Fetches content for a single script. Parses into outContentJson (which should be a JsonObject).
+    // Fetches content for a single script. The 'content' string of the JSON response is decoded
+    // on the fly and passed to writeChunk; the rest of the response is discarded. Memory use does
+    // not depend on the size of the script. outContentLength is the number of bytes passed on.
     // Checks interruptFlag periodically.
-    FetchResultStatus fetchScriptContent(const String &humanId, JsonDocument &outScriptDoc);
+    FetchResultStatus fetchScriptContent(const String &humanId, const ContentChunkWriter &writeChunk, size_t &outContentLength);
+
+    // Connection reuse for bulk sync: between beginSession() and endSession() all API requests go
+    // over one kept-alive TLS connection, opened by the first request and only re-established if
+    // the server closes it. Outside a session every request opens and closes its own connection.
+    // Keeping the connection saves the handshake for all but the first script. The WiFiClientSecure
+    // of this core has no TLS session-ticket API, and HTTPClient cannot pipeline requests; scripts
+    // are fetched one after another over the same connection instead.
+    void beginSession();
+    void endSession(); // Also done by disconnectWiFi()
 
     // Interrupt mechanism for long operations
     void setInterruptFlag(volatile bool *flag); // Pointer to a flag that can be set externally
@@ -41,6 +58,12 @@ private:
     SystemManager *_sysMgr;               // Optional, for settings like timezone if needed by API
     volatile bool *_interruptRequestFlag; // External flag to signal interruption
 
+    WiFiClientSecure _httpsClient; // CA certificate set once; its connection outlives a request within a session
+    HTTPClient _http;
+    bool _sessionActive;
+    int _sessionRequests;    // In the current session, for diagnostics
+    int _sessionConnections; // TLS handshakes in the current session
+
     // WiFi credentials and API endpoint (can be constants or from config)
     static const char *WIFI_SSID_DEFAULT;
     static const char *WIFI_PASSWORD_DEFAULT;
@@ -50,6 +73,10 @@ private:
 
     // Helper for HTTP requests
     int performHttpRequest(const String &url, String &payload, WiFiClientSecure &client, HTTPClient &http);
+    // Counts a request of the session about to be sent, and whether it needs a new connection
+    void noteSessionRequest();
+    // Ends a request; within a session the connection is dropped if the response was not read through
+    void finishRequest(bool responseConsumed);
 };
 
 #endif // NETWORK_MANAGER_H
\ No newline at end of file
@@ -1,66 +1,115 @@
 #include "occlusion_buffer.h"
 #include <algorithm> // For std::min, std::max
+#include <string.h>  // For memset
 #include "esp32-hal-log.h" // For logging (optional)
 
-OcclusionBuffer::OcclusionBuffer(int canvasWidth, int canvasHeight, int blockSize)
-    : _canvasWidth(canvasWidth), _canvasHeight(canvasHeight), _blockSize(blockSize), _culledByOcclusionCount(0) {
-    if (_blockSize <= 0) _blockSize = 1; // Ensure block size is positive
-    _gridWidth = (_canvasWidth + _blockSize - 1) / _blockSize; // Ceiling division
-    _gridHeight = (_canvasHeight + _blockSize - 1) / _blockSize; // Ceiling division
-    _grid.resize(_gridWidth * _gridHeight, 0);
-    // log_d("OcclusionBuffer created: Canvas(%dx%d), BlockSize(%d), Grid(%dx%d)", _canvasWidth, _canvasHeight, _blockSize, _gridWidth, _gridHeight);
+static const uint8_t BLOCK_FULL_ROWS = OCCLUSION_BLOCK_SIZE;
+static const uint8_t COARSE_FULL_BLOCKS = OCCLUSION_COARSE_BLOCKS * OCCLUSION_COARSE_BLOCKS;
+
+OcclusionBuffer::OcclusionBuffer(int canvasWidth, int canvasHeight, int originY)
+    : _canvasWidth(std::max(0, canvasWidth)), _canvasHeight(std::max(0, canvasHeight)), _originY(originY),
+      _culledByOcclusionCount(0) {
+    _gridWidth = (_canvasWidth + OCCLUSION_BLOCK_SIZE - 1) / OCCLUSION_BLOCK_SIZE; // Ceiling division
+    _gridHeight = (_canvasHeight + OCCLUSION_BLOCK_SIZE - 1) / OCCLUSION_BLOCK_SIZE;
+    _coarseWidth = (_gridWidth + OCCLUSION_COARSE_BLOCKS - 1) / OCCLUSION_COARSE_BLOCKS;
+    _coarseHeight = (_gridHeight + OCCLUSION_COARSE_BLOCKS - 1) / OCCLUSION_COARSE_BLOCKS;
+    _blocks.resize(_gridWidth * _gridHeight);
+    _fullRows.resize(_gridWidth * _gridHeight);
+    _coarseFullBlocks.resize(_coarseWidth * _coarseHeight);
+    reset();
 }
 
+// Starts from nothing covered, except the parts of edge blocks and tiles beyond the canvas
 void OcclusionBuffer::reset() {
-    std::fill(_grid.begin(), _grid.end(), 0);
+    if (!_blocks.empty()) memset(&_blocks[0], 0, _blocks.size() * sizeof(Block));
+    std::fill(_fullRows.begin(), _fullRows.end(), 0);
+    std::fill(_coarseFullBlocks.begin(), _coarseFullBlocks.end(), 0);
     _culledByOcclusionCount = 0;
-    // log_d("OcclusionBuffer reset.");
-}
 
-OcclusionBuffer::GridIndices OcclusionBuffer::_getGridIndices(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY) const {
-    GridIndices indices;
-    indices.startCol = std::max(0, screenMinX / _blockSize);
-    indices.endCol = std::min(_gridWidth - 1, (screenMaxX -1) / _blockSize); // Use maxX-1 for end col
-    indices.startRow = std::max(0, screenMinY / _blockSize);
-    indices.endRow = std::min(_gridHeight - 1, (screenMaxY-1) / _blockSize); // Use maxY-1 for end row
-    return indices;
+    for (int cy = 0; cy < _coarseHeight; ++cy) {
+        for (int cx = 0; cx < _coarseWidth; ++cx) {
+            int blocksX = std::min(OCCLUSION_COARSE_BLOCKS, _gridWidth - cx * OCCLUSION_COARSE_BLOCKS);
+            int blocksY = std::min(OCCLUSION_COARSE_BLOCKS, _gridHeight - cy * OCCLUSION_COARSE_BLOCKS);
+            _coarseFullBlocks[cy * _coarseWidth + cx] = COARSE_FULL_BLOCKS - blocksX * blocksY;
+        }
+    }
+    int tailX = _canvasWidth % OCCLUSION_BLOCK_SIZE;  // Valid columns of the last block column
+    int tailY = _canvasHeight % OCCLUSION_BLOCK_SIZE; // Valid rows of the last block row
+    for (int by = 0; by < _gridHeight; ++by) {
+        for (int bx = 0; bx < _gridWidth; ++bx) {
+            int b = by * _gridWidth + bx;
+            uint16_t outside = (tailX && bx == _gridWidth - 1) ? static_cast<uint16_t>(0xFFFF << tailX) : 0;
+            int validRows = (tailY && by == _gridHeight - 1) ? tailY : OCCLUSION_BLOCK_SIZE;
+            for (int r = 0; r < OCCLUSION_BLOCK_SIZE; ++r) {
+                _blocks[b].rows[r] = r < validRows ? outside : 0xFFFF;
+            }
+            _fullRows[b] = OCCLUSION_BLOCK_SIZE - validRows;
+        }
+    }
 }
 
-void OcclusionBuffer::markAreaOpaque(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY) {
-    if (screenMinX >= screenMaxX || screenMinY >= screenMaxY) return; // Invalid area
+void OcclusionBuffer::markSpan(int y, int x0, int x1) {
+    y -= _originY;
+    if (y < 0 || y >= _canvasHeight) return;
+    x0 = std::max(0, x0);
+    x1 = std::min(_canvasWidth, x1);
+    if (x0 >= x1) return;
 
-    GridIndices gi = _getGridIndices(screenMinX, screenMinY, screenMaxX, screenMaxY);
-    // log_d("Marking opaque: ScreenRect (%d,%d)-(%d,%d) -> GridRect (%d,%d)-(%d,%d)", screenMinX, screenMinY, screenMaxX, screenMaxY, gi.startCol, gi.startRow, gi.endCol, gi.endRow);
+    int by = y / OCCLUSION_BLOCK_SIZE;
+    int r = y % OCCLUSION_BLOCK_SIZE;
+    for (int bx = x0 / OCCLUSION_BLOCK_SIZE; bx <= (x1 - 1) / OCCLUSION_BLOCK_SIZE; ++bx) {
+        int blockX0 = bx * OCCLUSION_BLOCK_SIZE;
+        int lo = std::max(x0, blockX0) - blockX0;
+        int hi = std::min(x1, blockX0 + OCCLUSION_BLOCK_SIZE) - blockX0;
+        uint16_t mask = static_cast<uint16_t>((0xFFFFu >> (OCCLUSION_BLOCK_SIZE - (hi - lo))) << lo);
 
-    for (int r = gi.startRow; r <= gi.endRow; ++r) {
-        for (int c = gi.startCol; c <= gi.endCol; ++c) {
-            if (r >= 0 && r < _gridHeight && c >= 0 && c < _gridWidth) { // Bounds check for safety
-                 _grid[r * _gridWidth + c] = 1; // Mark as opaque
-            }
+        int b = by * _gridWidth + bx;
+        uint16_t& row = _blocks[b].rows[r];
+        if (row == 0xFFFF) continue;
+        row |= mask;
+        if (row == 0xFFFF && ++_fullRows[b] == BLOCK_FULL_ROWS) {
+            _coarseFullBlocks[(by / OCCLUSION_COARSE_BLOCKS) * _coarseWidth + bx / OCCLUSION_COARSE_BLOCKS]++;
         }
     }
 }
 
+// Checks the part [x0, x1) x [y0, y1) (buffer coordinates) of block (bx, by)
+bool OcclusionBuffer::isBlockAreaCovered(int bx, int by, int x0, int y0, int x1, int y1) const {
+    int b = by * _gridWidth + bx;
+    if (_fullRows[b] == BLOCK_FULL_ROWS) return true;
+    int blockX0 = bx * OCCLUSION_BLOCK_SIZE, blockY0 = by * OCCLUSION_BLOCK_SIZE;
+    int lo = std::max(x0, blockX0) - blockX0;
+    int hi = std::min(x1, blockX0 + OCCLUSION_BLOCK_SIZE) - blockX0;
+    uint16_t mask = static_cast<uint16_t>((0xFFFFu >> (OCCLUSION_BLOCK_SIZE - (hi - lo))) << lo);
+    int rowEnd = std::min(y1, blockY0 + OCCLUSION_BLOCK_SIZE) - blockY0;
+    for (int r = std::max(y0, blockY0) - blockY0; r < rowEnd; ++r) {
+        if ((_blocks[b].rows[r] & mask) != mask) return false;
+    }
+    return true;
+}
+
 bool OcclusionBuffer::isAreaOccluded(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY) const {
     if (screenMinX >= screenMaxX || screenMinY >= screenMaxY) return false; // Invalid or zero-size area cannot be occluded
+    // Only canvas pixels can be drawn; the rest of the rect is irrelevant
+    int x0 = std::max(0, screenMinX), y0 = std::max(0, screenMinY - _originY);
+    int x1 = std::min(_canvasWidth, screenMaxX), y1 = std::min(_canvasHeight, screenMaxY - _originY);
+    if (x0 >= x1 || y0 >= y1) return false;
 
-    GridIndices gi = _getGridIndices(screenMinX, screenMinY, screenMaxX, screenMaxY);
-    // log_d("Checking occlusion: ScreenRect (%d,%d)-(%d,%d) -> GridRect (%d,%d)-(%d,%d)", screenMinX, screenMinY, screenMaxX, screenMaxY, gi.startCol, gi.startRow, gi.endCol, gi.endRow);
-
-    for (int r = gi.startRow; r <= gi.endRow; ++r) {
-        for (int c = gi.startCol; c <= gi.endCol; ++c) {
-             if (r >= 0 && r < _gridHeight && c >= 0 && c < _gridWidth) { // Bounds check
-                if (_grid[r * _gridWidth + c] == 0) {
-                    // log_d("Area not occluded: Grid cell (%d,%d) is transparent.", c, r);
-                    return false; // Found a transparent block, so not fully occluded
+    const int coarseSize = OCCLUSION_BLOCK_SIZE * OCCLUSION_COARSE_BLOCKS;
+    for (int cy = y0 / coarseSize; cy <= (y1 - 1) / coarseSize; ++cy) {
+        for (int cx = x0 / coarseSize; cx <= (x1 - 1) / coarseSize; ++cx) {
+            if (_coarseFullBlocks[cy * _coarseWidth + cx] == COARSE_FULL_BLOCKS) continue; // Whole tile covered
+            int bx0 = std::max(x0 / OCCLUSION_BLOCK_SIZE, cx * OCCLUSION_COARSE_BLOCKS);
+            int bx1 = std::min((x1 - 1) / OCCLUSION_BLOCK_SIZE, cx * OCCLUSION_COARSE_BLOCKS + OCCLUSION_COARSE_BLOCKS - 1);
+            int by0 = std::max(y0 / OCCLUSION_BLOCK_SIZE, cy * OCCLUSION_COARSE_BLOCKS);
+            int by1 = std::min((y1 - 1) / OCCLUSION_BLOCK_SIZE, cy * OCCLUSION_COARSE_BLOCKS + OCCLUSION_COARSE_BLOCKS - 1);
+            for (int by = by0; by <= by1; ++by) {
+                for (int bx = bx0; bx <= bx1; ++bx) {
+                    if (!isBlockAreaCovered(bx, by, x0, y0, x1, y1)) return false;
                 }
-            } else { // Should not happen if _getGridIndices is correct
-                // log_w("Occlusion check: Index out of bounds (%d,%d) for grid (%dx%d)", c, r, _gridWidth, _gridHeight);
-                return false; // Treat out-of-bounds as not occluded for safety
             }
         }
     }
-    // log_d("Area IS occluded.");
     _culledByOcclusionCount++;
-    return true; // All blocks covered by the area are opaque
-}
\ No newline at end of file
+    return true; // Every pixel of the area is already covered
+}
@@ -4,31 +4,46 @@
 #include <vector>
 #include <Arduino.h> // For uint8_t
 
+const int OCCLUSION_BLOCK_SIZE = 16;  // Pixels per block side: one 16-bit mask row per pixel row
+const int OCCLUSION_COARSE_BLOCKS = 4; // Blocks per coarse tile side (64x64 pixels)
+
+// Two-level exact coverage of the canvas for back-to-front culling.
+// Fine level: a 16x16 bit mask per block, fed with every span the drawing module rasterises,
+// so rotated fills, circles and assets contribute exactly the pixels they cover.
+// Coarse level: per 64x64 tile, the number of fully covered blocks, so large queries are
+// answered in O(1) per fully covered tile. Pixels outside the canvas count as covered.
+// A buffer may cover only rows [originY, originY + canvasHeight) of the screen (one render
+// band); coordinates stay in screen space and rows outside it are ignored.
 class OcclusionBuffer {
 public:
-    OcclusionBuffer(int canvasWidth, int canvasHeight, int blockSize = 16);
+    OcclusionBuffer(int canvasWidth, int canvasHeight, int originY = 0);
 
     void reset();
-    // Marks the grid cells covered by the screen-space AABB as opaque.
-    void markAreaOpaque(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY);
-    // Checks if all grid cells for the screen-space AABB are already marked opaque.
+    // Marks [x0, x1) on row y as covered (clipped to the canvas)
+    void markSpan(int y, int x0, int x1);
+    // True if every canvas pixel of the screen-space rect is covered (empty rects are not)
     bool isAreaOccluded(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY) const;
 
     int getCulledByOcclusionCount() const { return _culledByOcclusionCount; }
 
 private:
+    struct Block {
+        uint16_t rows[OCCLUSION_BLOCK_SIZE]; // Bit (x & 15) of row (y & 15)
+    };
+
     int _canvasWidth;
     int _canvasHeight;
-    int _blockSize;
-    int _gridWidth;
+    int _originY;
+    int _gridWidth;   // Blocks
     int _gridHeight;
-    std::vector<uint8_t> _grid; // 0 = empty/transparent, 1 = opaque
+    int _coarseWidth; // Coarse tiles
+    int _coarseHeight;
+    std::vector<Block> _blocks;
+    std::vector<uint8_t> _fullRows;        // Per block: rows with all 16 bits set
+    std::vector<uint8_t> _coarseFullBlocks; // Per coarse tile: blocks with all rows full
     mutable int _culledByOcclusionCount; // Track items culled by this buffer
 
-    struct GridIndices {
-        int startCol, endCol, startRow, endRow;
-    };
-    GridIndices _getGridIndices(int screenMinX, int screenMinY, int screenMaxX, int screenMaxY) const;
+    bool isBlockAreaCovered(int bx, int by, int x0, int y0, int x1, int y1) const;
 };
 
-#endif // OCCLUSION_BUFFER_H
\ No newline at end of file
+#endif // OCCLUSION_BUFFER_H
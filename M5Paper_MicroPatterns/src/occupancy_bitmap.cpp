@@ -0,0 +1,70 @@
+#include "occupancy_bitmap.h"
+#include <string.h> // For memset
+
+OccupancyBitmap::OccupancyBitmap() : _width(0), _height(0), _wordsPerRow(0) {
+}
+
+void OccupancyBitmap::resize(int width, int height) {
+    if (width <= 0 || height <= 0) {
+        _bits.clear();
+        _width = _height = _wordsPerRow = 0;
+        return;
+    }
+    if (width != _width || height != _height) {
+        _width = width;
+        _height = height;
+        _wordsPerRow = (width + 31) / 32;
+        _bits.assign((size_t)_wordsPerRow * height, 0);
+    } else {
+        clear();
+    }
+}
+
+void OccupancyBitmap::clear() {
+    if (!_bits.empty()) memset(_bits.data(), 0, _bits.size() * sizeof(uint32_t));
+}
+
+int OccupancyBitmap::findBit(const uint32_t* row, int x, int x1, bool value) {
+    while (x < x1) {
+        uint32_t word = row[x >> 5];
+        if (!value) word = ~word;
+        word &= ~0u << (x & 31); // Ignore bits before x
+        if (word) {
+            int found = (x & ~31) + __builtin_ctz(word);
+            return found < x1 ? found : x1;
+        }
+        x = (x & ~31) + 32; // Whole remainder of the word skipped in one test
+    }
+    return x1;
+}
+
+bool OccupancyBitmap::findFreeRun(int y, int x0, int x1, int& runStart, int& runEnd) const {
+    const uint32_t* row = &_bits[y * _wordsPerRow];
+    runStart = findBit(row, x0, x1, false);
+    if (runStart >= x1) return false;
+    runEnd = findBit(row, runStart, x1, true);
+    return true;
+}
+
+void OccupancyBitmap::markRange(int y, int x0, int x1) {
+    if (x0 >= x1) return;
+    uint32_t* row = &_bits[y * _wordsPerRow];
+    int firstWord = x0 >> 5, lastWord = (x1 - 1) >> 5;
+    uint32_t firstMask = ~0u << (x0 & 31);
+    uint32_t lastMask = ~0u >> (31 - ((x1 - 1) & 31));
+    if (firstWord == lastWord) {
+        row[firstWord] |= firstMask & lastMask;
+        return;
+    }
+    row[firstWord] |= firstMask;
+    for (int w = firstWord + 1; w < lastWord; ++w) row[w] = ~0u;
+    row[lastWord] |= lastMask;
+}
+
+bool OccupancyBitmap::isRectOccupied(int x0, int y0, int x1, int y1) const {
+    if (x0 >= x1 || y0 >= y1) return false;
+    for (int y = y0; y < y1; ++y) {
+        if (findBit(&_bits[y * _wordsPerRow], x0, x1, false) < x1) return false;
+    }
+    return true;
+}
@@ -0,0 +1,43 @@
+#ifndef OCCUPANCY_BITMAP_H
+#define OCCUPANCY_BITMAP_H
+
+#include <vector>
+#include <stdint.h>
+
+// One bit per screen pixel (1 = already drawn by a nearer item), rows of 32-bit words with
+// pixel x at bit (x & 31) of word x >> 5. The back-to-front renderer queries and marks whole
+// spans a word at a time. Coordinates must be inside the bitmap.
+class OccupancyBitmap {
+public:
+    OccupancyBitmap();
+
+    void resize(int width, int height); // Reallocates only on size change; contents cleared
+    void clear();
+    bool isAllocated() const { return !_bits.empty(); }
+
+    inline bool test(int x, int y) const {
+        return (_bits[y * _wordsPerRow + (x >> 5)] >> (x & 31)) & 1;
+    }
+    inline void set(int x, int y) {
+        _bits[y * _wordsPerRow + (x >> 5)] |= 1u << (x & 31);
+    }
+
+    // First free run within [x0, x1) on row y: sets [runStart, runEnd) and returns true,
+    // or returns false if [x0, x1) is fully occupied
+    bool findFreeRun(int y, int x0, int x1, int& runStart, int& runEnd) const;
+    // Marks [x0, x1) on row y occupied
+    void markRange(int y, int x0, int x1);
+    // True if every pixel of [x0, x1) x [y0, y1) is occupied (empty rects are not)
+    bool isRectOccupied(int x0, int y0, int x1, int y1) const;
+
+private:
+    std::vector<uint32_t> _bits;
+    int _width;
+    int _height;
+    int _wordsPerRow;
+
+    // Index of the first bit >= x in [x, x1) on 'row' whose value equals 'value', or x1
+    static int findBit(const uint32_t* row, int x, int x1, bool value);
+};
+
+#endif // OCCUPANCY_BITMAP_H
@@ -0,0 +1,68 @@
+#include "pattern_tile_cache.h"
+#include "esp32-hal-log.h"
+#include <esp_heap_caps.h>
+
+PatternTileCache::PatternTileCache(size_t capacity)
+    : _capacity(capacity > 0 ? capacity : 1), _useClock(0) {
+    _tiles.reserve(_capacity);
+}
+
+PatternTileCache::~PatternTileCache() {
+    clear();
+}
+
+const PatternTile* PatternTileCache::find(const PatternTileKey& key) {
+    for (auto& tile : _tiles) {
+        if (tile.key == key) {
+            tile.lastUsed = ++_useClock;
+            return &tile;
+        }
+    }
+    return nullptr;
+}
+
+PatternTile* PatternTileCache::insert(const PatternTileKey& key, int periodX, int periodY) {
+    if (periodX <= 0 || periodY <= 0) return nullptr;
+    // Repeat the period until the row is even and wide enough to make each copy worthwhile
+    int width = periodX;
+    while ((width & 1) || width < PATTERN_TILE_MIN_ROW_PIXELS) width += periodX;
+    size_t bytes = (size_t)(width / 2) * periodY;
+    if (bytes > PATTERN_TILE_MAX_BYTES) return nullptr;
+
+    PatternTile* slot = nullptr;
+    if (_tiles.size() >= _capacity) {
+        slot = &_tiles[0];
+        for (auto& tile : _tiles) {
+            if (tile.lastUsed < slot->lastUsed) slot = &tile;
+        }
+        free(slot->pixels); // heap_caps allocations are released with free()
+        slot->pixels = nullptr;
+    }
+
+    uint8_t* pixels = static_cast<uint8_t*>(heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+    if (!pixels) pixels = static_cast<uint8_t*>(malloc(bytes)); // No PSRAM: internal heap
+    if (!pixels) {
+        log_w("PatternTileCache: Failed to allocate %u byte tile", (unsigned)bytes);
+        if (slot) _tiles.erase(_tiles.begin() + (slot - &_tiles[0]));
+        return nullptr;
+    }
+
+    if (!slot) {
+        _tiles.push_back(PatternTile());
+        slot = &_tiles.back();
+    }
+    slot->key = key;
+    slot->width = width;
+    slot->height = periodY;
+    slot->stride = width / 2;
+    slot->pixels = pixels;
+    slot->lastUsed = ++_useClock;
+    return slot;
+}
+
+void PatternTileCache::clear() {
+    for (auto& tile : _tiles) {
+        free(tile.pixels);
+    }
+    _tiles.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef PATTERN_TILE_CACHE_H
+#define PATTERN_TILE_CACHE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "micropatterns_command.h" // For MicroPatternsAsset
+
+const size_t PATTERN_TILE_CACHE_DEFAULT_CAPACITY = 8;
+const size_t PATTERN_TILE_MAX_BYTES = 16384; // Larger tiles are not cached
+const int PATTERN_TILE_MIN_ROW_PIXELS = 64;  // Rows repeat the period up to at least this width
+
+// Identifies one screen-space expansion of a fill pattern. Under an integer transform (see
+// TransformClass) the filled pattern is periodic on screen, so the tile depends only on the
+// pattern, its scale, the quarter-turn orientation, the color inversion and the translation
+// modulo the screen period (the phase).
+struct PatternTileKey {
+    const MicroPatternsAsset* asset;
+    int scale;
+    uint8_t orientation; // Packed signs of the integer 2x2 matrix
+    bool inverted;       // WHITE fill (set bits white)
+    int phaseX, phaseY;
+
+    bool operator==(const PatternTileKey& o) const {
+        return asset == o.asset && scale == o.scale && orientation == o.orientation &&
+               inverted == o.inverted && phaseX == o.phaseX && phaseY == o.phaseY;
+    }
+};
+
+// One pre-expanded pattern period in the framebuffer's 4bpp layout (even x in the high nibble).
+// Row r holds screen rows y with y mod height == r; pixel i of a row holds screen columns x
+// with x mod width == i. width is even, so a row copies into the framebuffer byte for byte.
+struct PatternTile {
+    PatternTileKey key;
+    int width;  // Pixels per row: a multiple of the screen period, even, >= PATTERN_TILE_MIN_ROW_PIXELS
+    int height; // Rows: the screen period in y
+    int stride; // Bytes per row (width / 2)
+    uint8_t* pixels;
+    uint32_t lastUsed;
+
+    inline const uint8_t* row(int sy) const {
+        int r = sy % height;
+        if (r < 0) r += height;
+        return pixels + r * stride;
+    }
+};
+
+// Small LRU cache of pattern tiles in PSRAM when available. Tiles reference their asset by
+// pointer, so the cache must be cleared whenever assets may have been freed or recycled
+// (i.e. when a program is compiled).
+class PatternTileCache {
+public:
+    explicit PatternTileCache(size_t capacity = PATTERN_TILE_CACHE_DEFAULT_CAPACITY);
+    ~PatternTileCache();
+
+    const PatternTile* find(const PatternTileKey& key);
+
+    // Returns an uninitialised tile of periodX x periodY pixels for the caller to fill, evicting
+    // the least recently used tile when full. Returns nullptr if the tile would be too large or
+    // memory is short.
+    PatternTile* insert(const PatternTileKey& key, int periodX, int periodY);
+
+    void clear();
+    size_t size() const { return _tiles.size(); }
+
+private:
+    std::vector<PatternTile> _tiles;
+    size_t _capacity;
+    uint32_t _useClock;
+
+    PatternTileCache(const PatternTileCache&);            // Non-copyable
+    PatternTileCache& operator=(const PatternTileCache&); // Non-copyable
+};
+
+#endif // PATTERN_TILE_CACHE_H
@@ -0,0 +1,116 @@
+#include "program_cache.h"
+#include "esp32-hal-log.h"
+#include <esp_heap_caps.h>
+#include <new>
+
+ProgramCache::ProgramCache(size_t capacity)
+    : _capacity(capacity > 0 ? capacity : 1), _useClock(0) {
+    _entries.reserve(_capacity);
+}
+
+ProgramCache::~ProgramCache() {
+    clear();
+}
+
+uint32_t ProgramCache::hashContent(const String& content) {
+    uint32_t hash = 2166136261u;
+    const char* p = content.c_str();
+    for (unsigned int i = 0; i < content.length(); ++i) {
+        hash ^= static_cast<uint8_t>(p[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// The program object goes to PSRAM; its vectors follow the allocator's PSRAM threshold.
+MicroPatternsProgram* ProgramCache::allocateProgram() {
+    void* mem = heap_caps_malloc(sizeof(MicroPatternsProgram), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) mem = malloc(sizeof(MicroPatternsProgram)); // No PSRAM: internal heap
+    if (!mem) return nullptr;
+    return new (mem) MicroPatternsProgram();
+}
+
+void ProgramCache::freeProgram(MicroPatternsProgram* program) {
+    if (!program) return;
+    program->~MicroPatternsProgram();
+    free(program); // heap_caps allocations are released with free()
+}
+
+const MicroPatternsProgram* ProgramCache::findValidated(const String& fileId, uint32_t contentGeneration) {
+    for (auto& entry : _entries) {
+        if (entry.fileId == fileId && entry.contentGeneration == contentGeneration) {
+            entry.lastUsed = ++_useClock;
+            return entry.program;
+        }
+    }
+    return nullptr;
+}
+
+const MicroPatternsProgram* ProgramCache::find(const String& fileId, uint32_t contentHash, uint32_t contentGeneration) {
+    for (auto& entry : _entries) {
+        if (entry.fileId == fileId && entry.contentHash == contentHash) {
+            entry.lastUsed = ++_useClock;
+            entry.contentGeneration = contentGeneration;
+            return entry.program;
+        }
+    }
+    return nullptr;
+}
+
+uint32_t ProgramCache::getContentHash(const MicroPatternsProgram* program) const {
+    for (const auto& entry : _entries) {
+        if (entry.program == program) return entry.contentHash;
+    }
+    return 0;
+}
+
+MicroPatternsProgram* ProgramCache::insert(const String& fileId, uint32_t contentHash, uint32_t contentGeneration) {
+    Entry* slot = nullptr;
+    for (auto& entry : _entries) {
+        if (entry.fileId == fileId) { slot = &entry; break; } // Stale version of the same script
+    }
+    if (!slot && _entries.size() >= _capacity) {
+        slot = &_entries[0];
+        for (auto& entry : _entries) {
+            if (entry.lastUsed < slot->lastUsed) slot = &entry;
+        }
+        log_i("ProgramCache: Evicting '%s'", slot->fileId.c_str());
+    }
+
+    if (slot) {
+        slot->program->clear();
+    } else {
+        MicroPatternsProgram* program = allocateProgram();
+        if (!program) {
+            log_e("ProgramCache: Failed to allocate program for '%s'", fileId.c_str());
+            return nullptr;
+        }
+        Entry entry;
+        entry.program = program;
+        _entries.push_back(entry);
+        slot = &_entries.back();
+    }
+
+    slot->fileId = fileId;
+    slot->contentHash = contentHash;
+    slot->contentGeneration = contentGeneration;
+    slot->lastUsed = ++_useClock;
+    return slot->program;
+}
+
+void ProgramCache::remove(const MicroPatternsProgram* program) {
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].program == program) {
+            freeProgram(_entries[i].program);
+            _entries.erase(_entries.begin() + i);
+            return;
+        }
+    }
+}
+
+void ProgramCache::clear() {
+    for (auto& entry : _entries) {
+        freeProgram(entry.program);
+    }
+    _entries.clear();
+}
@@ -0,0 +1,63 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <Arduino.h>
+#include <vector>
+#include "micropatterns_compiler.h" // For MicroPatternsProgram
+
+const size_t PROGRAM_CACHE_DEFAULT_CAPACITY = 4;
+
+// Small LRU cache of compiled programs, keyed by fileId and a hash of the script content.
+// Each entry also remembers the ScriptManager content generation it was last checked
+// against: while that generation is unchanged the script can be re-rendered (e.g. after a
+// light-sleep wake with a new $COUNTER) without reading, parsing or compiling it again.
+// Programs are allocated in PSRAM when available.
+class ProgramCache {
+public:
+    explicit ProgramCache(size_t capacity = PROGRAM_CACHE_DEFAULT_CAPACITY);
+    ~ProgramCache();
+
+    // FNV-1a over the script text
+    static uint32_t hashContent(const String& content);
+
+    // Program for 'fileId' if its content is known unchanged at 'contentGeneration', else nullptr.
+    const MicroPatternsProgram* findValidated(const String& fileId, uint32_t contentGeneration);
+
+    // Program compiled from exactly this content, else nullptr. A hit is revalidated
+    // at 'contentGeneration'.
+    const MicroPatternsProgram* find(const String& fileId, uint32_t contentHash, uint32_t contentGeneration);
+
+    // Returns an empty program to compile into. Replaces any entry for the same fileId,
+    // otherwise evicts the least recently used entry when full. Returns nullptr if out of memory.
+    MicroPatternsProgram* insert(const String& fileId, uint32_t contentHash, uint32_t contentGeneration);
+
+    // Content hash 'program' was compiled from, 0 if it is not in the cache
+    uint32_t getContentHash(const MicroPatternsProgram* program) const;
+
+    // Drops the entry owning 'program' (e.g. after a failed compile)
+    void remove(const MicroPatternsProgram* program);
+    void clear();
+
+    size_t size() const { return _entries.size(); }
+
+private:
+    struct Entry {
+        String fileId;
+        uint32_t contentHash;
+        uint32_t contentGeneration;
+        uint32_t lastUsed;
+        MicroPatternsProgram* program;
+    };
+
+    std::vector<Entry> _entries;
+    size_t _capacity;
+    uint32_t _useClock;
+
+    ProgramCache(const ProgramCache&);            // Non-copyable
+    ProgramCache& operator=(const ProgramCache&); // Non-copyable
+
+    static MicroPatternsProgram* allocateProgram();
+    static void freeProgram(MicroPatternsProgram* program);
+};
+
+#endif // PROGRAM_CACHE_H
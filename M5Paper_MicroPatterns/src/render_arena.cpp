@@ -0,0 +1,83 @@
+#include "render_arena.h"
+#include "esp32-hal-log.h"
+#include <esp_heap_caps.h>
+#include <stdlib.h> // For abort
+#include <algorithm> // For std::max
+
+RenderArena* RenderArena::_current = nullptr;
+
+RenderArena::RenderArena(size_t chunkBytes)
+    : _chunks(nullptr), _spare(nullptr), _chunkBytes(chunkBytes), _bytesUsed(0), _bytesReserved(0), _highWaterMark(0) {}
+
+RenderArena::~RenderArena() {
+    reset();
+    while (_spare) {
+        Chunk* next = _spare->next;
+        free(_spare); // heap_caps allocations are released with free()
+        _spare = next;
+    }
+}
+
+RenderArena::Chunk* RenderArena::newChunk(size_t minBytes) {
+    size_t size = std::max(_chunkBytes, minBytes);
+    void* mem = heap_caps_malloc(sizeof(Chunk) + size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!mem) mem = malloc(sizeof(Chunk) + size); // No PSRAM: internal heap
+    if (!mem) {
+        // Same outcome as a failed operator new in the std containers drawing from the arena
+        log_e("RenderArena: Out of memory for a %u byte chunk (%u bytes in use)", (unsigned)size, (unsigned)_bytesUsed);
+        abort();
+    }
+    Chunk* chunk = static_cast<Chunk*>(mem);
+    chunk->size = size;
+    chunk->used = 0;
+    _bytesReserved += size;
+    return chunk;
+}
+
+// Offset of the first 'alignment'-aligned address at or after 'used' in the chunk's data
+static size_t alignedOffset(const void* data, size_t used, size_t alignment) {
+    uintptr_t base = reinterpret_cast<uintptr_t>(data);
+    return ((base + used + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+}
+
+void* RenderArena::allocate(size_t bytes, size_t alignment) {
+    size_t offset = _chunks ? alignedOffset(_chunks + 1, _chunks->used, alignment) : 0;
+    if (!_chunks || offset + bytes > _chunks->size) {
+        // Start a new chunk, reusing a retained one if it is large enough
+        size_t needed = bytes + alignment - 1;
+        Chunk* chunk;
+        if (_spare && _spare->size >= needed) {
+            chunk = _spare;
+            _spare = _spare->next;
+            chunk->used = 0;
+        } else {
+            chunk = newChunk(needed);
+        }
+        chunk->next = _chunks;
+        _chunks = chunk;
+        offset = alignedOffset(_chunks + 1, 0, alignment);
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(_chunks + 1) + offset;
+    _bytesUsed += (offset - _chunks->used) + bytes;
+    _chunks->used = offset + bytes;
+    if (_bytesUsed > _highWaterMark) _highWaterMark = _bytesUsed;
+    return p;
+}
+
+void RenderArena::reset() {
+    size_t keptBytes = 0;
+    for (Chunk* spare = _spare; spare; spare = spare->next) keptBytes += spare->size;
+    while (_chunks) {
+        Chunk* next = _chunks->next;
+        if (keptBytes + _chunks->size <= RENDER_ARENA_RETAINED_BYTES) {
+            _chunks->next = _spare;
+            _spare = _chunks;
+            keptBytes += _chunks->size;
+        } else {
+            free(_chunks);
+        }
+        _chunks = next;
+    }
+    _bytesReserved = keptBytes;
+    _bytesUsed = 0;
+}
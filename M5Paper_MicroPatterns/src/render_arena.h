@@ -0,0 +1,98 @@
+#ifndef RENDER_ARENA_H
+#define RENDER_ARENA_H
+
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits> // For std::true_type
+
+const size_t RENDER_ARENA_CHUNK_BYTES = 16 * 1024;    // PSRAM when available
+const size_t RENDER_ARENA_RETAINED_BYTES = 64 * 1024; // Chunks kept across reset()
+
+// Bump allocator for the short-lived objects of one compile: the parser's command tree and
+// the compiler's intermediate form. Individual frees are no-ops; reset() releases everything
+// at once, so the many small nodes never reach (and fragment) the general heap.
+// Single-threaded: only the render task allocates from it.
+class RenderArena {
+public:
+    explicit RenderArena(size_t chunkBytes = RENDER_ARENA_CHUNK_BYTES);
+    ~RenderArena();
+
+    void* allocate(size_t bytes, size_t alignment);
+    // Invalidates all allocations. Keeps up to RENDER_ARENA_RETAINED_BYTES of chunks for reuse.
+    void reset();
+
+    size_t getBytesUsed() const { return _bytesUsed; }
+    size_t getBytesReserved() const { return _bytesReserved; }
+    size_t getHighWaterMark() const { return _highWaterMark; } // Largest getBytesUsed() since construction
+
+    // Arena picked up by default-constructed ArenaAllocators; nullptr = general heap
+    static RenderArena* current() { return _current; }
+
+    // Makes 'arena' current for its lifetime
+    class Scope {
+    public:
+        explicit Scope(RenderArena& arena) : _previous(_current) { _current = &arena; }
+        ~Scope() { _current = _previous; }
+    private:
+        RenderArena* _previous;
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+    };
+
+private:
+    struct Chunk {
+        Chunk* next;
+        size_t size; // Usable bytes after the header
+        size_t used;
+    };
+
+    Chunk* _chunks; // In use, current chunk first
+    Chunk* _spare;  // Retained by reset(), empty
+    size_t _chunkBytes;
+    size_t _bytesUsed;
+    size_t _bytesReserved;
+    size_t _highWaterMark;
+
+    static RenderArena* _current;
+
+    Chunk* newChunk(size_t minBytes);
+
+    RenderArena(const RenderArena&);            // Non-copyable
+    RenderArena& operator=(const RenderArena&); // Non-copyable
+};
+
+// Standard allocator drawing from the arena that was current when it was constructed (or from
+// the heap if none was). Containers pass it on to their copies, so a whole tree built under a
+// RenderArena::Scope lives in the arena; it must be destroyed before the arena is reset.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ArenaAllocator() : _arena(RenderArena::current()) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.arena()) {}
+
+    T* allocate(size_t n) {
+        if (!_arena) return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(_arena->allocate(n * sizeof(T), alignof(T)));
+    }
+    void deallocate(T* p, size_t) {
+        if (!_arena) ::operator delete(p); // Arena memory is released by RenderArena::reset()
+    }
+
+    RenderArena* arena() const { return _arena; }
+
+private:
+    RenderArena* _arena;
+};
+
+template <typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() == b.arena(); }
+template <typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.arena() != b.arena(); }
+
+#endif // RENDER_ARENA_H
@@ -1,116 +1,562 @@
 #include "render_controller.h"
 #include "esp32-hal-log.h"
+#include <string.h> // For memcpy
 
 RenderController::RenderController(DisplayManager& displayMgr)
-    : _displayMgr(displayMgr), _runtime(nullptr), _renderer(nullptr),
-      _interrupt_requested_for_runtime_or_renderer(false) {
+    : _displayMgr(displayMgr), _runtime(nullptr), _renderer(nullptr), _streamRing(nullptr),
+      _streamingRender(false), _listBudgetBytes(RUNTIME_DEFAULT_LIST_BUDGET_BYTES), _partialRender(true),
+      _frameBuildId(0), _frameCanvasRevision(0), _canvasFrameId(0), _canvasFrameRevision(0),
+      _speculationClock(0), _speculating(false),
+      _interrupt_requested_for_runtime_or_renderer(false),
+      _interruptFlag(&_interrupt_requested_for_runtime_or_renderer) {
+    _compiler.setOptimizer(&_optimizer);
 }
 
 RenderController::~RenderController() {
+    for (SpeculativeFrame& frame : _speculativeFrames) _displayMgr.releaseSpareCanvas(frame.canvas);
     delete _runtime;
     delete _renderer;
+    delete _streamRing;
+}
+
+const std::vector<ScreenBounds>& RenderController::getDirtyRegions() const {
+    static const std::vector<ScreenBounds> none;
+    return _renderer ? _renderer->getDirtyRegions() : none;
 }
 
 bool RenderController::checkInterrupt() {
-    return _interrupt_requested_for_runtime_or_renderer;
+    if (*_interruptFlag) return true;
+    if (_speculating) return _speculationAbort && _speculationAbort();
+    return _preemptCheck && _preemptCheck();
+}
+
+void RenderController::setInterruptFlag(volatile bool* flag) {
+    _interruptFlag = flag ? flag : &_interrupt_requested_for_runtime_or_renderer;
+    if (_runtime) _runtime->setInterruptFlag(_interruptFlag);
+    if (_renderer) _renderer->setInterruptFlag(_interruptFlag);
 }
 
-RenderResultData RenderController::renderScript(const String& script_id, const String& script_content, const ScriptExecState& initial_state) {
+RenderResultData RenderController::renderScript(const String& script_id, const String& file_id, const String& script_content,
+                                                const ScriptExecState& initial_state, uint32_t content_generation) {
     log_i("RenderController: Starting render for script ID: %s", script_id.c_str());
-    _interrupt_requested_for_runtime_or_renderer = false; // Reset interrupt flag
+    *_interruptFlag = false; // Reset interrupt flag
 
     RenderResultData result;
     result.script_id = script_id;
     result.success = false;
     result.interrupted = false;
     result.final_state = initial_state;
+    result.render_mode = RENDER_MODE_DISPLAY_LIST;
+    result.profile.beginMemory();
 
     if (script_id.isEmpty()) {
         result.error_message = "Render job had an empty script ID.";
         log_e("RenderController: %s", result.error_message.c_str());
         return result;
     }
-    if (script_content.isEmpty()) {
-        result.error_message = "Render job had empty script content.";
-        log_e("RenderController: %s for script ID %s", result.error_message.c_str(), script_id.c_str());
+
+    // 1. A preempted render of the same frame continues where it stopped
+    uint32_t contentHash = script_content.isEmpty() ? 0 : ProgramCache::hashContent(script_content);
+    if (canResume(file_id, contentHash, content_generation, initial_state)) {
+        log_i("RenderController: Resuming the preempted render of '%s'.", script_id.c_str());
+        return resumeRender();
+    }
+    discardSuspendedRender();
+
+    // 2. A frame already rendered for these inputs needs neither the program nor a render
+    const FrameCache::Entry* frame = script_content.isEmpty()
+                                         ? _frameCache.findValidated(file_id, content_generation, initial_state)
+                                         : _frameCache.find(file_id, contentHash, content_generation, initial_state);
+    if (frame && useCachedFrame(script_id, *frame, initial_state, result)) {
+        result.profile.endMemory();
         return result;
     }
 
+    // 3. Find the compiled program; parse and compile only on a cache miss
+    const MicroPatternsProgram* program = acquireProgram(script_id, file_id, script_content, contentHash, content_generation, result);
+    if (!program) {
+        result.profile.endMemory();
+        return result; // result.error_message set by acquireProgram
+    }
+
+    _job.scriptId = script_id;
+    _job.fileId = file_id;
+    _job.contentHash = script_content.isEmpty() ? _programCache.getContentHash(program) : contentHash;
+    _job.contentGeneration = content_generation;
+    _job.program = program;
+    _job.state = initial_state;
+    runProgram(script_id, *program, initial_state, result);
+    return completeJob(result);
+}
+
+RenderResultData& RenderController::completeJob(RenderResultData& result) {
+    if (result.success) {
+        result.content_hash = _job.contentHash;
+        result.input_mask = _job.program->inputMask;
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_FRAME_CACHE]);
+        storeFrame(_job.fileId, _job.contentHash, _job.contentGeneration, *_job.program, _job.state);
+    }
+    result.profile.endMemory();
+    return result;
+}
+
+bool RenderController::canResume(const String& file_id, uint32_t content_hash, uint32_t content_generation,
+                                 const ScriptExecState& state) const {
+    if (!_job.suspended || _job.fileId != file_id || _job.contentGeneration != content_generation) return false;
+    if (content_hash != 0 && content_hash != _job.contentHash) return false;
+    if (!FrameCache::inputsMatch(_job.program->inputMask, _job.state, state)) return false;
+    // Without a back buffer, messages and indicators may have drawn over the partial frame
+    return _displayMgr.hasBackBuffer() || _job.canvasRevision == _displayMgr.getCanvasRevision();
+}
+
+RenderResultData RenderController::resumeRender() {
+    if (!_job.suspended) {
+        RenderResultData result;
+        result.success = false;
+        result.interrupted = false;
+        result.error_message = "No preempted render to resume.";
+        return result;
+    }
+    *_interruptFlag = false;
+    _job.suspended = false;
+    RenderResultData result = _job.result;
+    result.interrupted = false;
+    result.error_message = "";
+    runSlices(_job.scriptId, *_job.program, result);
+    return completeJob(result);
+}
+
+void RenderController::discardSuspendedRender() {
+    if (!_job.suspended) return;
+    log_i("RenderController: Dropping the preempted render of '%s'.", _job.scriptId.c_str());
+    _job.suspended = false;
+    if (_renderer) _renderer->abandonRender();
+}
+
+bool RenderController::useCachedFrame(const String& script_id, const FrameCache::Entry& frame, const ScriptExecState& state,
+                                      RenderResultData& result) {
+    // Only renders draw into the back buffer; without one, messages and indicators draw over the frame
+    bool inCanvas = frame.id == _canvasFrameId &&
+                    (_displayMgr.hasBackBuffer() || _canvasFrameRevision == _displayMgr.getCanvasRevision());
+    if (!inCanvas) {
+        M5EPD_Canvas* target = _displayMgr.getRenderCanvas();
+        if (!target || !target->frameBuffer()) return false;
+        _frameBuildId = 0; // The renderer's dirty-rectangle tracking describes another frame
+        _canvasFrameId = 0;
+        unsigned long startTime = millis();
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_FRAME_CACHE]);
+        if (!FrameCache::decode(frame, (uint8_t*)target->frameBuffer(), (size_t)target->width() * target->height() / 2)) {
+            log_e("RenderController: Cached frame of '%s' does not fit the canvas, rendering it.", script_id.c_str());
+            return false;
+        }
+        _canvasFrameId = frame.id;
+        _canvasFrameRevision = _displayMgr.getCanvasRevision();
+        log_i("RenderController: Cached frame of '%s' decoded in %lu ms.", script_id.c_str(), millis() - startTime);
+    } else {
+        log_i("RenderController: Render canvas already holds the frame of '%s' for these inputs.", script_id.c_str());
+    }
+
+    result.script_id = script_id;
+    result.success = true;
+    result.interrupted = false;
+    result.final_state = state; // Inputs are read-only for scripts
+    result.final_state.state_loaded = true;
+    result.render_mode = inCanvas ? RENDER_MODE_UNCHANGED : RENDER_MODE_CACHED;
+    result.content_hash = frame.contentHash;
+    result.input_mask = frame.inputMask;
+    return true;
+}
 
-    // 1. Parse Script
+void RenderController::storeFrame(const String& file_id, uint32_t content_hash, uint32_t content_generation,
+                                  const MicroPatternsProgram& program, const ScriptExecState& state) {
+    if (program.readsInput(SLOT_SECOND)) return; // Its frames hardly ever repeat
+    M5EPD_Canvas* canvas = _displayMgr.getRenderCanvas();
+    if (!canvas || !canvas->frameBuffer()) return;
+    unsigned long startTime = millis();
+    const FrameCache::Entry* frame = _frameCache.insert(file_id, content_hash, content_generation, program.inputMask, state,
+                                                        (const uint8_t*)canvas->frameBuffer(),
+                                                        (size_t)canvas->width() * canvas->height() / 2);
+    if (frame) {
+        _canvasFrameId = frame->id;
+        _canvasFrameRevision = _displayMgr.getCanvasRevision();
+        log_d("RenderController: Frame of '%s' compressed in %lu ms.", file_id.c_str(), millis() - startTime);
+    }
+}
+
+const MicroPatternsProgram* RenderController::acquireProgram(const String& script_id, const String& file_id, const String& script_content,
+                                                             uint32_t content_hash, uint32_t content_generation, RenderResultData& result) {
+    if (script_content.isEmpty()) {
+        const MicroPatternsProgram* program = _programCache.findValidated(file_id, content_generation);
+        if (!program) {
+            result.error_message = "Render job had empty script content.";
+            log_e("RenderController: %s for script ID %s", result.error_message.c_str(), script_id.c_str());
+            return nullptr;
+        }
+        log_i("RenderController: Program cache hit for '%s', content not reloaded.", script_id.c_str());
+        return program;
+    }
+    const MicroPatternsProgram* program = _programCache.find(file_id, content_hash, content_generation);
+    if (program) {
+        log_i("RenderController: Program cache hit for '%s' (hash %08x).", script_id.c_str(), content_hash);
+        return program;
+    }
+    return compileScript(script_id, file_id, script_content, content_hash, content_generation, result);
+}
+
+bool RenderController::hasCachedProgram(const String& file_id, uint32_t content_generation) {
+    return _programCache.findValidated(file_id, content_generation) != nullptr;
+}
+
+bool RenderController::hasCachedFrame(const String& file_id, const ScriptExecState& state, uint32_t content_generation) {
+    return _frameCache.findValidated(file_id, content_generation, state) != nullptr;
+}
+
+const MicroPatternsProgram* RenderController::compileScript(const String& script_id, const String& file_id, const String& script_content,
+                                                            uint32_t content_hash, uint32_t content_generation, RenderResultData& result) {
+    // The command tree and the compiler's intermediate form are built in the arena and released
+    // in one reset; the program keeps its own storage
+    const MicroPatternsProgram* program;
+    {
+        RenderArena::Scope arenaScope(_arena);
+        program = parseAndCompile(script_id, file_id, script_content, content_hash, content_generation, result);
+    }
+    _parser.reset(); // Drops the command tree before the arena memory under it is reused
+    result.profile.arenaHighWaterBytes = (uint32_t)_arena.getBytesUsed(); // Only grows within a compile
+    result.profile.sampleMemory();
+    log_i("RenderController: Compile arena for '%s': %u bytes used, %u reserved, high-water %u bytes.",
+          script_id.c_str(), (unsigned)_arena.getBytesUsed(), (unsigned)_arena.getBytesReserved(),
+          (unsigned)_arena.getHighWaterMark());
+    _arena.reset();
+    return program;
+}
+
+const MicroPatternsProgram* RenderController::parseAndCompile(const String& script_id, const String& file_id, const String& script_content,
+                                                              uint32_t content_hash, uint32_t content_generation, RenderResultData& result) {
+    // 1a. Parse Script
     _parser.reset();
-    if (!_parser.parse(script_content)) {
+    bool parsed;
+    {
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_PARSE]);
+        parsed = _parser.parse(script_content);
+    }
+    if (!parsed) {
         String errors_str;
         for (const String& err : _parser.getErrors()) { errors_str += err + "\n"; }
         result.error_message = "Parse failed: " + errors_str;
         log_e("RenderController: Script parsing failed for ID %s. Errors:\n%s", script_id.c_str(), errors_str.c_str());
-        return result;
+        return nullptr;
     }
     log_i("RenderController: Script '%s' parsed successfully.", script_id.c_str());
 
+    // 1b. Compile and optimise to bytecode. The program keeps its own copy of the assets.
+    MicroPatternsOptimizerConfig optimizerConfig = _optimizer.getConfig();
+    optimizerConfig.canvasWidth = _displayMgr.getWidth();
+    optimizerConfig.canvasHeight = _displayMgr.getHeight();
+    _optimizer.setConfig(optimizerConfig);
+
+    if (_runtime) _runtime->setProgram(nullptr); // insert() may recycle the program it points to
+    if (_renderer) _renderer->invalidatePatternTiles(); // Tiles point at assets of the recycled program
+    MicroPatternsProgram* program = _programCache.insert(file_id, content_hash, content_generation);
+    if (!program) {
+        result.error_message = "Out of memory for compiled program.";
+        log_e("RenderController: %s ID %s", result.error_message.c_str(), script_id.c_str());
+        return nullptr;
+    }
+
+    unsigned long compileStartTime = millis();
+    bool compiled;
+    {
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_COMPILE]);
+        compiled = _compiler.compile(_parser.getCommands(), _parser.getDeclaredVariables(), _parser.getAssets(), *program);
+    }
+    if (!compiled) {
+        _programCache.remove(program);
+        result.error_message = "Compile failed for script.";
+        log_e("RenderController: %s ID %s", result.error_message.c_str(), script_id.c_str());
+        return nullptr;
+    }
+    log_i("RenderController: Script '%s' compiled in %lu ms (%d instructions).",
+          script_id.c_str(), millis() - compileStartTime, (int)program->instructions.size());
+    const MicroPatternsOptimizerStats& optStats = _optimizer.getStats();
+    log_i("RenderController: Optimizer stats: constantsFolded=%d constantsValuesSubstituted=%d loopsUnrolled=%d invariantsHoisted=%d deadCodeEliminated=%d transformsSequenced=%d loopsInstanced=%d",
+          optStats.constantsFolded, optStats.constantsValuesSubstituted, optStats.loopsUnrolled,
+          optStats.invariantsHoisted, optStats.deadCodeEliminated, optStats.transformsSequenced,
+          optStats.loopsInstanced);
+
+    return program;
+}
+
+void RenderController::runProgram(const String& script_id, const MicroPatternsProgram& program,
+                                  const ScriptExecState& initial_state, RenderResultData& result) {
     // 2. Prepare and Run Runtime to generate Display List
-    if (_runtime) delete _runtime;
-    _runtime = new MicroPatternsRuntime(_displayMgr.getWidth(), _displayMgr.getHeight(), _parser.getAssets());
-    _runtime->setCommands(&_parser.getCommands());
-    _runtime->setDeclaredVariables(&_parser.getDeclaredVariables());
-    _runtime->setInterruptCheckCallback([this]() { return this->checkInterrupt(); });
+    if (!_runtime) {
+        _runtime = new MicroPatternsRuntime(_displayMgr.getWidth(), _displayMgr.getHeight());
+        _runtime->setInterruptFlag(_interruptFlag);
+    }
+    _runtime->setProgram(&program);
+    _runtime->setDisplayListBudget(_listBudgetBytes);
     _runtime->setCounter(initial_state.counter);
     _runtime->setTime(initial_state.hour, initial_state.minute, initial_state.second);
 
-    unsigned long generationStartTime = millis();
-    _runtime->generateDisplayList();
-    unsigned long generationDuration = millis() - generationStartTime;
+    ensureRenderer();
 
-    if (_runtime->isInterrupted()) {
-        result.interrupted = true;
-        result.error_message = "Display list generation interrupted.";
-        log_i("RenderController: %s for script '%s'", result.error_message.c_str(), script_id.c_str());
-        // Final state might be partially updated by runtime before interrupt
-        result.final_state.counter = _runtime->getCounter();
-        _runtime->getTime(result.final_state.hour, result.final_state.minute, result.final_state.second);
-        result.final_state.state_loaded = true;
-        return result;
+    // The previous frame can only be patched if nothing else drew on the render canvas since:
+    // only renders draw into the back buffer, but messages and indicators into the displayed canvas
+    bool frameIntact = _frameBuildId != 0 && _frameBuildId == program.buildId &&
+                       (_displayMgr.hasBackBuffer() || _frameCanvasRevision == _displayMgr.getCanvasRevision());
+    if (!_speculating) {
+        _frameBuildId = 0; // Until this render completes; spare frames leave it alone
+        _canvasFrameId = 0;
+    }
+
+    if (_streamingRender && runStreaming(script_id, result)) {
+        result.render_mode = RENDER_MODE_STREAMING;
+        finishProgram(program, result);
+        return;
+    }
+    _job.rasterising = false;
+    _job.allowPartial = _partialRender && frameIntact;
+    {
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_GENERATE]);
+        _runtime->generateDisplayList(RENDER_SLICE_MS);
+    }
+    runSlices(script_id, program, result);
+}
+
+void RenderController::runSlices(const String& script_id, const MicroPatternsProgram& program, RenderResultData& result) {
+    while (!_job.rasterising) {
+        if (_runtime->isSuspended()) {
+            if (checkInterrupt()) {
+                suspendJob("Display list generation", script_id, result);
+                return;
+            }
+            ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_GENERATE]);
+            _runtime->resumeDisplayList(RENDER_SLICE_MS);
+            continue;
+        }
+
+        if (_runtime->isBudgetExceeded()) {
+            // Degrade to painter's order from a bounded ring instead of running out of memory
+            log_w("RenderController: Display list for '%s' exceeds its %u byte budget, re-running in streaming mode.",
+                  script_id.c_str(), (unsigned)_listBudgetBytes);
+            _runtime->releaseDisplayList();
+            _runtime->setCounter(result.final_state.counter);
+            _runtime->setTime(result.final_state.hour, result.final_state.minute, result.final_state.second);
+            if (!runStreaming(script_id, result)) {
+                result.error_message = "Display list exceeds memory budget and streaming is unavailable.";
+                log_e("RenderController: %s Script '%s'", result.error_message.c_str(), script_id.c_str());
+                return;
+            }
+            result.render_mode = RENDER_MODE_BUDGET_FALLBACK;
+            finishProgram(program, result);
+            return;
+        }
+
+        log_i("RenderController: Display list generation for '%s' took %u ms. List size: %d (%u reused from cached segments)",
+              script_id.c_str(), (unsigned)(result.profile.phaseMicros(RENDER_PHASE_GENERATE) / 1000),
+              (int)_runtime->getDisplayList().size(), (unsigned)_runtime->getReusedItemCount());
+
+        // 3. Run DisplayListRenderer: clears and draws the canvas or its dirty regions
+        _renderer->beginRender(_runtime->getDisplayList(), _job.allowPartial);
+        _job.rasterising = true;
     }
-    log_i("RenderController: Display list generation for '%s' took %lu ms. List size: %d",
-          script_id.c_str(), generationDuration, _runtime->getDisplayList().size());
 
-    // 3. Prepare and Run DisplayListRenderer
-    if (_renderer) delete _renderer;
-    _renderer = new DisplayListRenderer(_displayMgr, _parser.getAssets(), _displayMgr.getWidth(), _displayMgr.getHeight());
-    _renderer->setInterruptCheckCallback([this]() { return this->checkInterrupt(); });
-    
     unsigned long renderStartTime = millis();
-    _renderer->render(_runtime->getDisplayList()); // This clears canvas and draws items
-    unsigned long renderDuration = millis() - renderStartTime;
+    while (!_renderer->resumeRender(RENDER_SLICE_MS)) {
+        if (checkInterrupt()) {
+            suspendJob("Rendering process", script_id, result);
+            return;
+        }
+    }
+    log_i("RenderController: Display list rendering for '%s' took %lu ms since its last slice.", script_id.c_str(),
+          millis() - renderStartTime);
+    if (_renderer->isPartialRender()) {
+        int area = 0;
+        for (const ScreenBounds& region : _renderer->getDirtyRegions()) {
+            area += (region.maxX - region.minX) * (region.maxY - region.minY);
+        }
+        log_i("RenderController: Re-rendered %d dirty region(s) of '%s', %d px.",
+              (int)_renderer->getDirtyRegions().size(), script_id.c_str(), area);
+        result.render_mode = RENDER_MODE_PARTIAL;
+    } else {
+        result.render_mode = RENDER_MODE_DISPLAY_LIST;
+    }
+    finishProgram(program, result);
+}
 
-    // Check for interrupt again (renderer might also check it)
-    if (checkInterrupt()) { // Check our flag, renderer might have set it via callback
-        result.interrupted = true;
-        // result.success will be handled below
-        result.error_message = "Rendering process interrupted.";
+// Reports the job as interrupted. A foreground job is kept for resuming; a spare-frame render
+// is dropped, the runtime and renderer abandoning it with the next job.
+void RenderController::suspendJob(const char* stage, const String& script_id, RenderResultData& result) {
+    result.success = false;
+    result.interrupted = true;
+    result.error_message = String(stage) + " interrupted.";
+    if (_speculating) {
         log_i("RenderController: %s for script '%s'", result.error_message.c_str(), script_id.c_str());
-    } else {
-        log_i("RenderController: Display list rendering for '%s' took %lu ms.", script_id.c_str(), renderDuration);
-        // result.success will be set based on result.interrupted below
+        return;
     }
+    _job.suspended = true;
+    _job.canvasRevision = _displayMgr.getCanvasRevision();
+    _job.result = result;
+    log_i("RenderController: %s for script '%s', kept for resuming.", result.error_message.c_str(), script_id.c_str());
+}
 
+void RenderController::finishProgram(const MicroPatternsProgram& program, RenderResultData& result) {
     // Final success/interrupted status determination
-    if (result.interrupted) { // If interrupted at any stage (runtime or renderer)
+    if (result.interrupted) { // Streamed renders are not resumable
         result.success = false;
     } else {
         result.success = true; // Not interrupted, assume success unless other errors occurred
+        if (!_speculating && (result.render_mode == RENDER_MODE_DISPLAY_LIST || result.render_mode == RENDER_MODE_PARTIAL)) {
+            _frameBuildId = program.buildId; // Streamed renders are not tracked for dirty rectangles
+            _frameCanvasRevision = _displayMgr.getCanvasRevision();
+        }
     }
-    
+
+    // The display list (or ring) is still allocated: the memory peak of the job
+    result.profile.sampleMemory();
+    _renderer->collectProfile(result.profile);
+    result.profile.displayListItems = (uint32_t)_renderer->getTotalItems();
+    result.profile.expressionEvaluations = _runtime->getExpressionEvaluations();
+    result.profile.matrixInversions = _runtime->getMatrixInversions();
+
     // Final state from runtime (variables might have changed during display list generation)
     result.final_state.counter = _runtime->getCounter();
     _runtime->getTime(result.final_state.hour, result.final_state.minute, result.final_state.second);
     result.final_state.state_loaded = true;
-    
-    return result;
+}
+
+void RenderController::ensureRenderer() {
+    if (!_renderer) {
+        _renderer = new DisplayListRenderer(_displayMgr, _displayMgr.getWidth(), _displayMgr.getHeight());
+        _renderer->setInterruptFlag(_interruptFlag);
+    }
+}
+
+// Generation runs in slices on this task while the band worker drains the ring. A preempted
+// stream cannot be kept (the worker is waiting on the ring), so it is cancelled.
+bool RenderController::runStreaming(const String& script_id, RenderResultData& result) {
+    if (!_streamRing) _streamRing = new DisplayListRing();
+    _streamRing->reset();
+    if (!_renderer->beginStream(*_streamRing)) {
+        log_w("RenderController: Streaming unavailable, rendering '%s' from the full display list.", script_id.c_str());
+        return false;
+    }
+
+    unsigned long startTime = millis();
+    _runtime->setStreamOutput(_streamRing);
+    {
+        ProfileScope timing(result.profile.phaseCycles[RENDER_PHASE_GENERATE]); // Includes waits for ring space
+        _runtime->generateDisplayList(RENDER_SLICE_MS); // Blocks while the ring is full
+        while (_runtime->isSuspended() && !checkInterrupt()) _runtime->resumeDisplayList(RENDER_SLICE_MS);
+    }
+    _runtime->setStreamOutput(nullptr);
+    bool interrupted = _runtime->isSuspended() || _runtime->isInterrupted();
+    if (interrupted) {
+        _streamRing->cancel(); // Renderer stops at the next item
+    } else {
+        _streamRing->close();
+    }
+    _renderer->endStream();
+    if (interrupted || *_interruptFlag) { // The renderer may also have cancelled the ring
+        result.interrupted = true;
+        result.error_message = "Streamed rendering interrupted.";
+        log_i("RenderController: %s for script '%s'", result.error_message.c_str(), script_id.c_str());
+    }
+    log_i("RenderController: Streamed generation and rendering for '%s' took %lu ms.", script_id.c_str(), millis() - startTime);
+    return true;
+}
+
+bool RenderController::speculate(const String& script_id, const String& file_id, const String& script_content,
+                                 const ScriptExecState& state, uint32_t content_generation, std::function<bool()> abortCheck) {
+    // Reuse the frame of this script, else replace the least recently rendered one
+    SpeculativeFrame* frame = &_speculativeFrames[0];
+    for (SpeculativeFrame& candidate : _speculativeFrames) {
+        if (candidate.fileId == file_id) { frame = &candidate; break; }
+        if (candidate.lastRendered < frame->lastRendered) frame = &candidate;
+    }
+    frame->valid = false;
+    frame->fileId = file_id;
+    frame->contentGeneration = content_generation;
+    frame->state = state;
+    frame->lastRendered = ++_speculationClock;
+    if (!frame->canvas) frame->canvas = _displayMgr.createSpareCanvas();
+    if (!frame->canvas) return false;
+
+    discardSuspendedRender(); // Runtime and renderer are needed for this one
+    *_interruptFlag = false;
+    RenderResultData result;
+    result.script_id = script_id;
+    result.success = false;
+    result.interrupted = false;
+    result.final_state = state;
+    result.render_mode = RENDER_MODE_DISPLAY_LIST;
+    uint32_t contentHash = script_content.isEmpty() ? 0 : ProgramCache::hashContent(script_content);
+    const MicroPatternsProgram* program = acquireProgram(script_id, file_id, script_content, contentHash, content_generation, result);
+    if (!program) return false;
+    frame->inputMask = program->inputMask;
+    frame->contentHash = _programCache.getContentHash(program);
+
+    unsigned long startTime = millis();
+    _speculating = true;
+    _speculationAbort = abortCheck;
+    ensureRenderer();
+    _renderer->setTargetCanvas(frame->canvas);
+    runProgram(script_id, *program, state, result);
+    _renderer->setTargetCanvas(nullptr);
+    _speculationAbort = nullptr;
+    _speculating = false;
+
+    frame->valid = result.success;
+    log_i("RenderController: Speculative render of '%s' %s in %lu ms.", script_id.c_str(),
+          frame->valid ? "ready" : (result.interrupted ? "interrupted" : "failed"), millis() - startTime);
+    return frame->valid;
+}
+
+bool RenderController::needsSpeculation(const String& file_id, const ScriptExecState& state, uint32_t content_generation) const {
+    for (const SpeculativeFrame& frame : _speculativeFrames) {
+        if (frame.fileId != file_id || frame.contentGeneration != content_generation || frame.lastRendered == 0) continue;
+        if (frame.inputMask & (1u << SLOT_SECOND)) return false; // Never predictable
+        return !(frame.valid && FrameCache::inputsMatch(frame.inputMask, frame.state, state));
+    }
+    return true;
+}
+
+bool RenderController::takeSpeculativeFrame(const String& script_id, const String& file_id, const ScriptExecState& state,
+                                            uint32_t content_generation, RenderResultData& result) {
+    M5EPD_Canvas* target = _displayMgr.getRenderCanvas();
+    for (SpeculativeFrame& frame : _speculativeFrames) {
+        if (!frame.valid || frame.fileId != file_id) continue;
+        if (frame.contentGeneration != content_generation || !FrameCache::inputsMatch(frame.inputMask, frame.state, state)) {
+            log_i("RenderController: Speculative frame of '%s' is stale.", script_id.c_str());
+            frame.valid = false;
+            return false;
+        }
+        if (!target || !target->frameBuffer() || !frame.canvas->frameBuffer()) return false;
+        discardSuspendedRender(); // Its partial frame is overwritten
+        memcpy(target->frameBuffer(), frame.canvas->frameBuffer(), (size_t)target->width() * target->height() / 2);
+        frame.valid = false; // Consumed: its slot is free for the new neighbours
+        _frameBuildId = 0;   // The renderer's dirty-rectangle tracking describes another frame
+        _canvasFrameId = 0;
+
+        result.script_id = script_id;
+        result.success = true;
+        result.interrupted = false;
+        result.final_state = state; // Inputs are read-only for scripts
+        result.final_state.state_loaded = true;
+        result.render_mode = RENDER_MODE_SPECULATIVE;
+        result.content_hash = frame.contentHash;
+        result.input_mask = frame.inputMask;
+        log_i("RenderController: Using speculative frame for '%s'.", script_id.c_str());
+        return true;
+    }
+    return false;
+}
+
+void RenderController::invalidateSpeculativeFrames() {
+    for (SpeculativeFrame& frame : _speculativeFrames) frame.valid = false;
 }
 
 void RenderController::requestInterrupt() {
     log_i("RenderController: Interrupt requested.");
-    _interrupt_requested_for_runtime_or_renderer = true;
-    // Runtime and Renderer will check this flag via the callback.
+    *_interruptFlag = true; // Polled by the runtime, the renderer and the drawing
 }
\ No newline at end of file
@@ -1,11 +1,19 @@
 #ifndef RENDER_CONTROLLER_H
 #define RENDER_CONTROLLER_H
 
+#include "render_arena.h"
 #include "micropatterns_parser.h"
+#include "micropatterns_compiler.h"
+#include "micropatterns_optimizer.h"
 #include "micropatterns_runtime.h"
+#include "program_cache.h"
+#include "frame_cache.h"
 #include "display_manager.h"
 #include "event_defs.h"     // For RenderJobData, RenderResultData
 #include "display_list_renderer.h" // New include
+#include <functional>
+
+const int RENDER_SPECULATIVE_FRAMES = 2; // Spare framebuffers: the next and the previous script
 
 class RenderController
 {
@@ -14,20 +22,145 @@ public:
     ~RenderController();
 
     // RenderJobData no longer contains script_content. Content is passed separately.
-    // file_id is not strictly needed by parser/runtime if content is provided, but script_id is.
-    RenderResultData renderScript(const String& script_id, const String& script_content, const ScriptExecState& initial_state);
+    // file_id keys the program cache. content_generation is ScriptManager::getContentGeneration(),
+    // read before the content was loaded. script_content may be empty if hasCachedProgram() or
+    // hasCachedFrame() was true. A state that agrees with a cached frame on every input the
+    // script reads is not rendered: the frame is decoded (RENDER_MODE_CACHED), or left alone
+    // if the render canvas still holds it (RENDER_MODE_UNCHANGED).
+    RenderResultData renderScript(const String& script_id, const String& file_id, const String& script_content,
+                                  const ScriptExecState& initial_state, uint32_t content_generation);
+
+    // True if file_id can be rendered without loading its content again
+    bool hasCachedProgram(const String& file_id, uint32_t content_generation);
+    // True if the frame cache holds the image of file_id for 'state', so its content is not needed
+    bool hasCachedFrame(const String& file_id, const ScriptExecState& state, uint32_t content_generation);
     void requestInterrupt();
 
+    // Preemption: renders run in slices of RENDER_SLICE_MS. The interrupt flag, set from any
+    // task (e.g. on input), stops the render in progress at its next span or few dozen
+    // instructions; 'flag' is owned by the caller (nullptr: an internal flag, set by
+    // requestInterrupt()). The preempt check is polled between slices on the rendering task
+    // and may also block, e.g. to give the core to other tasks. A render preempted either way
+    // is reported as interrupted but keeps its display list and rasterisation cursor: a
+    // renderScript() of the same script and inputs, or resumeRender(), continues it instead of
+    // starting over. Any other render drops it.
+    void setInterruptFlag(volatile bool* flag);
+    void setPreemptCheck(std::function<bool()> check) { _preemptCheck = check; }
+    bool hasSuspendedRender() const { return _job.suspended; }
+    RenderResultData resumeRender();
+    void discardSuspendedRender();
+
+    // Streaming mode: display-list generation and rasterisation overlap on the two cores
+    // through a bounded ring, in painter's order and without occlusion culling. Memory stays
+    // bounded by the ring. Off by default; falls back to the full list if no worker is available.
+    void setStreamingRender(bool enable) { _streamingRender = enable; }
+
+    // Memory budget of the full display list (0: unlimited). A script that exceeds it is
+    // re-run in streaming mode, reported as RENDER_MODE_BUDGET_FALLBACK.
+    void setDisplayListBudget(size_t maxBytes) { _listBudgetBytes = maxBytes; }
+
+    // Dirty-rectangle re-render: while the canvas still holds the last frame of the same
+    // program, only the regions whose input-dependent items changed are re-rasterised, reported
+    // as RENDER_MODE_PARTIAL. On by default.
+    void setPartialRender(bool enable) { _partialRender = enable; }
+    // Regions re-rendered by the last RENDER_MODE_PARTIAL render: the only ones to push to the panel
+    const std::vector<ScreenBounds>& getDirtyRegions() const;
+
+    // Speculative pre-rendering: renders a script as renderScript() would, but into one of
+    // RENDER_SPECULATIVE_FRAMES spare PSRAM framebuffers (the least recently rendered one is
+    // replaced), while 'abortCheck' returns false. True if a frame is ready.
+    bool speculate(const String& script_id, const String& file_id, const String& script_content,
+                   const ScriptExecState& state, uint32_t content_generation, std::function<bool()> abortCheck);
+    // True unless a frame that takeSpeculativeFrame() would accept is ready, or the script is
+    // known to read $SECOND (its frames can never be predicted)
+    bool needsSpeculation(const String& file_id, const ScriptExecState& state, uint32_t content_generation) const;
+    // If a frame of file_id was rendered from the same content with the same value for every
+    // input its program reads, copies it into the render canvas and reports it in 'result'
+    // as RENDER_MODE_SPECULATIVE. The frame is consumed.
+    bool takeSpeculativeFrame(const String& script_id, const String& file_id, const ScriptExecState& state,
+                              uint32_t content_generation, RenderResultData& result);
+    void invalidateSpeculativeFrames();
+
 private:
+    struct SpeculativeFrame {
+        M5EPD_Canvas* canvas = nullptr; // From DisplayManager::createSpareCanvas, on first use
+        String fileId;
+        uint32_t contentGeneration = 0;
+        uint32_t inputMask = 0;         // Of the program rendered
+        uint32_t contentHash = 0;       // Of the script rendered
+        ScriptExecState state;          // Inputs rendered with
+        bool valid = false;
+        uint32_t lastRendered = 0;
+    };
+
+    // Foreground render, kept between slices and while suspended
+    struct RenderJob {
+        bool suspended = false;   // Preempted, resumable
+        bool rasterising = false; // Display list complete, handed to the renderer
+        bool allowPartial = false;
+        String scriptId;
+        String fileId;
+        uint32_t contentHash = 0;
+        uint32_t contentGeneration = 0;
+        const MicroPatternsProgram* program = nullptr; // In _programCache, which is left alone while suspended
+        ScriptExecState state;
+        uint32_t canvasRevision = 0; // DisplayManager canvas revision when it was preempted
+        RenderResultData result;     // So far, profile included, for the resumed job
+    };
+
     DisplayManager &_displayMgr;
+    RenderArena _arena;             // Parse and compile temporaries, declared before their users
     MicroPatternsParser _parser;
-    MicroPatternsRuntime *_runtime; // For display list generation
-    DisplayListRenderer *_renderer; // For rendering the display list
+    MicroPatternsCompiler _compiler;
+    MicroPatternsOptimizer _optimizer;
+    ProgramCache _programCache;     // Compiled programs of recently rendered scripts
+    FrameCache _frameCache;         // Compressed frames of recent renders
+    MicroPatternsRuntime *_runtime; // For display list generation, created on first render and reused
+    DisplayListRenderer *_renderer; // For rendering the display list, created on first render and reused
+    DisplayListRing *_streamRing;   // Between runtime and renderer in streaming mode, created on first use
+    bool _streamingRender;
+    size_t _listBudgetBytes;
+    bool _partialRender;
+    uint32_t _frameBuildId;        // Program whose completed display-list render the canvas holds (0: none)
+    uint32_t _frameCanvasRevision; // DisplayManager canvas revision right after that render
+    uint32_t _canvasFrameId;       // Frame cache entry the render canvas holds (0: none)
+    uint32_t _canvasFrameRevision; // DisplayManager canvas revision right after it was placed
+    SpeculativeFrame _speculativeFrames[RENDER_SPECULATIVE_FRAMES];
+    uint32_t _speculationClock;
+    bool _speculating;                       // Rendering into a spare frame
+    std::function<bool()> _speculationAbort; // Interrupts a speculative render
 
     volatile bool _interrupt_requested_for_runtime_or_renderer;
+    volatile bool* _interruptFlag; // Polled by runtime, renderer and drawing: the one above or the caller's
+    std::function<bool()> _preemptCheck;
+    RenderJob _job;
 
-    // Callback for interrupt checking (passed to runtime and renderer)
+    // Between slices: the interrupt flag, then the speculation abort or the preempt check
     bool checkInterrupt();
+
+    const MicroPatternsProgram* acquireProgram(const String& script_id, const String& file_id, const String& script_content,
+                                               uint32_t content_hash, uint32_t content_generation, RenderResultData& result);
+    const MicroPatternsProgram* compileScript(const String& script_id, const String& file_id, const String& script_content,
+                                              uint32_t content_hash, uint32_t content_generation, RenderResultData& result);
+    const MicroPatternsProgram* parseAndCompile(const String& script_id, const String& file_id, const String& script_content,
+                                                uint32_t content_hash, uint32_t content_generation, RenderResultData& result);
+    void runProgram(const String& script_id, const MicroPatternsProgram& program,
+                    const ScriptExecState& initial_state, RenderResultData& result);
+    // Generation and rasterisation slices of the full display list, from where _job stands
+    void runSlices(const String& script_id, const MicroPatternsProgram& program, RenderResultData& result);
+    void suspendJob(const char* stage, const String& script_id, RenderResultData& result);
+    void finishProgram(const MicroPatternsProgram& program, RenderResultData& result);
+    // Frame cache and content fields of a completed foreground render
+    RenderResultData& completeJob(RenderResultData& result);
+    bool canResume(const String& file_id, uint32_t content_hash, uint32_t content_generation,
+                   const ScriptExecState& state) const;
+    void ensureRenderer();
+    bool runStreaming(const String& script_id, RenderResultData& result); // False if streaming is unavailable (nothing run)
+    // Places a cached frame in the render canvas (unless it is there already) and reports it in 'result'
+    bool useCachedFrame(const String& script_id, const FrameCache::Entry& frame, const ScriptExecState& state,
+                        RenderResultData& result);
+    void storeFrame(const String& file_id, uint32_t content_hash, uint32_t content_generation,
+                    const MicroPatternsProgram& program, const ScriptExecState& state);
 };
 
 #endif // RENDER_CONTROLLER_H
\ No newline at end of file
@@ -0,0 +1,95 @@
+#include "render_profiler.h"
+#include <esp_heap_caps.h>
+#include <string.h> // For memset
+#include <algorithm>
+
+static const char* const PHASE_NAMES[RENDER_PHASE_COUNT] = {
+    "load", "parse", "compile", "generate", "bin", "rasterise", "frame_cache", "lock_wait", "push"
+};
+static const char* const KIND_NAMES[RENDER_PROFILE_KINDS] = {
+    "draw", "pixel", "fill_pixel", "line", "rect", "fill_rect", "circle", "fill_circle"
+};
+
+static uint32_t allocatedBlocks() {
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_8BIT); // Internal and PSRAM; walks the heap, so only at job boundaries
+    return info.allocated_blocks;
+}
+
+void RenderProfile::reset() {
+    memset(phaseCycles, 0, sizeof(phaseCycles));
+    memset(kinds, 0, sizeof(kinds));
+    displayListItems = 0;
+    expressionEvaluations = 0;
+    matrixInversions = 0;
+    arenaHighWaterBytes = 0;
+    heapBlocksAllocated = 0;
+    psramPeakBytes = 0;
+    internalPeakBytes = 0;
+    cpuMhz = getCpuFrequencyMhz();
+    _psramFreeAtBegin = 0;
+    _internalFreeAtBegin = 0;
+    _heapBlocksAtBegin = 0;
+}
+
+void RenderProfile::beginMemory() {
+    _psramFreeAtBegin = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    _internalFreeAtBegin = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    _heapBlocksAtBegin = allocatedBlocks();
+    psramPeakBytes = 0;
+    internalPeakBytes = 0;
+}
+
+void RenderProfile::sampleMemory() {
+    uint32_t psramFree = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    uint32_t internalFree = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    if (psramFree < _psramFreeAtBegin) psramPeakBytes = std::max(psramPeakBytes, _psramFreeAtBegin - psramFree);
+    if (internalFree < _internalFreeAtBegin) internalPeakBytes = std::max(internalPeakBytes, _internalFreeAtBegin - internalFree);
+}
+
+void RenderProfile::endMemory() {
+    sampleMemory();
+    heapBlocksAllocated = (int32_t)(allocatedBlocks() - _heapBlocksAtBegin);
+}
+
+void RenderProfile::addKinds(const RenderKindProfile (&other)[RENDER_PROFILE_KINDS]) {
+    for (int i = 0; i < RENDER_PROFILE_KINDS; ++i) {
+        kinds[i].cycles += other[i].cycles;
+        kinds[i].items += other[i].items;
+        kinds[i].pixels += other[i].pixels;
+    }
+}
+
+uint32_t RenderProfile::phaseMicros(RenderPhase phase) const {
+    return cpuMhz ? (uint32_t)(phaseCycles[phase] / cpuMhz) : 0;
+}
+
+String RenderProfile::toJson(const char* scriptId, const char* renderMode) const {
+    char buf[160];
+    String json;
+    json.reserve(1024);
+    // The build date identifies the firmware the numbers were taken with
+    snprintf(buf, sizeof(buf), "{\"profile\":\"render\",\"build\":\"%s %s\",\"script\":\"%s\",\"mode\":\"%s\",\"cpu_mhz\":%u,\"phases_us\":{",
+             __DATE__, __TIME__, scriptId, renderMode, (unsigned)cpuMhz);
+    json += buf;
+    for (int i = 0; i < RENDER_PHASE_COUNT; ++i) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%u", i ? "," : "", PHASE_NAMES[i], (unsigned)phaseMicros((RenderPhase)i));
+        json += buf;
+    }
+    json += "},\"commands\":{";
+    bool first = true;
+    for (int i = 0; i < RENDER_PROFILE_KINDS; ++i) {
+        if (kinds[i].items == 0) continue;
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"us\":%u,\"items\":%u,\"pixels\":%u}", first ? "" : ",", KIND_NAMES[i],
+                 (unsigned)(cpuMhz ? kinds[i].cycles / cpuMhz : 0), (unsigned)kinds[i].items, (unsigned)kinds[i].pixels);
+        json += buf;
+        first = false;
+    }
+    snprintf(buf, sizeof(buf), "},\"display_list_items\":%u,\"expressions\":%u,\"matrix_inversions\":%u,",
+             (unsigned)displayListItems, (unsigned)expressionEvaluations, (unsigned)matrixInversions);
+    json += buf;
+    snprintf(buf, sizeof(buf), "\"arena_high_water\":%u,\"heap_blocks\":%d,\"psram_peak\":%u,\"internal_peak\":%u}",
+             (unsigned)arenaHighWaterBytes, (int)heapBlocksAllocated, (unsigned)psramPeakBytes, (unsigned)internalPeakBytes);
+    json += buf;
+    return json;
+}
@@ -0,0 +1,87 @@
+#ifndef RENDER_PROFILER_H
+#define RENDER_PROFILER_H
+
+#include <Arduino.h>
+#include "micropatterns_command.h" // For CommandType
+
+// Phases of a render job, in pipeline order. Phases a job skips stay at zero.
+enum RenderPhase : uint8_t {
+    RENDER_PHASE_LOAD = 0,    // Script content read from SPIFFS
+    RENDER_PHASE_PARSE,
+    RENDER_PHASE_COMPILE,     // Bytecode compile and optimisation
+    RENDER_PHASE_GENERATE,    // Display-list generation (streamed: overlapping rasterisation)
+    RENDER_PHASE_BIN,         // Screen bounds and band binning
+    RENDER_PHASE_RASTERISE,   // Wall time of the band pass, both cores
+    RENDER_PHASE_FRAME_CACHE, // Frame cache decode or store
+    RENDER_PHASE_LOCK_WAIT,   // Waiting for the EPD lock to present
+    RENDER_PHASE_PUSH,        // Copy to the displayed canvas and EPD update
+    RENDER_PHASE_COUNT
+};
+
+// Drawing commands profiled individually, see renderProfileKind()
+const int RENDER_PROFILE_KINDS = 8;
+
+// Rasterisation cost of one drawing command type. Cycles are summed over both cores.
+struct RenderKindProfile {
+    uint64_t cycles;
+    uint32_t items;  // Per band an item was drawn in
+    uint32_t pixels; // Written, after occupation-map and clip rejection
+};
+
+// Counters of one render job, always compiled in. Times are CPU cycle counts (ESP.getCycleCount(),
+// read in pairs on the core doing the work), converted to microseconds only for output. Plain
+// data, so it travels in RenderResultQueueItem.
+struct RenderProfile {
+    uint64_t phaseCycles[RENDER_PHASE_COUNT];
+    RenderKindProfile kinds[RENDER_PROFILE_KINDS];
+    uint32_t displayListItems;
+    uint32_t expressionEvaluations;
+    uint32_t matrixInversions;
+    uint32_t arenaHighWaterBytes;  // Compile arena, 0 if nothing was compiled
+    int32_t heapBlocksAllocated;   // Net heap blocks allocated over the job (internal and PSRAM)
+    uint32_t psramPeakBytes;       // Largest drop of free PSRAM seen at a phase boundary
+    uint32_t internalPeakBytes;    // Same for the internal heap
+    uint32_t cpuMhz;
+
+    RenderProfile() { reset(); }
+    void reset();
+
+    // Memory baseline, then samples for the peaks; endMemory() also takes the net block count
+    void beginMemory();
+    void sampleMemory();
+    void endMemory();
+
+    void addKinds(const RenderKindProfile (&other)[RENDER_PROFILE_KINDS]);
+    uint32_t phaseMicros(RenderPhase phase) const;
+    // One-line JSON object for comparing scripts and firmware builds
+    String toJson(const char* scriptId, const char* renderMode) const;
+
+private:
+    uint32_t _psramFreeAtBegin;
+    uint32_t _internalFreeAtBegin;
+    uint32_t _heapBlocksAtBegin;
+};
+
+// Cycle counter of the calling core
+inline uint32_t profileCycles() { return ESP.getCycleCount(); }
+
+// Adds the cycles from construction to destruction to 'accumulator'
+class ProfileScope {
+public:
+    explicit ProfileScope(uint64_t& accumulator) : _accumulator(accumulator), _start(profileCycles()) {}
+    ~ProfileScope() { _accumulator += (uint32_t)(profileCycles() - _start); }
+private:
+    uint64_t& _accumulator;
+    uint32_t _start;
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+};
+
+// Index into RenderProfile::kinds of a drawing command, -1 for other commands
+inline int renderProfileKind(CommandType type) {
+    if (type == CMD_DRAW) return 0;
+    if (type >= CMD_PIXEL && type <= CMD_FILL_CIRCLE) return 1 + (type - CMD_PIXEL);
+    return -1;
+}
+
+#endif // RENDER_PROFILER_H
@@ -0,0 +1,22 @@
+#ifndef RENDER_SLICE_H
+#define RENDER_SLICE_H
+
+#include <Arduino.h> // For millis
+
+// Render jobs (display-list generation and rasterisation) run in slices of about this long.
+// Between slices the RenderController polls its preemption hooks; a preempted job keeps its
+// cursor and continues from there.
+const uint32_t RENDER_SLICE_MS = 40;
+
+// Deadline of a slice starting now, 0 for an unbounded one (sliceMs == 0)
+inline uint32_t renderSliceDeadline(uint32_t sliceMs) {
+    if (sliceMs == 0) return 0;
+    uint32_t deadline = millis() + sliceMs;
+    return deadline ? deadline : 1; // 0 means unbounded
+}
+
+inline bool renderSliceExpired(uint32_t deadline) {
+    return deadline != 0 && (int32_t)(millis() - deadline) >= 0;
+}
+
+#endif // RENDER_SLICE_H
@@ -9,7 +9,9 @@
 const char *ScriptManager::LIST_JSON_PATH = "/scripts/list.json";
 const char *ScriptManager::CONTENT_DIR_PATH = "/scripts/content";
 const char *ScriptManager::CURRENT_SCRIPT_ID_PATH = "/current_script.id";
-const char *ScriptManager::SCRIPT_STATES_PATH = "/scripts/script_states.json";
+const char *ScriptManager::SCRIPT_STATES_PATH = "/scripts/script_states.bin";
+const char *ScriptManager::LEGACY_SCRIPT_STATES_PATH = "/scripts/script_states.json";
+const char *ScriptManager::CONTENT_TEMP_SUFFIX = ".tmp";
 
 // Default script content with clear visual indication it's the fallback script
 const char *ScriptManager::DEFAULT_SCRIPT_CONTENT = R"(
@@ -64,7 +66,7 @@ ENDREPEAT
 )";
 const char *ScriptManager::DEFAULT_SCRIPT_ID = "default_fallback_script";
 
-ScriptManager::ScriptManager()
+ScriptManager::ScriptManager() : _stateStore(SCRIPT_STATES_PATH)
 {
     _spiffsMutex = xSemaphoreCreateMutex();
     if (_spiffsMutex == NULL)
@@ -387,11 +389,94 @@ bool ScriptManager::saveScriptList(JsonDocument &listDoc)
     return false;
 }
 
+void ScriptManager::carryOverSyncState(JsonDocument &serverListDoc, const JsonArrayConst &storedList)
+{
+    if (!serverListDoc.is<JsonArray>())
+    {
+        return;
+    }
+    int carried = 0;
+    for (JsonObject scriptInfo : serverListDoc.as<JsonArray>())
+    {
+        const char *humanId = scriptInfo["id"].as<const char *>();
+        if (!humanId)
+        {
+            continue;
+        }
+        for (JsonVariantConst item : storedList)
+        {
+            const char *storedId = item["id"].as<const char *>();
+            if (!storedId || strcmp(storedId, humanId) != 0)
+            {
+                continue;
+            }
+            if (item["fileId"].is<const char *>())
+            {
+                scriptInfo["fileId"] = item["fileId"].as<String>();
+            }
+            if (item["contentVersion"].is<const char *>())
+            {
+                scriptInfo["contentVersion"] = item["contentVersion"].as<String>();
+            }
+            carried++;
+            break;
+        }
+    }
+    log_i("carryOverSyncState: %d of %u scripts already known locally", carried, serverListDoc.as<JsonArray>().size());
+}
+
+bool ScriptManager::isScriptContentCurrent(const JsonObjectConst &scriptInfo)
+{
+    const char *version = scriptInfo["contentHash"].as<const char *>();
+    const char *storedVersion = scriptInfo["contentVersion"].as<const char *>();
+    const char *fileId = scriptInfo["fileId"].as<const char *>();
+    if (!version || !storedVersion || !fileId || version[0] == '\0' || fileId[0] != 's' ||
+        strcmp(version, storedVersion) != 0)
+    {
+        return false;
+    }
+    bool exists = false;
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) == pdTRUE)
+    {
+        exists = SPIFFS.exists(String(CONTENT_DIR_PATH) + "/" + fileId);
+        xSemaphoreGive(_spiffsMutex);
+    }
+    else
+    {
+        log_e("isScriptContentCurrent: Failed to take mutex");
+    }
+    return exists;
+}
+
 // Implementation is now using JsonDocument instead of DynamicJsonDocument
 
+// "id=fileId;" of every entry, in order: what cached programs depend on
+static String fileIdMapping(const JsonArrayConst &list)
+{
+    String mapping;
+    for (JsonVariantConst item : list)
+    {
+        mapping += item["id"].as<const char *>() ? item["id"].as<const char *>() : "";
+        mapping += '=';
+        mapping += item["fileId"].as<const char *>() ? item["fileId"].as<const char *>() : "";
+        mapping += ';';
+    }
+    return mapping;
+}
+
 // Internal helper: Assumes _spiffsMutex is already held.
 bool ScriptManager::saveScriptList_nolock(JsonDocument &listDoc)
 {
+    // Only a change of fileId assignments invalidates cached programs, not new names or versions
+    String mapping;
+    if (listDoc.is<JsonArray>())
+    {
+        mapping = fileIdMapping(listDoc.as<JsonArrayConst>());
+        if (mapping != _storedFileIdMapping)
+        {
+            _contentGeneration++;
+        }
+    }
     // Validations from the original public saveScriptList
     if (listDoc.isNull()) {
         log_e("saveScriptList_nolock: Document is null/empty");
@@ -420,6 +505,7 @@ bool ScriptManager::saveScriptList_nolock(JsonDocument &listDoc)
         log_e("saveScriptList_nolock: Failed to open %s for writing. SPIFFS.open() returned null", LIST_JSON_PATH);
         return false;
     }
+    _storedFileIdMapping = ""; // Until the new list is written
 
     bool success = false;
     log_d("saveScriptList_nolock: Beginning serialization of %u elements to %s", arraySize, LIST_JSON_PATH);
@@ -432,6 +518,7 @@ bool ScriptManager::saveScriptList_nolock(JsonDocument &listDoc)
         log_i("saveScriptList_nolock: Saved list with %u entries (%u bytes) to %s",
               arraySize, bytesWritten, LIST_JSON_PATH);
         success = true;
+        _storedFileIdMapping = mapping;
     } else {
         log_e("saveScriptList_nolock: Failed to write to %s (serializeJson returned 0)", LIST_JSON_PATH);
     }
@@ -502,6 +589,7 @@ bool ScriptManager::loadScriptList_nolock(JsonDocument &outListDoc)
     }
     size_t numEntries = outListDoc.as<JsonArray>().size();
     log_i("loadScriptList_nolock: Successfully loaded script list with %u entries", numEntries);
+    _storedFileIdMapping = fileIdMapping(outListDoc.as<JsonArrayConst>());
     ensureUniqueFileIds_nolock(outListDoc); // This is already _nolock
     return true;
 }
@@ -570,6 +658,13 @@ bool ScriptManager::loadScriptContent_nolock(const String &fileId, String &outCo
     String path = String(CONTENT_DIR_PATH) + "/" + actualFileId;
     log_i("loadScriptContent_nolock: Attempting to load script content from %s", path.c_str());
 
+    // Content committed while the rename into place failed only exists under its temporary name
+    String tempPath = path + CONTENT_TEMP_SUFFIX;
+    if (!SPIFFS.exists(path.c_str()) && !(_contentWriteFile && _contentWritePath == path) && SPIFFS.exists(tempPath.c_str())) {
+        log_w("loadScriptContent_nolock: %s is missing, loading its pending content from %s", path.c_str(), tempPath.c_str());
+        path = tempPath;
+    }
+
     if (!SPIFFS.exists(path.c_str())) {
         log_w("loadScriptContent_nolock: Path does not exist: %s (for actualFileId: %s, original fileId: %s)", path.c_str(), actualFileId.c_str(), fileId.c_str());
         // Recovery attempt
@@ -648,17 +743,8 @@ bool ScriptManager::loadScriptContent_nolock(const String &fileId, String &outCo
     return true;
 }
 
-// _nolock version of saveScriptContent
-bool ScriptManager::saveScriptContent_nolock(const String &fileId, const String &content) {
-    if (fileId.isEmpty()) {
-        log_e("saveScriptContent_nolock: fileId is empty");
-        return false;
-    }
-    if (content.isEmpty()) {
-        log_e("saveScriptContent_nolock: content is empty for fileId '%s'", fileId.c_str());
-        return false;
-    }
-
+// Short fileId under which the content of 'fileId' (a short fileId or a humanId) is stored
+String ScriptManager::resolveContentFileId_nolock(const String &fileId) {
     String actualFileId = fileId;
     JsonDocument listDoc; // Use default allocator
 
@@ -672,7 +758,7 @@ bool ScriptManager::saveScriptContent_nolock(const String &fileId, const String
                         if (!storedFileId.isEmpty() && storedFileId != "null" && storedFileId.startsWith("s")) {
                             actualFileId = storedFileId;
                             idFound = true;
-                            log_i("saveScriptContent_nolock: Mapped humanId '%s' to fileId '%s'", fileId.c_str(), actualFileId.c_str());
+                            log_i("resolveContentFileId_nolock: Mapped humanId '%s' to fileId '%s'", fileId.c_str(), actualFileId.c_str());
                             break;
                         }
                     }
@@ -680,67 +766,140 @@ bool ScriptManager::saveScriptContent_nolock(const String &fileId, const String
             }
             if (!idFound) {
                 actualFileId = _generateShortFileId_nolock(fileId); // Use _nolock
-                log_w("saveScriptContent_nolock: Generated new fileId '%s' for humanId '%s'", actualFileId.c_str(), fileId.c_str());
+                log_w("resolveContentFileId_nolock: Generated new fileId '%s' for humanId '%s'", actualFileId.c_str(), fileId.c_str());
                 // Note: The listDoc is not updated here with the new fileId. This should be handled by ensureUniqueFileIds or similar.
             }
         } else {
-             log_w("saveScriptContent_nolock: Failed to load script list for humanId to fileId mapping. Generating new fileId.");
+             log_w("resolveContentFileId_nolock: Failed to load script list for humanId to fileId mapping. Generating new fileId.");
              actualFileId = _generateShortFileId_nolock(fileId); // Use _nolock
         }
     }
+    return actualFileId;
+}
 
-    String path = String(CONTENT_DIR_PATH) + "/" + actualFileId;
-    log_i("saveScriptContent_nolock: Attempting to save %u bytes to %s", content.length(), path.c_str());
+bool ScriptManager::beginScriptContentWrite(const String &fileId)
+{
+    if (fileId.isEmpty()) { // Check before taking mutex
+        log_e("beginScriptContentWrite: fileId is empty");
+        return false;
+    }
+    if (_contentWriteFile) {
+        log_w("beginScriptContentWrite: Discarding unfinished write to %s", _contentWritePath.c_str());
+        abortScriptContentWrite();
+    }
 
-    if (content.length() > 10000) {
-        log_w("saveScriptContent_nolock: Large content detected (%u bytes)", content.length());
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        log_e("beginScriptContentWrite: Failed to take mutex for fileId %s after 1000ms", fileId.c_str());
+        return false;
     }
 
-    if (!SPIFFS.exists(CONTENT_DIR_PATH)) {
-        log_w("saveScriptContent_nolock: Directory %s does not exist, creating...", CONTENT_DIR_PATH);
-        if (!SPIFFS.mkdir(CONTENT_DIR_PATH)) {
-            log_e("saveScriptContent_nolock: Failed to create directory %s", CONTENT_DIR_PATH);
-            return false;
+    bool success = false;
+    String actualFileId = resolveContentFileId_nolock(fileId);
+    _contentWritePath = String(CONTENT_DIR_PATH) + "/" + actualFileId;
+    _contentWriteBytes = 0;
+    String tempPath = _contentWritePath + CONTENT_TEMP_SUFFIX;
+
+    if (!SPIFFS.exists(CONTENT_DIR_PATH) && !SPIFFS.mkdir(CONTENT_DIR_PATH)) {
+        log_e("beginScriptContentWrite: Failed to create directory %s", CONTENT_DIR_PATH);
+    } else {
+        if (SPIFFS.exists(tempPath.c_str())) {
+            // Left over by an interrupted write, or by a commit whose rename failed (no main file)
+            if (SPIFFS.exists(_contentWritePath.c_str()) || !SPIFFS.rename(tempPath.c_str(), _contentWritePath.c_str())) {
+                SPIFFS.remove(tempPath.c_str());
+            }
+        }
+        _contentWriteFile = SPIFFS.open(tempPath.c_str(), FILE_WRITE);
+        if (!_contentWriteFile) {
+            log_e("beginScriptContentWrite: Failed to open %s for writing", tempPath.c_str());
+        } else {
+            log_d("beginScriptContentWrite: Writing content for '%s' to %s", fileId.c_str(), tempPath.c_str());
+            success = true;
         }
     }
+    xSemaphoreGive(_spiffsMutex);
+    return success;
+}
 
-    size_t freeSpace = SPIFFS.totalBytes() - SPIFFS.usedBytes();
-    if (content.length() + 100 > freeSpace) {
-        log_e("saveScriptContent_nolock: Not enough space. Content: %u bytes, Free: %u bytes", content.length(), freeSpace);
+bool ScriptManager::writeScriptContentChunk(const char *data, size_t length)
+{
+    if (!_contentWriteFile) {
+        log_e("writeScriptContentChunk: No content write in progress");
+        return false;
+    }
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        log_e("writeScriptContentChunk: Failed to take mutex after 1000ms");
         return false;
     }
 
-    if (SPIFFS.exists(path.c_str())) {
-        log_d("saveScriptContent_nolock: Deleting existing file before writing new content");
-        SPIFFS.remove(path.c_str());
+    bool success = false;
+    size_t freeSpace = SPIFFS.totalBytes() - SPIFFS.usedBytes();
+    if (length + 100 > freeSpace) {
+        log_e("writeScriptContentChunk: Not enough space. %u bytes written, %u more, Free: %u bytes", _contentWriteBytes, length, freeSpace);
+    } else {
+        size_t bytesWritten = _contentWriteFile.write((const uint8_t *)data, length);
+        _contentWriteBytes += bytesWritten;
+        success = (bytesWritten == length);
+        if (!success) log_e("writeScriptContentChunk: Write incomplete. Wrote %u of %u bytes", bytesWritten, length);
     }
+    xSemaphoreGive(_spiffsMutex);
+    return success;
+}
 
-    log_d("saveScriptContent_nolock: Opening file for writing");
-    File file = SPIFFS.open(path.c_str(), FILE_WRITE);
-    if (!file) {
-        log_e("saveScriptContent_nolock: Failed to open %s for writing", path.c_str());
+bool ScriptManager::commitScriptContentWrite()
+{
+    if (!_contentWriteFile) {
+        log_e("commitScriptContentWrite: No content write in progress");
+        return false;
+    }
+    if (_contentWriteBytes == 0) {
+        log_e("commitScriptContentWrite: content is empty for %s", _contentWritePath.c_str());
+        abortScriptContentWrite();
+        return false;
+    }
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        log_e("commitScriptContentWrite: Failed to take mutex after 1000ms");
+        abortScriptContentWrite();
         return false;
     }
 
-    esp_task_wdt_reset();
-    size_t bytesWritten = file.print(content);
-    esp_task_wdt_reset();
-    bool success = (bytesWritten == content.length());
-
-    if (success) log_i("saveScriptContent_nolock: Successfully wrote %u bytes to file", bytesWritten);
-    else log_e("saveScriptContent_nolock: Write incomplete. Wrote %u of %u bytes", bytesWritten, content.length());
-    file.close();
+    String tempPath = _contentWritePath + CONTENT_TEMP_SUFFIX;
+    _contentWriteFile.close();
+    _contentGeneration++; // Any content write invalidates cached programs
 
-    if (success) { // Verification
-        File verifyFile = SPIFFS.open(path.c_str(), FILE_READ);
+    // SPIFFS cannot rename over an existing file. Readers hold the mutex, so none sees the gap.
+    if (SPIFFS.exists(_contentWritePath.c_str())) {
+        log_d("commitScriptContentWrite: Deleting existing file before moving new content in place");
+        SPIFFS.remove(_contentWritePath.c_str());
+    }
+    bool success = SPIFFS.rename(tempPath.c_str(), _contentWritePath.c_str());
+    if (success) {
+        log_i("commitScriptContentWrite: Successfully wrote %u bytes to %s", _contentWriteBytes, _contentWritePath.c_str());
+        File verifyFile = SPIFFS.open(_contentWritePath.c_str(), FILE_READ);
         if (verifyFile) {
-            if (verifyFile.size() != content.length()) log_w("saveScriptContent_nolock: Verification size mismatch");
+            if (verifyFile.size() != _contentWriteBytes) log_w("commitScriptContentWrite: Verification size mismatch");
             verifyFile.close();
-        } else { log_e("saveScriptContent_nolock: Failed to open file for verification"); }
+        } else { log_e("commitScriptContentWrite: Failed to open file for verification"); }
+    } else {
+        // The old content is gone, so the temporary file is now the only copy. Keep it: the
+        // loader falls back to it and the next write for this script retries the move.
+        log_e("commitScriptContentWrite: Failed to rename %s to %s, keeping the temporary file", tempPath.c_str(), _contentWritePath.c_str());
     }
+    xSemaphoreGive(_spiffsMutex);
     return success;
 }
 
+void ScriptManager::abortScriptContentWrite()
+{
+    if (!_contentWriteFile) return;
+    bool locked = (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) == pdTRUE);
+    _contentWriteFile.close();
+    if (locked) { // Otherwise the temporary file is replaced by the next write, or removed by cleanupOrphanedContent
+        SPIFFS.remove((_contentWritePath + CONTENT_TEMP_SUFFIX).c_str());
+        xSemaphoreGive(_spiffsMutex);
+    }
+    log_d("abortScriptContentWrite: Discarded %u bytes for %s", _contentWriteBytes, _contentWritePath.c_str());
+}
+
 bool ScriptManager::saveScriptContent(const String &fileId, const String &content)
 {
     if (fileId.isEmpty()) { // Check before taking mutex
@@ -752,14 +911,14 @@ bool ScriptManager::saveScriptContent(const String &fileId, const String &conten
         return false;
     }
 
-    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) == pdTRUE)
-    {
-        bool success_local = saveScriptContent_nolock(fileId, content);
-        xSemaphoreGive(_spiffsMutex);
-        return success_local;
+    if (!beginScriptContentWrite(fileId)) return false;
+    esp_task_wdt_reset();
+    if (!writeScriptContentChunk(content.c_str(), content.length())) {
+        abortScriptContentWrite();
+        return false;
     }
-    log_e("saveScriptContent: Failed to take mutex for fileId %s after 1000ms", fileId.c_str());
-    return false;
+    esp_task_wdt_reset();
+    return commitScriptContentWrite();
 }
 
 bool ScriptManager::loadScriptExecutionState(const String &humanId, ScriptExecState &outState)
@@ -770,96 +929,14 @@ bool ScriptManager::loadScriptExecutionState(const String &humanId, ScriptExecSt
         outState.state_loaded = false;
         return false;
     }
-    outState = ScriptExecState(); // Reset to default
-
     if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
-        File file = SPIFFS.open(SCRIPT_STATES_PATH, FILE_READ);
-        if (!file || file.isDirectory() || file.size() == 0)
-        {
-            if (file)
-                file.close();
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            return false;
-        }
-    
-        JsonDocument statesDoc; // Use default allocator
-        DeserializationError error = deserializeJson(statesDoc, file);
-        file.close();
-
-        if (error)
-        {
-            log_e("loadScriptExecutionState: Failed to parse %s: %s.", SCRIPT_STATES_PATH, error.c_str());
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            return false;
-        }
-        if (!statesDoc.is<JsonObject>())
-        {
-            log_e("loadScriptExecutionState: %s content is not a JSON object.", SCRIPT_STATES_PATH);
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            return false;
-        }
-
-        JsonObject root = statesDoc.as<JsonObject>();
-
-        JsonVariantConst scriptVariant = root[humanId.c_str()];
-
-        if (scriptVariant.isNull())
-        { // Check if the key exists and is not null
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            // log_d("Script ID '%s' not found in states file.", humanId.c_str());
-            return false; // Script ID not found in the states object
-        }
-
-        // Ensure the value for humanId is an object
-        if (!scriptVariant.is<JsonObjectConst>())
-        { // Check if it can be viewed as JsonObjectConst
-            log_e("loadScriptExecutionState: State for script ID '%s' is not a JSON object.", humanId.c_str());
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            return false;
-        }
-
-        JsonObjectConst scriptStateObj = scriptVariant.as<JsonObjectConst>(); // Use JsonObjectConst for reading
-        if (!scriptStateObj["counter"].is<int>() || !scriptStateObj["hour"].is<int>() ||
-            !scriptStateObj["minute"].is<int>() || !scriptStateObj["second"].is<int>())
-        {
-            log_e("loadScriptExecutionState: Incomplete state for script ID '%s' in %s.", humanId.c_str(), SCRIPT_STATES_PATH);
-            xSemaphoreGive(_spiffsMutex);
-            outState.state_loaded = false;
-            return false;
-        }
-
-        outState.counter = scriptStateObj["counter"].as<int>();
-        outState.hour = scriptStateObj["hour"].as<int>();
-        outState.minute = scriptStateObj["minute"].as<int>();
-        outState.second = scriptStateObj["second"].as<int>();
-        outState.state_loaded = true;
-
+        bool success = loadScriptExecutionState_nolock(humanId, outState);
         xSemaphoreGive(_spiffsMutex);
-        log_i("Script execution state loaded for ID '%s': Counter=%d, Time=%02d:%02d:%02d",
-              humanId.c_str(), outState.counter, outState.hour, outState.minute, outState.second);
-        return true;
+        return success;
     }
-    // Mutex was not taken or already given in a path above.
-    // If mutex was taken and an early return happened, it should have been released.
-    // If we reach here, it means xSemaphoreTake failed initially or was released and logic continued.
-    // The original code had a path where mutex was given then another log_i and return false.
-    // Ensuring mutex is always given if taken.
-    // The original code had a bug here: if xSemaphoreTake failed, it would fall through and log "not found".
-    // Corrected: if xSemaphoreTake fails, it should log and return.
-    // If it succeeds, all paths must give it back.
-
-    // This part of the original code is reached if xSemaphoreTake fails.
-    // log_e("ScriptManager::loadScriptExecutionState failed to take mutex for humanId %s", humanId.c_str());
-    // The original log_i("Script execution state not found...") was misleading if mutex failed.
-    // The function should have already returned if mutex was taken.
-    // If mutex was not taken, this is the correct path.
     log_e("ScriptManager::loadScriptExecutionState failed to take mutex for humanId %s", humanId.c_str());
+    outState = ScriptExecState();
     outState.state_loaded = false; // Ensure state_loaded is false if mutex fails
     return false;
 }
@@ -958,72 +1035,75 @@ bool ScriptManager::saveCurrentScriptId(const String &humanId)
     return false;
 }
 
-// _nolock version of loadScriptExecutionState
-bool ScriptManager::loadScriptExecutionState_nolock(const String &humanId, ScriptExecState &outState)
+void ScriptManager::importLegacyStates_nolock()
 {
-    if (humanId.isEmpty())
-    {
-        log_e("loadScriptExecutionState_nolock: humanId is null or empty.");
-        outState.state_loaded = false;
-        return false;
-    }
-    outState = ScriptExecState(); // Reset to default
-
-    File file = SPIFFS.open(SCRIPT_STATES_PATH, FILE_READ);
-    if (!file || file.isDirectory() || file.size() == 0)
+    File file = SPIFFS.open(LEGACY_SCRIPT_STATES_PATH, FILE_READ);
+    if (!file || file.isDirectory())
     {
         if (file) file.close();
-        outState.state_loaded = false;
-        return false;
+        return;
     }
-
     JsonDocument statesDoc; // Use default allocator
     DeserializationError error = deserializeJson(statesDoc, file);
     file.close();
-
-    if (error)
+    if (error || !statesDoc.is<JsonObject>())
     {
-        log_e("loadScriptExecutionState_nolock: Failed to parse %s: %s.", SCRIPT_STATES_PATH, error.c_str());
-        outState.state_loaded = false;
-        return false;
+        log_e("importLegacyStates_nolock: Failed to parse %s, its states are lost", LEGACY_SCRIPT_STATES_PATH);
     }
-    if (!statesDoc.is<JsonObject>())
+    else
     {
-        log_e("loadScriptExecutionState_nolock: %s content is not a JSON object.", SCRIPT_STATES_PATH);
-        outState.state_loaded = false;
-        return false;
+        for (JsonPairConst kv : statesDoc.as<JsonObjectConst>())
+        {
+            JsonObjectConst scriptStateObj = kv.value().as<JsonObjectConst>();
+            if (!scriptStateObj["counter"].is<int>() || !scriptStateObj["hour"].is<int>() ||
+                !scriptStateObj["minute"].is<int>() || !scriptStateObj["second"].is<int>())
+            {
+                log_w("importLegacyStates_nolock: Incomplete state for script ID '%s', skipped", kv.key().c_str());
+                continue;
+            }
+            ScriptExecState state;
+            state.counter = scriptStateObj["counter"].as<int>();
+            state.hour = scriptStateObj["hour"].as<int>();
+            state.minute = scriptStateObj["minute"].as<int>();
+            state.second = scriptStateObj["second"].as<int>();
+            _stateStore.put(String(kv.key().c_str()), state);
+        }
+        if (!_stateStore.flush())
+        {
+            return; // Keep the JSON file to import it again next time
+        }
+        log_i("importLegacyStates_nolock: Imported %u states from %s", (unsigned)_stateStore.size(), LEGACY_SCRIPT_STATES_PATH);
     }
+    SPIFFS.remove(LEGACY_SCRIPT_STATES_PATH);
+}
 
-    JsonObject root = statesDoc.as<JsonObject>();
-    JsonVariantConst scriptVariant = root[humanId.c_str()];
-
-    if (scriptVariant.isNull())
+void ScriptManager::ensureStatesLoaded_nolock()
+{
+    if (_stateStore.isLoaded())
     {
-        outState.state_loaded = false;
-        return false;
+        return;
     }
-    if (!scriptVariant.is<JsonObjectConst>())
+    if (!_stateStore.load() && SPIFFS.exists(LEGACY_SCRIPT_STATES_PATH))
     {
-        log_e("loadScriptExecutionState_nolock: State for script ID '%s' is not a JSON object.", humanId.c_str());
-        outState.state_loaded = false;
-        return false;
+        importLegacyStates_nolock();
     }
+}
 
-    JsonObjectConst scriptStateObj = scriptVariant.as<JsonObjectConst>();
-    if (!scriptStateObj["counter"].is<int>() || !scriptStateObj["hour"].is<int>() ||
-        !scriptStateObj["minute"].is<int>() || !scriptStateObj["second"].is<int>())
+// _nolock version of loadScriptExecutionState
+bool ScriptManager::loadScriptExecutionState_nolock(const String &humanId, ScriptExecState &outState)
+{
+    outState = ScriptExecState(); // Reset to default
+    if (humanId.isEmpty())
+    {
+        log_e("loadScriptExecutionState_nolock: humanId is null or empty.");
+        return false;
+    }
+    ensureStatesLoaded_nolock();
+    if (!_stateStore.get(humanId, outState))
     {
-        log_e("loadScriptExecutionState_nolock: Incomplete state for script ID '%s' in %s.", humanId.c_str(), SCRIPT_STATES_PATH);
-        outState.state_loaded = false;
         return false;
     }
-
-    outState.counter = scriptStateObj["counter"].as<int>();
-    outState.hour = scriptStateObj["hour"].as<int>();
-    outState.minute = scriptStateObj["minute"].as<int>();
-    outState.second = scriptStateObj["second"].as<int>();
     outState.state_loaded = true;
-
     log_i("loadScriptExecutionState_nolock: Script execution state loaded for ID '%s': Counter=%d, Time=%02d:%02d:%02d",
           humanId.c_str(), outState.counter, outState.hour, outState.minute, outState.second);
     return true;
@@ -1031,81 +1111,56 @@ bool ScriptManager::loadScriptExecutionState_nolock(const String &humanId, Scrip
 
 bool ScriptManager::saveScriptExecutionState(const String &humanId, const ScriptExecState &state)
 {
-    // Create a local copy of humanId to ensure its stability
-    String localHumanId = humanId;
-
-    if (localHumanId.isEmpty())
+    if (humanId.isEmpty())
     {
         log_e("saveScriptExecutionState: Attempted to save state for an empty humanId. Aborting.");
         return false;
     }
-
-    // Redundant check, already covered above.
-    // if (localHumanId.isEmpty())
-    // {
-    //     log_e("saveScriptExecutionState: localHumanId (from humanId) is null or empty.");
-    //     return false;
-    // }
-
     if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
-        bool success = false; // Declare success variable
-        JsonDocument statesDoc; // Use default allocator
-
-        File file = SPIFFS.open(SCRIPT_STATES_PATH, FILE_READ);
-        if (file && file.size() > 0 && !file.isDirectory())
+        ensureStatesLoaded_nolock();
+        bool wasDirty = _stateStore.isDirty();
+        _stateStore.put(humanId, state);
+        bool switched = !_lastSavedStateId.isEmpty() && _lastSavedStateId != humanId;
+        _lastSavedStateId = humanId;
+        if (_stateStore.isDirty())
         {
-            DeserializationError error = deserializeJson(statesDoc, file);
-            if (error)
+            if (!wasDirty)
             {
-                log_w("saveScriptExecutionState: Failed to parse existing %s: %s. Will overwrite.", SCRIPT_STATES_PATH, error.c_str());
-                statesDoc.clear(); // Clear to ensure it's a fresh object if parsing failed
+                _pendingStateCount = 0;
+                _pendingStateSinceMs = millis();
+            }
+            _pendingStateCount++;
+            if (switched || _pendingStateCount >= STATE_FLUSH_MAX_PENDING ||
+                millis() - _pendingStateSinceMs >= STATE_FLUSH_MAX_AGE_MS)
+            {
+                if (!_stateStore.flush()) // Stays dirty, retried by the next save or before sleep
+                {
+                    log_w("saveScriptExecutionState: Failed to write %s", SCRIPT_STATES_PATH);
+                }
             }
         }
-        if (file) file.close(); // Ensure file is closed
-
-        // Ensure statesDoc is an object, even if file didn't exist or was unparsable
-        if (!statesDoc.is<JsonObject>()) {
-            statesDoc.to<JsonObject>();
-        }
-        JsonObject root = statesDoc.as<JsonObject>();
-        
-        JsonObject scriptStateObj = root[localHumanId.c_str()].to<JsonObject>();
-        scriptStateObj["counter"] = state.counter;
-        scriptStateObj["hour"] = state.hour;
-        scriptStateObj["minute"] = state.minute;
-        scriptStateObj["second"] = state.second;
-
-        file = SPIFFS.open(SCRIPT_STATES_PATH, FILE_WRITE);
-        if (!file)
-        {
-            log_e("saveScriptExecutionState: Failed to open %s for writing.", SCRIPT_STATES_PATH);
-            xSemaphoreGive(_spiffsMutex);
-            return false;
-        }
-    
-        // Serialize the modified statesDoc to the file
-        size_t bytesWritten = serializeJson(statesDoc, file);
-        if (bytesWritten == 0) {
-            log_e("saveScriptExecutionState: Failed to write to %s (serializeJson returned 0).", SCRIPT_STATES_PATH);
-        } else {
-            log_d("saveScriptExecutionState: Wrote %u bytes to %s", bytesWritten, SCRIPT_STATES_PATH);
-            success = true;
-        }
-        file.close(); // Close file after writing
-
+        bool written = !_stateStore.isDirty();
         xSemaphoreGive(_spiffsMutex);
-
-        if (success) {
-            log_i("Script state for ID '%s' (C:%d, T:%02d:%02d:%02d) saved to %s.", localHumanId.c_str(), state.counter, state.hour, state.minute, state.second, SCRIPT_STATES_PATH);
-        }
-        return success;
+        log_i("Script state for ID '%s' (C:%d, T:%02d:%02d:%02d) saved%s.",
+              humanId.c_str(), state.counter, state.hour, state.minute, state.second,
+              written ? "" : ", not yet written to SPIFFS");
+        return true;
     }
-    else // This else corresponds to if (xSemaphoreTake...
+    log_e("ScriptManager::saveScriptExecutionState failed to take mutex for humanId %s", humanId.c_str());
+    return false;
+}
+
+bool ScriptManager::flushScriptExecutionStates()
+{
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
-        log_e("ScriptManager::saveScriptExecutionState failed to take mutex for humanId %s", localHumanId.c_str());
-        return false;
+        bool success = _stateStore.flush();
+        xSemaphoreGive(_spiffsMutex);
+        return success;
     }
+    log_e("ScriptManager::flushScriptExecutionStates failed to take mutex.");
+    return false;
 }
 
 bool ScriptManager::selectNextScript(bool moveUp, String &outSelectedHumanId, String &outSelectedName)
@@ -1191,6 +1246,50 @@ bool ScriptManager::selectNextScript(bool moveUp, String &outSelectedHumanId, St
     return false;
 }
 
+bool ScriptManager::getAdjacentScript(bool moveUp, String &outHumanId, String &outFileId)
+{
+    if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        log_e("getAdjacentScript: Failed to take mutex.");
+        return false;
+    }
+    JsonDocument listDoc; // Use default allocator
+    if (!loadScriptList_nolock(listDoc) || !listDoc.is<JsonArray>() || listDoc.as<JsonArray>().size() == 0)
+    {
+        xSemaphoreGive(_spiffsMutex);
+        return false;
+    }
+
+    JsonArray scriptList = listDoc.as<JsonArray>();
+    String currentHumanId;
+    getCurrentScriptId_nolock(currentHumanId);
+    xSemaphoreGive(_spiffsMutex);
+
+    // Same index logic as selectNextScript
+    int currentIndex = -1;
+    for (int i = 0; i < scriptList.size(); i++)
+    {
+        const char *idJson = scriptList[i]["id"];
+        if (idJson && currentHumanId == idJson)
+        {
+            currentIndex = i;
+            break;
+        }
+    }
+    int nextIndex = moveUp ? scriptList.size() - 1 : 0;
+    if (currentIndex != -1)
+    {
+        int delta = moveUp ? -1 : 1;
+        nextIndex = (currentIndex + delta + scriptList.size()) % scriptList.size();
+    }
+
+    const char *nextId = scriptList[nextIndex]["id"];
+    const char *nextFileId = scriptList[nextIndex]["fileId"];
+    if (!nextId || !nextFileId) return false;
+    outHumanId = nextId;
+    outFileId = nextFileId;
+    return !outFileId.isEmpty() && outFileId != "null" && outFileId.startsWith("s");
+}
+
 bool ScriptManager::getScriptForExecution(String &outHumanId, String &outFileId, ScriptExecState &outInitialState)
 {
     log_i("getScriptForExecution: Starting script selection process");
@@ -1333,11 +1432,15 @@ void ScriptManager::clearAllScriptData()
 {
     if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(1000)) == pdTRUE)
     {
-        log_w("Clearing all script data (list.json, current_script.id, script_states.json and content files).");
+        log_w("Clearing all script data (list.json, current_script.id, script states and content files).");
+        _contentGeneration++;
 
         SPIFFS.remove(LIST_JSON_PATH);
+        _storedFileIdMapping = "";
         SPIFFS.remove(CURRENT_SCRIPT_ID_PATH);
-        SPIFFS.remove(SCRIPT_STATES_PATH);
+        _stateStore.clear();
+        _stateStore.flush(); // Removes SCRIPT_STATES_PATH
+        SPIFFS.remove(LEGACY_SCRIPT_STATES_PATH);
 
         File root = SPIFFS.open(CONTENT_DIR_PATH);
         if (root)
@@ -1385,97 +1488,36 @@ void ScriptManager::cleanupOrphanedStates(const JsonArrayConst &validScriptList)
     if (xSemaphoreTake(_spiffsMutex, pdMS_TO_TICKS(500)) == pdTRUE)
     {
         log_i("Cleaning up orphaned script execution states...");
-        JsonDocument currentStatesDoc; // Use default allocator
-        File statesFile = SPIFFS.open(SCRIPT_STATES_PATH, FILE_READ);
-        bool statesLoaded = false;
+        ensureStatesLoaded_nolock();
 
-        if (!statesFile || statesFile.isDirectory() || statesFile.size() == 0)
-        {
-            if (statesFile)
-                statesFile.close();
-            log_i("%s not found or empty. No states to clean.", SCRIPT_STATES_PATH);
-        }
-        else
+        std::set<String> validHumanIds;
+        for (JsonVariantConst item : validScriptList)
         {
-            DeserializationError error = deserializeJson(currentStatesDoc, statesFile);
-            statesFile.close();
-            if (error)
-            {
-                log_e("Failed to parse %s for cleanup: %s. Skipping cleanup.", SCRIPT_STATES_PATH, error.c_str());
-            }
-            else if (!currentStatesDoc.is<JsonObject>())
-            {
-                log_e("%s content not a JSON object. Skipping cleanup.", SCRIPT_STATES_PATH);
-            }
-            else
+            if (!item.is<JsonObjectConst>())
             {
-                statesLoaded = true;
+                log_w("Cleanup: Item in validScriptList is not an object, skipping.");
+                continue;
             }
+            JsonObjectConst item_obj = item.as<JsonObjectConst>();
+            const char *humanId = item_obj["id"].as<const char *>();
+            if (humanId)
+                validHumanIds.insert(String(humanId));
         }
 
-        if (statesLoaded)
+        size_t removed = _stateStore.removeAllExcept(validHumanIds);
+        if (removed > 0)
         {
-            std::set<String> validHumanIds;
-            for (JsonVariantConst item : validScriptList)
-            {
-                if (!item.is<JsonObjectConst>())
-                {
-                    log_w("Cleanup: Item in validScriptList is not an object, skipping.");
-                    continue;
-                }
-                JsonObjectConst item_obj = item.as<JsonObjectConst>();
-                const char *humanId = item_obj["id"].as<const char *>();
-                if (humanId)
-                    validHumanIds.insert(String(humanId));
-            }
-
-            JsonObject statesRoot = currentStatesDoc.as<JsonObject>();
-            bool statesModified = false;
-            std::vector<String> keysToRemove;
-
-            for (auto kv : statesRoot)
+            log_i("Removed states for %u orphaned script IDs.", (unsigned)removed);
+            esp_task_wdt_reset();
+            if (!_stateStore.flush())
             {
-                String scriptIdKey = kv.key().c_str();
-                if (validHumanIds.find(scriptIdKey) == validHumanIds.end())
-                {
-                    keysToRemove.push_back(scriptIdKey);
-                }
-            }
-
-            if (!keysToRemove.empty())
-            {
-                statesModified = true;
-                log_i("Removing states for %d orphaned script IDs:", keysToRemove.size());
-                for (const String &key : keysToRemove)
-                {
-                    log_i("  - Removing state for: %s", key.c_str());
-                    statesRoot.remove(key);
-                }
-
-                statesFile = SPIFFS.open(SCRIPT_STATES_PATH, FILE_WRITE);
-                if (!statesFile)
-                {
-                    log_e("Failed to open %s for writing cleaned states.", SCRIPT_STATES_PATH);
-                }
-                else
-                {
-                    esp_task_wdt_reset();
-                    if (serializeJson(currentStatesDoc, statesFile) > 0)
-                    {
-                        log_i("Successfully saved cleaned-up script states to %s.", SCRIPT_STATES_PATH);
-                    }
-                    else
-                    {
-                        log_e("Failed to write updated states to %s.", SCRIPT_STATES_PATH);
-                    }
-                    statesFile.close();
-                }
-            }
-            else
-            {
-                log_i("No orphaned script states found to remove.");
+                log_e("Failed to write cleaned-up script states to %s.", SCRIPT_STATES_PATH);
             }
         }
+        else
+        {
+            log_i("No orphaned script states found to remove.");
+        }
         xSemaphoreGive(_spiffsMutex);
     }
     else
@@ -1545,7 +1587,14 @@ void ScriptManager::cleanupOrphanedContent(const JsonArrayConst &validScriptList
                     String entryName = entry.name();
                     String fileIdFromPath = entryName.substring(entryName.lastIndexOf('/') + 1);
 
-                    if (validFileIds.find(fileIdFromPath) == validFileIds.end())
+                    // A temporary file is kept while its script has no main file (failed rename)
+                    String baseFileId = fileIdFromPath;
+                    if (baseFileId.endsWith(CONTENT_TEMP_SUFFIX)) {
+                        baseFileId = baseFileId.substring(0, baseFileId.length() - strlen(CONTENT_TEMP_SUFFIX));
+                        if (SPIFFS.exists((String(CONTENT_DIR_PATH) + "/" + baseFileId).c_str())) baseFileId = "";
+                    }
+
+                    if (validFileIds.find(baseFileId) == validFileIds.end())
                     {
                         String fullPathToRemove = String(CONTENT_DIR_PATH) + "/" + fileIdFromPath;
                         log_i("Removing orphaned script content: %s (fileId: %s)", fullPathToRemove.c_str(), fileIdFromPath.c_str());
@@ -1553,6 +1602,7 @@ void ScriptManager::cleanupOrphanedContent(const JsonArrayConst &validScriptList
                         {
                             log_e("Failed to remove %s", fullPathToRemove.c_str());
                         }
+                        _contentGeneration++;
                     }
                 }
                 entry.close();
@@ -5,6 +5,7 @@
 #include <ArduinoJson.h>
 #include <SPIFFS.h>
 #include "event_defs.h" // For ScriptExecState
+#include "script_state_store.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h" // For mutex
 
@@ -12,6 +13,11 @@
 const size_t JSON_DOC_CAPACITY_SCRIPT_LIST = 1024; // For list.json, observed size 378 bytes
 const size_t JSON_DOC_CAPACITY_SCRIPT_STATES = 2048; // For script_states.json, can grow with more scripts
 
+// Saved execution states are written to SPIFFS after this many changed states, or once the
+// oldest unwritten one is this old, so that a reset loses little
+const uint32_t STATE_FLUSH_MAX_PENDING = 8;
+const uint32_t STATE_FLUSH_MAX_AGE_MS = 60000;
+
 class ScriptManager
 {
 public:
@@ -25,21 +31,49 @@ public:
     // Saves the script list from the provided JsonDocument. Returns true on success.
     bool saveScriptList(JsonDocument &listDoc); // Changed to non-const reference
 
+    // Incremental sync
+    // Copies the fileId and contentVersion of every stored script into the entry with the same id
+    // of a freshly fetched list, so that saving it keeps the content already on SPIFFS.
+    void carryOverSyncState(JsonDocument &serverListDoc, const JsonArrayConst &storedList);
+    // True if the stored content of the script is the version the list entry names: its
+    // contentVersion (the server's "contentHash" when it was downloaded) is unchanged and the
+    // content file exists. Such a script does not need to be downloaded again. Entries without a
+    // contentHash, from a server that predates it, are always downloaded.
+    bool isScriptContentCurrent(const JsonObjectConst &scriptInfo);
+
     // Script Content Management
     bool loadScriptContent(const String &fileId, String &outContent);
     bool saveScriptContent(const String &fileId, const String &content);
+    // Streamed alternative to saveScriptContent, one at a time: the chunks go to a temporary file
+    // that only replaces the stored content in commitScriptContentWrite(). Until then readers see
+    // the previous content; abortScriptContentWrite() leaves it in place.
+    bool beginScriptContentWrite(const String &fileId);
+    bool writeScriptContentChunk(const char *data, size_t length);
+    bool commitScriptContentWrite();
+    void abortScriptContentWrite();
+
+    // Incremented whenever script content or the fileId mapping has changed.
+    // Lets callers reuse data derived from a script without reading it again.
+    uint32_t getContentGeneration() const { return _contentGeneration; }
 
     // Current Script ID Management
     bool getCurrentScriptId(String &outHumanId); // Gets human-readable ID
     bool saveCurrentScriptId(const String &humanId);
 
     // Script Execution State Management
+    // States are kept in RAM and written to SPIFFS by flushScriptExecutionStates(), which is due
+    // before sleep. Saving a state also flushes when the script differs from the previous save,
+    // or when STATE_FLUSH_MAX_PENDING / STATE_FLUSH_MAX_AGE_MS is reached.
     bool loadScriptExecutionState(const String &humanId, ScriptExecState &outState);
     bool saveScriptExecutionState(const String &humanId, const ScriptExecState &state);
+    bool flushScriptExecutionStates(); // Writes the states saved since the last flush, if any
 
     // Script Selection Logic
     // Selects next/prev script, saves it as current, returns its humanId and name.
     bool selectNextScript(bool moveUp, String &outSelectedHumanId, String &outSelectedName);
+    // The script selectNextScript() would select, without selecting it. False if there is none
+    // or it has no valid fileId yet (it is only assigned once the script is selected).
+    bool getAdjacentScript(bool moveUp, String &outHumanId, String &outFileId);
 
     // Get Script for Execution
     // Tries to load current script. If not found, tries first script. If none, uses default.
@@ -56,12 +90,26 @@ public:
 
 private:
     SemaphoreHandle_t _spiffsMutex; // Mutex to protect SPIFFS operations
+    volatile uint32_t _contentGeneration = 0; // Written with _spiffsMutex held, read without
+    String _storedFileIdMapping; // fileIdMapping() of list.json as last loaded or saved, empty if unknown
+
+    // Content write in progress (beginScriptContentWrite)
+    File _contentWriteFile;
+    String _contentWritePath; // Final path, the temporary file adds CONTENT_TEMP_SUFFIX
+    size_t _contentWriteBytes = 0;
+
+    ScriptStateStore _stateStore; // Execution states, under _spiffsMutex
+    String _lastSavedStateId; // humanId of the previous saveScriptExecutionState()
+    uint32_t _pendingStateCount = 0; // Changed states since the store was last clean
+    uint32_t _pendingStateSinceMs = 0; // When the store became dirty
 
     // SPIFFS paths
     static const char *LIST_JSON_PATH;
     static const char *CONTENT_DIR_PATH;
     static const char *CURRENT_SCRIPT_ID_PATH;
     static const char *SCRIPT_STATES_PATH;
+    static const char *LEGACY_SCRIPT_STATES_PATH; // JSON states of earlier versions, imported once
+    static const char *CONTENT_TEMP_SUFFIX; // Of content being written
 
     // Default script content
 public: // Made DEFAULT_SCRIPT_ID and DEFAULT_SCRIPT_CONTENT public
@@ -92,7 +140,9 @@ private:
     bool getCurrentScriptId_nolock(String &outHumanId);
     bool saveCurrentScriptId_nolock(const String &humanId);
     bool loadScriptExecutionState_nolock(const String &humanId, ScriptExecState &outState);
-    bool saveScriptContent_nolock(const String &fileId, const String &content);
+    void ensureStatesLoaded_nolock(); // Reads the state store on first use
+    void importLegacyStates_nolock();
+    String resolveContentFileId_nolock(const String &fileId);
     bool loadScriptContent_nolock(const String &fileId, String &outContent);
 };
 
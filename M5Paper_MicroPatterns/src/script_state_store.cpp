@@ -0,0 +1,204 @@
+#include "script_state_store.h"
+#include "esp32-hal-log.h"
+#include <SPIFFS.h>
+#include <vector>
+
+// File layout: header, then 'count' records in hashId order. Native byte order: only this
+// device reads the file.
+static const uint32_t STATE_FILE_MAGIC = 0x5453504Du; // "MPST"
+static const uint16_t STATE_FILE_VERSION = 1;
+static const char* STATE_FILE_TEMP_SUFFIX = ".tmp";
+
+struct StateFileHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t checksum; // FNV-1a over the records
+};
+
+struct StateFileRecord {
+    uint32_t idHash;
+    int32_t counter;
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t second;
+    uint8_t reserved;
+};
+
+static_assert(sizeof(StateFileHeader) == 12 && sizeof(StateFileRecord) == 12, "State file layout");
+
+static uint32_t checksumRecords(const StateFileRecord* records, size_t count) {
+    uint32_t hash = 2166136261u;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(records);
+    for (size_t i = 0; i < count * sizeof(StateFileRecord); ++i) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+ScriptStateStore::ScriptStateStore(const char* path)
+    : _path(path), _loaded(false), _dirty(false) {
+}
+
+uint32_t ScriptStateStore::hashId(const String& humanId) {
+    uint32_t hash = 2166136261u;
+    const char* p = humanId.c_str();
+    for (unsigned int i = 0; i < humanId.length(); ++i) {
+        hash ^= static_cast<uint8_t>(p[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+bool ScriptStateStore::load() {
+    _records.clear();
+    _loaded = true;
+    _dirty = false;
+
+    // A flush interrupted between removing the old file and renaming the new one leaves only the temporary file
+    String tempPath = String(_path) + STATE_FILE_TEMP_SUFFIX;
+    const char* path = SPIFFS.exists(_path) ? _path : (SPIFFS.exists(tempPath.c_str()) ? tempPath.c_str() : nullptr);
+    if (!path) {
+        return false;
+    }
+    File file = SPIFFS.open(path, FILE_READ);
+    if (!file || file.isDirectory()) {
+        if (file) file.close();
+        return false;
+    }
+
+    StateFileHeader header;
+    if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) != sizeof(header) ||
+        header.magic != STATE_FILE_MAGIC || header.version != STATE_FILE_VERSION) {
+        log_e("ScriptStateStore: %s is not a state file of version %u", path, STATE_FILE_VERSION);
+        file.close();
+        return false;
+    }
+    std::vector<StateFileRecord> records(header.count);
+    size_t bytes = header.count * sizeof(StateFileRecord);
+    bool complete = bytes == 0 || file.read(reinterpret_cast<uint8_t*>(records.data()), bytes) == bytes;
+    file.close();
+    if (!complete || checksumRecords(records.data(), records.size()) != header.checksum) {
+        log_e("ScriptStateStore: %s is truncated or corrupt, starting with no states", path);
+        return false;
+    }
+
+    for (const StateFileRecord& stored : records) {
+        Record& record = _records[stored.idHash];
+        record.counter = stored.counter;
+        record.hour = stored.hour;
+        record.minute = stored.minute;
+        record.second = stored.second;
+    }
+    log_i("ScriptStateStore: Loaded %u states from %s", (unsigned)_records.size(), path);
+    return true;
+}
+
+bool ScriptStateStore::get(const String& humanId, ScriptExecState& outState) const {
+    auto it = _records.find(hashId(humanId));
+    if (it == _records.end()) {
+        return false;
+    }
+    outState.counter = it->second.counter;
+    outState.hour = it->second.hour;
+    outState.minute = it->second.minute;
+    outState.second = it->second.second;
+    return true;
+}
+
+void ScriptStateStore::put(const String& humanId, const ScriptExecState& state) {
+    Record updated;
+    updated.counter = state.counter;
+    updated.hour = static_cast<uint8_t>(state.hour);
+    updated.minute = static_cast<uint8_t>(state.minute);
+    updated.second = static_cast<uint8_t>(state.second);
+    auto it = _records.find(hashId(humanId));
+    if (it == _records.end()) {
+        _records[hashId(humanId)] = updated;
+        _dirty = true;
+    } else if (it->second.counter != updated.counter || it->second.hour != updated.hour ||
+               it->second.minute != updated.minute || it->second.second != updated.second) {
+        it->second = updated;
+        _dirty = true;
+    }
+}
+
+size_t ScriptStateStore::removeAllExcept(const std::set<String>& humanIds) {
+    std::set<uint32_t> keep;
+    for (const String& humanId : humanIds) {
+        keep.insert(hashId(humanId));
+    }
+    size_t removed = 0;
+    for (auto it = _records.begin(); it != _records.end();) {
+        if (keep.count(it->first)) {
+            ++it;
+        } else {
+            it = _records.erase(it);
+            removed++;
+        }
+    }
+    if (removed > 0) _dirty = true;
+    return removed;
+}
+
+void ScriptStateStore::clear() {
+    _records.clear();
+    _loaded = true;
+    _dirty = true;
+}
+
+bool ScriptStateStore::flush() {
+    if (!_dirty) {
+        return true;
+    }
+    String tempPath = String(_path) + STATE_FILE_TEMP_SUFFIX;
+    if (_records.empty()) {
+        SPIFFS.remove(_path);
+        SPIFFS.remove(tempPath.c_str());
+        _dirty = false;
+        return true;
+    }
+
+    std::vector<StateFileRecord> records;
+    records.reserve(_records.size());
+    for (const auto& kv : _records) {
+        StateFileRecord stored;
+        stored.idHash = kv.first;
+        stored.counter = kv.second.counter;
+        stored.hour = kv.second.hour;
+        stored.minute = kv.second.minute;
+        stored.second = kv.second.second;
+        stored.reserved = 0;
+        records.push_back(stored);
+    }
+    StateFileHeader header;
+    header.magic = STATE_FILE_MAGIC;
+    header.version = STATE_FILE_VERSION;
+    header.count = static_cast<uint16_t>(records.size());
+    header.checksum = checksumRecords(records.data(), records.size());
+
+    File file = SPIFFS.open(tempPath.c_str(), FILE_WRITE);
+    if (!file) {
+        log_e("ScriptStateStore: Failed to open %s for writing", tempPath.c_str());
+        return false;
+    }
+    size_t bytes = records.size() * sizeof(StateFileRecord);
+    bool written = file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header)) == sizeof(header) &&
+                   file.write(reinterpret_cast<const uint8_t*>(records.data()), bytes) == bytes;
+    file.close();
+    if (!written) {
+        log_e("ScriptStateStore: Failed to write %s", tempPath.c_str());
+        SPIFFS.remove(tempPath.c_str());
+        return false;
+    }
+    // SPIFFS cannot rename over an existing file; load() falls back to the temporary file
+    SPIFFS.remove(_path);
+    if (!SPIFFS.rename(tempPath.c_str(), _path)) {
+        log_e("ScriptStateStore: Failed to rename %s to %s", tempPath.c_str(), _path);
+        return false;
+    }
+    _dirty = false;
+    log_d("ScriptStateStore: Wrote %u states (%u bytes) to %s", (unsigned)records.size(), (unsigned)(sizeof(header) + bytes), _path);
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef SCRIPT_STATE_STORE_H
+#define SCRIPT_STATE_STORE_H
+
+#include <Arduino.h>
+#include <map>
+#include <set>
+#include "event_defs.h" // For ScriptExecState
+
+// Execution states of all scripts as a table of fixed-size binary records, keyed by a hash of
+// the humanId. The table is read from SPIFFS once and then lives in RAM: put() only updates
+// it, and flush() rewrites the file (a few bytes per script, replaced through a temporary file)
+// when something changed. Not thread-safe: ScriptManager calls it with its SPIFFS mutex held.
+class ScriptStateStore {
+public:
+    explicit ScriptStateStore(const char* path);
+
+    // Replaces the table with the one in the file. False if there is no usable file: the table
+    // is then empty. Either way isLoaded() is true afterwards.
+    bool load();
+    bool isLoaded() const { return _loaded; }
+
+    bool get(const String& humanId, ScriptExecState& outState) const;
+    void put(const String& humanId, const ScriptExecState& state);
+    // Drops the states of scripts not in 'humanIds'. Returns the number removed.
+    size_t removeAllExcept(const std::set<String>& humanIds);
+    void clear(); // Empty table; the file is removed at the next flush()
+
+    // Writes the table if changed since the last flush. False on write error (stays dirty).
+    bool flush();
+    bool isDirty() const { return _dirty; }
+    size_t size() const { return _records.size(); }
+
+    static uint32_t hashId(const String& humanId); // FNV-1a of the humanId
+
+private:
+    struct Record {
+        int32_t counter;
+        uint8_t hour;
+        uint8_t minute;
+        uint8_t second;
+    };
+
+    const char* _path;
+    std::map<uint32_t, Record> _records; // Key is hashId()
+    bool _loaded;
+    bool _dirty;
+};
+
+#endif // SCRIPT_STATE_STORE_H
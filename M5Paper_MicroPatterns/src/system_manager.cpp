@@ -250,6 +250,29 @@ void SystemManager::goToLightSleep(TickType_t sleepDurationSec, WakeupCallback o
     }
 }
 
+void SystemManager::goToDeepSleep(uint32_t sleepDurationSec) {
+    log_i("Preparing for deep sleep...");
+    esp_task_wdt_reset();
+    if (!saveSettings()) { // NVS skips values that did not change
+        log_w("Failed to save settings before sleep.");
+    }
+
+    esp_sleep_enable_timer_wakeup(sleepDurationSec * 1000000ULL);
+    // Deep sleep only wakes on RTC GPIOs, and ext1 needs all of its pins low at once, so a
+    // single button (ext0) is used: PUSH. UP and DOWN act once the device is awake.
+    esp_sleep_enable_ext0_wakeup(GPIO_NUM_38, 0); // BUTTON_PUSH_PIN, active low
+
+    // The main power latch must stay on through the sleep: on battery the M5Paper switches off
+    // when it is released. setup() releases the hold.
+    gpio_hold_en((gpio_num_t)M5EPD_MAIN_PWR_PIN);
+    gpio_deep_sleep_hold_en();
+    M5.disableEPDPower(); // The panel keeps its image unpowered
+
+    log_i("Entering deep sleep for %u seconds...", (unsigned)sleepDurationSec);
+    Serial.flush();
+    esp_deep_sleep_start();
+}
+
 esp_sleep_wakeup_cause_t SystemManager::getWakeupCause() {
     return esp_sleep_get_wakeup_cause();
 }
@@ -292,4 +315,16 @@ void SystemManager::updateLastFetchTimestamp() {
     _lastFetchMinute = rtcTime.min;
     log_i("Updated last fetch timestamp in SystemManager: %d-%02d-%02d %02d:%02d", _lastFetchYear, _lastFetchMonth, _lastFetchDay, _lastFetchHour, _lastFetchMinute);
     // Consider if saveSettings() should be called here or batched.
+}
+
+bool SystemManager::isFetchDue() {
+    RTC_Date currentDate = getDate();
+    RTC_Time currentTime = getTime();
+    if (_lastFetchYear == -1 || currentDate.year != _lastFetchYear || currentDate.mon != _lastFetchMonth ||
+        currentDate.day != _lastFetchDay) {
+        return true; // Different day or never fetched
+    }
+    int elapsedMinutes = (currentTime.hour - _lastFetchHour) * 60 + (currentTime.min - _lastFetchMinute);
+    if (elapsedMinutes < 0) elapsedMinutes += 24 * 60; // Crossed midnight
+    return elapsedMinutes >= 120;
 }
\ No newline at end of file
@@ -25,6 +25,9 @@ public:
 
     // Power Management
     void goToLightSleep(TickType_t sleepDurationSec, WakeupCallback onWakeup = nullptr); // Specify duration
+    // Saves the settings and sleeps until the timer or the PUSH button wakes the device, which
+    // then restarts from setup(); only RTC memory (see boot_snapshot.h) is kept. Does not return.
+    void goToDeepSleep(uint32_t sleepDurationSec);
     esp_sleep_wakeup_cause_t getWakeupCause();
     void configureWakeupSources(); // Configures GPIO and Timer wakeups
     void disableWakeupSources();   // Disables GPIO wakeups after waking
@@ -46,6 +49,8 @@ public:
     // Fetch timing related (persisted in NVS)
     void getLastFetchTimestamp(int &year, int &month, int &day, int &hour, int &minute);
     void updateLastFetchTimestamp();
+    // True if the last fetch was on another day (or never) or at least two hours ago
+    bool isFetchDue();
 
 private:
     // NVS handle management
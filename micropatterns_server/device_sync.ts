@@ -0,0 +1,19 @@
+// --- Device Sync Metadata ---
+// Devices keep the contentHash of every script they stored and download only the scripts whose
+// hash in the device index differs, so the index must follow every script save.
+
+// Short SHA-256 (16 hex digits) of a script's content
+export async function contentHash(content: string): Promise<string> {
+    const digest = await crypto.subtle.digest("SHA-256", new TextEncoder().encode(content));
+    return Array.from(new Uint8Array(digest).slice(0, 8), (b) => b.toString(16).padStart(2, "0")).join("");
+}
+
+// Device index with the entry of a saved script replaced by its new index entry.
+// Returns null if the script is not selected for the device (nothing to update).
+export function refreshDeviceEntry(deviceIndex: any[], indexEntry: any): any[] | null {
+    const position = deviceIndex.findIndex(item => item.id === indexEntry.id);
+    if (position === -1) return null;
+    const updated = deviceIndex.slice();
+    updated[position] = indexEntry;
+    return updated;
+}
@@ -0,0 +1,32 @@
+import { assert, assertEquals, assertNotEquals } from "std/assert/mod.ts";
+import { contentHash, refreshDeviceEntry } from "./device_sync.ts";
+
+Deno.test("contentHash is a short hex digest that follows the content", async () => {
+    const hash = await contentHash("COLOR NAME=BLACK\nFILL_RECT X=0 Y=0 WIDTH=10 HEIGHT=10\n");
+    assert(/^[0-9a-f]{16}$/.test(hash));
+    assertEquals(hash, await contentHash("COLOR NAME=BLACK\nFILL_RECT X=0 Y=0 WIDTH=10 HEIGHT=10\n"));
+    assertNotEquals(hash, await contentHash("COLOR NAME=BLACK\nFILL_RECT X=0 Y=0 WIDTH=12 HEIGHT=10\n"));
+});
+
+Deno.test("saving a selected script refreshes its device index entry", async () => {
+    // PUT /api/device/scripts copies the scripts index entries of the selection
+    const deviceIndex = [
+        { id: "city", name: "City", lastModified: "2025-01-01T00:00:00.000Z", contentHash: await contentHash("v1") },
+        { id: "waves", name: "Waves", lastModified: "2025-01-02T00:00:00.000Z", contentHash: await contentHash("w") },
+    ];
+    // PUT /api/scripts/:user/city with new content
+    const saved = { id: "city", name: "City", lastModified: "2025-02-01T00:00:00.000Z", contentHash: await contentHash("v2") };
+
+    const updated = refreshDeviceEntry(deviceIndex, saved);
+    assert(updated);
+    assertEquals(updated[0], saved);
+    assertEquals(updated[1], deviceIndex[1]);
+    // What the device compares with the hash it stored for the previous download
+    assertNotEquals(updated[0].contentHash, deviceIndex[0].contentHash);
+    assertEquals(deviceIndex[0].contentHash, await contentHash("v1")); // Input left unchanged
+});
+
+Deno.test("saving a script not selected for the device leaves the device index alone", async () => {
+    const deviceIndex = [{ id: "city", name: "City", lastModified: "2025-01-01T00:00:00.000Z", contentHash: await contentHash("v1") }];
+    assertEquals(refreshDeviceEntry(deviceIndex, { id: "other", name: "Other", lastModified: "", contentHash: "" }), null);
+});
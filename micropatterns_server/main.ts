@@ -1,5 +1,6 @@
 import { serve } from "std/http/server.ts";
 import * as s3 from "./s3.ts";
+import { contentHash, refreshDeviceEntry } from "./device_sync.ts";
 
 const PORT = 8000; // Default Deno Deploy port
 
@@ -132,6 +133,7 @@ async function handler(req: Request): Promise<Response> {
                 name: requestBody.name,
                 content: requestBody.content,
                 lastModified: new Date().toISOString(),
+                contentHash: await contentHash(requestBody.content),
             };
 
             const scriptSaveSuccess = await s3.saveScript(userId, scriptId, scriptData);
@@ -144,7 +146,7 @@ async function handler(req: Request): Promise<Response> {
 
             let index = await s3.getScriptsIndex(userId);
             const existingIndexEntry = index.findIndex(item => item.id === scriptId);
-            const indexEntry = { id: scriptId, name: scriptData.name, lastModified: scriptData.lastModified };
+            const indexEntry = { id: scriptId, name: scriptData.name, lastModified: scriptData.lastModified, contentHash: scriptData.contentHash };
 
             if (existingIndexEntry !== -1) {
                 index[existingIndexEntry] = indexEntry;
@@ -158,6 +160,12 @@ async function handler(req: Request): Promise<Response> {
                  console.error(`[Server] Script ${scriptId} for user ${userId} saved, but failed to update index.`);
             }
 
+            // Devices only download scripts whose contentHash in the device index changed
+            const deviceIndex = refreshDeviceEntry(await s3.getDeviceScriptsIndex(userId), indexEntry);
+            if (deviceIndex && !(await s3.saveDeviceScriptsIndex(userId, deviceIndex))) {
+                 console.error(`[Server] Script ${scriptId} for user ${userId} saved, but failed to update device index.`);
+            }
+
             return new Response(JSON.stringify({ success: true, script: scriptData }), {
                 status: 200,
                 headers: { ...corsHeaders, "Content-Type": "application/json" },